@@ -0,0 +1,442 @@
+// capture_core.h : the parts of the capture pipeline that do not need media
+// foundation. main.cpp puts them around the camera and the sink writer,
+// the unit tests in tests/ drive them with made up frames.
+
+#pragma once
+
+#include "plx_util.h"
+
+// Checks consecutive camera timestamps against the negotiated frame rate.
+// A step of about n frame intervals means n - 1 frames were dropped, a
+// step under a quarter of the interval means the frame is a duplicate.
+// add() runs on the capture thread, the counters can be read anywhere.
+class FrameGapDetector {
+  const int64_t interval_;
+  int64_t last_;
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> duplicated_;
+  std::atomic<uint64_t> gaps_;
+  // time between frames in nanoseconds.
+  plx::LatencyHistogram intervals_;
+
+public:
+  struct Stats {
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t gaps;
+  };
+
+  // |interval| is the nominal frame time in 100ns units.
+  explicit FrameGapDetector(int64_t interval)
+      : interval_(interval),
+        last_(-1),
+        frames_(0ULL),
+        dropped_(0ULL),
+        duplicated_(0ULL),
+        gaps_(0ULL) {
+    if (interval_ <= 0)
+      throw plx::InvalidParamException(__LINE__, 1);
+  }
+
+  // Returns how many frames are missing right before |timestamp|.
+  uint32_t add(int64_t timestamp) {
+    ++frames_;
+    auto last = last_;
+    last_ = timestamp;
+    if (last < 0)
+      return 0;
+    auto delta = timestamp - last;
+    intervals_.record(delta > 0 ? delta * 100 : 0);
+    if (delta < (interval_ / 4)) {
+      ++duplicated_;
+      return 0;
+    }
+    if ((delta * 2) < (interval_ * 3))
+      return 0;
+    // rounded to the nearest whole number of intervals.
+    auto missing = static_cast<uint32_t>(((delta + (interval_ / 2)) / interval_) - 1);
+    dropped_ += missing;
+    ++gaps_;
+    return missing;
+  }
+
+  // The next add() starts over, used when the camera restarts.
+  void reset() {
+    last_ = -1;
+  }
+
+  int64_t interval() const {
+    return interval_;
+  }
+
+  const plx::LatencyHistogram& intervals() const {
+    return intervals_;
+  }
+
+  Stats stats() const {
+    Stats st = { frames_, dropped_, duplicated_, gaps_ };
+    return st;
+  }
+};
+
+// Where the time of a frame goes, from the capture callback to the sink.
+struct PipelineLatency {
+  // arrival to the writer thread picking it up.
+  plx::LatencyHistogram queue;
+  plx::LatencyHistogram convert;
+  // the write alone, includes the encoder when it runs synchronously.
+  plx::LatencyHistogram write;
+  // arrival to the write returning.
+  plx::LatencyHistogram total;
+  // finalizing each segment, which flushes it to disk.
+  plx::LatencyHistogram finalize;
+};
+
+// Frames missing in a segment, |time| is relative to the segment start.
+struct GapEvent {
+  int64_t time;
+  uint32_t dropped;
+};
+
+// What the writer thread knows about a segment it left.
+struct SegmentInfo {
+  // plx::QpcNow() when its first frame arrived, -1 if it got none.
+  int64_t first_arrival;
+  std::vector<GapEvent> gaps;
+};
+
+// The capture callback does not write to the sink. It push()es the frame
+// and returns, the writer thread drains the queue so disk or encoder stalls
+// don't throttle the camera. The writer thread also rotates segments: the
+// first frame at or past the segment length goes to the writer given to
+// prepare_next(), so every frame lands in exactly one segment. The slow
+// parts, opening and finalizing writers, happen on the caller's thread.
+// Writer : the sink of one segment, empty when default constructed.
+// Frame : what the capture callback hands over.
+//
+template <typename Writer, typename Frame>
+class SegmentedWriter {
+public:
+  // prepare_frame(), write_frame() and frame_written() run on the writer
+  // thread, the others on the thread that calls stop() or
+  // finalize_retired().
+  class Delegate {
+  public:
+    virtual ~Delegate() {}
+    // Returns false if |frame| cannot be written, for example because it
+    // could not be converted.
+    virtual bool prepare_frame(Frame& frame) = 0;
+    // |time| is relative to the start of the segment.
+    virtual bool write_frame(Writer& writer, Frame& frame, int64_t time) = 0;
+    // |time| is the one given to push().
+    virtual void frame_written(Frame& frame, int64_t time) = 0;
+    virtual void finalize_writer(Writer& writer) = 0;
+    // |writer| never got a frame so its file is useless.
+    virtual void discard_writer(Writer& writer, const std::wstring& name) = 0;
+  };
+
+  struct Stats {
+    uint64_t frames_written;
+    uint64_t queue_full_drops;
+    uint64_t slow_writes;
+    uint64_t write_errors;
+    size_t max_queue_depth;
+  };
+
+private:
+  // beyond this a segment only counts its gaps.
+  static const size_t kMaxGapEvents = 1000;
+  static const int64_t kSlowWriteMs = 100;
+  // reasons to wake the writer thread.
+  static const unsigned int kWakeFrame = 1;
+  static const unsigned int kWakeFlush = 2;
+  static const uint32_t kIdleWakeMs = 1000;
+
+  struct Queued {
+    Frame frame;
+    int64_t time;
+    // plx::QpcNow() when the frame arrived.
+    int64_t arrival;
+    // frames the camera skipped right before this one.
+    uint32_t dropped_before;
+  };
+
+  Delegate* const delegate_;
+  plx::SpscQueue<Queued> queue_;
+  plx::CoalescingEvent wake_;
+  plx::CoalescingEvent flushed_;
+
+  // Owned by the writer thread while recording.
+  Writer writer_;
+  int64_t base_time_;
+  int64_t segment_length_;
+  SegmentInfo segment_;
+
+  // Double buffered rotation, guarded by |next_lock_|.
+  std::mutex next_lock_;
+  Writer next_writer_;
+  Writer retired_;
+  std::wstring next_name_;
+  int64_t next_segment_length_;
+  SegmentInfo retired_info_;
+  std::atomic<uint32_t> segment_count_;
+
+  std::atomic<uint64_t> frames_written_;
+  std::atomic<uint64_t> queue_full_drops_;
+  std::atomic<uint64_t> slow_writes_;
+  std::atomic<uint64_t> write_errors_;
+  std::atomic<size_t> max_queue_depth_;
+  // frames push() could not queue since the last one it did, only the
+  // producer touches it.
+  uint32_t pending_drops_;
+  PipelineLatency latency_;
+
+  std::unique_ptr<std::thread> thread_;
+
+  SegmentedWriter(const SegmentedWriter&) = delete;
+  SegmentedWriter& operator=(const SegmentedWriter&) = delete;
+
+public:
+  SegmentedWriter(Delegate* delegate, size_t queue_depth)
+      : delegate_(delegate),
+        queue_(queue_depth),
+        base_time_(-1),
+        segment_length_(0),
+        next_segment_length_(0),
+        segment_count_(0),
+        frames_written_(0ULL),
+        queue_full_drops_(0ULL),
+        slow_writes_(0ULL),
+        write_errors_(0ULL),
+        max_queue_depth_(0),
+        pending_drops_(0) {
+    segment_.first_arrival = -1;
+    retired_info_.first_arrival = -1;
+    thread_ = std::make_unique<std::thread>(&SegmentedWriter::threadproc, this);
+  }
+
+  ~SegmentedWriter() {
+    shutdown();
+  }
+
+  // |segment_length| is in the units of the frame times. Returns false if
+  // already started.
+  bool start(Writer writer, int64_t segment_length) {
+    if (writer_)
+      return false;
+    writer_ = std::move(writer);
+    segment_length_ = segment_length;
+    base_time_ = -1;
+    segment_.first_arrival = -1;
+    segment_.gaps.clear();
+    return true;
+  }
+
+  // Hands over the writer for the next segment, the writer thread switches
+  // to it at the segment boundary. |segment_length| applies from that
+  // segment on. Returns false if there is one already.
+  bool prepare_next(Writer writer, const std::wstring& name, int64_t segment_length) {
+    std::lock_guard<std::mutex> lock(next_lock_);
+    if (next_writer_)
+      return false;
+    next_writer_ = std::move(writer);
+    next_name_ = name;
+    next_segment_length_ = segment_length;
+    return true;
+  }
+
+  bool has_next() {
+    std::lock_guard<std::mutex> lock(next_lock_);
+    return next_writer_ ? true : false;
+  }
+
+  // Closes the segment that the writer thread just left.
+  void finalize_retired() {
+    Writer retired;
+    {
+      std::lock_guard<std::mutex> lock(next_lock_);
+      retired = std::move(retired_);
+      retired_ = Writer();
+    }
+    if (retired)
+      finalize(retired);
+  }
+
+  // About the segment that the writer thread left last.
+  SegmentInfo take_retired_info() {
+    std::lock_guard<std::mutex> lock(next_lock_);
+    SegmentInfo info = { retired_info_.first_arrival, std::vector<GapEvent>() };
+    info.gaps.swap(retired_info_.gaps);
+    retired_info_.first_arrival = -1;
+    return info;
+  }
+
+  uint32_t segment_count() const {
+    return segment_count_;
+  }
+
+  // Producer side, only one thread may call it. Returns false if the
+  // queue is full, which means the writer is hopelessly behind. The frames
+  // dropped here show up as a gap before the next frame that makes it.
+  bool push(Frame frame, int64_t time, int64_t arrival, uint32_t dropped_before) {
+    Queued queued = { std::move(frame), time, arrival, dropped_before + pending_drops_ };
+    if (!queue_.push(std::move(queued))) {
+      ++queue_full_drops_;
+      pending_drops_ += 1 + dropped_before;
+      return false;
+    }
+    pending_drops_ = 0;
+    auto depth = queue_.size();
+    if (depth > max_queue_depth_)
+      max_queue_depth_ = depth;
+    wake_.signal(kWakeFrame);
+    return true;
+  }
+
+  // Writes what is queued and closes every writer. The caller makes sure
+  // nothing is pushed anymore. Returns the info of the last segment, the
+  // one before it is still up for take_retired_info().
+  SegmentInfo stop() {
+    SegmentInfo info = { -1, std::vector<GapEvent>() };
+    if (!thread_)
+      return info;
+    wake_.signal(kWakeFlush);
+    uint64_t waited_ms = 0;
+    while (!flushed_.wait(kIdleWakeMs, &waited_ms)) {
+    }
+    if (writer_)
+      finalize(writer_);
+    writer_ = Writer();
+    finalize_retired();
+    discard_next();
+    info.first_arrival = segment_.first_arrival;
+    info.gaps.swap(segment_.gaps);
+    segment_.first_arrival = -1;
+    pending_drops_ = 0;
+    return info;
+  }
+
+  void shutdown() {
+    if (!thread_)
+      return;
+    wake_.close();
+    thread_->join();
+    thread_.reset();
+  }
+
+  PipelineLatency& latency() {
+    return latency_;
+  }
+
+  const PipelineLatency& latency() const {
+    return latency_;
+  }
+
+  Stats stats() const {
+    Stats st = {
+      frames_written_,
+      queue_full_drops_,
+      slow_writes_,
+      write_errors_,
+      max_queue_depth_
+    };
+    return st;
+  }
+
+private:
+  void finalize(Writer& writer) {
+    auto start = plx::QpcNow();
+    delegate_->finalize_writer(writer);
+    latency_.finalize.record(plx::QpcToNanos(plx::QpcNow() - start));
+  }
+
+  // Fails if the next writer is not ready or the previous segment has not
+  // been finalized yet, in both cases the current segment just grows a
+  // bit longer.
+  bool swap_writer() {
+    std::lock_guard<std::mutex> lock(next_lock_);
+    if (!next_writer_ || retired_)
+      return false;
+    retired_ = std::move(writer_);
+    writer_ = std::move(next_writer_);
+    next_writer_ = Writer();
+    segment_length_ = next_segment_length_;
+    retired_info_.first_arrival = segment_.first_arrival;
+    retired_info_.gaps.swap(segment_.gaps);
+    segment_.first_arrival = -1;
+    segment_.gaps.clear();
+    next_name_.clear();
+    ++segment_count_;
+    return true;
+  }
+
+  void discard_next() {
+    Writer next;
+    std::wstring name;
+    {
+      std::lock_guard<std::mutex> lock(next_lock_);
+      if (!next_writer_)
+        return;
+      next = std::move(next_writer_);
+      next_writer_ = Writer();
+      name.swap(next_name_);
+    }
+    delegate_->discard_writer(next, name);
+  }
+
+  void threadproc() {
+    while (true) {
+      uint64_t waited_ms = 0;
+      auto reasons = wake_.wait(kIdleWakeMs, &waited_ms);
+      if (wake_.is_closed())
+        break;
+      drain();
+      if (reasons & kWakeFlush)
+        flushed_.signal(kWakeFlush);
+    }
+  }
+
+  void drain() {
+    Queued queued;
+    while (queue_.pop(queued)) {
+      auto dequeued = plx::QpcNow();
+      latency_.queue.record(plx::QpcToNanos(dequeued - queued.arrival));
+      if (base_time_ < 0)
+        base_time_ = queued.time;
+      // The first frame at or past the boundary starts the next segment.
+      if ((queued.time - base_time_) >= segment_length_) {
+        if (swap_writer())
+          base_time_ = queued.time;
+      }
+      if (segment_.first_arrival < 0)
+        segment_.first_arrival = queued.arrival;
+      auto time = queued.time - base_time_;
+      if (queued.dropped_before && (segment_.gaps.size() < kMaxGapEvents)) {
+        GapEvent gap = { time, queued.dropped_before };
+        segment_.gaps.push_back(gap);
+      }
+      if (!delegate_->prepare_frame(queued.frame)) {
+        ++write_errors_;
+        queued.frame = Frame();
+        continue;
+      }
+      auto start = plx::QpcNow();
+      latency_.convert.record(plx::QpcToNanos(start - dequeued));
+      auto written = delegate_->write_frame(writer_, queued.frame, time);
+      auto end = plx::QpcNow();
+      if (written)
+        ++frames_written_;
+      else
+        ++write_errors_;
+      auto write_ns = plx::QpcToNanos(end - start);
+      if (write_ns > (kSlowWriteMs * 1000000))
+        ++slow_writes_;
+      latency_.write.record(write_ns);
+      latency_.total.record(plx::QpcToNanos(end - queued.arrival));
+      delegate_->frame_written(queued.frame, queued.time);
+      queued.frame = Frame();
+    }
+  }
+};
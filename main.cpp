@@ -3,10 +3,25 @@
 #include "stdafx.h"
 
 #include <mfreadwrite.h>
+#include <shellapi.h>
+#include <codecapi.h>
+#include <evr.h>
 #include "resource.h"
 
+// plex only emits the catalog components named in this file. The plx_*.h
+// files also need plx::CodecException plx::InvalidParamException
+// plx::ItRange plx::JsonException plx::JsonType plx::JsonValue
+// plx::RangeException.
+#include "plx_io.h"
+#include "plx_json.h"
+#include "plx_segments.h"
+#include "plx_video.h"
+#include "capture_core.h"
+#include "settings_core.h"
+
 // this pragma cannot be done by plex because there is MS header ordering issue.
 #pragma comment(lib, "mfreadwrite.lib")
+#pragma comment(lib, "evr.lib")
 
 enum class HardFailures {
   none,
@@ -24,7 +39,8 @@ struct AppException {
   AppException(HardFailures failure, int line) : failure(failure), line(line) {}
 };
 
-void HardfailMsgBox(HardFailures id, int line) {
+// |detail| if not empty is shown below the line.
+void HardfailMsgBox(HardFailures id, int line, const std::string& detail = std::string()) {
   const char* err = nullptr;
   switch (id) {
     case HardFailures::none: err = "none"; break;
@@ -37,40 +53,37 @@ void HardfailMsgBox(HardFailures id, int line) {
     default: err = "(??)"; break;
   }
 
-  auto err_text = plx::StringPrintf("Exception [%s]\nLine: %d", err, line);
-  auto full_err = plx::UTF16FromUTF8(plx::RangeFromString(err_text), true);
+  auto err_text = plx::Format("Exception [%s]\nLine: %d", err, line);
+  if (!detail.empty())
+    err_text += "\n" + detail;
+  auto full_err = plx::WideFromUTF8(plx::RangeFromString(err_text), true);
   ::MessageBox(NULL, full_err.c_str(), L"CamCenter", MB_OK | MB_ICONEXCLAMATION);
 }
 
-struct Settings {
-  std::string folder;
-  int64_t seconds_per_file;
-  int64_t average_bitrate;
-  int64_t keep_file_count;
-  int64_t clean_interval_minutes;
-};
-
-plx::File OpenConfigFile() {
+plx::FilePath ConfigFilePath() {
   auto appdata_path = plx::GetAppDataPath(false);
-  auto path = appdata_path.append(L"vortex\\camcenter\\config.json");
-  plx::FileParams fparams = plx::FileParams::Read_SharedRead();
-  return plx::File::Create(path, fparams, plx::FileSecurity());
+  return appdata_path.append(L"vortex\\camcenter\\config.json");
 }
 
 Settings LoadSettings() {
-  auto config = plx::JsonFromFile(OpenConfigFile());
-  if (config.type() != plx::JsonType::OBJECT)
-    throw plx::IOException(__LINE__, L"<unexpected json>");
-
+  plx::FileView view(ConfigFilePath());
   Settings settings;
-  settings.folder = config["folder"].get_string();
-  settings.seconds_per_file = config["seconds_per_file"].get_int64();
-  settings.average_bitrate = config["average_bitrate"].get_int64();
-  settings.keep_file_count = config["keep_file_count"].get_int64();
-  settings.clean_interval_minutes = config["clean_interval_minutes"].get_int64();
+  settings_schema.decode(view.chars(), settings);
   return settings;
 }
 
+// Writes |settings| in the config.json format, for example the ones a
+// camera ended up with after its overrides.
+void SaveSettings(const Settings& settings, const plx::FilePath& path) {
+  auto file = plx::File::Create(
+      path, plx::FileParams::ReadWrite_SharedRead(CREATE_ALWAYS), plx::FileSecurity());
+  if (!file.is_valid())
+    return;
+  plx::JsonWriter writer;
+  settings_schema.encode(writer, settings);
+  writer.flush(file);
+}
+
 const D2D1_SIZE_F zero_offset = {0};
 
 class DCoWindow : public plx::Window <DCoWindow> {
@@ -79,6 +92,8 @@ class DCoWindow : public plx::Window <DCoWindow> {
   const int height_;
 
   std::function<void()> timer_callback_;
+  std::function<void()> click_callback_;
+  std::function<void(int)> key_callback_;
 
   plx::ComPtr<ID3D11Device> d3d_device_;
   plx::ComPtr<ID2D1Factory2> d2d_factory_;
@@ -193,6 +208,15 @@ public:
     ::SetTimer(window(), 169, milisecs, nullptr);
   }
 
+  void set_click_callback(std::function<void()> callback) {
+    click_callback_ = callback;
+  }
+
+  // |callback| gets the virtual key code.
+  void set_key_callback(std::function<void(int)> callback) {
+    key_callback_ = callback;
+  }
+
   void reset_timer() {
     if (timer_callback_)
       ::KillTimer(window(), 169);
@@ -222,6 +246,11 @@ public:
         timer_callback_();
         return 0;
       }
+      case WM_KEYDOWN: {
+        if (key_callback_)
+          key_callback_(static_cast<int>(wparam));
+        return 0;
+      }
     }
 
     return ::DefWindowProc(window(), message, wparam, lparam);
@@ -265,6 +294,8 @@ public:
       ::SendMessageW(window(), WM_SYSCOMMAND, SC_MOVE|0x0002, 0);
     } else {
       // probably on the main text.
+      if (click_callback_)
+        click_callback_();
     }
     return 0L;
   }
@@ -291,7 +322,12 @@ void CopyMFAttribute(const GUID& key, IMFAttributes* src, IMFAttributes* dest) {
   ::PropVariantClear(&var);
 }
 
-plx::ComPtr<IMFMediaSource> GetCaptureDevice() {
+struct CaptureDevice {
+  std::wstring name;
+  plx::ComPtr<IMFActivate> activate;
+};
+
+std::vector<CaptureDevice> EnumerateCaptureDevices() {
   auto attributes = MakeMFAttributes(1);
   attributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
                       MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
@@ -302,21 +338,34 @@ plx::ComPtr<IMFMediaSource> GetCaptureDevice() {
   if (hr != S_OK)
     throw plx::ComException(__LINE__, hr);
 
-  if (count == 0)
+  std::vector<CaptureDevice> devices;
+  for (uint32_t ix = 0; ix != count; ++ix) {
+    CaptureDevice device;
+    wchar_t* name = nullptr;
+    UINT32 name_len = 0;
+    if (sources[ix]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME,
+                                        &name, &name_len) == S_OK) {
+      device.name.assign(name, name_len);
+      ::CoTaskMemFree(name);
+    }
+    // the vector keeps the reference the enumeration gave us.
+    device.activate.Attach(sources[ix]);
+    devices.push_back(device);
+  }
+
+  ::CoTaskMemFree(sources);
+  if (devices.empty())
     throw AppException(HardFailures::no_capture_device, __LINE__);
+  return devices;
+}
 
-  plx::ComPtr<IMFMediaSource> device;
-  hr = sources[0]->ActivateObject(__uuidof(device),
-                                  reinterpret_cast<void **>(device.GetAddressOf()));
+plx::ComPtr<IMFMediaSource> ActivateCaptureDevice(const CaptureDevice& device) {
+  plx::ComPtr<IMFMediaSource> source;
+  auto hr = device.activate->ActivateObject(
+      __uuidof(source), reinterpret_cast<void **>(source.GetAddressOf()));
   if (hr != S_OK)
     throw plx::ComException(__LINE__, hr);
-
-  for (uint32_t ix = 0; ix != count; ++ix) {
-    sources[ix]->Release();
-  }
-  
-  ::CoTaskMemFree(sources);
-  return device;
+  return source;
 }
 
 class MediaFoundationInit {
@@ -332,19 +381,806 @@ public:
   }
 };
 
-class VideoCaptureH264 : public plx::ComObject <IMFSourceReaderCallback> {
+// Block based motion detection on the luma of raw frames. Each frame is
+// shrunk by 4 and compared with the previous one in 16x16 tiles, so a
+// tile covers 64x64 pixels of the original frame.
+class MotionDetector {
+  static const size_t kShrink = 4;
+
+  const size_t width_;
+  const size_t height_;
+  const size_t pixel_step_;
+  const size_t small_w_;
+  const size_t small_h_;
+  const uint32_t tile_threshold_;
+  const plx::SimdLevel simd_;
+  std::vector<uint8_t> prev_;
+  std::vector<uint8_t> cur_;
+  std::vector<uint32_t> sads_;
+  // one bit per tile that changed in the last frame.
+  std::vector<uint64_t> dirty_;
+  bool has_prev_;
+
+public:
+  MotionDetector(size_t width, size_t height, size_t pixel_step, uint32_t pixel_delta)
+      : width_(width),
+        height_(height),
+        pixel_step_(pixel_step),
+        small_w_(width / kShrink),
+        small_h_(height / kShrink),
+        tile_threshold_(pixel_delta * 16 * 16),
+        simd_(plx::BestSimdLevel()),
+        prev_(small_w_ * small_h_),
+        cur_(small_w_ * small_h_),
+        sads_((small_w_ / 16) * (small_h_ / 16)),
+        dirty_((sads_.size() + 63) / 64),
+        has_prev_(false) {
+    if (sads_.empty())
+      throw plx::InvalidParamException(__LINE__, 1);
+  }
+
+  // Returns the per-mille of tiles that changed since the previous frame.
+  uint32_t process(const uint8_t* luma, size_t stride) {
+    plx::DownsampleLuma(luma, stride, width_, height_, pixel_step_, kShrink,
+                        &cur_[0], small_w_, simd_);
+    uint32_t changed = 0;
+    if (has_prev_) {
+      plx::BlockSad16(&prev_[0], &cur_[0], small_w_, small_w_, small_h_, &sads_[0], simd_);
+      std::fill(begin(dirty_), end(dirty_), 0ULL);
+      for (size_t ix = 0; ix != sads_.size(); ++ix) {
+        if (sads_[ix] > tile_threshold_) {
+          dirty_[ix / 64] |= 1ULL << (ix % 64);
+          ++changed;
+        }
+      }
+    }
+    prev_.swap(cur_);
+    has_prev_ = true;
+    return static_cast<uint32_t>((changed * 1000) / sads_.size());
+  }
+
+  const std::vector<uint64_t>& dirty_tiles() const {
+    return dirty_;
+  }
+
+  size_t width() const { return width_; }
+  size_t height() const { return height_; }
+  size_t pixel_step() const { return pixel_step_; }
+};
+
+// Lets a plx::FramePool frame travel through Media Foundation without a
+// copy, the buffer keeps the frame alive.
+class WrappedMediaBuffer : public plx::ComObject <IMFMediaBuffer> {
+  BYTE* data_;
+  DWORD max_length_;
+  DWORD length_;
+  plx::FrameRef frame_;
+
+public:
+  WrappedMediaBuffer(plx::FrameRef frame, DWORD max_length)
+      : data_(frame.data()),
+        max_length_(max_length),
+        length_(0),
+        frame_(std::move(frame)) {
+  }
+
+  HRESULT __stdcall Lock(BYTE** buffer, DWORD* max_length, DWORD* length) override {
+    *buffer = data_;
+    if (max_length)
+      *max_length = max_length_;
+    if (length)
+      *length = length_;
+    return S_OK;
+  }
+
+  HRESULT __stdcall Unlock() override {
+    return S_OK;
+  }
+
+  HRESULT __stdcall GetCurrentLength(DWORD* length) override {
+    *length = length_;
+    return S_OK;
+  }
+
+  HRESULT __stdcall SetCurrentLength(DWORD length) override {
+    if (length > max_length_)
+      return E_INVALIDARG;
+    length_ = length;
+    return S_OK;
+  }
+
+  HRESULT __stdcall GetMaxLength(DWORD* max_length) override {
+    *max_length = max_length_;
+    return S_OK;
+  }
+};
+
+// Uncompressed video type, |like| provides the frame rate, aspect ratio and
+// interlacing.
+plx::ComPtr<IMFMediaType> MakeRawVideoType(const GUID& subtype,
+                                           uint32_t width, uint32_t height,
+                                           IMFMediaType* like) {
+  plx::ComPtr<IMFMediaType> mtype;
+  auto hr = ::MFCreateMediaType(mtype.GetAddressOf());
+  if (hr != S_OK)
+    throw plx::ComException(__LINE__, hr);
+  auto pixel_bytes = (subtype == MFVideoFormat_YUY2) ? 2 : 1;
+  auto frame_bytes = (subtype == MFVideoFormat_YUY2) ?
+      (width * height * 2) : (width * height * 3 / 2);
+  mtype->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  mtype->SetGUID(MF_MT_SUBTYPE, subtype);
+  mtype->SetUINT32(MF_MT_DEFAULT_STRIDE, width * pixel_bytes);
+  mtype->SetUINT32(MF_MT_SAMPLE_SIZE, frame_bytes);
+  mtype->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE);
+  mtype->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
+  ::MFSetAttributeSize(mtype.Get(), MF_MT_FRAME_SIZE, width, height);
+  CopyMFAttribute(MF_MT_FRAME_RATE, like, mtype.Get());
+  CopyMFAttribute(MF_MT_PIXEL_ASPECT_RATIO, like, mtype.Get());
+  CopyMFAttribute(MF_MT_INTERLACE_MODE, like, mtype.Get());
+  return mtype;
+}
+
+// H.264 with the size, rate and shape of |like|.
+plx::ComPtr<IMFMediaType> MakeH264Type(IMFMediaType* like, uint32_t bitrate) {
+  plx::ComPtr<IMFMediaType> mtype;
+  auto hr = MFCreateMediaType(mtype.GetAddressOf());
+  if (hr != S_OK)
+    throw plx::ComException(__LINE__, hr);
+
+  mtype->SetGUID( MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  mtype->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+  mtype->SetUINT32(MF_MT_AVG_BITRATE, bitrate);
+  CopyMFAttribute(MF_MT_FRAME_SIZE, like, mtype.Get());
+  CopyMFAttribute(MF_MT_FRAME_RATE, like, mtype.Get());
+  CopyMFAttribute(MF_MT_PIXEL_ASPECT_RATIO, like, mtype.Get());
+  CopyMFAttribute(MF_MT_INTERLACE_MODE, like, mtype.Get());
+  return mtype;
+}
+
+// Hands out media samples that come back by themselves once nobody holds
+// them, so steady state frames do not make new ones. They are tracked
+// samples: instead of deleting itself, a sample whose last reference goes
+// away calls Recycler::Invoke() which puts it back on the free list. On the
+// way back it loses its attributes and, unless |keep_buffers|, its buffers.
+// Up to |max_samples| are made, after that acquire() returns null. Samples
+// still out when the pool goes away keep the recycler alive.
+class SamplePool {
+  class Recycler : public plx::ComObject <IMFAsyncCallback> {
+  public:
+    std::mutex lock;
+    std::vector<plx::ComPtr<IMFSample>> free;
+    const size_t max_samples;
+    const bool keep_buffers;
+    size_t all;
+    size_t in_use;
+    size_t high_water;
+    uint64_t exhausted;
+
+    Recycler(size_t max_samples, bool keep_buffers)
+        : max_samples(max_samples),
+          keep_buffers(keep_buffers),
+          all(0),
+          in_use(0),
+          high_water(0),
+          exhausted(0ULL) {
+      free.reserve(max_samples);
+    }
+
+    HRESULT __stdcall GetParameters(DWORD*, DWORD*) override {
+      return E_NOTIMPL;
+    }
+
+    HRESULT __stdcall Invoke(IMFAsyncResult* result) override {
+      plx::ComPtr<IUnknown> object;
+      plx::ComPtr<IMFSample> sample;
+      if ((result->GetObject(object.GetAddressOf()) != S_OK) ||
+          (object.As(&sample) != S_OK))
+        return S_OK;
+      sample->DeleteAllItems();
+      if (!keep_buffers)
+        sample->RemoveAllBuffers();
+      std::lock_guard<std::mutex> guard(lock);
+      free.push_back(std::move(sample));
+      --in_use;
+      return S_OK;
+    }
+  };
+
+  plx::ComPtr<Recycler> recycler_;
+
+public:
+  SamplePool(size_t max_samples, bool keep_buffers)
+      : recycler_(plx::MakeComObj<Recycler>(max_samples, keep_buffers)) {
+  }
+
+  plx::ComPtr<IMFSample> acquire() {
+    plx::ComPtr<IMFSample> sample;
+    {
+      std::lock_guard<std::mutex> guard(recycler_->lock);
+      if (!recycler_->free.empty()) {
+        sample = std::move(recycler_->free.back());
+        recycler_->free.pop_back();
+      } else if ((recycler_->all < recycler_->max_samples) &&
+                 (::MFCreateVideoSampleFromSurface(nullptr, sample.GetAddressOf()) == S_OK)) {
+        ++recycler_->all;
+      }
+      if (!sample) {
+        ++recycler_->exhausted;
+        return nullptr;
+      }
+      ++recycler_->in_use;
+      recycler_->high_water = std::max(recycler_->high_water, recycler_->in_use);
+    }
+    // the owner is cleared every time the sample comes back.
+    plx::ComPtr<IMFTrackedSample> tracked;
+    if ((sample.As(&tracked) != S_OK) ||
+        (tracked->SetAllocator(recycler_.Get(), nullptr) != S_OK)) {
+      // still usable, it just gets deleted at the end.
+      std::lock_guard<std::mutex> guard(recycler_->lock);
+      --recycler_->all;
+      --recycler_->in_use;
+    }
+    return sample;
+  }
+
+  // Only the counters, the caller knows the rest.
+  plx::FramePool::Stats stats() const {
+    std::lock_guard<std::mutex> guard(recycler_->lock);
+    plx::FramePool::Stats st = {
+      0,
+      recycler_->all,
+      recycler_->in_use,
+      recycler_->high_water,
+      recycler_->exhausted,
+      false
+    };
+    return st;
+  }
+};
+
+// A sample from |samples| holding a |pool| frame in |buffer|. The frame
+// stays with the sample on its next trips. Returns null if either pool is
+// out.
+plx::ComPtr<IMFSample> AcquireFrameSample(SamplePool& samples, plx::FramePool& pool,
+                                          plx::ComPtr<IMFMediaBuffer>& buffer) {
+  auto sample = samples.acquire();
+  if (!sample)
+    return nullptr;
+  DWORD count = 0;
+  sample->GetBufferCount(&count);
+  if (count)
+    sample->GetBufferByIndex(0, buffer.ReleaseAndGetAddressOf());
+  if (buffer)
+    return sample;
+  auto frame = pool.acquire();
+  if (!frame)
+    return nullptr;
+  buffer = plx::MakeComObj<WrappedMediaBuffer>(
+      std::move(frame), plx::To<DWORD>(pool.frame_bytes()));
+  sample->AddBuffer(buffer.Get());
+  return sample;
+}
+
+// Attribute of the H264Encoder input samples, the sample whose buffer they
+// share. {61b84be0-cca7-42f9-be36-b7f4424b2d56}
+const GUID kSourceSampleAttribute = {
+  0x61b84be0, 0xcca7, 0x42f9, { 0xbe, 0x36, 0xb7, 0xf4, 0x42, 0x4b, 0x2d, 0x56 }
+};
+
+// Encodes raw frames to H.264 with the first synchronous encoder MFT that
+// takes them. The output is annex-b without b-frames, in the order it is
+// shown, which is what plx::Fmp4Muxer takes. A keyframe comes about every
+// |gop_time| (100ns units) so the output can be cut every so often.
+class H264Encoder {
+  // frames the encoder holds on to while it looks ahead.
+  static const size_t kInputSamples = 16;
+
+  plx::ComPtr<IMFTransform> mft_;
+  plx::ComPtr<IMFMediaType> output_mtype_;
+  // the output sample, reused for every frame unless the encoder brings
+  // its own.
+  plx::ComPtr<IMFSample> output_;
+  plx::ComPtr<IMFMediaBuffer> output_buffer_;
+  SamplePool inputs_;
+  UINT64 frame_duration_;
+
+  H264Encoder(const H264Encoder&) = delete;
+  H264Encoder& operator=(const H264Encoder&) = delete;
+
+public:
+  H264Encoder(IMFMediaType* input_mtype, uint32_t bitrate, LONGLONG gop_time)
+      : inputs_(kInputSamples, false),
+        frame_duration_(0) {
+    MFT_REGISTER_TYPE_INFO input_info = { MFMediaType_Video, GUID_NULL };
+    input_mtype->GetGUID(MF_MT_SUBTYPE, &input_info.guidSubtype);
+    MFT_REGISTER_TYPE_INFO output_info = { MFMediaType_Video, MFVideoFormat_H264 };
+    IMFActivate** activates = nullptr;
+    UINT32 count = 0;
+    auto hr = ::MFTEnumEx(MFT_CATEGORY_VIDEO_ENCODER,
+                          MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+                          &input_info, &output_info, &activates, &count);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    hr = count ? activates[0]->ActivateObject(IID_PPV_ARGS(mft_.GetAddressOf())) :
+                 MF_E_TOPO_CODEC_NOT_FOUND;
+    for (UINT32 ix = 0; ix != count; ++ix)
+      activates[ix]->Release();
+    ::CoTaskMemFree(activates);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+
+    UINT32 rate_num = 0, rate_den = 0;
+    hr = ::MFGetAttributeRatio(input_mtype, MF_MT_FRAME_RATE, &rate_num, &rate_den);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    hr = ::MFFrameRateToAverageTimePerFrame(rate_num, rate_den, &frame_duration_);
+    if ((hr != S_OK) || !frame_duration_)
+      throw plx::ComException(__LINE__, hr);
+
+    plx::ComPtr<ICodecAPI> codec_api;
+    if (mft_.As(&codec_api) == S_OK) {
+      VARIANT gop;
+      ::VariantInit(&gop);
+      gop.vt = VT_UI4;
+      gop.ulVal = static_cast<ULONG>(std::max(gop_time / static_cast<LONGLONG>(frame_duration_), 1LL));
+      codec_api->SetValue(&CODECAPI_AVEncMPVGOPSize, &gop);
+      VARIANT b_frames;
+      ::VariantInit(&b_frames);
+      b_frames.vt = VT_UI4;
+      b_frames.ulVal = 0;
+      codec_api->SetValue(&CODECAPI_AVEncMPVDefaultBPictureCount, &b_frames);
+    }
+
+    // encoders want the output type first.
+    auto output_mtype = MakeH264Type(input_mtype, bitrate);
+    hr = mft_->SetOutputType(0, output_mtype.Get(), 0);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    hr = mft_->SetInputType(0, input_mtype, 0);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    // now with the sequence header.
+    hr = mft_->GetOutputCurrentType(0, output_mtype_.GetAddressOf());
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+
+    MFT_OUTPUT_STREAM_INFO info = {0};
+    hr = mft_->GetOutputStreamInfo(0, &info);
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    if (!(info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES |
+                          MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES))) {
+      hr = ::MFCreateSample(output_.GetAddressOf());
+      if (hr != S_OK)
+        throw plx::ComException(__LINE__, hr);
+      hr = ::MFCreateMemoryBuffer(info.cbSize, output_buffer_.GetAddressOf());
+      if (hr != S_OK)
+        throw plx::ComException(__LINE__, hr);
+      output_->AddBuffer(output_buffer_.Get());
+    }
+    mft_->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+    mft_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+  }
+
+  ~H264Encoder() {
+    mft_->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+  }
+
+  // It does not change after construction, other threads can use it.
+  IMFMediaType* output_type() const {
+    return output_mtype_.Get();
+  }
+
+  // In 100ns units.
+  LONGLONG frame_duration() const {
+    return static_cast<LONGLONG>(frame_duration_);
+  }
+
+  // Feeds |frame| at |time| and calls |fn(IMFSample*)| for each encoded
+  // frame that comes out, which is only valid during the call. Returns
+  // false if the encoder failed.
+  template <typename Fn>
+  bool encode(IMFSample* frame, LONGLONG time, Fn fn) {
+    // the sink writer might still be reading |frame|, its time stays as is.
+    // The input holds |frame| too, a pooled frame must not be reused while
+    // the encoder still looks at its buffer.
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    if (frame->ConvertToContiguousBuffer(buffer.GetAddressOf()) != S_OK)
+      return false;
+    auto input = inputs_.acquire();
+    if (!input && (::MFCreateSample(input.GetAddressOf()) != S_OK))
+      return false;
+    input->AddBuffer(buffer.Get());
+    input->SetUnknown(kSourceSampleAttribute, frame);
+    input->SetSampleTime(time);
+    input->SetSampleDuration(frame_duration_);
+    if (mft_->ProcessInput(0, input.Get(), 0) != S_OK)
+      return false;
+    return pull(fn);
+  }
+
+  // Calls |fn(IMFSample*)| for the frames the encoder still holds, at the
+  // end of the stream.
+  template <typename Fn>
+  bool drain(Fn fn) {
+    if (mft_->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0) != S_OK)
+      return false;
+    return pull(fn);
+  }
+
+private:
+  template <typename Fn>
+  bool pull(Fn fn) {
+    while (true) {
+      MFT_OUTPUT_DATA_BUFFER out = {0};
+      if (output_) {
+        output_buffer_->SetCurrentLength(0);
+        out.pSample = output_.Get();
+      }
+      DWORD status = 0;
+      auto hr = mft_->ProcessOutput(0, 1, &out, &status);
+      if (out.pEvents)
+        out.pEvents->Release();
+      // samples the encoder made are ours to release.
+      plx::ComPtr<IMFSample> made;
+      if (!output_)
+        made.Attach(out.pSample);
+      if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+        return true;
+      if ((hr != S_OK) || !out.pSample)
+        return false;
+      fn(out.pSample);
+    }
+  }
+};
+
+// The H.264 parameter sets that |encoder| keeps in its output type.
+std::vector<uint8_t> SequenceHeader(const H264Encoder& encoder) {
+  UINT32 size = 0;
+  std::vector<uint8_t> header;
+  if ((encoder.output_type()->GetBlobSize(MF_MT_MPEG_SEQUENCE_HEADER, &size) != S_OK) || !size)
+    return header;
+  header.resize(size);
+  if (encoder.output_type()->GetBlob(MF_MT_MPEG_SEQUENCE_HEADER, &header[0], size, nullptr) != S_OK)
+    header.clear();
+  return header;
+}
+
+// Muxer settings for the output of |encoder|, a fragment a second.
+plx::Fmp4Muxer::Params Fmp4Params(const H264Encoder& encoder) {
+  UINT32 width = 0, height = 0;
+  ::MFGetAttributeSize(encoder.output_type(), MF_MT_FRAME_SIZE, &width, &height);
+  auto duration = encoder.frame_duration();
+  plx::Fmp4Muxer::Params params = {
+    width,
+    height,
+    10000000,
+    static_cast<uint32_t>(std::max(10000000LL / duration, 1LL)),
+    static_cast<uint32_t>(duration)
+  };
+  return params;
+}
+
+// One recording, H.264 from its own encoder in fragmented mp4. A file cut
+// short by a crash or a power loss plays up to its last fragment, about a
+// second before the end. The media foundation sink for fragmented mp4 only
+// exists from windows 8 on, plx::Fmp4Muxer does the same on windows 7.
+// The fragments are coalesced into 1 MB blocks that plx::AsyncFileWriter
+// writes in the background, so the writer thread only waits for the disk
+// when all of them are still in flight. Made on one thread, written on the
+// writer thread and finished back on the first one.
+class Fmp4Segment {
+  static const size_t kBlockSize = 1024 * 1024;
+  static const unsigned int kDepth = 4;
+
+  H264Encoder encoder_;
+  plx::LargeFile file_;
+  plx::AsyncFileWriter writer_;
+  plx::Fmp4Muxer muxer_;
+  bool failed_;
+
+  Fmp4Segment(const Fmp4Segment&) = delete;
+  Fmp4Segment& operator=(const Fmp4Segment&) = delete;
+
+public:
+  Fmp4Segment(const wchar_t* filename, IMFMediaType* input_mtype, uint32_t bitrate)
+      : encoder_(input_mtype, bitrate, 10000000LL),
+        file_(OpenSegment(filename)),
+        writer_(plx::MakeAsyncIo(file_.native(), kDepth), kBlockSize, kDepth),
+        muxer_(Fmp4Params(encoder_), [this](const plx::Range<const uint8_t>& r) { sink(r); }),
+        failed_(false) {
+    auto header = SequenceHeader(encoder_);
+    if (!header.empty())
+      muxer_.add_parameter_sets(plx::Range<const uint8_t>(&header[0], header.size()));
+  }
+
+  // |time| is relative to the start of the segment. Returns false once
+  // anything failed, the rest of the segment is lost then.
+  bool write(IMFSample* frame, LONGLONG time) {
+    if (failed_)
+      return false;
+    if (!encoder_.encode(frame, time, [this](IMFSample* encoded) { mux(encoded); }))
+      failed_ = true;
+    return !failed_;
+  }
+
+  // Writes the frames still in the encoder and the last fragment, and
+  // waits until every block is written.
+  bool finish() {
+    if (!failed_ && !encoder_.drain([this](IMFSample* encoded) { mux(encoded); }))
+      failed_ = true;
+    muxer_.flush();
+    writer_.flush();
+    if (writer_.failures())
+      failed_ = true;
+    return !failed_;
+  }
+
+private:
+  // the writer needs the file open before it is made.
+  static plx::LargeFile OpenSegment(const wchar_t* filename) {
+    auto file = plx::LargeFile::Create(plx::FilePath(filename),
+        FILE_GENERIC_READ | FILE_GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS);
+    if (!file.is_valid())
+      throw plx::IOException(__LINE__, filename);
+    return file;
+  }
+
+  void mux(IMFSample* encoded) {
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    if (encoded->ConvertToContiguousBuffer(buffer.GetAddressOf()) != S_OK) {
+      failed_ = true;
+      return;
+    }
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    if (buffer->Lock(&data, nullptr, &length) != S_OK) {
+      failed_ = true;
+      return;
+    }
+    LONGLONG time = 0;
+    encoded->GetSampleTime(&time);
+    auto keyframe = ::MFGetAttributeUINT32(encoded, MFSampleExtension_CleanPoint, FALSE);
+    muxer_.add_access_unit(plx::Range<const uint8_t>(data, length), time, keyframe != 0);
+    buffer->Unlock();
+  }
+
+  // a block that failed is only counted once it finishes, a later write
+  // or finish() sees it.
+  void sink(const plx::Range<const uint8_t>& r) {
+    writer_.write(r.start(), r.size());
+    if (writer_.failures())
+      failed_ = true;
+  }
+};
+
+// Large pages need the "Lock pages in memory" right, which the account has
+// to be granted and the process has to switch on in its token. Returns
+// false if the account does not have it.
+bool EnableLockMemoryPrivilege() {
+  HANDLE token = nullptr;
+  if (!::OpenProcessToken(::GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    return false;
+  TOKEN_PRIVILEGES privileges = {0};
+  privileges.PrivilegeCount = 1;
+  privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  // AdjustTokenPrivileges() succeeds even when it enables nothing.
+  auto enabled =
+      ::LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+      ::AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+      (::GetLastError() != ERROR_NOT_ALL_ASSIGNED);
+  ::CloseHandle(token);
+  return enabled;
+}
+
+// Converts YUY2 frames to NV12 in samples from a SamplePool, splitting each
+// frame across a few threads. Each pooled sample gets a plx::FramePool
+// buffer the first time out and keeps it, so a frame in steady state makes
+// no COM object and touches no heap. A pool miss means the encoder is far
+// behind, then the heap keeps us going.
+class Yuy2Converter {
+  // converted frames held by the encoder and the queue to the disk.
+  static const size_t kPoolFrames = 32;
+
+  const uint32_t width_;
+  const uint32_t height_;
+  const plx::SimdLevel simd_level_;
+  plx::RowWorkers workers_;
+  plx::FramePool pool_;
+  SamplePool samples_;
+  // the frame convert() is working on, for convert_rows_.
+  const uint8_t* src_;
+  LONG pitch_;
+  uint8_t* dst_;
+  const std::function<void(size_t, size_t)> convert_rows_;
+
+public:
+  Yuy2Converter(uint32_t width, uint32_t height, bool large_pages)
+      : width_(width),
+        height_(height),
+        simd_level_(plx::BestSimdLevel()),
+        workers_(WorkerCount()),
+        pool_(nv12_size(), kPoolFrames, large_pages),
+        samples_(kPoolFrames, true),
+        src_(nullptr),
+        pitch_(0),
+        dst_(nullptr),
+        convert_rows_([this](size_t begin, size_t end) {
+          plx::Yuy2ToNv12(src_, pitch_, width_, begin, end,
+                          dst_, width_, dst_ + (width_ * height_), width_, simd_level_);
+        }) {
+  }
+
+  DWORD nv12_size() const {
+    return width_ * height_ * 3 / 2;
+  }
+
+  plx::FramePool::Stats pool_stats() const {
+    auto st = samples_.stats();
+    auto frames = pool_.stats();
+    st.frame_bytes = frames.frame_bytes;
+    st.large_pages = frames.large_pages;
+    return st;
+  }
+
+  // |src| is top-down with |pitch| bytes per row. Returns a sample with
+  // the NV12 frame and no time, or null if out of memory.
+  plx::ComPtr<IMFSample> convert(const uint8_t* src, LONG pitch) {
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    auto sample = AcquireFrameSample(samples_, pool_, buffer);
+    if (!sample) {
+      if ((::MFCreateSample(sample.GetAddressOf()) != S_OK) ||
+          (::MFCreateMemoryBuffer(nv12_size(), buffer.GetAddressOf()) != S_OK))
+        return nullptr;
+      sample->AddBuffer(buffer.Get());
+    }
+    buffer->Lock(&dst_, nullptr, nullptr);
+    src_ = src;
+    pitch_ = pitch;
+    workers_.run(height_, 2, convert_rows_);
+    buffer->Unlock();
+    buffer->SetCurrentLength(nv12_size());
+    return sample;
+  }
+
+  // Returns an NV12 sample with the same time as the YUY2 |sample|, or
+  // null if the sample buffer cannot be read.
+  plx::ComPtr<IMFSample> convert(IMFSample* sample) {
+    plx::ComPtr<IMFMediaBuffer> src_buffer;
+    if (sample->GetBufferByIndex(0, src_buffer.GetAddressOf()) != S_OK)
+      return nullptr;
+
+    BYTE* src = nullptr;
+    LONG pitch = 0;
+    plx::ComPtr<IMF2DBuffer> src2d;
+    if (src_buffer.As(&src2d) == S_OK) {
+      if (src2d->Lock2D(&src, &pitch) != S_OK)
+        return nullptr;
+    } else {
+      DWORD length = 0;
+      if (src_buffer->Lock(&src, nullptr, &length) != S_OK)
+        return nullptr;
+      pitch = width_ * 2;
+      if (length < DWORD(pitch) * height_)
+        pitch = 0;
+    }
+    // bottom-up frames are not expected from cameras.
+    plx::ComPtr<IMFSample> converted;
+    if (pitch > 0)
+      converted = convert(src, pitch);
+    if (src2d)
+      src2d->Unlock2D();
+    else
+      src_buffer->Unlock();
+    if (!converted)
+      return nullptr;
+
+    LONGLONG time = 0;
+    if (sample->GetSampleTime(&time) == S_OK)
+      converted->SetSampleTime(time);
+    if (sample->GetSampleDuration(&time) == S_OK)
+      converted->SetSampleDuration(time);
+    return converted;
+  }
+
+private:
+  // The caller helps, so one less worker than cores, up to 3.
+  static size_t WorkerCount() {
+    auto cores = std::max(std::thread::hardware_concurrency(), 1U);
+    return std::min(cores - 1, 3U);
+  }
+};
+
+HANDLE MakeAutoResetEvent() {
+  auto event = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+  if (!event)
+    throw plx::IOException(__LINE__, L"<event>");
+  return event;
+}
+
+// Reads the camera into H.264 segments. The capture callback hands the
+// samples to a SegmentedWriter whose writer thread calls back here to
+// convert, write and look at them.
+class VideoCaptureH264 : public plx::ComObject <IMFSourceReaderCallback>,
+    private SegmentedWriter<std::shared_ptr<Fmp4Segment>, plx::ComPtr<IMFSample>>::Delegate {
+public:
+  typedef SegmentedWriter<std::shared_ptr<Fmp4Segment>, plx::ComPtr<IMFSample>> Segments;
+
+  struct Stats {
+    uint64_t frames_written;
+    uint64_t queue_full_drops;
+    uint64_t slow_writes;
+    uint64_t write_errors;
+    size_t max_queue_depth;
+    uint32_t motion_score;
+    uint64_t motion_frames;
+    plx::FramePool::Stats pool;
+    FrameGapDetector::Stats gaps;
+  };
+
+private:
+  // about two seconds of 30 fps video.
+  static const size_t kQueueDepth = 64;
+
   plx::ReaderWriterLock rw_lock_;
   plx::ComPtr<IMFSourceReader> reader_;
-  plx::ComPtr<IMFSinkWriter> writer_;
   uint32_t avg_bitrate_;
-  LONGLONG base_time_;
   LONGLONG frame_count_;
+  bool recording_;
+
+  // Pre-event frames, encoded on the writer thread by their own encoder
+  // so the ring holds seconds of H.264 instead of raw frames. A save
+  // takes the ring to the saver thread, which gives it back empty when
+  // the file is written. Until then the writer thread has no ring to
+  // fill. |pre_event_lock_| guards the rings and the names.
+  std::unique_ptr<H264Encoder> pre_event_encoder_;
+  std::mutex pre_event_lock_;
+  std::unique_ptr<plx::ArenaRing> pre_event_;
+  std::unique_ptr<plx::ArenaRing> saving_;
+  std::wstring saving_name_;
+  std::vector<std::wstring> saved_;
+  plx::CoalescingEvent saver_event_;
+  std::unique_ptr<std::thread> saver_thread_;
+
+  // Negotiated frame format.
+  uint32_t frame_width_;
+  uint32_t frame_height_;
+  GUID subtype_;
+
+  // Fed by the capture callback.
+  std::unique_ptr<FrameGapDetector> gap_detector_;
+  bool stream_tick_;
+
+  // YUY2 cameras are converted to NV12 on the writer thread so the sink
+  // writer does not need the color converter DSP. Everything past the
+  // conversion, the encoder, pre-event ring and motion detection, sees NV12.
+  std::unique_ptr<Yuy2Converter> converter_;
+
+  // Motion detection runs on the writer thread.
+  std::unique_ptr<MotionDetector> motion_;
+  uint32_t motion_threshold_;
+  std::atomic<uint32_t> motion_score_;
+  std::atomic<uint64_t> motion_frames_;
+  std::atomic<uint32_t> motion_events_;
+
+  // Last so its writer thread is gone before the rest goes away.
+  Segments segments_;
 
 public:
-  VideoCaptureH264(plx::ComPtr<IMFMediaSource> source, uint32_t bitrate) 
+  VideoCaptureH264(plx::ComPtr<IMFMediaSource> source, uint32_t bitrate, bool large_pages) 
       : avg_bitrate_(bitrate),
-        base_time_(0ULL),
-        frame_count_(0ULL) {
+        frame_count_(0ULL),
+        recording_(false),
+        frame_width_(0),
+        frame_height_(0),
+        subtype_(GUID_NULL),
+        stream_tick_(false),
+        motion_threshold_(0),
+        motion_score_(0),
+        motion_frames_(0ULL),
+        motion_events_(0),
+        segments_(this, kQueueDepth) {
     auto attributes = MakeMFAttributes(2);
     attributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, this);
     auto hr = ::MFCreateSourceReaderFromMediaSource(
@@ -388,6 +1224,17 @@ public:
                                               mtype.Get());
             if (hr != S_OK)
               throw plx::ComException(__LINE__, hr);
+            hr = ::MFGetAttributeSize(mtype.Get(), MF_MT_FRAME_SIZE,
+                                      &frame_width_, &frame_height_);
+            if (hr != S_OK)
+              throw plx::ComException(__LINE__, hr);
+            subtype_ = subtype;
+            UINT32 rate_num = 0, rate_den = 0;
+            hr = ::MFGetAttributeRatio(mtype.Get(), MF_MT_FRAME_RATE, &rate_num, &rate_den);
+            if ((hr != S_OK) || !rate_num || !rate_den)
+              throw AppException(HardFailures::bad_format, __LINE__);
+            gap_detector_ = std::make_unique<FrameGapDetector>(
+                (10000000LL * rate_den) / rate_num);
             done = true;
           }
         }
@@ -398,246 +1245,1071 @@ public:
 
       mtype->FreeRepresentation(AM_MEDIA_TYPE_REPRESENTATION, amr);
     }
-    // Register the color converter DSP for this process. This will enable the sink writer
-    // to find the color converter when the sink writer attempts to match the media types.
-    hr = ::MFTRegisterLocalByCLSID(__uuidof(CColorConvertDMO),
-                                   MFT_CATEGORY_VIDEO_PROCESSOR, L"",
-                                   MFT_ENUM_FLAG_SYNCMFT,
-                                   0, nullptr, 0, nullptr);
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
+    if (subtype_ == MFVideoFormat_YUY2)
+      converter_ = std::make_unique<Yuy2Converter>(frame_width_, frame_height_, large_pages);
   }
 
-  void start(const wchar_t* filename) {
-    if (writer_)
+  // |segment_length| is in 100ns units. The writer thread switches to the
+  // writer given to prepare_next() on the first frame past that length.
+  void start(const wchar_t* filename, LONGLONG segment_length) {
+    if (!segments_.start(make_writer(filename), segment_length))
       throw AppException(HardFailures::invalid_command, __LINE__);
 
-    auto hr = MFCreateSinkWriterFromURL(
-        filename, nullptr, nullptr, writer_.GetAddressOf());
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
-
-    plx::ComPtr<IMFMediaType> reader_mtype;
-    hr = reader_->GetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-                                      reader_mtype.GetAddressOf());
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
-
-    plx::ComPtr<IMFMediaType> writer_mtype;
-    hr = MFCreateMediaType(writer_mtype.GetAddressOf());
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
-
-    writer_mtype->SetGUID( MF_MT_MAJOR_TYPE, MFMediaType_Video);
-    writer_mtype->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
-    writer_mtype->SetUINT32(MF_MT_AVG_BITRATE, avg_bitrate_);
-    CopyMFAttribute(MF_MT_FRAME_SIZE, reader_mtype.Get(), writer_mtype.Get());
-    CopyMFAttribute(MF_MT_FRAME_RATE, reader_mtype.Get(), writer_mtype.Get());
-    CopyMFAttribute(MF_MT_PIXEL_ASPECT_RATIO, reader_mtype.Get(), writer_mtype.Get());
-    CopyMFAttribute(MF_MT_INTERLACE_MODE, reader_mtype.Get(), writer_mtype.Get());
-
-    DWORD stream_index;
-    hr = writer_->AddStream(writer_mtype.Get(), &stream_index);
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
-
-    hr = writer_->SetInputMediaType(stream_index, reader_mtype.Get(), nullptr);
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
-
-    base_time_ = 0ULL;
     frame_count_ = 0ULL;
+    gap_detector_->reset();
 
-    hr = writer_->BeginWriting();
-    if (hr != S_OK)
-      throw plx::ComException(__LINE__, hr);
+    {
+      auto lock = rw_lock_.write_lock();
+      recording_ = true;
+    }
 
-    hr = reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-                             0, nullptr, nullptr, nullptr, nullptr);
+    auto hr = reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+                                  0, nullptr, nullptr, nullptr, nullptr);
     if (hr != S_OK)
       throw plx::ComException(__LINE__, hr);
   }
 
-  void stop() {
-    auto lock = rw_lock_.write_lock();
-    if (!writer_)
-      return;
-    writer_->Finalize();
-    writer_.Reset();
+  // Opens the writer for the next segment. This is the slow part of the
+  // rotation and it happens on the caller's thread, the writer thread
+  // only swaps pointers at the segment boundary. |segment_length| applies
+  // from that segment on.
+  void prepare_next(const wchar_t* filename, LONGLONG segment_length) {
+    auto writer = make_writer(filename);
+    if (!segments_.prepare_next(writer, filename, segment_length)) {
+      discard_writer(writer, filename);
+      throw AppException(HardFailures::invalid_command, __LINE__);
+    }
   }
 
-private:
-  HRESULT __stdcall OnReadSample(HRESULT status,
-                                 DWORD stream_index,
-                                 DWORD stream_flags,
-                                 LONGLONG timestamp,
-                                 IMFSample *sample) override {
-    if (FAILED(status))
-      return status;
-    HRESULT hr;
-    auto lock = rw_lock_.write_lock();
-
-    if (!writer_)
-      return S_OK;
-
-    if (sample) {
-      ++frame_count_;
+  // Used by the writers made from now on, call it from the thread that
+  // calls start() and prepare_next().
+  void set_bitrate(uint32_t bitrate) {
+    avg_bitrate_ = bitrate;
+  }
 
-      if (!base_time_)
-        base_time_ = timestamp;
-      
-      auto norm_timestamp = timestamp - base_time_;
-      sample->SetSampleTime(norm_timestamp);
-      hr = writer_->WriteSample(0, sample);
-      if (hr != S_OK)
-        throw plx::ComException(__LINE__, hr);
-    }
+  bool has_next() {
+    return segments_.has_next();
+  }
 
-    // request the next sample.
-    hr = reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-                             0, nullptr, nullptr, nullptr, nullptr);
+  // Closes the file of the segment that the writer thread just left.
+  void finalize_retired() {
+    segments_.finalize_retired();
+  }
 
-    return hr;
-  };
+  // About the segment that finalize_retired() closed last.
+  SegmentInfo take_retired_info() {
+    return segments_.take_retired_info();
+  }
 
-  HRESULT __stdcall OnEvent(DWORD, IMFMediaEvent*) override {
-    return S_OK;
+  const FrameGapDetector& gap_detector() const {
+    return *gap_detector_;
   }
 
-  HRESULT __stdcall OnFlush(DWORD) {
-    return S_OK;
+  uint32_t segment_count() const {
+    return segments_.segment_count();
   }
-};
 
-plx::File OpenDirectory(plx::FilePath& path) {
-  auto dir_par = plx::FileParams::Directory_ShareAll();
-  return plx::File::Create(path, dir_par, plx::FileSecurity());
-}
+  // Returns what is known about the last segment.
+  SegmentInfo stop() {
+    {
+      auto lock = rw_lock_.write_lock();
+      if (!recording_) {
+        SegmentInfo none = { -1, std::vector<GapEvent>() };
+        return none;
+      }
+      // After this the capture callback does not queue anymore.
+      recording_ = false;
+    }
+    // writes what is already queued and closes the files.
+    return segments_.stop();
+  }
 
-bool EnumAndClean(plx::FilesInfo& files, const plx::FilePath& dirname, int64_t keep_count) {
-  std::map<long long, plx::Range<wchar_t>> file_map;
-  for (files.first(); !files.done(); files.next()) {
-    if (files.is_directory())
-      continue;
-    if (files.file_name().back() == '4') {
-      file_map[files.creation_ns1600()] = files.file_name();
+  // Must be called before the last reference goes away. The source reader
+  // holds a reference to us so we need to break the cycle here.
+  void shutdown() {
+    stop();
+    segments_.shutdown();
+    if (saver_thread_) {
+      saver_event_.close();
+      saver_thread_->join();
+      saver_thread_.reset();
     }
+    reader_.Reset();
   }
-  // Figure out how many to delete.
-  auto delete_count = plx::To<int64_t>(file_map.size()) - keep_count;
-  if (delete_count <= 1)
-    return true;
 
-  for (auto& it : file_map) {
-    std::wstring name(it.second.start(), it.second.end());
-    auto ffn = dirname.append(name);
-    if (!::DeleteFile(ffn.raw())) {
-      auto gle = ::GetLastError();
-      continue;
+  // Keeps the last |window| (in 100ns units) of frames in |bytes| of
+  // memory so save_pre_event() can write what happened before an event.
+  // Call it before start().
+  void enable_pre_event(size_t bytes, LONGLONG window) {
+    // one descriptor per frame at up to 60 fps.
+    auto max_frames = plx::To<size_t>((window / 10000000LL) + 1) * 60;
+    // a keyframe every second, the ring trims whole groups of pictures.
+    pre_event_encoder_ = std::make_unique<H264Encoder>(
+        writer_input_type().Get(), avg_bitrate_, 10000000LL);
+    {
+      std::lock_guard<std::mutex> lock(pre_event_lock_);
+      pre_event_ = std::make_unique<plx::ArenaRing>(bytes, max_frames, window);
     }
-    // success, adjust the count.
-    --delete_count;
-    if (!delete_count)
-      break;
+    saver_thread_ = std::make_unique<std::thread>(
+        &VideoCaptureH264::saver_threadproc, this);
   }
 
-  return true;
+  // Starts writing the frames in the pre-event ring to |filename| on the
+  // saver thread. Returns false if there is nothing to save or a save is
+  // still going on. take_saved_pre_events() tells when it is done.
+  bool save_pre_event(const wchar_t* filename) {
+    std::lock_guard<std::mutex> lock(pre_event_lock_);
+    if (!pre_event_ || !pre_event_->frames() || saving_)
+      return false;
+    saving_ = std::move(pre_event_);
+    saving_name_ = filename;
+    saver_event_.signal(1);
+    return true;
+  }
+
+  // The files save_pre_event() finished since the last call, the ones
+  // that failed are already deleted.
+  std::vector<std::wstring> take_saved_pre_events() {
+    std::lock_guard<std::mutex> lock(pre_event_lock_);
+    std::vector<std::wstring> saved;
+    saved.swap(saved_);
+    return saved;
+  }
+
+  // A frame where at least |threshold| per-mille of the tiles changed
+  // by more than |pixel_delta| on average counts as a motion event.
+  void enable_motion(uint32_t threshold, uint32_t pixel_delta) {
+    motion_threshold_ = threshold;
+    // it sees the frames after the NV12 conversion.
+    motion_ = std::make_unique<MotionDetector>(
+        frame_width_, frame_height_, 1, pixel_delta);
+  }
+
+  // Returns how many motion events happened since the last call.
+  uint32_t take_motion_events() {
+    return motion_events_.exchange(0);
+  }
+
+  const PipelineLatency& latency() const {
+    return segments_.latency();
+  }
+
+  Stats stats() const {
+    auto segments = segments_.stats();
+    Stats st = {
+      segments.frames_written,
+      segments.queue_full_drops,
+      segments.slow_writes,
+      segments.write_errors,
+      segments.max_queue_depth,
+      motion_score_,
+      motion_frames_
+    };
+    if (converter_)
+      st.pool = converter_->pool_stats();
+    else
+      st.pool = plx::FramePool::Stats();
+    st.gaps = gap_detector_->stats();
+    return st;
+  }
+
+private:
+  // What the encoders get, the camera frames or their NV12 conversion.
+  plx::ComPtr<IMFMediaType> writer_input_type() {
+    plx::ComPtr<IMFMediaType> reader_mtype;
+    auto hr = reader_->GetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+                                           reader_mtype.GetAddressOf());
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    if (!converter_)
+      return reader_mtype;
+    return MakeRawVideoType(
+        MFVideoFormat_NV12, frame_width_, frame_height_, reader_mtype.Get());
+  }
+
+  std::shared_ptr<Fmp4Segment> make_writer(const wchar_t* filename) {
+    return std::make_shared<Fmp4Segment>(filename, writer_input_type().Get(), avg_bitrate_);
+  }
+
+  bool prepare_frame(plx::ComPtr<IMFSample>& sample) override {
+    if (converter_)
+      sample = converter_->convert(sample.Get());
+    return sample ? true : false;
+  }
+
+  bool write_frame(std::shared_ptr<Fmp4Segment>& writer,
+                   plx::ComPtr<IMFSample>& sample, int64_t time) override {
+    return writer->write(sample.Get(), time);
+  }
+
+  void frame_written(plx::ComPtr<IMFSample>& sample, int64_t time) override {
+    keep_pre_event(sample.Get(), time);
+    detect_motion(sample.Get());
+  }
+
+  void finalize_writer(std::shared_ptr<Fmp4Segment>& writer) override {
+    writer->finish();
+  }
+
+  // the file closes with the last reference.
+  void discard_writer(std::shared_ptr<Fmp4Segment>& writer,
+                      const std::wstring& name) override {
+    writer.reset();
+    ::DeleteFileW(name.c_str());
+  }
+
+  void detect_motion(IMFSample* sample) {
+    if (!motion_)
+      return;
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    if (sample->GetBufferByIndex(0, buffer.GetAddressOf()) != S_OK)
+      return;
+    // Prefer the 2D interface, it knows the real pitch.
+    plx::ComPtr<IMF2DBuffer> buffer2d;
+    if (buffer.As(&buffer2d) == S_OK) {
+      BYTE* scan0 = nullptr;
+      LONG pitch = 0;
+      if (buffer2d->Lock2D(&scan0, &pitch) != S_OK)
+        return;
+      if (pitch > 0)
+        on_motion_result(motion_->process(scan0, pitch));
+      buffer2d->Unlock2D();
+    } else {
+      BYTE* data = nullptr;
+      DWORD length = 0;
+      if (buffer->Lock(&data, nullptr, &length) != S_OK)
+        return;
+      auto stride = motion_->width() * motion_->pixel_step();
+      if (length >= stride * motion_->height())
+        on_motion_result(motion_->process(data, stride));
+      buffer->Unlock();
+    }
+  }
+
+  void on_motion_result(uint32_t score) {
+    motion_score_ = score;
+    if (motion_threshold_ && (score >= motion_threshold_)) {
+      ++motion_frames_;
+      ++motion_events_;
+    }
+  }
+
+  // Runs on the writer thread. The encoder sees every frame even while
+  // the ring is away so its output stays continuous.
+  void keep_pre_event(IMFSample* sample, LONGLONG timestamp) {
+    if (!pre_event_encoder_)
+      return;
+    pre_event_encoder_->encode(sample, timestamp, [this](IMFSample* encoded) {
+      plx::ComPtr<IMFMediaBuffer> buffer;
+      if (encoded->ConvertToContiguousBuffer(buffer.GetAddressOf()) != S_OK)
+        return;
+      BYTE* data = nullptr;
+      DWORD length = 0;
+      if (buffer->Lock(&data, nullptr, &length) != S_OK)
+        return;
+      LONGLONG time = 0;
+      encoded->GetSampleTime(&time);
+      auto keyframe = ::MFGetAttributeUINT32(encoded, MFSampleExtension_CleanPoint, FALSE);
+      {
+        std::lock_guard<std::mutex> lock(pre_event_lock_);
+        if (pre_event_)
+          pre_event_->push(plx::Range<const uint8_t>(data, length), time, keyframe != 0);
+      }
+      buffer->Unlock();
+    });
+  }
+
+  // Writes the ring that save_pre_event() took, the H.264 goes from the
+  // ring to the muxer as is. The file starts at the first frame the ring
+  // still has, which is a keyframe.
+  bool write_pre_event(const plx::ArenaRing& ring, const std::wstring& filename) {
+    auto file = plx::File::Create(plx::FilePath(filename),
+                                  plx::FileParams::ReadWrite_SharedRead(CREATE_ALWAYS),
+                                  plx::FileSecurity());
+    if (!file.is_valid())
+      return false;
+    bool written = true;
+    plx::Fmp4Muxer muxer(Fmp4Params(*pre_event_encoder_),
+                         [&](const plx::Range<const uint8_t>& r) {
+      if (file.write(r) != r.size())
+        written = false;
+    });
+    auto header = SequenceHeader(*pre_event_encoder_);
+    if (!header.empty())
+      muxer.add_parameter_sets(plx::Range<const uint8_t>(&header[0], header.size()));
+    ring.visit([&](const plx::Range<const uint8_t>& frame,
+                   int64_t time, bool keyframe) {
+      muxer.add_access_unit(frame, time, keyframe);
+    });
+    muxer.flush();
+    return written && muxer.bytes_out();
+  }
+
+  void saver_threadproc() {
+    while (true) {
+      uint64_t waited_ms = 0;
+      saver_event_.wait(INFINITE, &waited_ms);
+      if (saver_event_.is_closed())
+        break;
+      plx::ArenaRing* ring = nullptr;
+      std::wstring filename;
+      {
+        std::lock_guard<std::mutex> lock(pre_event_lock_);
+        ring = saving_.get();
+        filename = saving_name_;
+      }
+      if (!ring)
+        continue;
+      // nothing may leave the thread, a failed save just loses the event.
+      bool saved = false;
+      try {
+        saved = write_pre_event(*ring, filename);
+      } catch (...) {
+      }
+      if (!saved)
+        ::DeleteFileW(filename.c_str());
+      ring->clear();
+      std::lock_guard<std::mutex> lock(pre_event_lock_);
+      pre_event_ = std::move(saving_);
+      saved_.push_back(filename);
+    }
+  }
+
+  HRESULT __stdcall OnReadSample(HRESULT status,
+                                 DWORD stream_index,
+                                 DWORD stream_flags,
+                                 LONGLONG timestamp,
+                                 IMFSample *sample) override {
+    auto arrival = plx::QpcNow();
+    if (FAILED(status))
+      return status;
+    auto lock = rw_lock_.write_lock();
+
+    if (!recording_)
+      return S_OK;
+
+    // a stream tick comes without a sample, it is the source telling us
+    // there is a gap before the next one.
+    if (stream_flags & MF_SOURCE_READERF_STREAMTICK)
+      stream_tick_ = true;
+
+    if (sample) {
+      ++frame_count_;
+      auto dropped = gap_detector_->add(timestamp);
+      if (stream_tick_ && !dropped)
+        dropped = 1;
+      stream_tick_ = false;
+      // If the queue is full the writer is hopelessly behind, we drop the
+      // frame but keep the camera going.
+      segments_.push(sample, timestamp, arrival, dropped);
+    }
+
+    // request the next sample.
+    return reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+                               0, nullptr, nullptr, nullptr, nullptr);
+  };
+
+  HRESULT __stdcall OnEvent(DWORD, IMFMediaEvent*) override {
+    return S_OK;
+  }
+
+  HRESULT __stdcall OnFlush(DWORD) {
+    return S_OK;
+  }
+};
+
+// The wall clock for plx::RetentionEngine, like file creation times.
+long long NowNs1600() {
+  FILETIME ft;
+  ::GetSystemTimeAsFileTime(&ft);
+  return (static_cast<long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
 }
 
-void _stdcall DoNothingAPC(ULONG_PTR dwParam) {}
+void ValidateSettings(const Settings& settings) {
+  if ((settings.seconds_per_file < 10) || (settings.seconds_per_file > kMaxSecondsPerFile))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if (settings.average_bitrate < 50000)
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if ((settings.keep_file_count < 0) || (settings.max_bytes < 0) ||
+      (settings.min_free_bytes < 0) || (settings.max_age_hours < 0))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if ((settings.clean_interval_minutes < 1) ||
+      (settings.clean_interval_minutes > kMaxCleanIntervalMinutes))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if ((settings.pre_event_seconds > 0) && (settings.pre_event_megabytes < 1))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if (settings.pre_event_megabytes > kMaxPreEventMegabytes)
+    throw AppException(HardFailures::bad_config, __LINE__);
+  if ((settings.motion_threshold < 0) || (settings.motion_threshold > 1000))
+    throw AppException(HardFailures::bad_config, __LINE__);
+}
 
-class CaptureManager {
-  DCoWindow* window_;
-  const Settings settings_;
-  uint64_t start_time_ms_;
+// Everything one camera needs: capture, rotation, its own index and its own
+// cleaner thread. Pipelines share nothing so cameras don't wait on each
+// other. The methods other than the cleaner and update_settings() run on
+// the UI thread. New settings are picked up at the next boundary: segment
+// length and bitrate with the next segment, retention with the next
+// cleaner pass. The folder, the pre-event ring, motion detection and large
+// pages are fixed when the pipeline is made. The settings in effect are
+// kept in the folder as settings.json.
+class CameraPipeline {
+  // How long before the segment ends the next writer is opened.
+  static const int64_t kRotationLeadSecs = 3;
+  // How often on_timer() looks at the disk free space.
+  static const int64_t kSpaceCheckSecs = 10;
+  // Average luma change of a tile that counts as motion.
+  static const uint32_t kMotionPixelDelta = 12;
+  // Reasons to wake up the cleaner.
+  static const unsigned int kCleanSegmentClosed = 1;
+  static const unsigned int kCleanLowSpace = 2;
+  static const unsigned int kCleanSettingsChanged = 4;
+
+  struct CleanerStats {
+    std::atomic<uint32_t> passes;
+    std::atomic<uint64_t> last_latency_ms;
+    std::atomic<uint64_t> max_latency_ms;
+    std::atomic<long long> last_reclaimed;
+    std::atomic<long long> total_reclaimed;
+    std::atomic<long long> secs_to_full;
+    std::atomic<uint32_t> failures;
+
+    CleanerStats()
+        : passes(0), last_latency_ms(0), max_latency_ms(0),
+          last_reclaimed(0), total_reclaimed(0), secs_to_full(-1),
+          failures(0) {
+    }
+  };
+
+  const std::wstring name_;
+  const std::string folder_;
+  // published by the config watcher, read by the UI thread through
+  // |ui_settings_| and by the cleaner through its own reader.
+  plx::Snapshot<Settings> settings_;
+  plx::Snapshot<Settings>::Reader ui_settings_;
   uint64_t capture_start_ms_;
   uint32_t capture_count_;
+  uint32_t segments_seen_;
+  std::wstring current_file_;
+  std::wstring next_file_;
   plx::ComPtr<VideoCaptureH264> capture_;
+  // the capture folder as the index sees it.
+  std::unique_ptr<plx::LocalFolder> files_;
+  std::unique_ptr<plx::SegmentIndex> index_;
+  plx::CoalescingEvent cleaner_event_;
+  CleanerStats cleaner_stats_;
+  uint64_t last_space_check_ms_;
+  uint64_t last_event_ms_;
+  // first frame and gaps of the last closed segment.
+  SegmentInfo last_segment_;
+  // reused for every sidecar.
+  plx::JsonWriter sidecar_;
+  // for the frame rate shown in the status.
+  uint64_t fps_frames_;
+  uint64_t fps_time_ms_;
+  double fps_;
   std::unique_ptr<std::thread> cleaner_thread_;
-  
+
 public:
-  CaptureManager(DCoWindow* window, const Settings& settings) 
-      : window_(window),
-        settings_(settings),
-        start_time_ms_(::GetTickCount64()),
+  CameraPipeline(const std::wstring& name,
+                 plx::ComPtr<IMFMediaSource> source,
+                 const Settings& settings)
+      : name_(name),
+        folder_(settings.folder),
+        settings_(std::make_shared<const Settings>(settings)),
+        ui_settings_(settings_),
         capture_start_ms_(0ULL),
-        capture_count_(0UL) {
+        capture_count_(0UL),
+        segments_seen_(0UL),
+        last_space_check_ms_(0ULL),
+        last_event_ms_(0ULL),
+        fps_frames_(0ULL),
+        fps_time_ms_(::GetTickCount64()),
+        fps_(0.0) {
+    ValidateSettings(settings);
     auto bitrate = plx::To<uint32_t>(settings.average_bitrate);
-    // validate config.
-    if (settings_.seconds_per_file < 10)
-      throw AppException(HardFailures::bad_config, __LINE__);
-    if (settings_.average_bitrate < 50000)
-      throw AppException(HardFailures::bad_config, __LINE__);
     // Open camera and configure capture device.
-    capture_ = plx::MakeComObj<VideoCaptureH264>(GetCaptureDevice(), bitrate);
+    capture_ = plx::MakeComObj<VideoCaptureH264>(
+        source, bitrate, (settings.large_pages != 0) && EnableLockMemoryPrivilege());
+    if (settings.pre_event_seconds > 0) {
+      capture_->enable_pre_event(
+          plx::To<size_t>(settings.pre_event_megabytes * 1024 * 1024),
+          settings.pre_event_seconds * 10000000LL);
+    }
+    if (settings.motion_threshold > 0)
+      capture_->enable_motion(plx::To<uint32_t>(settings.motion_threshold), kMotionPixelDelta);
+    // load what is already in the folder.
+    files_ = std::make_unique<plx::LocalFolder>(folder_path().raw());
+    index_ = std::make_unique<plx::SegmentIndex>(files_.get());
+    index_->load();
+    SaveSettings(settings, folder_path().append(L"settings.json"));
     // configure cleaner thread.
     cleaner_thread_ = std::make_unique<std::thread>(
-        &CaptureManager::cleaner_threadproc, settings);
-    // update UI.
-    update_ui_status();
+        &CameraPipeline::cleaner_threadproc, this);
   }
 
-  CaptureManager(const CaptureManager&) = delete;
+  CameraPipeline(const CameraPipeline&) = delete;
 
-  ~CaptureManager() {
+  ~CameraPipeline() {
+    capture_->shutdown();
+    collect_pre_events();
     if (cleaner_thread_) {
-      ::QueueUserAPC(&DoNothingAPC, cleaner_thread_->native_handle(), 0);
+      cleaner_event_.close();
       cleaner_thread_->join();
     }
   }
 
+  const std::string& folder() const {
+    return folder_;
+  }
+
+  // Called from the config watcher thread. Throws if |settings| are not
+  // valid, the pipeline then keeps the ones it has.
+  // Throws if this pipeline cannot take |settings|.
+  void check_settings(const Settings& settings) const {
+    ValidateSettings(settings);
+    if (settings.folder != folder_)
+      throw AppException(HardFailures::bad_config, __LINE__);
+  }
+
+  // |settings| must have passed check_settings().
+  void update_settings(const Settings& settings) {
+    settings_.publish(std::make_shared<const Settings>(settings));
+    cleaner_event_.signal(kCleanSettingsChanged);
+    SaveSettings(settings, folder_path().append(L"settings.json"));
+  }
+
   void start() {
-    if (!capture_count_) {
-      window_->set_timer_callback(
-          1000, std::bind(&CaptureManager::on_timer, this));
-    }
+    ui_settings_.refresh();
+    auto& st = ui_settings_.get();
     // configure encoder and start capturing.
+    capture_->set_bitrate(plx::To<uint32_t>(st.average_bitrate));
     auto file = gen_filename();
-    capture_->start(file.c_str());
+    capture_->start(file.c_str(), st.seconds_per_file * 10000000LL);
+    current_file_ = plx::FilePath(file).leaf();
+    index_->open_segment(current_file_);
     capture_start_ms_ = ::GetTickCount64();
+    segments_seen_ = capture_->segment_count();
     ++capture_count_;
   }
 
   void stop() {
     if (capture_start_ms_) {
       // stop only destroys the encoder.
-      capture_->stop();
+      auto last = capture_->stop();
+      if (capture_->segment_count() != segments_seen_)
+        segment_switched();
+      last_segment_ = std::move(last);
+      auto closed = index_->close_segment(
+          current_file_, segment_filename(last_segment_.first_arrival));
+      write_sidecar(closed);
+      if (!next_file_.empty())
+        index_->close_segment(next_file_);
+      current_file_.clear();
+      next_file_.clear();
       capture_start_ms_ = 0ULL;
     }
   }
 
+  // Something interesting happened, save what led to it.
+  void on_event() {
+    if (ui_settings_.get().pre_event_seconds <= 0)
+      return;
+    last_event_ms_ = ::GetTickCount64();
+    auto file = gen_filename("-event");
+    // written on the capture's saver thread, see collect_pre_events().
+    if (capture_->save_pre_event(file.c_str()))
+      index_->open_segment(plx::FilePath(file).leaf());
+  }
+
+  // Writes the pipeline latency percentiles to latency.txt in the folder.
+  void dump_latency() {
+    auto& latency = capture_->latency();
+    const struct {
+      const char* name;
+      const plx::LatencyHistogram* histogram;
+    } stages[] = {
+      { "queue", &latency.queue },
+      { "convert", &latency.convert },
+      { "write", &latency.write },
+      { "total", &latency.total },
+      { "finalize", &latency.finalize },
+      { "interval", &capture_->gap_detector().intervals() },
+    };
+    std::string report("stage     count     mean us   p50 us    p99 us    p999 us   max us\n");
+    for (auto& stage : stages) {
+      auto sm = stage.histogram->summary();
+      report += plx::Format("%-9s %-9llu %-9llu %-9llu %-9llu %-9llu %llu\n",
+          stage.name, sm.count, sm.mean / 1000, sm.p50 / 1000,
+          sm.p99 / 1000, sm.p999 / 1000, sm.max / 1000);
+    }
+    auto file = plx::File::Create(
+        folder_path().append(L"latency.txt"),
+        plx::FileParams::ReadWrite_SharedRead(CREATE_ALWAYS),
+        plx::FileSecurity());
+    if (!file.is_valid())
+      return;
+    file.write(plx::Range<const uint8_t>(
+        reinterpret_cast<const uint8_t*>(report.c_str()), report.size()));
+  }
+
   void on_timer() {
+    collect_pre_events();
     if (!capture_start_ms_)
       return;
+    ui_settings_.refresh();
+    auto& st = ui_settings_.get();
+    if (capture_->segment_count() != segments_seen_) {
+      // The writer thread moved to the next file, close the old one.
+      capture_->finalize_retired();
+      segment_switched();
+      capture_start_ms_ = ::GetTickCount64();
+      ++capture_count_;
+    }
     int64_t elapsed_s = (::GetTickCount64() - capture_start_ms_) / 1000ULL;
-    if (elapsed_s > settings_.seconds_per_file) {
-      // Time to start a new file.
-      stop();
-      ::Sleep(100);
-      start();
+    if ((elapsed_s + kRotationLeadSecs >= st.seconds_per_file) &&
+        !capture_->has_next()) {
+      // Get the next file ready, the switch happens on the writer thread.
+      capture_->set_bitrate(plx::To<uint32_t>(st.average_bitrate));
+      auto file = gen_filename();
+      capture_->prepare_next(file.c_str(), st.seconds_per_file * 10000000LL);
+      next_file_ = plx::FilePath(file).leaf();
+      index_->open_segment(next_file_);
     }
-    // update the UI.
-    if (elapsed_s > 3)
-      update_ui_status();
+    check_free_space();
+    check_motion();
   }
 
 private:
-  std::wstring gen_filename() {
+  plx::FilePath folder_path() const {
+    return plx::FilePath(plx::WideFromUTF8(plx::RangeFromString(folder_), true));
+  }
+
+  // Pre-event files the saver thread is done with go in the index.
+  void collect_pre_events() {
+    for (auto& file : capture_->take_saved_pre_events())
+      index_->close_segment(plx::FilePath(file).leaf());
+  }
+
+  // The previous segment has been finalized.
+  void segment_switched() {
+    segments_seen_ = capture_->segment_count();
+    last_segment_ = capture_->take_retired_info();
+    // The file was named when it was opened, a few seconds before the
+    // writer thread switched to it. It is renamed after its first frame.
+    auto closed = index_->close_segment(
+        current_file_, segment_filename(last_segment_.first_arrival));
+    write_sidecar(closed);
+    current_file_ = next_file_;
+    next_file_.clear();
+    cleaner_event_.signal(kCleanSegmentClosed);
+  }
+
+  // Writes what is known about a closed segment next to it, as
+  // <segment>.json. It is deleted along with the segment. A segment that
+  // never got a frame has nothing to describe.
+  void write_sidecar(const std::wstring& segment) {
+    if (segment.empty() || (last_segment_.first_arrival < 0))
+      return;
+    auto file = plx::File::Create(
+        folder_path().append(segment + L".json"),
+        plx::FileParams::ReadWrite_SharedRead(CREATE_ALWAYS),
+        plx::FileSecurity());
+    if (!file.is_valid())
+      return;
+    int64_t dropped = 0;
+    sidecar_.clear();
+    sidecar_.begin_object();
+    sidecar_.key("file").string(
+        plx::UTF8FromWide(plx::Range<const wchar_t>(segment.c_str(), segment.size())));
+    sidecar_.key("camera").string(
+        plx::UTF8FromWide(plx::Range<const wchar_t>(name_.c_str(), name_.size())));
+    sidecar_.key("gaps").begin_array();
+    for (auto& gap : last_segment_.gaps) {
+      sidecar_.begin_object()
+              .key("time").dbl(gap.time / 10000000.0)
+              .key("dropped").int64(gap.dropped)
+              .end_object();
+      dropped += gap.dropped;
+    }
+    sidecar_.end_array();
+    sidecar_.key("dropped").int64(dropped);
+    sidecar_.end_object();
+    sidecar_.flush(file);
+  }
+
+  // Motion saves the pre-event frames, at most once per pre-event window
+  // since the ring is empty right after a save.
+  void check_motion() {
+    auto& st = ui_settings_.get();
+    if (!capture_->take_motion_events() || (st.pre_event_seconds <= 0))
+      return;
+    auto window_ms = static_cast<uint64_t>(st.pre_event_seconds) * 1000ULL;
+    if (last_event_ms_ && ((::GetTickCount64() - last_event_ms_) < window_ms))
+      return;
+    on_event();
+  }
+
+  // Wakes the cleaner if the next segment might not fit above the free
+  // space watermark.
+  void check_free_space() {
+    auto& st = ui_settings_.get();
+    if (!st.min_free_bytes)
+      return;
+    auto now_ms = ::GetTickCount64();
+    if ((now_ms - last_space_check_ms_) < (kSpaceCheckSecs * 1000ULL))
+      return;
+    last_space_check_ms_ = now_ms;
+    ULARGE_INTEGER avail = {0};
+    if (!::GetDiskFreeSpaceExW(folder_path().raw(), &avail, nullptr, nullptr))
+      return;
+    auto segment_bytes = (st.average_bitrate / 8) * st.seconds_per_file;
+    if (static_cast<long long>(avail.QuadPart) < (st.min_free_bytes + segment_bytes))
+      cleaner_event_.signal(kCleanLowSpace);
+  }
+
+  std::wstring gen_filename(const char* tag = "") {
     SYSTEMTIME st = {0};
     ::GetLocalTime(&st);
+    return gen_filename(st, tag);
+  }
+
+  // The name of a segment whose first frame arrived at |arrival|, a
+  // plx::QpcNow() value. Empty if it got no frames.
+  std::wstring segment_filename(int64_t arrival) {
+    if (arrival < 0)
+      return std::wstring();
+    ULARGE_INTEGER now;
+    FILETIME ft;
+    ::GetSystemTimeAsFileTime(&ft);
+    now.LowPart = ft.dwLowDateTime;
+    now.HighPart = ft.dwHighDateTime;
+    now.QuadPart -= plx::QpcToNanos(plx::QpcNow() - arrival) / 100;
+    ft.dwLowDateTime = now.LowPart;
+    ft.dwHighDateTime = now.HighPart;
+    SYSTEMTIME utc, local;
+    if (!::FileTimeToSystemTime(&ft, &utc) ||
+        !::SystemTimeToTzSpecificLocalTime(nullptr, &utc, &local))
+      return std::wstring();
+    return plx::FilePath(gen_filename(local, "")).leaf();
+  }
+
+  std::wstring gen_filename(SYSTEMTIME st, const char* tag) {
     st.wYear -= 2000;
 
-    auto filename = settings_.folder;
+    plx::FormatBuffer<MAX_PATH> filename;
     if (st.wHour < 13)
-      filename += plx::StringPrintf(
-          "\\Y%02d-%02d-%02d-am-%02dh%02dm%02ds.mp4",
-          st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+      plx::FormatTo(filename,
+          "%s\\Y%02d-%02d-%02d-am-%02dh%02dm%02ds%s.mp4",
+          folder_, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, tag);
     else {
-      filename += plx::StringPrintf(
-          "\\Y%02d-%02d-%02d-pm-%02dh%02dm%02ds.mp4",
-          st.wYear, st.wMonth, st.wDay, st.wHour - 12, st.wMinute, st.wSecond);
+      plx::FormatTo(filename,
+          "%s\\Y%02d-%02d-%02d-pm-%02dh%02dm%02ds%s.mp4",
+          folder_, st.wYear, st.wMonth, st.wDay, st.wHour - 12, st.wMinute, st.wSecond, tag);
     }
-    return plx::UTF16FromUTF8(plx::RangeFromString(filename), true);
+    return plx::WideFromUTF8(plx::RangeFromBytes(filename.c_str(), filename.size()), true);
+  }
+
+  // Frame rate since the last call.
+  void update_fps() {
+    auto now_ms = ::GetTickCount64();
+    auto frames = capture_->stats().frames_written;
+    if (now_ms > fps_time_ms_)
+      fps_ = ((frames - fps_frames_) * 1000.0) / (now_ms - fps_time_ms_);
+    fps_frames_ = frames;
+    fps_time_ms_ = now_ms;
+  }
+
+public:
+  // Appends the status of this camera to |out|.
+  void status_text(plx::FormatOut& out) {
+    auto& st = ui_settings_.get();
+    update_fps();
+    auto stats = capture_->stats();
+    auto total = capture_->latency().total.summary();
+    auto name = plx::UTF8FromWide(plx::Range<const wchar_t>(name_.c_str(), name_.size()));
+    PLX_FORMAT_TO(out,
+        " [%s] %.1f fps, %d videos of %d secs\n"
+        "  Directory is [%s], kepping %d videos\n"
+        "  Queue max %d dropped %llu slow %llu\n"
+        "  Index has %d files, %lld MB\n"
+        "  Cleaner %d passes, %llu ms, %lld MB freed, %d failed\n"
+        "  Motion %d/1000, %llu frames\n"
+        "  Pool %d frames, %d high, %llu misses\n"
+        "  Latency p99 %llu us, max %llu us\n"
+        "  Dropped %llu dup %llu frames, last file %d gaps\n",
+        name, fps_,
+        capture_count_, st.seconds_per_file,
+        folder_, st.keep_file_count,
+        static_cast<int>(stats.max_queue_depth),
+        stats.queue_full_drops, stats.slow_writes,
+        static_cast<int>(index_->count()), index_->total_bytes() / (1024 * 1024),
+        static_cast<int>(cleaner_stats_.passes), cleaner_stats_.max_latency_ms.load(),
+        cleaner_stats_.total_reclaimed / (1024 * 1024),
+        static_cast<int>(cleaner_stats_.failures),
+        stats.motion_score, stats.motion_frames,
+        static_cast<int>(stats.pool.allocated), static_cast<int>(stats.pool.high_water),
+        stats.pool.exhausted,
+        total.p99 / 1000, total.max / 1000,
+        stats.gaps.dropped, stats.gaps.duplicated,
+        static_cast<int>(last_segment_.gaps.size()));
+  }
+
+private:
+  // Runs a retention pass when a segment closes, when the disk is getting
+  // full or every |clean_interval_minutes| if nothing else happens.
+  void cleaner_threadproc() {
+    const uint64_t kReconcileMs = 24ULL * 3600ULL * 1000ULL;
+    plx::Snapshot<Settings>::Reader settings(settings_);
+    plx::RetentionEngine retention(files_.get());
+    auto last_reconcile_ms = ::GetTickCount64();
+
+    while (true) {
+      // validated settings are in range, the clamp keeps it that way.
+      const auto interval_minutes = std::min(
+          std::max(settings.get().clean_interval_minutes, int64_t(1)),
+          kMaxCleanIntervalMinutes);
+      const auto interval_ms = static_cast<uint32_t>(interval_minutes * 60 * 1000);
+      uint64_t waited_ms = 0;
+      cleaner_event_.wait(interval_ms, &waited_ms);
+      if (cleaner_event_.is_closed())
+        break;
+      settings.refresh();
+      auto& current = settings.get();
+      // The next segment close is the latest the next pass can happen.
+      const auto lookahead_secs =
+          std::min(current.clean_interval_minutes * 60, current.seconds_per_file);
+
+      auto start_ms = ::GetTickCount64();
+      plx::RetentionEngine::Result result = {};
+      // Nothing may leave the thread, a failed pass is retried at the
+      // next wake up.
+      try {
+        if ((start_ms - last_reconcile_ms) > kReconcileMs) {
+          index_->rescan();
+          last_reconcile_ms = start_ms;
+        }
+        plx::RetentionEngine::Limits limits = {
+          current.keep_file_count, current.max_bytes,
+          current.min_free_bytes, current.max_age_hours
+        };
+        result = retention.run(index_.get(), lookahead_secs, limits,
+                               NowNs1600(), ::GetTickCount64());
+      } catch (...) {
+        ++cleaner_stats_.failures;
+        continue;
+      }
+
+      auto latency_ms = waited_ms + (::GetTickCount64() - start_ms);
+      cleaner_stats_.last_latency_ms = latency_ms;
+      if (latency_ms > cleaner_stats_.max_latency_ms)
+        cleaner_stats_.max_latency_ms = latency_ms;
+      cleaner_stats_.last_reclaimed = result.reclaimed;
+      cleaner_stats_.total_reclaimed += result.reclaimed;
+      cleaner_stats_.secs_to_full = static_cast<long long>(result.secs_to_full);
+      ++cleaner_stats_.passes;
+    }
+  }
+
+};
+
+// Runs one CameraPipeline per camera, either every camera found or the ones
+// in the "cameras" setting, and drives them from the UI timer. Edits to
+// config.json are applied to the running pipelines; changes to the folders
+// or to the number of cameras need a restart and are refused.
+class CaptureManager {
+  DCoWindow* window_;
+  // what the pipelines run with, only the watcher thread changes it.
+  Settings settings_;
+  uint64_t start_time_ms_;
+  bool started_;
+  std::vector<std::unique_ptr<CameraPipeline>> pipelines_;
+  // the camera number of each pipeline and how many there are, which
+  // pick their folders.
+  std::vector<size_t> slots_;
+  size_t slot_count_;
+  // cameras found that could not be opened.
+  size_t skipped_;
+  std::atomic<uint32_t> reloads_;
+  // why the last reload was refused, empty if it was applied.
+  std::mutex reload_lock_;
+  std::string reload_error_;
+  // last so it stops before the pipelines go away.
+  std::unique_ptr<plx::FileWatcher> config_watcher_;
+
+public:
+  CaptureManager(DCoWindow* window, const Settings& settings)
+      : window_(window),
+        settings_(settings),
+        start_time_ms_(::GetTickCount64()),
+        started_(false),
+        slot_count_(0),
+        skipped_(0),
+        reloads_(0) {
+    ValidateSettings(settings_);
+    auto devices = EnumerateCaptureDevices();
+    if (settings_.cameras.empty()) {
+      // A single camera records in |folder| as it always did, more get a
+      // folder each. A camera that is busy or broken is left out instead
+      // of keeping the others from recording, its folder stays unused.
+      slot_count_ = devices.size();
+      for (size_t ix = 0; ix != devices.size(); ++ix) {
+        auto folder = CameraFolder(settings_, ix, slot_count_);
+        try {
+          add_pipeline(devices[ix], ix, SettingsForCamera(settings_, CameraSettings(), folder));
+        } catch (plx::Exception&) {
+          ++skipped_;
+        } catch (AppException&) {
+          ++skipped_;
+        }
+      }
+      if (pipelines_.empty())
+        throw AppException(HardFailures::no_capture_device, __LINE__);
+    } else {
+      slot_count_ = settings_.cameras.size();
+      std::vector<bool> used(devices.size(), false);
+      for (size_t ix = 0; ix != settings_.cameras.size(); ++ix) {
+        auto& camera = settings_.cameras[ix];
+        auto found = find_device(devices, used, camera.device);
+        if (found == devices.size())
+          throw AppException(HardFailures::no_capture_device, __LINE__);
+        used[found] = true;
+        auto folder = CameraFolder(settings_, ix, slot_count_);
+        add_pipeline(devices[found], ix, SettingsForCamera(settings_, camera, folder));
+      }
+    }
+    window_->set_click_callback(std::bind(&CaptureManager::on_event, this));
+    window_->set_key_callback(
+        std::bind(&CaptureManager::on_key, this, std::placeholders::_1));
+    config_watcher_ = std::make_unique<plx::FileWatcher>(
+        ConfigFilePath(), std::bind(&CaptureManager::reload_settings, this));
+    // update UI.
+    update_ui_status();
+  }
+
+  CaptureManager(const CaptureManager&) = delete;
+
+  void start() {
+    if (!started_) {
+      window_->set_timer_callback(
+          1000, std::bind(&CaptureManager::on_timer, this));
+      started_ = true;
+    }
+    for (auto& pipeline : pipelines_)
+      pipeline->start();
+  }
+
+  void stop() {
+    for (auto& pipeline : pipelines_)
+      pipeline->stop();
+  }
+
+  void on_event() {
+    for (auto& pipeline : pipelines_)
+      pipeline->on_event();
+  }
+
+  void on_key(int key) {
+    if (key == 'L') {
+      for (auto& pipeline : pipelines_)
+        pipeline->dump_latency();
+    }
+  }
+
+  void on_timer() {
+    for (auto& pipeline : pipelines_)
+      pipeline->on_timer();
+    // update the UI.
+    if ((::GetTickCount64() - start_time_ms_) > 3000)
+      update_ui_status();
+  }
+
+private:
+  // Where camera |ix| of |count| records unless it names its own folder.
+  static std::string CameraFolder(const Settings& settings, size_t ix, size_t count) {
+    if (settings.cameras.empty() && (count < 2))
+      return settings.folder;
+    return settings.folder + plx::Format("\\cam%d", static_cast<int>(ix));
+  }
+
+  // Runs on the watcher thread. The new settings go to every pipeline or,
+  // if any of them refuses, to none and the reason shows in the status.
+  void reload_settings() {
+    try {
+      auto settings = ReloadSettingsFile();
+      ValidateSettings(settings);
+      if (settings.cameras.size() != settings_.cameras.size())
+        throw AppException(HardFailures::bad_config, __LINE__);
+      std::vector<Settings> per_camera;
+      for (size_t ix = 0; ix != pipelines_.size(); ++ix) {
+        auto camera = settings.cameras.empty() ? CameraSettings() : settings.cameras[ix];
+        auto folder = CameraFolder(settings, slots_[ix], slot_count_);
+        per_camera.push_back(SettingsForCamera(settings, camera, folder));
+        pipelines_[ix]->check_settings(per_camera.back());
+      }
+      for (size_t ix = 0; ix != pipelines_.size(); ++ix)
+        pipelines_[ix]->update_settings(per_camera[ix]);
+      settings_ = settings;
+      set_reload_error(std::string());
+    } catch (plx::JsonSchemaException& ex) {
+      set_reload_error(ex.field() + ": " + ex.Message());
+    } catch (plx::Exception& ex) {
+      set_reload_error(plx::Format("error at line %d", ex.Line()));
+    } catch (AppException& ex) {
+      set_reload_error(plx::Format("error at line %d", ex.line));
+    } catch (...) {
+      // an escaping exception would end the watcher thread, and the app.
+      set_reload_error("unexpected error");
+    }
+    ++reloads_;
+  }
+
+  // The editor that saved the file can still have it open when the watcher
+  // fires, so opening it is tried a few more times.
+  static Settings ReloadSettingsFile() {
+    const int kRetries = 4;
+    const DWORD kRetryMs = 250;
+    for (int ix = 0; ; ++ix) {
+      try {
+        return LoadSettings();
+      } catch (plx::IOException&) {
+        if (ix == kRetries)
+          throw;
+      }
+      ::Sleep(kRetryMs);
+    }
+  }
+
+  void set_reload_error(const std::string& error) {
+    std::lock_guard<std::mutex> lock(reload_lock_);
+    reload_error_ = error;
+  }
+
+  std::string reload_error() {
+    std::lock_guard<std::mutex> lock(reload_lock_);
+    return reload_error_;
+  }
+
+  void add_pipeline(const CaptureDevice& device, size_t slot, const Settings& settings) {
+    auto folder = plx::WideFromUTF8(plx::RangeFromString(settings.folder), true);
+    // the top level folder has to exist already, the camera ones we make.
+    ::CreateDirectoryW(folder.c_str(), nullptr);
+    pipelines_.push_back(std::make_unique<CameraPipeline>(
+        device.name, ActivateCaptureDevice(device), settings));
+    slots_.push_back(slot);
+  }
+
+  // First unused device with |part| in its name, an empty |part| matches any.
+  static size_t find_device(const std::vector<CaptureDevice>& devices,
+                            const std::vector<bool>& used,
+                            const std::string& part) {
+    auto wpart = plx::WideFromUTF8(plx::RangeFromString(part), true);
+    for (size_t ix = 0; ix != devices.size(); ++ix) {
+      if (used[ix])
+        continue;
+      if (wpart.empty() || (devices[ix].name.find(wpart) != std::wstring::npos))
+        return ix;
+    }
+    return devices.size();
   }
 
   void update_ui_status() {
@@ -645,47 +2317,519 @@ private:
     static int count = 0;
 
     auto elapsed_secs = (GetTickCount64() - start_time_ms_) / 1000LL;
-    auto status = plx::StringPrintf(
-        "=== CamCenter v1 2015 by cpu@ ===\n\n\n"
-        " Running for %d hours [%c]\n"
-        " Directory is [%s]\n"
-        " %d videos of %d secs captured\n"
-        " Kepping %d videos\n",
-        elapsed_secs / 3600LL, anim[++count % sizeof(anim)],
-        settings_.folder.c_str(),
-        capture_count_, settings_.seconds_per_file,
-        settings_.keep_file_count);
-    auto text = plx::UTF16FromUTF8(plx::RangeFromString(status), true);
+    plx::FormatBuffer<4096> status;
+    // this runs on WM_TIMER, a bad format is shown instead of thrown.
+    try {
+      PLX_FORMAT_TO(status,
+          "=== CamCenter v1 2015 by cpu@ ===\n\n\n"
+          " Running for %d hours [%c], %d cameras (%d skipped), [L] saves latency\n"
+          " Config reloaded %d times %s\n",
+          elapsed_secs / 3600LL, anim[++count % sizeof(anim)],
+          pipelines_.size(), skipped_, reloads_.load(), reload_error());
+    } catch (plx::InvalidParamException& ex) {
+      StatusError(status, ex);
+    }
+    for (auto& pipeline : pipelines_) {
+      try {
+        pipeline->status_text(status);
+      } catch (plx::InvalidParamException& ex) {
+        StatusError(status, ex);
+      }
+    }
+    auto text = plx::WideFromUTF8(plx::RangeFromBytes(status.c_str(), status.size()), false);
     window_->update_text(text);
   }
 
-  static void cleaner_threadproc(const Settings settings) {
-    while (true) {
-      // alertable sleep.
-      auto le = ::SleepEx(10 * 60 * 1000, TRUE);
-      if (le != 0)
-        break;
-      // timed out. Proceed to clean.
-      plx::FilePath path(std::wstring(settings.folder.begin(), settings.folder.end()));
-      auto dir = OpenDirectory(path);
-      if (dir.status() != (plx::File::directory | plx::File::existing))
+  static void StatusError(plx::FormatOut& out, const plx::InvalidParamException& ex) {
+    plx::FormatTo(out, "\n  status format error at line %d, argument %d\n",
+                  ex.Line(), ex.Parameter());
+  }
+};
+
+// Measures the capture to disk path without a camera. Started with
+//   camcenter --bench size=1920x1080 fps=30 format=yuy2 sink=mp4 pace=fast seconds=20
+// A synthetic source feeds the same SegmentedWriter, conversion, sample
+// pools and sink writer code that a live capture uses. With cameras=N that
+// many pipelines run at once, each on its own threads. The report goes to
+// bench.txt in the current directory, the sinks write benchN.nv12 or
+// benchN.mp4 next to it. sink=async writes the raw frames through
+// plx::AsyncFileWriter, block=KB and depth=N set its block size and how
+// many blocks are in flight.
+struct BenchParams {
+  enum Sink {
+    null_sink,
+    file_sink,
+    mp4_sink,
+    async_sink
+  };
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+  bool yuy2;
+  Sink sink;
+  // pace frames like a camera or push them as fast as the sink takes them.
+  bool realtime;
+  uint32_t seconds;
+  uint32_t bitrate;
+  uint32_t cameras;
+  uint32_t block_kb;
+  uint32_t depth;
+};
+
+// A whole decimal number, a sign or anything after the digits makes the
+// command line bad.
+uint32_t ParseBenchNumber(const std::wstring& value) {
+  if (value.empty() || (value[0] < L'0') || (value[0] > L'9'))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  wchar_t* end = nullptr;
+  errno = 0;
+  auto number = ::wcstoul(value.c_str(), &end, 10);
+  if (*end || (errno == ERANGE) || (number > UINT32_MAX))
+    throw AppException(HardFailures::bad_config, __LINE__);
+  return static_cast<uint32_t>(number);
+}
+
+// Returns false if the command line does not start with --bench.
+bool ParseBenchParams(BenchParams& params) {
+  params.width = 1920;
+  params.height = 1080;
+  params.fps = 30;
+  params.yuy2 = true;
+  params.sink = BenchParams::null_sink;
+  params.realtime = false;
+  params.seconds = 20;
+  params.bitrate = 4000000;
+  params.cameras = 1;
+  params.block_kb = 1024;
+  params.depth = 4;
+
+  int argc = 0;
+  // freed on the way out, thrown or not.
+  std::unique_ptr<LPWSTR, decltype(&::LocalFree)> args(
+      ::CommandLineToArgvW(::GetCommandLineW(), &argc), &::LocalFree);
+  if (!args)
+    return false;
+  auto argv = args.get();
+  bool bench = (argc > 1) && (std::wstring(argv[1]) == L"--bench");
+  for (int ix = 2; bench && (ix < argc); ++ix) {
+    std::wstring arg(argv[ix]);
+    auto eq = arg.find(L'=');
+    if (eq == std::wstring::npos)
+      throw AppException(HardFailures::bad_config, __LINE__);
+    auto key = arg.substr(0, eq);
+    auto value = arg.substr(eq + 1);
+    if (key == L"size") {
+      auto x = value.find(L'x');
+      if (x == std::wstring::npos)
+        throw AppException(HardFailures::bad_config, __LINE__);
+      params.width = ParseBenchNumber(value.substr(0, x));
+      params.height = ParseBenchNumber(value.substr(x + 1));
+    } else if (key == L"fps") {
+      params.fps = ParseBenchNumber(value);
+    } else if (key == L"format") {
+      params.yuy2 = (value == L"yuy2");
+    } else if (key == L"sink") {
+      params.sink = (value == L"file") ? BenchParams::file_sink :
+                    (value == L"mp4") ? BenchParams::mp4_sink :
+                    (value == L"async") ? BenchParams::async_sink : BenchParams::null_sink;
+    } else if (key == L"pace") {
+      params.realtime = (value == L"realtime");
+    } else if (key == L"seconds") {
+      params.seconds = ParseBenchNumber(value);
+    } else if (key == L"bitrate") {
+      params.bitrate = ParseBenchNumber(value);
+    } else if (key == L"cameras") {
+      params.cameras = ParseBenchNumber(value);
+    } else if (key == L"block") {
+      params.block_kb = ParseBenchNumber(value);
+    } else if (key == L"depth") {
+      params.depth = ParseBenchNumber(value);
+    } else {
+      throw AppException(HardFailures::bad_config, __LINE__);
+    }
+  }
+  if (bench) {
+    if ((params.width < 64) || (params.height < 64) || (params.width % 16) ||
+        (params.width > 8192) || (params.height > 8192) ||
+        (params.height % 2) || !params.fps || !params.seconds ||
+        !params.cameras || (params.cameras > 64) ||
+        (params.block_kb < 4) || !params.depth || (params.depth > 256))
+      throw AppException(HardFailures::bad_config, __LINE__);
+  }
+  return bench;
+}
+
+// Where the benchmark frames end up.
+class BenchSink {
+public:
+  virtual ~BenchSink() {}
+  // |sample| has its time and duration set.
+  virtual void write(IMFSample* sample) = 0;
+  virtual void finish() = 0;
+};
+
+class NullBenchSink : public BenchSink {
+public:
+  void write(IMFSample*) override {}
+  void finish() override {}
+};
+
+// Raw NV12 frames straight to disk, no encoder. A minute of 1080p goes
+// past 4 GB.
+class FileBenchSink : public BenchSink {
+  plx::LargeFile file_;
+
+public:
+  explicit FileBenchSink(const std::wstring& filename)
+      : file_(plx::LargeFile::Create(plx::FilePath(filename),
+                                     GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS)) {
+    if (!file_.is_valid())
+      throw plx::IOException(__LINE__, filename.c_str());
+  }
+
+  void write(IMFSample* sample) override {
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    if (sample->GetBufferByIndex(0, buffer.GetAddressOf()) != S_OK)
+      return;
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    if (buffer->Lock(&data, nullptr, &length) != S_OK)
+      return;
+    file_.write(plx::Range<const uint8_t>(data, length));
+    buffer->Unlock();
+  }
+
+  void finish() override {}
+};
+
+// Raw frames like FileBenchSink but coalesced into blocks that are written
+// in the background.
+class AsyncFileBenchSink : public BenchSink {
+  plx::LargeFile file_;
+  std::unique_ptr<plx::AsyncFileWriter> writer_;
+
+public:
+  AsyncFileBenchSink(const std::wstring& filename, uint32_t block_kb, uint32_t depth)
+      : file_(plx::LargeFile::Create(plx::FilePath(filename),
+                                     GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS)) {
+    if (!file_.is_valid())
+      throw plx::IOException(__LINE__, filename.c_str());
+    writer_.reset(new plx::AsyncFileWriter(
+        plx::MakeAsyncIo(file_.native(), depth), block_kb * 1024, depth));
+  }
+
+  void write(IMFSample* sample) override {
+    plx::ComPtr<IMFMediaBuffer> buffer;
+    if (sample->GetBufferByIndex(0, buffer.GetAddressOf()) != S_OK)
+      return;
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    if (buffer->Lock(&data, nullptr, &length) != S_OK)
+      return;
+    writer_->write(data, length);
+    buffer->Unlock();
+  }
+
+  void finish() override {
+    writer_->flush();
+  }
+};
+
+// The same H.264 mp4 writer as the recordings.
+class Mp4BenchSink : public BenchSink {
+  Fmp4Segment segment_;
+
+public:
+  Mp4BenchSink(const std::wstring& filename, IMFMediaType* nv12_mtype, uint32_t bitrate)
+      : segment_(filename.c_str(), nv12_mtype, bitrate) {
+  }
+
+  void write(IMFSample* sample) override {
+    LONGLONG time = 0;
+    sample->GetSampleTime(&time);
+    segment_.write(sample, time);
+  }
+
+  void finish() override {
+    segment_.finish();
+  }
+};
+
+// One synthetic camera. Its frames go through a SegmentedWriter like the
+// ones of VideoCaptureH264: the source thread push()es them as the capture
+// callback does and the writer thread converts and writes them.
+class PipelineBench :
+    private SegmentedWriter<std::shared_ptr<BenchSink>, plx::ComPtr<IMFSample>>::Delegate {
+public:
+  typedef SegmentedWriter<std::shared_ptr<BenchSink>, plx::ComPtr<IMFSample>> Segments;
+
+  struct Result {
+    uint64_t frames;
+    uint64_t drops;
+    double secs;
+    double megabytes;
+    plx::LatencyHistogram::Summary latency;
+    plx::FramePool::Stats pool;
+  };
+
+private:
+  // distinct frames the source cycles through.
+  static const size_t kPatterns = 8;
+  // the same as VideoCaptureH264. The source has no more frames than fit
+  // in the queue, so going as fast as possible never overflows it.
+  static const size_t kQueueDepth = 64;
+
+  const BenchParams params_;
+  const int index_;
+  const size_t raw_size_;
+  const LONGLONG interval_;
+  std::vector<std::vector<uint8_t>> patterns_;
+  // stand in for the buffers of the camera.
+  plx::FramePool source_pool_;
+  SamplePool source_samples_;
+  std::unique_ptr<Yuy2Converter> converter_;
+  uint64_t source_drops_;
+  Segments segments_;
+
+public:
+  PipelineBench(const BenchParams& params, int index)
+      : params_(params),
+        index_(index),
+        raw_size_(params.yuy2 ? (params.width * params.height * 2) :
+                                (params.width * params.height * 3 / 2)),
+        interval_(10000000LL / params.fps),
+        source_pool_(raw_size_, kQueueDepth, false),
+        source_samples_(kQueueDepth, true),
+        source_drops_(0ULL),
+        segments_(this, kQueueDepth) {
+    make_patterns();
+    if (params_.yuy2)
+      converter_ = std::make_unique<Yuy2Converter>(params_.width, params_.height, false);
+  }
+
+  ~PipelineBench() {
+    segments_.shutdown();
+  }
+
+  Result run() {
+    auto like = make_source_type();
+    auto nv12_mtype = MakeRawVideoType(
+        MFVideoFormat_NV12, params_.width, params_.height, like.Get());
+    std::shared_ptr<BenchSink> sink;
+    auto name = plx::Format("bench%d", index_);
+    auto filename = std::wstring(name.begin(), name.end());
+    if (params_.sink == BenchParams::file_sink)
+      sink = std::make_shared<FileBenchSink>(filename + L".nv12");
+    else if (params_.sink == BenchParams::async_sink)
+      sink = std::make_shared<AsyncFileBenchSink>(
+          filename + L".nv12", params_.block_kb, params_.depth);
+    else if (params_.sink == BenchParams::mp4_sink)
+      sink = std::make_shared<Mp4BenchSink>(filename + L".mp4", nv12_mtype.Get(), params_.bitrate);
+    else
+      sink = std::make_shared<NullBenchSink>();
+
+    auto start = plx::QpcNow();
+    // the whole run is one segment.
+    segments_.start(std::move(sink), static_cast<int64_t>(params_.seconds + 1) * 10000000LL);
+    produce();
+    // writes what is queued and finishes the sink.
+    segments_.stop();
+    auto st = segments_.stats();
+    Result result = {
+      st.frames_written,
+      source_drops_ + st.queue_full_drops,
+      static_cast<double>(plx::QpcToNanos(plx::QpcNow() - start)) / 1.0e9,
+      (st.frames_written * raw_size_) / (1024.0 * 1024.0),
+      segments_.latency().total.summary(),
+      converter_ ? converter_->pool_stats() : plx::FramePool::Stats()
+    };
+    return result;
+  }
+
+  // user plus kernel time of the process in 100ns units.
+  static int64_t ProcessCpuTime() {
+    FILETIME creation, exit, kernel, user;
+    ::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return static_cast<int64_t>(k.QuadPart + u.QuadPart);
+  }
+
+private:
+  bool prepare_frame(plx::ComPtr<IMFSample>& sample) override {
+    if (converter_)
+      sample = converter_->convert(sample.Get());
+    return sample ? true : false;
+  }
+
+  bool write_frame(std::shared_ptr<BenchSink>& sink,
+                   plx::ComPtr<IMFSample>& sample, int64_t time) override {
+    sample->SetSampleTime(time);
+    sink->write(sample.Get());
+    return true;
+  }
+
+  void frame_written(plx::ComPtr<IMFSample>&, int64_t) override {}
+
+  void finalize_writer(std::shared_ptr<BenchSink>& sink) override {
+    sink->finish();
+  }
+
+  void discard_writer(std::shared_ptr<BenchSink>&, const std::wstring&) override {}
+
+  // A diagonal gradient that moves a bit every pattern, so the encoder has
+  // real work to do.
+  void make_patterns() {
+    patterns_.resize(kPatterns);
+    for (size_t ix = 0; ix != kPatterns; ++ix) {
+      auto& frame = patterns_[ix];
+      frame.resize(raw_size_);
+      for (size_t y = 0; y != params_.height; ++y) {
+        for (size_t x = 0; x != params_.width; ++x) {
+          auto luma = static_cast<uint8_t>(x + y + (ix * 8));
+          auto chroma = static_cast<uint8_t>(128 + ((x / 2) % 32) - 16);
+          if (params_.yuy2) {
+            frame[(y * params_.width * 2) + (x * 2)] = luma;
+            frame[(y * params_.width * 2) + (x * 2) + 1] = chroma;
+          } else {
+            frame[(y * params_.width) + x] = luma;
+          }
+        }
+      }
+      if (!params_.yuy2) {
+        auto uv = &frame[params_.width * params_.height];
+        for (size_t jx = 0; jx != (params_.width * params_.height / 2); ++jx)
+          uv[jx] = static_cast<uint8_t>(128 + ((jx / 2) % 32) - 16);
+      }
+    }
+  }
+
+  plx::ComPtr<IMFMediaType> make_source_type() {
+    plx::ComPtr<IMFMediaType> mtype;
+    auto hr = ::MFCreateMediaType(mtype.GetAddressOf());
+    if (hr != S_OK)
+      throw plx::ComException(__LINE__, hr);
+    ::MFSetAttributeRatio(mtype.Get(), MF_MT_FRAME_RATE, params_.fps, 1);
+    ::MFSetAttributeRatio(mtype.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+    mtype->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+    return mtype;
+  }
+
+  // Plays the camera and its capture callback on the calling thread.
+  void produce() {
+    const uint64_t total = static_cast<uint64_t>(params_.fps) * params_.seconds;
+    const int64_t start = plx::QpcNow();
+    for (uint64_t ix = 0; ix != total; ++ix) {
+      if (params_.realtime) {
+        auto due_ns = static_cast<int64_t>(ix * interval_ * 100);
+        auto ahead_ms = (due_ns - plx::QpcToNanos(plx::QpcNow() - start)) / 1000000;
+        if (ahead_ms > 0)
+          ::Sleep(static_cast<DWORD>(ahead_ms));
+      }
+      plx::ComPtr<IMFMediaBuffer> buffer;
+      auto sample = AcquireFrameSample(source_samples_, source_pool_, buffer);
+      while (!sample && !params_.realtime) {
+        // as fast as possible means as fast as the writer thread.
+        ::Sleep(0);
+        sample = AcquireFrameSample(source_samples_, source_pool_, buffer);
+      }
+      if (!sample) {
+        // a camera out of buffers drops the frame.
+        ++source_drops_;
         continue;
-      EnumAndClean(plx::FilesInfo::FromDir(dir), path, settings.keep_file_count);
+      }
+      // stands in for the camera filling its buffer.
+      BYTE* data = nullptr;
+      buffer->Lock(&data, nullptr, nullptr);
+      memcpy(data, &patterns_[ix % kPatterns][0], raw_size_);
+      buffer->Unlock();
+      buffer->SetCurrentLength(plx::To<DWORD>(raw_size_));
+      auto time = static_cast<LONGLONG>(ix) * interval_;
+      sample->SetSampleTime(time);
+      sample->SetSampleDuration(interval_);
+      segments_.push(std::move(sample), time, plx::QpcNow(), 0);
     }
   }
 
 };
 
+int RunBench(const BenchParams& params) {
+  MediaFoundationInit mf_init;
+  std::vector<std::unique_ptr<PipelineBench>> benches;
+  for (uint32_t ix = 0; ix != params.cameras; ++ix)
+    benches.push_back(std::make_unique<PipelineBench>(params, ix));
+  std::vector<PipelineBench::Result> results(params.cameras);
+
+  auto cpu_start = PipelineBench::ProcessCpuTime();
+  std::vector<std::thread> threads;
+  for (uint32_t ix = 0; ix != params.cameras; ++ix) {
+    threads.emplace_back([&benches, &results, ix]() {
+      results[ix] = benches[ix]->run();
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  auto cpu_ns = (PipelineBench::ProcessCpuTime() - cpu_start) * 100;
+
+  const char* sinks[] = { "null", "file", "mp4", "async" };
+  auto report = plx::Format(
+      "camcenter bench: %d x %ux%u %s at %u fps, %s sink, %s\n"
+      "camera frames    secs     fps      MB/s     dropped  p50 us   p99 us   p999 us  max us\n",
+      params.cameras, params.width, params.height, params.yuy2 ? "yuy2" : "nv12", params.fps,
+      sinks[params.sink], params.realtime ? "realtime" : "as fast as possible");
+  uint64_t total_frames = 0;
+  double total_fps = 0.0;
+  double total_mbps = 0.0;
+  for (uint32_t ix = 0; ix != params.cameras; ++ix) {
+    auto& r = results[ix];
+    report += plx::Format(
+        "%-6u %-8llu %-8.2f %-8.1f %-8.1f %-8llu %-8llu %-8llu %-8llu %llu\n",
+        ix, r.frames, r.secs, r.frames / r.secs, r.megabytes / r.secs, r.drops,
+        r.latency.p50 / 1000, r.latency.p99 / 1000, r.latency.p999 / 1000, r.latency.max / 1000);
+    total_frames += r.frames;
+    total_fps += r.frames / r.secs;
+    total_mbps += r.megabytes / r.secs;
+  }
+  report += plx::Format(
+      "total %.1f fps, %.1f MB/s, cpu per frame %.3f ms (all threads)\n",
+      total_fps, total_mbps, total_frames ? (cpu_ns / 1.0e6) / total_frames : 0.0);
+  if (params.sink == BenchParams::async_sink)
+    report += plx::Format("async writer %u KB blocks, %u in flight\n", params.block_kb, params.depth);
+  if (params.yuy2) {
+    auto& pool = results[0].pool;
+    report += plx::Format("camera 0 nv12 pool %d frames, %d high, %llu misses\n",
+        static_cast<int>(pool.allocated), static_cast<int>(pool.high_water), pool.exhausted);
+  }
+
+  ::OutputDebugStringA(report.c_str());
+  auto file = plx::File::Create(plx::FilePath(L"bench.txt"),
+                                plx::FileParams::ReadWrite_SharedRead(CREATE_ALWAYS),
+                                plx::FileSecurity());
+  if (!file.is_valid())
+    return 4;
+  file.write(plx::Range<const uint8_t>(
+      reinterpret_cast<const uint8_t*>(report.c_str()), report.size()));
+  return 0;
+}
+
 int __stdcall wWinMain(HINSTANCE instance, HINSTANCE,
                        wchar_t* cmdline, int cmd_show) {
   ::CoInitializeEx(NULL, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
 
   try {
+    BenchParams bench;
+    if (ParseBenchParams(bench))
+      return RunBench(bench);
+
     auto settings = LoadSettings();
     DCoWindow window(300, 200);
 
     MediaFoundationInit mf_init;
-    CaptureManager capture_manager(&window, LoadSettings());
+    CaptureManager capture_manager(&window, settings);
 
     capture_manager.start();
 
@@ -703,6 +2847,9 @@ int __stdcall wWinMain(HINSTANCE instance, HINSTANCE,
   } catch (plx::ComException& ex) {
     HardfailMsgBox(HardFailures::com_error, ex.Line());
     return 1;
+  } catch (plx::JsonSchemaException& ex) {
+    HardfailMsgBox(HardFailures::bad_config, ex.Line(), ex.field() + ": " + ex.Message());
+    return 2;
   } catch (plx::Exception& ex) {
     HardfailMsgBox(HardFailures::plex_error, ex.Line());
     return 2;
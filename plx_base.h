@@ -0,0 +1,32 @@
+// plx_base.h : the plex catalog components that the other plx_*.h files
+// build on. With plex they come from the generated stdafx.h, which only has
+// the components that main.cpp names, so main.cpp must name every catalog
+// component these files use. Other builds get them from plx_posix.h.
+
+#pragma once
+
+#if defined(_WIN32)
+#include "stdafx.h"
+#else
+#include "plx_posix.h"
+#include <time.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
@@ -0,0 +1,32 @@
+// plx_io.cpp : see plx_io.h.
+
+#include "plx_io.h"
+
+namespace plx {
+#if defined(_WIN32)
+std::unique_ptr<plx::AsyncIo> MakeAsyncIo(HANDLE file, unsigned int depth) {
+  return std::unique_ptr<plx::AsyncIo>(new plx::ThreadPoolIo(
+      [file](const plx::AsyncIo::Op& op) -> int64_t {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(op.offset);
+        ov.OffsetHigh = static_cast<DWORD>(op.offset >> 32);
+        DWORD written = 0;
+        if (!::WriteFile(file, op.data, static_cast<DWORD>(op.size), &written, &ov))
+          return -1;
+        return written;
+      }, depth));
+}
+#else
+std::unique_ptr<plx::AsyncIo> MakeAsyncIo(int fd, unsigned int depth) {
+  try {
+    return std::unique_ptr<plx::AsyncIo>(new plx::IoUringIo(fd, depth));
+  } catch (plx::IOException&) {
+    // no io_uring in this kernel or it is not allowed.
+  }
+  return std::unique_ptr<plx::AsyncIo>(new plx::ThreadPoolIo(
+      [fd](const plx::AsyncIo::Op& op) -> int64_t {
+        return ::pwrite(fd, op.data, op.size, static_cast<off_t>(op.offset));
+      }, depth));
+}
+#endif
+}
@@ -0,0 +1,954 @@
+// plx_io.h : file and directory access that is not in the plex catalog:
+// memory mapped files, directory listings, change notifications and
+// writes that complete in the background.
+
+#pragma once
+
+#include "plx_util.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace plx {
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FileView : read-only memory map of the whole file at |path|.
+// chars() : the file contents, valid for the lifetime of the view.
+//
+#if defined(_WIN32)
+
+class FileView {
+  HANDLE mapping_;
+  const uint8_t* view_;
+  size_t size_;
+
+  FileView(const FileView&) = delete;
+  FileView& operator=(const FileView&) = delete;
+
+public:
+  explicit FileView(const plx::FilePath& path)
+      : mapping_(nullptr), view_(nullptr), size_(0) {
+    auto file = ::CreateFileW(path.raw(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      throw plx::IOException(__LINE__, path.raw());
+    LARGE_INTEGER li = {};
+    ::GetFileSizeEx(file, &li);
+    size_ = plx::To<size_t>(li.QuadPart);
+    // mapping an empty file fails, and there is nothing to see anyway. The
+    // mapping keeps the file open so the handle is not needed past this.
+    if (size_)
+      mapping_ = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto gle = ::GetLastError();
+    ::CloseHandle(file);
+    if (!size_)
+      return;
+    if (!mapping_) {
+      ::SetLastError(gle);
+      throw plx::IOException(__LINE__, path.raw());
+    }
+    view_ = reinterpret_cast<const uint8_t*>(
+        ::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, size_));
+    if (!view_) {
+      gle = ::GetLastError();
+      ::CloseHandle(mapping_);
+      ::SetLastError(gle);
+      throw plx::IOException(__LINE__, path.raw());
+    }
+  }
+
+  ~FileView() {
+    if (view_)
+      ::UnmapViewOfFile(view_);
+    if (mapping_)
+      ::CloseHandle(mapping_);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  plx::Range<const char> chars() const {
+    auto start = reinterpret_cast<const char*>(view_);
+    return plx::Range<const char>(start, start + size_);
+  }
+};
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::LargeFile : plx::File with 64-bit offsets. The catalog one takes
+// them as an int and sets only OVERLAPPED::Offset, so nothing past 2 GB
+// lands where it should. It also gives out its handle for
+// plx::MakeAsyncIo().
+// Create() : |access|, |sharing| and |disposition| as CreateFileW takes
+//   them, on linux |flags| and |mode| as open() does. Check is_valid().
+// read(), write() : at |from|, or at the current position if it is -1.
+//   Return the bytes moved, 0 on failure.
+//
+class LargeFile {
+public:
+#if defined(_WIN32)
+  typedef HANDLE Native;
+#else
+  typedef int Native;
+#endif
+
+private:
+  Native file_;
+
+  explicit LargeFile(Native file) : file_(file) {
+  }
+
+  LargeFile(const LargeFile&) = delete;
+  LargeFile& operator=(const LargeFile&) = delete;
+
+public:
+  LargeFile(LargeFile&& other) : file_(other.file_) {
+    other.file_ = Invalid();
+  }
+
+  ~LargeFile() {
+    if (!is_valid())
+      return;
+#if defined(_WIN32)
+    ::CloseHandle(file_);
+#else
+    ::close(file_);
+#endif
+  }
+
+#if defined(_WIN32)
+  static LargeFile Create(const plx::FilePath& path,
+                          DWORD access, DWORD sharing, DWORD disposition) {
+    return LargeFile(::CreateFileW(path.raw(), access, sharing, nullptr, disposition,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr));
+  }
+#else
+  static LargeFile Create(const char* path, int flags, int mode = 0644) {
+    static_assert(sizeof(off_t) == 8, "32-bit builds need _FILE_OFFSET_BITS=64");
+    return LargeFile(::open(path, flags | O_CLOEXEC, mode));
+  }
+#endif
+
+  static Native Invalid() {
+#if defined(_WIN32)
+    return INVALID_HANDLE_VALUE;
+#else
+    return -1;
+#endif
+  }
+
+  bool is_valid() const {
+    return file_ != Invalid();
+  }
+
+  Native native() const {
+    return file_;
+  }
+
+  long long size_in_bytes() const {
+#if defined(_WIN32)
+    LARGE_INTEGER li = {};
+    ::GetFileSizeEx(file_, &li);
+    return li.QuadPart;
+#else
+    struct stat st;
+    return (::fstat(file_, &st) < 0) ? 0 : st.st_size;
+#endif
+  }
+
+  size_t read(plx::Range<uint8_t>& mem, long long from = -1) {
+    return read(mem.start(), mem.size(), from);
+  }
+
+  size_t read(uint8_t* buf, size_t len, long long from) {
+#if defined(_WIN32)
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(from);
+    ov.OffsetHigh = static_cast<DWORD>(from >> 32);
+    DWORD read = 0;
+    if (!::ReadFile(file_, buf, static_cast<DWORD>(len), &read, (from < 0) ? nullptr : &ov))
+      return 0;
+    return read;
+#else
+    auto read = (from < 0) ? ::read(file_, buf, len) : ::pread(file_, buf, len, from);
+    return (read < 0) ? 0 : static_cast<size_t>(read);
+#endif
+  }
+
+  size_t write(const plx::Range<const uint8_t>& mem, long long from = -1) {
+    return write(mem.start(), mem.size(), from);
+  }
+
+  size_t write(const uint8_t* buf, size_t len, long long from) {
+#if defined(_WIN32)
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(from);
+    ov.OffsetHigh = static_cast<DWORD>(from >> 32);
+    DWORD written = 0;
+    if (!::WriteFile(file_, buf, static_cast<DWORD>(len),
+                     &written, (from < 0) ? nullptr : &ov))
+      return 0;
+    return written;
+#else
+    auto written = (from < 0) ? ::write(file_, buf, len) : ::pwrite(file_, buf, len, from);
+    return (written < 0) ? 0 : static_cast<size_t>(written);
+#endif
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::DirEntries : like plx::FilesInfo of the catalog but faster.
+// Lists a directory in one go, then first(), next() and done() walk it.
+// read() lists again reusing the memory of the last listing. On windows
+// the batches live in a plx::Arena. On linux getdents64 fills one buffer
+// that grows as needed and statx runs only for the entries whose time,
+// size or type is asked for, once per entry.
+//
+#if defined(__linux__)
+
+class DirEntries {
+  // what getdents64 writes, records are 8 byte aligned.
+  struct Dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  // room left before a getdents64 call, a few hundred entries.
+  static const size_t kMinBatch = 16 * 1024;
+
+  int dir_fd_;
+  std::vector<char> buf_;
+  size_t used_;
+  size_t pos_;
+  // |stx_| is for the entry at |stat_pos_|.
+  mutable size_t stat_pos_;
+  mutable struct statx stx_;
+
+  DirEntries(const DirEntries&) = delete;
+
+public:
+  explicit DirEntries(size_t buffer_size = 64 * 1024)
+      : dir_fd_(-1), buf_(std::max(buffer_size, size_t(kMinBatch))),
+        used_(0), pos_(0), stat_pos_(SIZE_MAX) {
+  }
+
+  DirEntries(DirEntries&& other)
+      : dir_fd_(other.dir_fd_), buf_(std::move(other.buf_)),
+        used_(other.used_), pos_(other.pos_), stat_pos_(SIZE_MAX) {
+    other.used_ = 0;
+    other.pos_ = 0;
+  }
+
+  // |dir_fd| is opened with O_DIRECTORY and has to stay open while the
+  // entries are used.
+  static DirEntries FromDir(int dir_fd, size_t buffer_size = 64 * 1024) {
+    DirEntries finf(buffer_size);
+    finf.read(dir_fd);
+    return finf;
+  }
+
+  // Lists |dir_fd| again from the start, reusing the buffer.
+  void read(int dir_fd) {
+    if (::lseek(dir_fd, 0, SEEK_SET) < 0)
+      throw plx::IOException(__LINE__, nullptr);
+    dir_fd_ = dir_fd;
+    used_ = 0;
+    pos_ = 0;
+    stat_pos_ = SIZE_MAX;
+    while (true) {
+      if ((buf_.size() - used_) < kMinBatch)
+        buf_.resize(buf_.size() * 2);
+      auto count = ::syscall(SYS_getdents64, dir_fd, &buf_[used_], buf_.size() - used_);
+      if (count < 0)
+        throw plx::IOException(__LINE__, nullptr);
+      if (count == 0)
+        break;
+      used_ += count;
+    }
+  }
+
+  void first() {
+    pos_ = 0;
+  }
+
+  void next() {
+    pos_ += entry()->d_reclen;
+  }
+
+  bool done() const {
+    return pos_ >= used_;
+  }
+
+  const plx::ItRange<const char*> file_name() const {
+    auto name = entry()->d_name;
+    return plx::ItRange<const char*>(name, name + strlen(name));
+  }
+
+  // birth time if the file system keeps it, else the last write, in 100ns
+  // units since 1601 as on windows.
+  long long creation_ns1600() const {
+    auto& stx = stat();
+    auto& t = (stx.stx_mask & STATX_BTIME) ? stx.stx_btime : stx.stx_mtime;
+    return ((t.tv_sec + 11644473600LL) * 10000000LL) + (t.tv_nsec / 100);
+  }
+
+  long long size_in_bytes() const {
+    return stat().stx_size;
+  }
+
+  bool is_directory() const {
+    auto type = entry()->d_type;
+    if (type != DT_UNKNOWN)
+      return type == DT_DIR;
+    return S_ISDIR(stat().stx_mode);
+  }
+
+private:
+  const Dirent64* entry() const {
+    return reinterpret_cast<const Dirent64*>(&buf_[pos_]);
+  }
+
+  // an entry deleted since the listing reads as empty.
+  const struct statx& stat() const {
+    if (stat_pos_ != pos_) {
+      if (::statx(dir_fd_, entry()->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                  STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_BTIME, &stx_) != 0)
+        memset(&stx_, 0, sizeof(stx_));
+      stat_pos_ = pos_;
+    }
+    return stx_;
+  }
+};
+
+#else
+
+class DirEntries {
+private:
+  FILE_ID_BOTH_DIR_INFO* info_;
+  // each batch is what one GetFileInformationByHandleEx() call returned.
+  plx::Arena arena_;
+  std::vector<FILE_ID_BOTH_DIR_INFO*> batches_;
+  size_t batch_;
+  size_t batch_size_;
+
+  DirEntries(const DirEntries&) = delete;
+
+public:
+  // |buffer_hint| * 128 is the size of a batch, it trades syscalls for
+  // memory.
+  explicit DirEntries(long buffer_hint = 512)
+      : info_(nullptr),
+        arena_(buffer_hint * 128 * 8),
+        batch_(0),
+        batch_size_(buffer_hint * 128) {
+  }
+
+  static DirEntries FromDir(const plx::FilePath& path, long buffer_hint = 512) {
+    DirEntries finf(buffer_hint);
+    finf.read(path);
+    return finf;
+  }
+
+  DirEntries(DirEntries&& other)
+      : info_(other.info_),
+        arena_(std::move(other.arena_)),
+        batches_(std::move(other.batches_)),
+        batch_(other.batch_),
+        batch_size_(other.batch_size_) {
+    other.info_ = nullptr;
+  }
+
+  // Lists the directory at |path| again, reusing the memory of the
+  // previous listing.
+  void read(const plx::FilePath& path) {
+    auto dir = ::CreateFileW(path.raw(), FILE_LIST_DIRECTORY,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (dir == INVALID_HANDLE_VALUE)
+      throw plx::IOException(__LINE__, path.raw());
+    arena_.reset();
+    batches_.clear();
+    info_ = nullptr;
+    for (size_t count = 0; ;++count) {
+      auto data = arena_.allocate(batch_size_, 8);
+      if (!::GetFileInformationByHandleEx(
+          dir,
+          count == 0 ? FileIdBothDirectoryRestartInfo: FileIdBothDirectoryInfo,
+          data, plx::To<DWORD>(batch_size_))) {
+        auto gle = ::GetLastError();
+        ::CloseHandle(dir);
+        if (gle != ERROR_NO_MORE_FILES) {
+          ::SetLastError(gle);
+          throw plx::IOException(__LINE__, path.raw());
+        }
+        break;
+      }
+      batches_.push_back(reinterpret_cast<FILE_ID_BOTH_DIR_INFO*>(data));
+    }
+  }
+
+  void first() {
+    batch_ = 0;
+    info_ = batches_.empty() ? nullptr : batches_[0];
+  }
+
+  void next() {
+    if (!info_->NextEntryOffset) {
+      // last entry of this batch. Move to next batch.
+      ++batch_;
+      info_ = (batch_ < batches_.size()) ? batches_[batch_] : nullptr;
+    } else {
+      info_ =reinterpret_cast<FILE_ID_BOTH_DIR_INFO*>(
+          ULONG_PTR(info_) + info_->NextEntryOffset);
+    }
+  }
+
+  bool done() const {
+    return info_ == nullptr;
+  }
+
+  const plx::ItRange<wchar_t*> file_name() const {
+    return plx::ItRange<wchar_t*>(
+      info_->FileName,
+      info_->FileName+ (info_->FileNameLength / sizeof(wchar_t)));
+  }
+
+  long long creation_ns1600() const {
+    return info_->CreationTime.QuadPart;
+  }
+
+  long long size_in_bytes() const {
+    return info_->EndOfFile.QuadPart;
+  }
+
+  bool is_directory() const {
+    return info_->FileAttributes & FILE_ATTRIBUTE_DIRECTORY? true : false;
+  }
+};
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FileWatcher : calls |changed| from its own thread when the file at
+// |path| gets a new write time, which covers edits, renames over it and it
+// being created. Editors save in several steps so the check happens once
+// things have been quiet for |settle_ms|.
+//
+#if defined(_WIN32)
+
+class FileWatcher {
+  const plx::FilePath path_;
+  const std::function<void()> changed_;
+  const DWORD settle_ms_;
+  HANDLE stop_;
+  HANDLE notify_;
+  std::unique_ptr<std::thread> thread_;
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+public:
+  FileWatcher(const plx::FilePath& path,
+              std::function<void()> changed,
+              DWORD settle_ms = 250)
+      : path_(path),
+        changed_(std::move(changed)),
+        settle_ms_(settle_ms),
+        stop_(nullptr),
+        notify_(INVALID_HANDLE_VALUE) {
+    notify_ = ::FindFirstChangeNotificationW(
+        path_.parent().raw(), FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (notify_ == INVALID_HANDLE_VALUE)
+      throw plx::IOException(__LINE__, path_.raw());
+    stop_ = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!stop_) {
+      ::FindCloseChangeNotification(notify_);
+      throw plx::IOException(__LINE__, path_.raw());
+    }
+    thread_ = std::make_unique<std::thread>(&FileWatcher::threadproc, this);
+  }
+
+  ~FileWatcher() {
+    ::SetEvent(stop_);
+    thread_->join();
+    ::FindCloseChangeNotification(notify_);
+    ::CloseHandle(stop_);
+  }
+
+private:
+  long long write_time() const {
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!::GetFileAttributesExW(path_.raw(), GetFileExInfoStandard, &fad))
+      return 0LL;
+    return (static_cast<long long>(fad.ftLastWriteTime.dwHighDateTime) << 32) |
+           fad.ftLastWriteTime.dwLowDateTime;
+  }
+
+  void threadproc() {
+    auto last = write_time();
+    HANDLE handles[] = { stop_, notify_ };
+    for (;;) {
+      if (::WaitForMultipleObjects(2, handles, FALSE, INFINITE) != (WAIT_OBJECT_0 + 1))
+        return;
+      // wait for the burst to end, each new change restarts the wait.
+      do {
+        if (!::FindNextChangeNotification(notify_))
+          return;
+      } while (::WaitForMultipleObjects(2, handles, FALSE, settle_ms_) == (WAIT_OBJECT_0 + 1));
+      if (::WaitForSingleObject(stop_, 0) == WAIT_OBJECT_0)
+        return;
+      auto now = write_time();
+      if (now == last)
+        continue;
+      last = now;
+      changed_();
+    }
+  }
+};
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::AsyncIo : positional writes that finish in the background.
+// submit() : queues |op|, the memory it points to must stay put until
+//   reap() returns it.
+// reap() : appends the finished ops to |done|. With |wait| it blocks for
+//   at least one unless nothing is in flight.
+// Done::result is the bytes written or negative on failure.
+//
+class AsyncIo {
+public:
+  struct Op {
+    uint64_t offset;
+    const uint8_t* data;
+    size_t size;
+    uint64_t tag;
+  };
+
+  struct Done {
+    uint64_t tag;
+    int64_t result;
+  };
+
+  virtual ~AsyncIo() {}
+  virtual void submit(const Op& op) = 0;
+  virtual void reap(std::vector<Done>& done, bool wait) = 0;
+  virtual size_t in_flight() const = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::ThreadPoolIo : plx::AsyncIo on |threads| threads that each run
+// |write| for one op at a time. Works anywhere a positional write does.
+//
+class ThreadPoolIo : public AsyncIo {
+  const std::function<int64_t(const Op&)> write_;
+  mutable std::mutex lock_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::list<Op> queue_;
+  std::vector<Done> done_;
+  size_t in_flight_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+
+  ThreadPoolIo(const ThreadPoolIo&) = delete;
+  ThreadPoolIo& operator=(const ThreadPoolIo&) = delete;
+
+public:
+  ThreadPoolIo(std::function<int64_t(const Op&)> write, size_t threads)
+      : write_(std::move(write)), in_flight_(0), stop_(false) {
+    for (size_t ix = 0; ix != std::max(threads, size_t(1)); ++ix)
+      threads_.push_back(std::thread(&ThreadPoolIo::threadproc, this));
+  }
+
+  ~ThreadPoolIo() {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_)
+      thread.join();
+  }
+
+  void submit(const Op& op) override {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      queue_.push_back(op);
+      ++in_flight_;
+    }
+    work_cv_.notify_one();
+  }
+
+  void reap(std::vector<Done>& done, bool wait) override {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (wait)
+      done_cv_.wait(lock, [this]() { return !done_.empty() || !in_flight_; });
+    done.insert(done.end(), done_.begin(), done_.end());
+    in_flight_ -= done_.size();
+    done_.clear();
+  }
+
+  size_t in_flight() const override {
+    std::lock_guard<std::mutex> lock(lock_);
+    return in_flight_;
+  }
+
+private:
+  void threadproc() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+      work_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      // pending writes go out before the threads stop.
+      if (queue_.empty())
+        return;
+      auto op = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+      Done done = { op.tag, write_(op) };
+      lock.lock();
+      done_.push_back(done);
+      done_cv_.notify_one();
+    }
+  }
+};
+
+
+#if defined(__linux__)
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::IoUringIo : plx::AsyncIo on an io_uring of |depth| entries, made
+// with the raw syscalls. Each submit() is one io_uring_enter. Throws
+// plx::IOException if the kernel does not allow io_uring or is older than
+// 5.6 and has no IORING_OP_WRITE, see plx::MakeAsyncIo() for the fallback.
+//
+class IoUringIo : public AsyncIo {
+  const int fd_;
+  int ring_fd_;
+  uint8_t* sq_ring_;
+  size_t sq_ring_size_;
+  uint8_t* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+  size_t in_flight_;
+
+  IoUringIo(const IoUringIo&) = delete;
+  IoUringIo& operator=(const IoUringIo&) = delete;
+
+public:
+  IoUringIo(int fd, unsigned depth)
+      : fd_(fd), ring_fd_(-1),
+        sq_ring_(nullptr), sq_ring_size_(0),
+        cq_ring_(nullptr), cq_ring_size_(0),
+        sqes_(nullptr), sqes_size_(0),
+        in_flight_(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, std::max(depth, 1u), &params));
+    if (ring_fd_ < 0)
+      throw plx::IOException(__LINE__, nullptr);
+    // kernels before 5.6 set the ring up fine and then fail every write.
+    if (!supports(IORING_OP_WRITE)) {
+      close();
+      throw plx::IOException(__LINE__, nullptr);
+    }
+    sq_ring_size_ = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    cq_ring_size_ = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+    // newer kernels put both rings in one mapping.
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = single ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = reinterpret_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+    if (!sq_ring_ || !cq_ring_ || !sqes_) {
+      close();
+      throw plx::IOException(__LINE__, nullptr);
+    }
+    sq_head_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+    cq_head_ = reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq_ring_ + params.cq_off.cqes);
+  }
+
+  ~IoUringIo() {
+    // the kernel may still write to the buffers, wait for everything.
+    std::vector<Done> done;
+    while (in_flight_)
+      reap(done, true);
+    close();
+  }
+
+  void submit(const Op& op) override {
+    auto tail = *sq_tail_;
+    // io_uring_enter hands every entry to the kernel, the ring is only full
+    // if an earlier enter failed.
+    if ((tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) == sq_entries_)
+      throw plx::IOException(__LINE__, nullptr);
+    auto index = tail & sq_mask_;
+    auto& sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = fd_;
+    sqe.off = op.offset;
+    sqe.addr = reinterpret_cast<uint64_t>(op.data);
+    sqe.len = static_cast<uint32_t>(op.size);
+    sqe.user_data = op.tag;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    if (enter(1, 0, 0) < 0)
+      throw plx::IOException(__LINE__, nullptr);
+    ++in_flight_;
+  }
+
+  void reap(std::vector<Done>& done, bool wait) override {
+    if (wait && in_flight_ && (*cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))) {
+      if ((enter(0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR))
+        throw plx::IOException(__LINE__, nullptr);
+    }
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      auto& cqe = cqes_[head & cq_mask_];
+      Done d = { cqe.user_data, cqe.res };
+      done.push_back(d);
+      --in_flight_;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  size_t in_flight() const override {
+    return in_flight_;
+  }
+
+private:
+  uint8_t* map(size_t size, off_t offset) {
+    auto mem = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return (mem == MAP_FAILED) ? nullptr : reinterpret_cast<uint8_t*>(mem);
+  }
+
+  // the probe is 5.6 too, failing it means the op is not there either.
+  bool supports(unsigned op) const {
+    const unsigned kOps = 256;
+    std::vector<uint8_t> mem(sizeof(io_uring_probe) + (kOps * sizeof(io_uring_probe_op)));
+    auto probe = reinterpret_cast<io_uring_probe*>(&mem[0]);
+    if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, kOps) < 0)
+      return false;
+    return (op <= probe->last_op) && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd_,
+                                      to_submit, min_complete, flags, nullptr, 0));
+  }
+
+  void close() {
+    if (sqes_)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ && (cq_ring_ != sq_ring_))
+      ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_)
+      ::munmap(sq_ring_, sq_ring_size_);
+    ::close(ring_fd_);
+  }
+};
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::MakeAsyncIo : the best plx::AsyncIo for a file. On linux an io_uring
+// if the kernel allows it, else and on windows a plx::ThreadPoolIo.
+// |depth| is how many writes can be in flight.
+//
+#if defined(_WIN32)
+std::unique_ptr<plx::AsyncIo> MakeAsyncIo(HANDLE file, unsigned int depth) ;
+#else
+std::unique_ptr<plx::AsyncIo> MakeAsyncIo(int fd, unsigned int depth) ;
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::AsyncFileWriter : coalesces writes into blocks of |block_size| and
+// keeps up to |depth| blocks in flight on a plx::AsyncIo. Blocks end on
+// multiples of |block_size| in the file, so after the first one the
+// backend only sees full, aligned writes. The last block is as long as
+// the data, which unbuffered files do not allow.
+// write() : copies |data| after the last write, write_at() anywhere. Both
+//   only wait when every block is in flight. Blocks in flight finish in any
+//   order, flush() before writing over one.
+// done : called from write() and flush() with each finished block.
+// failures() : blocks that were not written in full.
+//
+class AsyncFileWriter {
+public:
+  typedef std::function<void(uint64_t offset, size_t size, int64_t result)> Done;
+
+private:
+  struct Block {
+    uint64_t offset;
+    size_t size;
+    bool busy;
+  };
+
+  static const size_t kNone = size_t(-1);
+  static const size_t kPage = 4096;
+
+  std::unique_ptr<plx::AsyncIo> io_;
+  const size_t block_size_;
+  std::unique_ptr<uint8_t[]> mem_;
+  uint8_t* blocks_mem_;
+  std::vector<Block> blocks_;
+  // the block being filled or kNone.
+  size_t cur_;
+  uint64_t end_;
+  Done done_;
+  std::vector<plx::AsyncIo::Done> reaped_;
+  uint64_t failures_;
+
+  AsyncFileWriter(const AsyncFileWriter&) = delete;
+  AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+public:
+  AsyncFileWriter(std::unique_ptr<plx::AsyncIo> io,
+                  size_t block_size, size_t depth,
+                  Done done = Done(), uint64_t offset = 0)
+      : io_(std::move(io)),
+        block_size_(std::max(block_size, size_t(kPage))),
+        mem_(new uint8_t[(block_size_ * std::max(depth, size_t(1))) + kPage]),
+        blocks_(std::max(depth, size_t(1))),
+        cur_(kNone),
+        end_(offset),
+        done_(std::move(done)),
+        failures_(0) {
+    auto addr = reinterpret_cast<uintptr_t>(mem_.get());
+    blocks_mem_ = reinterpret_cast<uint8_t*>((addr + kPage - 1) & ~uintptr_t(kPage - 1));
+    for (auto& block : blocks_) {
+      block.offset = 0;
+      block.size = 0;
+      block.busy = false;
+    }
+  }
+
+  ~AsyncFileWriter() {
+    flush();
+  }
+
+  void write(const uint8_t* data, size_t size) {
+    write_at(end_, data, size);
+  }
+
+  void write_at(uint64_t offset, const uint8_t* data, size_t size) {
+    if ((cur_ != kNone) && (offset != (blocks_[cur_].offset + blocks_[cur_].size)))
+      submit_current();
+    while (size) {
+      if (cur_ == kNone)
+        start_block(offset);
+      auto& block = blocks_[cur_];
+      auto limit = block_size_ - static_cast<size_t>(block.offset % block_size_);
+      auto count = std::min(size, limit - block.size);
+      memcpy(block_mem(cur_) + block.size, data, count);
+      block.size += count;
+      data += count;
+      size -= count;
+      offset += count;
+      if (block.size == limit)
+        submit_current();
+    }
+    end_ = offset;
+  }
+
+  // sends the partial block and waits for everything in flight.
+  void flush() {
+    if (cur_ != kNone)
+      submit_current();
+    while (io_->in_flight())
+      reap(true);
+  }
+
+  uint64_t end() const {
+    return end_;
+  }
+
+  uint64_t failures() const {
+    return failures_;
+  }
+
+private:
+  uint8_t* block_mem(size_t ix) {
+    return blocks_mem_ + (ix * block_size_);
+  }
+
+  void start_block(uint64_t offset) {
+    while (true) {
+      for (size_t ix = 0; ix != blocks_.size(); ++ix) {
+        if (blocks_[ix].busy)
+          continue;
+        blocks_[ix].offset = offset;
+        blocks_[ix].size = 0;
+        blocks_[ix].busy = true;
+        cur_ = ix;
+        return;
+      }
+      reap(true);
+    }
+  }
+
+  void submit_current() {
+    auto& block = blocks_[cur_];
+    plx::AsyncIo::Op op = { block.offset, block_mem(cur_), block.size, cur_ };
+    cur_ = kNone;
+    io_->submit(op);
+    reap(false);
+  }
+
+  void reap(bool wait) {
+    reaped_.clear();
+    io_->reap(reaped_, wait);
+    for (auto& done : reaped_) {
+      auto& block = blocks_[static_cast<size_t>(done.tag)];
+      block.busy = false;
+      if (done.result != static_cast<int64_t>(block.size))
+        ++failures_;
+      if (done_)
+        done_(block.offset, block.size, done.result);
+    }
+  }
+};
+
+}
@@ -0,0 +1,361 @@
+// plx_json.cpp : see plx_json.h.
+
+#include "plx_json.h"
+
+#include <locale.h>
+
+namespace plx {
+namespace JsonScanImp {
+// json numbers always have a '.', whatever locale the process runs with.
+const _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+
+// exact powers of ten, the largest that a double holds without rounding.
+const double exact_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int HexDigit(char c) {
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+unsigned int ReadHex4(const char* s, const char* e) {
+  if ((e - s) < 4)
+    throw plx::CodecException(__LINE__, nullptr);
+  unsigned int cp = 0;
+  for (int ix = 0; ix != 4; ++ix) {
+    auto d = HexDigit(s[ix]);
+    if (d < 0) {
+      auto r = plx::RangeFromBytes(s, 4);
+      throw plx::CodecException(__LINE__, &r);
+    }
+    cp = (cp << 4) | d;
+  }
+  return cp;
+}
+
+void AppendUTF8(unsigned int cp, std::string& out) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+bool IsDigit(char c) {
+  return (c >= '0') && (c <= '9');
+}
+}
+const char* JsonSkipSpace(const char* s, const char* e) {
+  // most json has at most a few spaces between tokens so test a byte first.
+  while (s != e) {
+    auto c = *s;
+    if ((c != ' ') && (c != '\n') && (c != '\r') && (c != '\t'))
+      return s;
+    ++s;
+    if ((e - s) < 16)
+      continue;
+    // pretty printed json has long runs of indentation.
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while ((e - s) >= 16) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+      auto ws = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, nl)),
+          _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab)));
+      auto mask = static_cast<unsigned int>(~_mm_movemask_epi8(ws)) & 0xFFFF;
+      if (mask)
+        return s + plx::LowestBit(mask);
+      s += 16;
+    }
+  }
+  return e;
+}
+const char* JsonFindStringEnd(const char* s, const char* e) {
+  const __m128i quote = _mm_set1_epi8('\"');
+  const __m128i slash = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1F);
+  while ((e - s) >= 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+    // a byte is a control char when max(byte, 0x1F) is 0x1F (unsigned).
+    auto hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(hit));
+    if (mask)
+      return s + plx::LowestBit(mask);
+    s += 16;
+  }
+  for (; s != e; ++s) {
+    auto c = static_cast<unsigned char>(*s);
+    if ((c == '\"') || (c == '\\') || (c < 32))
+      return s;
+  }
+  return e;
+}
+bool JsonParseNumber(plx::Range<const char>& range, int64_t* iv, double* dv) {
+  auto s = range.start();
+  auto e = range.end();
+  auto p = s;
+
+  bool negative = false;
+  if ((p != e) && (*p == '-')) {
+    negative = true;
+    ++p;
+  }
+  // no '+', no leading zeros and digits on both sides of the dot.
+  if ((p == e) || !JsonScanImp::IsDigit(*p) ||
+      ((*p == '0') && ((p + 1) != e) && JsonScanImp::IsDigit(p[1]))) {
+    auto r = plx::RangeFromBytes(s, std::min(range.size(), size_t(16)));
+    throw plx::CodecException(__LINE__, &r);
+  }
+
+  // up to 19 significant digits always fit in a uint64_t.
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exp10 = 0;
+  bool truncated = false;
+  bool integer = true;
+
+  for (; (p != e) && JsonScanImp::IsDigit(*p); ++p) {
+    if (digits < 19) {
+      mantissa = (mantissa * 10) + (*p - '0');
+      if (mantissa)
+        ++digits;
+    } else {
+      ++exp10;
+      truncated = true;
+    }
+  }
+  if ((p != e) && (*p == '.')) {
+    integer = false;
+    ++p;
+    if ((p == e) || !JsonScanImp::IsDigit(*p)) {
+      auto r = plx::RangeFromBytes(s, p - s);
+      throw plx::CodecException(__LINE__, &r);
+    }
+    for (; (p != e) && JsonScanImp::IsDigit(*p); ++p) {
+      if (digits < 19) {
+        mantissa = (mantissa * 10) + (*p - '0');
+        if (mantissa)
+          ++digits;
+        --exp10;
+      } else {
+        truncated = true;
+      }
+    }
+  }
+  if ((p != e) && ((*p == 'e') || (*p == 'E'))) {
+    integer = false;
+    ++p;
+    bool exp_negative = false;
+    if ((p != e) && ((*p == '-') || (*p == '+'))) {
+      exp_negative = (*p == '-');
+      ++p;
+    }
+    if ((p == e) || !JsonScanImp::IsDigit(*p)) {
+      auto r = plx::RangeFromBytes(s, p - s);
+      throw plx::CodecException(__LINE__, &r);
+    }
+    int exp = 0;
+    for (; (p != e) && JsonScanImp::IsDigit(*p); ++p) {
+      // anything past this over or underflows anyway.
+      if (exp < 100000)
+        exp = (exp * 10) + (*p - '0');
+    }
+    exp10 += exp_negative ? -exp : exp;
+  }
+
+  range = plx::Range<const char>(p, e);
+
+  if (integer && !truncated) {
+    const uint64_t max_positive = static_cast<uint64_t>(INT64_MAX);
+    if (!negative && (mantissa <= max_positive)) {
+      *iv = static_cast<int64_t>(mantissa);
+      return true;
+    }
+    if (negative && (mantissa <= max_positive + 1)) {
+      *iv = static_cast<int64_t>(0 - mantissa);
+      return true;
+    }
+  }
+
+  // Clinger's fast path: both the mantissa and the power of ten are exact
+  // doubles, so one multiply or divide gives the correctly rounded result.
+  if (!truncated && (mantissa <= (1ULL << 53)) && (exp10 >= -22) && (exp10 <= 22)) {
+    double v = static_cast<double>(mantissa);
+    v = (exp10 < 0) ? v / JsonScanImp::exact_pow10[-exp10] :
+                      v * JsonScanImp::exact_pow10[exp10];
+    *dv = negative ? -v : v;
+    return false;
+  }
+
+  // rare case, let the crt do the rounding on a bounded copy.
+  char buf[64];
+  std::string big;
+  const char* num = buf;
+  size_t len = p - s;
+  if (len < sizeof(buf)) {
+    memcpy(buf, s, len);
+    buf[len] = 0;
+  } else {
+    big.assign(s, p);
+    num = big.c_str();
+  }
+  *dv = _strtod_l(num, nullptr, JsonScanImp::c_locale);
+  return false;
+}
+const char* JsonDecodeEscapes(const char* s, const char* e, std::string& out) {
+  for (;;) {
+    auto end = plx::JsonFindStringEnd(s, e);
+    out.append(s, end);
+    if (end == e)
+      throw plx::CodecException(__LINE__, nullptr);
+    if (*end == '\"')
+      return end;
+    if (*end != '\\')
+      throw plx::CodecException(__LINE__, nullptr);
+    if ((e - end) < 2)
+      throw plx::CodecException(__LINE__, nullptr);
+
+    s = end + 2;
+    switch (end[1]) {
+      case '\"':  out.push_back('\"'); break;
+      case '\\':  out.push_back('\\'); break;
+      case '/':   out.push_back('/');  break;
+      case 'b':   out.push_back('\b'); break;
+      case 'f':   out.push_back('\f'); break;
+      case 'n':   out.push_back('\n'); break;
+      case 'r':   out.push_back('\r'); break;
+      case 't':   out.push_back('\t'); break;
+      case 'u': {
+        auto cp = JsonScanImp::ReadHex4(s, e);
+        s += 4;
+        if ((cp >= 0xD800) && (cp <= 0xDBFF)) {
+          // high surrogate, must be followed by \u and a low one.
+          if (((e - s) < 6) || (s[0] != '\\') || (s[1] != 'u'))
+            throw plx::CodecException(__LINE__, nullptr);
+          auto low = JsonScanImp::ReadHex4(s + 2, e);
+          if ((low < 0xDC00) || (low > 0xDFFF))
+            throw plx::CodecException(__LINE__, nullptr);
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          s += 6;
+        } else if ((cp >= 0xDC00) && (cp <= 0xDFFF)) {
+          throw plx::CodecException(__LINE__, nullptr);
+        }
+        JsonScanImp::AppendUTF8(cp, out);
+        break;
+      }
+      default: {
+        auto r = plx::RangeFromBytes(end, 2);
+        throw plx::CodecException(__LINE__, &r);
+      }
+    }
+  }
+}
+namespace JsonValueImp {
+// the value that starts at the current token of |reader|.
+plx::JsonValue ReadValue(plx::JsonReader& reader) {
+  switch (reader.token()) {
+    case JsonReader::Token::object_begin: {
+      plx::JsonValue obj(plx::JsonType::OBJECT);
+      while (reader.next() != JsonReader::Token::object_end) {
+        std::string key(reader.str().start(), reader.str().end());
+        reader.next();
+        obj[key] = ReadValue(reader);
+      }
+      return obj;
+    }
+    case JsonReader::Token::array_begin: {
+      plx::JsonValue arr(plx::JsonType::ARRAY);
+      while (reader.next() != JsonReader::Token::array_end)
+        plx::JsonAppend(arr, ReadValue(reader));
+      return arr;
+    }
+    case JsonReader::Token::string:
+      return std::string(reader.str().start(), reader.str().end());
+    case JsonReader::Token::int64:
+      return reader.int64();
+    case JsonReader::Token::dbl:
+      return reader.dbl();
+    case JsonReader::Token::boolean:
+      return reader.boolean();
+    case JsonReader::Token::null:
+      return nullptr;
+    default:
+      throw plx::CodecException(__LINE__, nullptr);
+  }
+}
+}
+plx::JsonValue JsonParseValue(plx::Range<const char>& range) {
+  plx::JsonReader reader(range);
+  reader.next();
+  auto value = JsonValueImp::ReadValue(reader);
+  // the reader stops after the value, what follows is for the caller.
+  range = reader.rest();
+  return value;
+}
+size_t JsonFormatDouble(double v, char (&buf)[32]) {
+  if (!std::isfinite(v))
+    return 0;
+  // fast path for short decimals like 0.25 or 12.0333: if m / 10^k is
+  // exactly v, "m with k decimals" reads back as v. both are exact doubles
+  // so the division rounds the same way strtod does.
+  for (int k = 0; k <= 9; ++k) {
+    auto scaled = v * JsonScanImp::exact_pow10[k];
+    if (std::fabs(scaled) >= 9007199254740992.0)
+      break;
+    auto m = static_cast<int64_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    if ((static_cast<double>(m) / JsonScanImp::exact_pow10[k]) != v)
+      continue;
+    if ((m == 0) && std::signbit(v))
+      break;
+    char digits[24];
+    auto end = digits + sizeof(digits);
+    auto p = end;
+    uint64_t mag = (m < 0) ? (0ULL - static_cast<uint64_t>(m)) : m;
+    for (int ix = 0; ix != k; ++ix) {
+      *--p = static_cast<char>('0' + (mag % 10));
+      mag /= 10;
+    }
+    if (k)
+      *--p = '.';
+    do {
+      *--p = static_cast<char>('0' + (mag % 10));
+      mag /= 10;
+    } while (mag);
+    if (m < 0)
+      *--p = '-';
+    size_t len = end - p;
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    return len;
+  }
+  // otherwise the shortest %g that round trips, usually 15 digits.
+  for (int precision = 15; precision != 17; ++precision) {
+    auto len = _snprintf_s_l(buf, sizeof(buf), _TRUNCATE, "%.*g",
+                             JsonScanImp::c_locale, precision, v);
+    if (_strtod_l(buf, nullptr, JsonScanImp::c_locale) == v)
+      return len;
+  }
+  return _snprintf_s_l(buf, sizeof(buf), _TRUNCATE, "%.17g", JsonScanImp::c_locale, v);
+}
+}
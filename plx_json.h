@@ -0,0 +1,1404 @@
+// plx_json.h : fast json reading and writing that is not in the plex
+// catalog: a pull reader, a compact DOM, a streaming parser, a writer and
+// schemas that decode straight into structs.
+
+#pragma once
+
+#include "plx_util.h"
+
+namespace plx {
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonSchemaException (thrown when json does not match a plx::JsonSchema)
+// field_ : path of the offending field, like "cameras[1].max_bytes".
+//
+class JsonSchemaException : public plx::Exception {
+  std::string field_;
+
+public:
+  JsonSchemaException(int line, const char* problem, const std::string& field)
+      : Exception(line, problem), field_(field) {
+    PostCtor();
+  }
+
+  const std::string& field() const {
+    return field_;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonSkipSpace : first non-whitespace char in [s, e), or |e|.
+// plx::JsonFindStringEnd : first ("), (\) or control char in [s, e), or |e|.
+// plx::JsonParseNumber : parses the number at the front of |range| in place.
+//   returns true and sets |iv| for integers that fit in 64 bits, otherwise
+//   returns false and sets |dv|.
+// plx::JsonDecodeEscapes : appends the string body at |s| to |out|, decoding
+//   escapes including unicode ones. returns the position of the closing (").
+//
+const char* JsonSkipSpace(const char* s, const char* e) ;
+const char* JsonFindStringEnd(const char* s, const char* e) ;
+bool JsonParseNumber(plx::Range<const char>& range, int64_t* iv, double* dv) ;
+const char* JsonDecodeEscapes(const char* s, const char* e, std::string& out) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonReader : pull parser over a json text, no DOM is built.
+// next() : advances to the next token and returns it.
+// str() : the key or string of the current token. strings without escapes
+//   point into the input, the rest into a scratch buffer that is reused by the
+//   following next() call.
+// int64(), dbl(), boolean() : the value of the current scalar token.
+// depth() : number of open objects and arrays.
+// rest() : the text after the current token.
+//
+class JsonReader {
+public:
+  enum class Token {
+    none,
+    object_begin,
+    object_end,
+    array_begin,
+    array_end,
+    key,
+    string,
+    int64,
+    dbl,
+    boolean,
+    null,
+    end
+  };
+
+private:
+  enum class Expect {
+    value,
+    first_key,
+    key,
+    first_value,
+    separator
+  };
+
+  plx::Range<const char> range_;
+  std::vector<char> stack_;
+  std::string scratch_;
+  plx::Range<const char> str_;
+  Token token_;
+  Expect expect_;
+  int64_t iv_;
+  double dv_;
+  bool bv_;
+
+public:
+  explicit JsonReader(const plx::Range<const char>& json)
+      : range_(json),
+        str_(),
+        token_(Token::none),
+        expect_(Expect::value),
+        iv_(0),
+        dv_(0.0),
+        bv_(false) {
+  }
+
+  Token token() const { return token_; }
+  const plx::Range<const char>& str() const { return str_; }
+  int64_t int64() const { return iv_; }
+  double dbl() const { return dv_; }
+  bool boolean() const { return bv_; }
+  size_t depth() const { return stack_.size(); }
+  const plx::Range<const char>& rest() const { return range_; }
+
+  // after next() returns object_begin or array_begin, consumes the rest of
+  // that container.
+  void skip_children() {
+    auto depth = stack_.size();
+    while (stack_.size() >= depth)
+      next();
+  }
+
+  Token next() {
+    auto s = plx::JsonSkipSpace(range_.start(), range_.end());
+    range_ = plx::Range<const char>(s, range_.end());
+
+    if (expect_ == Expect::separator) {
+      if (stack_.empty()) {
+        if (!range_.empty())
+          error();
+        return (token_ = Token::end);
+      }
+      if (range_.empty())
+        error();
+      auto c = range_.front();
+      if (c == ',') {
+        range_.advance(1);
+        range_ = plx::Range<const char>(
+            plx::JsonSkipSpace(range_.start(), range_.end()), range_.end());
+        expect_ = (stack_.back() == '{') ? Expect::key : Expect::value;
+      } else {
+        return close(c);
+      }
+    }
+
+    if (range_.empty())
+      error();
+    auto c = range_.front();
+
+    if ((expect_ == Expect::first_key) || (expect_ == Expect::key)) {
+      if ((c == '}') && (expect_ == Expect::first_key))
+        return close(c);
+      if (c != '\"')
+        error();
+      read_string();
+      range_ = plx::Range<const char>(
+          plx::JsonSkipSpace(range_.start(), range_.end()), range_.end());
+      if (range_.empty() || (range_.front() != ':'))
+        error();
+      range_.advance(1);
+      expect_ = Expect::value;
+      return (token_ = Token::key);
+    }
+
+    if ((c == ']') && (expect_ == Expect::first_value))
+      return close(c);
+
+    expect_ = Expect::separator;
+    switch (c) {
+      case '{':
+        range_.advance(1);
+        stack_.push_back('{');
+        expect_ = Expect::first_key;
+        return (token_ = Token::object_begin);
+      case '[':
+        range_.advance(1);
+        stack_.push_back('[');
+        expect_ = Expect::first_value;
+        return (token_ = Token::array_begin);
+      case '\"':
+        read_string();
+        return (token_ = Token::string);
+      case 't':
+        literal("true");
+        bv_ = true;
+        return (token_ = Token::boolean);
+      case 'f':
+        literal("false");
+        bv_ = false;
+        return (token_ = Token::boolean);
+      case 'n':
+        literal("null");
+        return (token_ = Token::null);
+      default:
+        return (token_ = plx::JsonParseNumber(range_, &iv_, &dv_) ?
+                         Token::int64 : Token::dbl);
+    }
+  }
+
+private:
+  void error() {
+    auto r = plx::RangeFromBytes(range_.start(), std::min(range_.size(), size_t(16)));
+    throw plx::CodecException(__LINE__, &r);
+  }
+
+  Token close(char c) {
+    if (c == '}') {
+      if (stack_.empty() || (stack_.back() != '{'))
+        error();
+      token_ = Token::object_end;
+    } else if (c == ']') {
+      if (stack_.empty() || (stack_.back() != '['))
+        error();
+      token_ = Token::array_end;
+    } else {
+      error();
+    }
+    stack_.pop_back();
+    range_.advance(1);
+    expect_ = Expect::separator;
+    return token_;
+  }
+
+  template <size_t count>
+  void literal(const char (&text)[count]) {
+    if (range_.size() < (count - 1))
+      error();
+    if (memcmp(range_.start(), text, count - 1) != 0)
+      error();
+    range_.advance(count - 1);
+  }
+
+  void read_string() {
+    auto start = range_.start() + 1;
+    auto end = plx::JsonFindStringEnd(start, range_.end());
+    if (end == range_.end())
+      error();
+    if (*end == '\\') {
+      // slow path, the decoded string lives in scratch_.
+      scratch_.assign(start, end);
+      end = plx::JsonDecodeEscapes(end, range_.end(), scratch_);
+      str_ = plx::Range<const char>(scratch_.data(), scratch_.data() + scratch_.size());
+    } else if (*end == '\"') {
+      str_ = plx::Range<const char>(start, end);
+    } else {
+      // raw control char.
+      range_ = plx::Range<const char>(end, range_.end());
+      error();
+    }
+    range_ = plx::Range<const char>(end + 1, range_.end());
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonAppend : moves |value| to the end of |array|. The catalog
+// JsonValue::push_back(JsonValue&&) copies its argument, a whole subtree,
+// so this appends a null, which has nothing to copy, and moves into it.
+//
+inline void JsonAppend(plx::JsonValue& array, plx::JsonValue&& value) {
+  array.push_back(plx::JsonValue());
+  array[array.size() - 1] = std::move(value);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonParseValue : the catalog plx::ParseJsonValue without its quadratic
+// number parsing. Parses the json value at the front of |range| into a
+// plx::JsonValue and advances |range| past it, through plx::JsonReader so
+// numbers take the strict grammar of plx::JsonParseNumber.
+//
+plx::JsonValue JsonParseValue(plx::Range<const char>& range) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonNode : read-only json value owned by a plx::JsonDoc.
+// size_ : string length, array items or object members.
+// u_ : the value. strings up to 8 bytes are stored inline in small.
+// Object members are sorted by key and keys are interned, so a lookup is a
+// binary search and a repeated key costs one pointer.
+//
+struct JsonKey {
+  uint32_t size;
+  uint32_t hash;
+  const char* chars() const {
+    return reinterpret_cast<const char*>(this + 1);
+  }
+};
+
+struct JsonMember;
+
+class JsonNode {
+  plx::JsonType type_;
+  uint32_t size_;
+  union Data {
+    bool bolv;
+    int64_t intv;
+    double dblv;
+    const char* strv;
+    char small[8];
+    const JsonNode* items;
+    const JsonMember* members;
+  } u_;
+
+  friend class JsonDoc;
+
+public:
+  JsonNode() : type_(JsonType::NULLT), size_(0) {
+    u_.intv = 0;
+  }
+
+  plx::JsonType type() const {
+    return type_;
+  }
+
+  bool get_bool() const {
+    check(JsonType::BOOL);
+    return u_.bolv;
+  }
+
+  int64_t get_int64() const {
+    check(JsonType::INT64);
+    return u_.intv;
+  }
+
+  double get_double() const {
+    check(JsonType::DOUBLE);
+    return u_.dblv;
+  }
+
+  plx::Range<const char> str() const {
+    check(JsonType::STRING);
+    auto start = (size_ <= sizeof(u_.small)) ? u_.small : u_.strv;
+    return plx::Range<const char>(start, start + size_);
+  }
+
+  std::string get_string() const {
+    auto r = str();
+    return std::string(r.start(), r.end());
+  }
+
+  size_t size() const {
+    return ((type_ == JsonType::ARRAY) || (type_ == JsonType::OBJECT)) ? size_ : 0;
+  }
+
+  const JsonNode& operator[](size_t ix) const {
+    check(JsonType::ARRAY);
+    if (ix >= size_)
+      throw plx::JsonException(__LINE__);
+    return u_.items[ix];
+  }
+
+  inline const JsonNode* find(const plx::Range<const char>& key) const;
+
+  const JsonNode* find(const char* key) const {
+    return find(plx::Range<const char>(key, key + strlen(key)));
+  }
+
+  bool has_key(const char* key) const {
+    return find(key) != nullptr;
+  }
+
+  const JsonNode& operator[](const char* key) const {
+    auto node = find(key);
+    if (!node)
+      throw plx::JsonException(__LINE__);
+    return *node;
+  }
+
+  inline const JsonMember& member(size_t ix) const;
+
+private:
+  void check(plx::JsonType type) const {
+    if (type_ != type)
+      throw plx::JsonException(__LINE__);
+  }
+};
+
+struct JsonMember {
+  const JsonKey* key;
+  JsonNode value;
+
+  plx::Range<const char> name() const {
+    return plx::Range<const char>(key->chars(), key->chars() + key->size);
+  }
+
+  static bool Less(const plx::Range<const char>& a, const plx::Range<const char>& b) {
+    auto c = memcmp(a.start(), b.start(), std::min(a.size(), b.size()));
+    return c ? (c < 0) : (a.size() < b.size());
+  }
+};
+
+const JsonNode* JsonNode::find(const plx::Range<const char>& key) const {
+  check(JsonType::OBJECT);
+  auto first = u_.members;
+  auto last = u_.members + size_;
+  auto it = std::lower_bound(first, last, key,
+      [](const JsonMember& m, const plx::Range<const char>& k) {
+        return JsonMember::Less(m.name(), k);
+      });
+  if ((it == last) || !it->name().equals(key))
+    return nullptr;
+  return &it->value;
+}
+
+const JsonMember& JsonNode::member(size_t ix) const {
+  check(JsonType::OBJECT);
+  if (ix >= size_)
+    throw plx::JsonException(__LINE__);
+  return u_.members[ix];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonDoc : compact json DOM. Every node, key and string of a document
+// lives in one arena, so parsing does a handful of allocations and freeing
+// the document is O(chunks).
+// parse() : replaces the current document, reusing the arena memory.
+// root() : the top level value, valid until the next parse().
+//
+class JsonDoc {
+  struct Frame {
+    bool object;
+    size_t start;
+    const JsonKey* key;
+  };
+
+  plx::Arena arena_;
+  std::vector<const JsonKey*> keys_;
+  size_t key_count_;
+  JsonNode root_;
+  // reused between parses; hold the children of the open containers.
+  std::vector<Frame> frames_;
+  std::vector<JsonNode> items_;
+  std::vector<JsonMember> members_;
+
+  JsonDoc(const JsonDoc&) = delete;
+  JsonDoc& operator=(const JsonDoc&) = delete;
+
+public:
+  JsonDoc() : arena_(16 * 1024), key_count_(0) {
+  }
+
+  const JsonNode& parse(const plx::Range<const char>& json) {
+    arena_.reset();
+    keys_.assign(64, nullptr);
+    key_count_ = 0;
+    root_ = JsonNode();
+    frames_.clear();
+    items_.clear();
+    members_.clear();
+
+    plx::JsonReader reader(json);
+    const JsonKey* key = nullptr;
+    for (;;) {
+      JsonNode node;
+      switch (reader.next()) {
+        case JsonReader::Token::end:
+          return root_;
+        case JsonReader::Token::key:
+          key = intern(reader.str());
+          continue;
+        case JsonReader::Token::object_begin:
+        case JsonReader::Token::array_begin: {
+          bool object = reader.token() == JsonReader::Token::object_begin;
+          Frame frame = { object, object ? members_.size() : items_.size(), key };
+          frames_.push_back(frame);
+          key = nullptr;
+          continue;
+        }
+        case JsonReader::Token::object_end:
+          key = frames_.back().key;
+          node = close_object();
+          break;
+        case JsonReader::Token::array_end:
+          key = frames_.back().key;
+          node = close_array();
+          break;
+        case JsonReader::Token::string:
+          node = make_string(reader.str());
+          break;
+        case JsonReader::Token::int64:
+          node.type_ = JsonType::INT64;
+          node.u_.intv = reader.int64();
+          break;
+        case JsonReader::Token::dbl:
+          node.type_ = JsonType::DOUBLE;
+          node.u_.dblv = reader.dbl();
+          break;
+        case JsonReader::Token::boolean:
+          node.type_ = JsonType::BOOL;
+          node.u_.bolv = reader.boolean();
+          break;
+        case JsonReader::Token::null:
+          break;
+        default:
+          throw plx::JsonException(__LINE__);
+      }
+
+      if (frames_.empty()) {
+        root_ = node;
+      } else if (frames_.back().object) {
+        JsonMember member = { key, node };
+        members_.push_back(member);
+      } else {
+        items_.push_back(node);
+      }
+      key = nullptr;
+    }
+  }
+
+  const JsonNode& root() const {
+    return root_;
+  }
+
+  const plx::Arena& arena() const {
+    return arena_;
+  }
+
+  size_t key_count() const {
+    return key_count_;
+  }
+
+private:
+  JsonNode make_string(const plx::Range<const char>& r) {
+    JsonNode node;
+    node.type_ = JsonType::STRING;
+    node.size_ = plx::To<uint32_t>(r.size());
+    if (r.size() <= sizeof(node.u_.small)) {
+      memcpy(node.u_.small, r.start(), r.size());
+    } else {
+      auto mem = arena_.allocate_array<char>(r.size());
+      memcpy(mem, r.start(), r.size());
+      node.u_.strv = mem;
+    }
+    return node;
+  }
+
+  JsonNode close_array() {
+    auto start = frames_.back().start;
+    frames_.pop_back();
+    JsonNode node;
+    node.type_ = JsonType::ARRAY;
+    node.size_ = plx::To<uint32_t>(items_.size() - start);
+    auto items = arena_.allocate_array<JsonNode>(node.size_);
+    std::copy(items_.begin() + start, items_.end(), items);
+    items_.resize(start);
+    node.u_.items = items;
+    return node;
+  }
+
+  JsonNode close_object() {
+    auto start = frames_.back().start;
+    frames_.pop_back();
+    auto first = members_.begin() + start;
+    // must be stable so with repeated keys the last one wins like JsonValue
+    // does. std::stable_sort allocates, most objects are small enough for
+    // an insertion sort.
+    auto less = [](const JsonMember& a, const JsonMember& b) {
+      return JsonMember::Less(a.name(), b.name());
+    };
+    if ((members_.end() - first) > 32) {
+      std::stable_sort(first, members_.end(), less);
+    } else {
+      for (auto it = first; it != members_.end(); ++it) {
+        auto member = *it;
+        auto hole = it;
+        for (; (hole != first) && less(member, *(hole - 1)); --hole)
+          *hole = *(hole - 1);
+        *hole = member;
+      }
+    }
+    auto last = first;
+    for (auto it = first; it != members_.end(); ++it) {
+      if ((it + 1 != members_.end()) && ((it + 1)->key == it->key))
+        continue;
+      *last++ = *it;
+    }
+    JsonNode node;
+    node.type_ = JsonType::OBJECT;
+    node.size_ = plx::To<uint32_t>(last - first);
+    auto members = arena_.allocate_array<JsonMember>(node.size_);
+    std::copy(first, last, members);
+    members_.resize(start);
+    node.u_.members = members;
+    return node;
+  }
+
+  const JsonKey* intern(const plx::Range<const char>& r) {
+    // fnv-1a.
+    uint32_t hash = 2166136261u;
+    for (auto c : r)
+      hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+
+    auto mask = keys_.size() - 1;
+    for (auto ix = hash & mask; ; ix = (ix + 1) & mask) {
+      auto key = keys_[ix];
+      if (!key)
+        break;
+      if ((key->hash == hash) && (key->size == r.size()) &&
+          (memcmp(key->chars(), r.start(), r.size()) == 0))
+        return key;
+    }
+
+    auto mem = arena_.allocate(sizeof(JsonKey) + r.size(), __alignof(JsonKey));
+    auto key = reinterpret_cast<JsonKey*>(mem);
+    key->size = plx::To<uint32_t>(r.size());
+    key->hash = hash;
+    memcpy(key + 1, r.start(), r.size());
+
+    if ((key_count_ + 1) * 2 > keys_.size())
+      rehash(keys_.size() * 2);
+    mask = keys_.size() - 1;
+    auto ix = hash & mask;
+    while (keys_[ix])
+      ix = (ix + 1) & mask;
+    keys_[ix] = key;
+    ++key_count_;
+    return key;
+  }
+
+  void rehash(size_t size) {
+    std::vector<const JsonKey*> keys(size, nullptr);
+    for (auto key : keys_) {
+      if (!key)
+        continue;
+      auto ix = key->hash & (size - 1);
+      while (keys[ix])
+        ix = (ix + 1) & (size - 1);
+      keys[ix] = key;
+    }
+    keys_.swap(keys);
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonHandler : callbacks of plx::JsonSaxReader. Ranges are only valid
+// during the call.
+// key() : return false to skip the value that follows.
+// begin_object(), begin_array() : return false to skip the whole subtree;
+//   its end_ callback is not called either.
+//
+class JsonHandler {
+public:
+  virtual ~JsonHandler() {}
+  virtual bool key(const plx::Range<const char>&) { return true; }
+  virtual bool begin_object() { return true; }
+  virtual void end_object() {}
+  virtual bool begin_array() { return true; }
+  virtual void end_array() {}
+  virtual void string(const plx::Range<const char>&) {}
+  virtual void int64(int64_t) {}
+  virtual void dbl(double) {}
+  virtual void boolean(bool) {}
+  virtual void null() {}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonSaxReader : streaming json parser. The input is pulled in chunks
+// into one buffer of |chunk_size|, so memory does not depend on the size of
+// the document. The buffer only grows for a single key, string or number
+// longer than it; skipped subtrees never make it grow.
+// parse(source) : |source| fills up to len bytes and returns 0 at the end.
+// Skipped subtrees are only scanned for strings and brackets; they are not
+// decoded nor fully validated.
+//
+class JsonSaxReader {
+  enum class Expect {
+    value,
+    first_key,
+    key,
+    first_value,
+    separator
+  };
+
+  enum class Step {
+    token,
+    more,
+    done
+  };
+
+  const size_t chunk_size_;
+  std::vector<char> buf_;
+  std::vector<char> stack_;
+  std::string scratch_;
+  Expect expect_;
+  size_t skip_depth_;
+  // inside a string of a skipped subtree.
+  bool skip_string_;
+  bool skip_value_;
+  long long offset_;
+
+  JsonSaxReader(const JsonSaxReader&) = delete;
+  JsonSaxReader& operator=(const JsonSaxReader&) = delete;
+
+public:
+  explicit JsonSaxReader(size_t chunk_size = 64 * 1024)
+      : chunk_size_(chunk_size ? chunk_size : 64 * 1024),
+        expect_(Expect::value),
+        skip_depth_(0),
+        skip_string_(false),
+        skip_value_(false),
+        offset_(0) {
+  }
+
+  void parse(const std::function<size_t(char*, size_t)>& source,
+             plx::JsonHandler& handler) {
+    stack_.clear();
+    expect_ = Expect::value;
+    skip_depth_ = 0;
+    skip_string_ = false;
+    skip_value_ = false;
+    offset_ = 0;
+    if (buf_.size() != chunk_size_)
+      buf_.assign(chunk_size_, 0);
+
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;
+    for (;;) {
+      Step step;
+      do {
+        const char* pos = buf_.data() + begin;
+        step = skip_depth_ ?
+            skip(pos, buf_.data() + end, eof) :
+            next(pos, buf_.data() + end, eof, handler);
+        offset_ += pos - (buf_.data() + begin);
+        begin = pos - buf_.data();
+      } while (step == Step::token);
+
+      if (step == Step::done)
+        return;
+
+      // keep the unfinished token, growing the buffer if it fills it.
+      auto left = end - begin;
+      if (begin)
+        memmove(buf_.data(), buf_.data() + begin, left);
+      else if (left == buf_.size())
+        buf_.resize(buf_.size() * 2);
+      begin = 0;
+      end = left;
+      auto read = source(buf_.data() + end, buf_.size() - end);
+      if (!read)
+        eof = true;
+      end += read;
+    }
+  }
+
+#if defined(_WIN32)
+  void parse(plx::File& file, plx::JsonHandler& handler) {
+    parse([&file](char* buf, size_t len) {
+      return file.read(reinterpret_cast<uint8_t*>(buf), len, -1);
+    }, handler);
+  }
+#endif
+
+  // bytes consumed so far, useful to report errors.
+  long long offset() const {
+    return offset_;
+  }
+
+  size_t buffer_size() const {
+    return buf_.size();
+  }
+
+private:
+  void error(const char* p, const char* e) {
+    auto r = plx::RangeFromBytes(p, std::min(size_t(e - p), size_t(16)));
+    throw plx::CodecException(__LINE__, &r);
+  }
+
+  // returns one past the closing quote of the string at |p| or null if the
+  // buffer ends first. |escaped| tells if the slow decode is needed.
+  const char* string_end(const char* p, const char* e, bool* escaped) {
+    *escaped = false;
+    auto q = p + 1;
+    for (;;) {
+      q = plx::JsonFindStringEnd(q, e);
+      if (q == e)
+        return nullptr;
+      if (*q == '"')
+        return q + 1;
+      if (*q != '\\')
+        error(q, e);
+      if ((e - q) < 2)
+        return nullptr;
+      *escaped = true;
+      q += 2;
+    }
+  }
+
+  plx::Range<const char> string_value(const char* p, const char* q, bool escaped) {
+    if (!escaped)
+      return plx::Range<const char>(p + 1, q - 1);
+    scratch_.clear();
+    plx::JsonDecodeEscapes(p + 1, q, scratch_);
+    return plx::Range<const char>(scratch_.data(), scratch_.data() + scratch_.size());
+  }
+
+  Step close(const char*& pos, const char* p, const char* e, plx::JsonHandler& handler) {
+    if (stack_.empty() || (stack_.back() != ((*p == '}') ? '{' : '[')))
+      error(p, e);
+    stack_.pop_back();
+    pos = p + 1;
+    expect_ = Expect::separator;
+    if (*p == '}')
+      handler.end_object();
+    else
+      handler.end_array();
+    return Step::token;
+  }
+
+  Step next(const char*& pos, const char* e, bool eof, plx::JsonHandler& handler) {
+    auto p = plx::JsonSkipSpace(pos, e);
+    pos = p;
+    if (p == e) {
+      if (!eof)
+        return Step::more;
+      if ((expect_ == Expect::separator) && stack_.empty())
+        return Step::done;
+      error(p, e);
+    }
+
+    if (expect_ == Expect::separator) {
+      if (stack_.empty())
+        error(p, e);
+      if (*p == ',') {
+        pos = p + 1;
+        expect_ = (stack_.back() == '{') ? Expect::key : Expect::value;
+        return Step::token;
+      }
+      if ((*p != '}') && (*p != ']'))
+        error(p, e);
+      return close(pos, p, e, handler);
+    }
+
+    if ((expect_ == Expect::first_key) || (expect_ == Expect::key)) {
+      if ((*p == '}') && (expect_ == Expect::first_key))
+        return close(pos, p, e, handler);
+      if (*p != '"')
+        error(p, e);
+      bool escaped;
+      auto q = string_end(p, e, &escaped);
+      auto colon = q ? plx::JsonSkipSpace(q, e) : e;
+      if (colon == e) {
+        if (eof)
+          error(p, e);
+        return Step::more;
+      }
+      if (*colon != ':')
+        error(colon, e);
+      skip_value_ = !handler.key(string_value(p, q, escaped));
+      pos = colon + 1;
+      expect_ = Expect::value;
+      return Step::token;
+    }
+
+    if ((*p == ']') && (expect_ == Expect::first_value))
+      return close(pos, p, e, handler);
+
+    auto skip = skip_value_;
+    skip_value_ = false;
+
+    if ((*p == '{') || (*p == '[')) {
+      pos = p + 1;
+      auto object = (*p == '{');
+      if (skip || !(object ? handler.begin_object() : handler.begin_array())) {
+        skip_depth_ = 1;
+        return Step::token;
+      }
+      stack_.push_back(*p);
+      expect_ = object ? Expect::first_key : Expect::first_value;
+      return Step::token;
+    }
+
+    if (*p == '"') {
+      bool escaped;
+      auto q = string_end(p, e, &escaped);
+      if (!q) {
+        if (eof)
+          error(p, e);
+        skip_value_ = skip;
+        return Step::more;
+      }
+      if (!skip)
+        handler.string(string_value(p, q, escaped));
+      pos = q;
+      expect_ = Expect::separator;
+      return Step::token;
+    }
+
+    if ((*p == 't') || (*p == 'f') || (*p == 'n')) {
+      const char* literal = (*p == 't') ? "true" : (*p == 'f') ? "false" : "null";
+      auto len = strlen(literal);
+      if (size_t(e - p) < len) {
+        if (eof)
+          error(p, e);
+        skip_value_ = skip;
+        return Step::more;
+      }
+      if (memcmp(p, literal, len) != 0)
+        error(p, e);
+      if (!skip) {
+        if (*p == 'n')
+          handler.null();
+        else
+          handler.boolean(*p == 't');
+      }
+      pos = p + len;
+      expect_ = Expect::separator;
+      return Step::token;
+    }
+
+    // a number might continue in the next chunk.
+    auto q = p;
+    while ((q != e) && (((*q >= '0') && (*q <= '9')) ||
+           (*q == '-') || (*q == '+') || (*q == '.') || (*q == 'e') || (*q == 'E')))
+      ++q;
+    if ((q == e) && !eof) {
+      skip_value_ = skip;
+      return Step::more;
+    }
+    plx::Range<const char> num(p, q);
+    int64_t iv;
+    double dv;
+    auto integer = plx::JsonParseNumber(num, &iv, &dv);
+    if (!num.empty() || (q == p))
+      error(p, e);
+    if (!skip) {
+      if (integer)
+        handler.int64(iv);
+      else
+        handler.dbl(dv);
+    }
+    pos = q;
+    expect_ = Expect::separator;
+    return Step::token;
+  }
+
+  Step skip(const char*& pos, const char* e, bool eof) {
+    auto p = pos;
+    while (p != e) {
+      if (skip_string_) {
+        // strings are walked a chunk at a time, however long they are.
+        p = plx::JsonFindStringEnd(p, e);
+        if (p == e)
+          break;
+        if (*p == '\\') {
+          // keep a backslash that ends the chunk for the next one.
+          if ((e - p) < 2)
+            break;
+          p += 2;
+          continue;
+        }
+        if (*p != '"')
+          error(p, e);
+        skip_string_ = false;
+        ++p;
+        continue;
+      }
+      auto c = *p;
+      if (c == '"') {
+        skip_string_ = true;
+      } else if ((c == '{') || (c == '[')) {
+        ++skip_depth_;
+      } else if ((c == '}') || (c == ']')) {
+        if (--skip_depth_ == 0) {
+          pos = p + 1;
+          expect_ = Expect::separator;
+          return Step::token;
+        }
+      }
+      ++p;
+    }
+    pos = p;
+    if (eof)
+      error(p, e);
+    return Step::more;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonFormatDouble : shortest of %.15g, %.16g or %.17g that reads back
+// as the same double. returns the number of chars written to |buf|.
+//
+size_t JsonFormatDouble(double v, char (&buf)[32]) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonWriter : streaming json serializer. Text accumulates in a buffer
+// that keeps its capacity across clear() and flush(), so steady state
+// writing does not allocate.
+// key(), begin_object(), int64() ... : append one token, commas are implied.
+// flush(sink) : hands the text so far to |sink|, which writes up to len
+//   bytes and returns how many it wrote, then empties the buffer. returns
+//   false if the sink stopped short. flush(file) is the same for a file.
+// Doubles that are not finite have no json form and are written as null.
+//
+class JsonWriter {
+  std::string buf_;
+  // one entry per open container, true until it has an element.
+  std::vector<bool> first_;
+  bool after_key_;
+
+public:
+  JsonWriter() : after_key_(false) {
+  }
+
+  void clear() {
+    buf_.clear();
+    first_.clear();
+    after_key_ = false;
+  }
+
+  plx::Range<const char> text() const {
+    return plx::Range<const char>(buf_.data(), buf_.data() + buf_.size());
+  }
+
+  const std::string& str() const {
+    return buf_;
+  }
+
+  bool flush(const std::function<size_t(const char*, size_t)>& sink) {
+    size_t done = 0;
+    while (done != buf_.size()) {
+      auto written = sink(buf_.data() + done, buf_.size() - done);
+      if (!written)
+        break;
+      done += written;
+    }
+    auto all = (done == buf_.size());
+    buf_.clear();
+    return all;
+  }
+
+#if defined(_WIN32)
+  bool flush(plx::File& file) {
+    return flush([&file](const char* data, size_t len) {
+      return file.write(reinterpret_cast<const uint8_t*>(data), len, -1);
+    });
+  }
+#endif
+
+  JsonWriter& begin_object() {
+    separator();
+    buf_.push_back('{');
+    first_.push_back(true);
+    return *this;
+  }
+
+  JsonWriter& end_object() {
+    first_.pop_back();
+    buf_.push_back('}');
+    return *this;
+  }
+
+  JsonWriter& begin_array() {
+    separator();
+    buf_.push_back('[');
+    first_.push_back(true);
+    return *this;
+  }
+
+  JsonWriter& end_array() {
+    first_.pop_back();
+    buf_.push_back(']');
+    return *this;
+  }
+
+  JsonWriter& key(const plx::Range<const char>& name) {
+    separator();
+    escaped(name);
+    buf_.push_back(':');
+    after_key_ = true;
+    return *this;
+  }
+
+  JsonWriter& key(const char* name) {
+    return key(plx::Range<const char>(name, name + strlen(name)));
+  }
+
+  JsonWriter& string(const plx::Range<const char>& value) {
+    separator();
+    escaped(value);
+    return *this;
+  }
+
+  JsonWriter& string(const char* value) {
+    return string(plx::Range<const char>(value, value + strlen(value)));
+  }
+
+  JsonWriter& string(const std::string& value) {
+    return string(plx::Range<const char>(value.data(), value.data() + value.size()));
+  }
+
+  JsonWriter& int64(int64_t value) {
+    separator();
+    char digits[24];
+    auto end = digits + sizeof(digits);
+    auto p = end;
+    // negate as unsigned so INT64_MIN works.
+    uint64_t mag = (value < 0) ? (0ULL - static_cast<uint64_t>(value)) : value;
+    do {
+      *--p = static_cast<char>('0' + (mag % 10));
+      mag /= 10;
+    } while (mag);
+    if (value < 0)
+      *--p = '-';
+    buf_.append(p, end);
+    return *this;
+  }
+
+  JsonWriter& dbl(double value) {
+    separator();
+    char digits[32];
+    auto len = plx::JsonFormatDouble(value, digits);
+    if (!len) {
+      buf_.append("null");
+      return *this;
+    }
+    buf_.append(digits, len);
+    // keep it a double when read back.
+    if (!std::any_of(digits, digits + len,
+                     [](char c) { return (c == '.') || (c == 'e'); }))
+      buf_.append(".0");
+    return *this;
+  }
+
+  JsonWriter& boolean(bool value) {
+    separator();
+    buf_.append(value ? "true" : "false");
+    return *this;
+  }
+
+  JsonWriter& null() {
+    separator();
+    buf_.append("null");
+    return *this;
+  }
+
+private:
+  void separator() {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (first_.empty())
+      return;
+    if (!first_.back())
+      buf_.push_back(',');
+    first_.back() = false;
+  }
+
+  void escaped(const plx::Range<const char>& r) {
+    static const char hex[] = "0123456789abcdef";
+    buf_.push_back('"');
+    auto p = r.start();
+    auto e = r.end();
+    for (;;) {
+      // same scan the readers use, it finds the chars that need escaping.
+      auto q = plx::JsonFindStringEnd(p, e);
+      buf_.append(p, q);
+      if (q == e)
+        break;
+      auto c = static_cast<unsigned char>(*q);
+      switch (c) {
+        case '"':  buf_.append("\\\""); break;
+        case '\\': buf_.append("\\\\"); break;
+        case '\b': buf_.append("\\b"); break;
+        case '\f': buf_.append("\\f"); break;
+        case '\n': buf_.append("\\n"); break;
+        case '\r': buf_.append("\\r"); break;
+        case '\t': buf_.append("\\t"); break;
+        default: {
+          const char u[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+          buf_.append(u, sizeof(u));
+        }
+      }
+      p = q + 1;
+    }
+    buf_.push_back('"');
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonField : binds a json key to a member of S. Tables of these are
+// made with the helpers below and given to plx::JsonSchema.
+// required : if false a missing key leaves |def| (or an empty string).
+// min, max : inclusive range of integers.
+// array : codec of a member that is a vector of structs, see JsonArrayOf.
+//
+enum class JsonFieldKind {
+  int64,
+  string,
+  array
+};
+
+template <typename S>
+struct JsonArrayCodec;
+
+template <typename S>
+struct JsonField {
+  const char* name;
+  JsonFieldKind kind;
+  bool required;
+  int64_t S::* int_member;
+  std::string S::* str_member;
+  const JsonArrayCodec<S>* array;
+  int64_t min;
+  int64_t max;
+  int64_t def;
+};
+
+template <typename S>
+JsonField<S> JsonInt64Field(const char* name, int64_t S::* member,
+                            int64_t min, int64_t max) {
+  JsonField<S> field = { name, JsonFieldKind::int64, true, member, nullptr, nullptr, min, max, 0 };
+  return field;
+}
+
+template <typename S>
+JsonField<S> JsonOptionalInt64Field(const char* name, int64_t S::* member,
+                                    int64_t min, int64_t max, int64_t def) {
+  JsonField<S> field = { name, JsonFieldKind::int64, false, member, nullptr, nullptr, min, max, def };
+  return field;
+}
+
+template <typename S>
+JsonField<S> JsonStringField(const char* name, std::string S::* member, bool required) {
+  JsonField<S> field = { name, JsonFieldKind::string, required, nullptr, member, nullptr, 0, 0, 0 };
+  return field;
+}
+
+template <typename S>
+JsonField<S> JsonArrayField(const char* name, const JsonArrayCodec<S>& codec) {
+  JsonField<S> field = { name, JsonFieldKind::array, false, nullptr, nullptr, &codec, 0, 0, 0 };
+  return field;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonSchema : decodes a json object straight into an S in one pass
+// over a plx::JsonReader, and writes an S back as json. Unknown keys are
+// skipped. Errors name the field, see plx::JsonSchemaException.
+//
+template <typename S>
+struct JsonArrayCodec {
+  virtual ~JsonArrayCodec() {}
+  virtual void decode(plx::JsonReader& reader, S& out, const std::string& path) const = 0;
+  virtual void encode(plx::JsonWriter& writer, const S& in) const = 0;
+};
+
+template <typename S>
+class JsonSchema {
+  const JsonField<S>* fields_;
+  size_t count_;
+
+public:
+  template <size_t count>
+  explicit JsonSchema(const JsonField<S> (&fields)[count])
+      : fields_(fields), count_(count) {
+  }
+
+  // |json| must be exactly one object.
+  void decode(const plx::Range<const char>& json, S& out) const {
+    plx::JsonReader reader(json);
+    reader.next();
+    decode_object(reader, out, std::string());
+    if (reader.next() != JsonReader::Token::end)
+      throw plx::JsonException(__LINE__);
+  }
+
+  // the current token of |reader| is the start of the object.
+  void decode_object(plx::JsonReader& reader, S& out, const std::string& path) const {
+    if (reader.token() != JsonReader::Token::object_begin)
+      throw plx::JsonSchemaException(__LINE__, "json object expected", path);
+    std::vector<bool> seen(count_, false);
+    while (reader.next() != JsonReader::Token::object_end) {
+      auto ix = find(reader.str());
+      reader.next();
+      if (ix == count_) {
+        if ((reader.token() == JsonReader::Token::object_begin) ||
+            (reader.token() == JsonReader::Token::array_begin))
+          reader.skip_children();
+        continue;
+      }
+      auto& field = fields_[ix];
+      if (seen[ix])
+        throw plx::JsonSchemaException(__LINE__, "json field repeated", path + field.name);
+      seen[ix] = true;
+      decode_field(reader, field, out, path);
+    }
+    for (size_t ix = 0; ix != count_; ++ix) {
+      if (seen[ix])
+        continue;
+      auto& field = fields_[ix];
+      if (field.required)
+        throw plx::JsonSchemaException(__LINE__, "json field missing", path + field.name);
+      if (field.kind == JsonFieldKind::int64)
+        out.*field.int_member = field.def;
+      else if (field.kind == JsonFieldKind::string)
+        (out.*field.str_member).clear();
+    }
+  }
+
+  // optional fields that hold their default are left out, so what is
+  // written decodes back to the same S.
+  void encode(plx::JsonWriter& writer, const S& in) const {
+    writer.begin_object();
+    for (size_t ix = 0; ix != count_; ++ix) {
+      auto& field = fields_[ix];
+      if (field.kind == JsonFieldKind::int64) {
+        if (!field.required && (in.*field.int_member == field.def))
+          continue;
+        writer.key(field.name).int64(in.*field.int_member);
+      } else if (field.kind == JsonFieldKind::string) {
+        if (!field.required && (in.*field.str_member).empty())
+          continue;
+        writer.key(field.name).string(in.*field.str_member);
+      } else {
+        writer.key(field.name);
+        field.array->encode(writer, in);
+      }
+    }
+    writer.end_object();
+  }
+
+private:
+  size_t find(const plx::Range<const char>& name) const {
+    for (size_t ix = 0; ix != count_; ++ix) {
+      auto len = strlen(fields_[ix].name);
+      if ((len == name.size()) && (memcmp(fields_[ix].name, name.start(), len) == 0))
+        return ix;
+    }
+    return count_;
+  }
+
+  void decode_field(plx::JsonReader& reader, const JsonField<S>& field,
+                    S& out, const std::string& path) const {
+    auto token = reader.token();
+    switch (field.kind) {
+      case JsonFieldKind::int64: {
+        if (token != JsonReader::Token::int64)
+          throw plx::JsonSchemaException(__LINE__, "json integer expected", path + field.name);
+        auto value = reader.int64();
+        if ((value < field.min) || (value > field.max))
+          throw plx::JsonSchemaException(__LINE__, "json integer out of range", path + field.name);
+        out.*field.int_member = value;
+        break;
+      }
+      case JsonFieldKind::string: {
+        if (token != JsonReader::Token::string)
+          throw plx::JsonSchemaException(__LINE__, "json string expected", path + field.name);
+        auto& str = reader.str();
+        (out.*field.str_member).assign(str.start(), str.end());
+        break;
+      }
+      case JsonFieldKind::array: {
+        if (token != JsonReader::Token::array_begin)
+          throw plx::JsonSchemaException(__LINE__, "json array expected", path + field.name);
+        field.array->decode(reader, out, path + field.name);
+        break;
+      }
+      default:
+        throw plx::JsonException(__LINE__);
+    }
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonArrayOf : codec for a std::vector<E> member of S whose elements
+// are objects described by a plx::JsonSchema<E>.
+//
+template <typename S, typename E>
+class JsonArrayOf : public JsonArrayCodec<S> {
+  std::vector<E> S::* member_;
+  const JsonSchema<E>& schema_;
+
+public:
+  JsonArrayOf(std::vector<E> S::* member, const JsonSchema<E>& schema)
+      : member_(member), schema_(schema) {
+  }
+
+  void decode(plx::JsonReader& reader, S& out, const std::string& path) const override {
+    auto& items = out.*member_;
+    items.clear();
+    while (reader.next() != JsonReader::Token::array_end) {
+      E item;
+      auto item_path = path + "[" + std::to_string(
+          static_cast<unsigned long long>(items.size())) + "].";
+      schema_.decode_object(reader, item, item_path);
+      items.push_back(std::move(item));
+    }
+  }
+
+  void encode(plx::JsonWriter& writer, const S& in) const override {
+    writer.begin_array();
+    for (auto& item : in.*member_)
+      schema_.encode(writer, item);
+    writer.end_array();
+  }
+};
+
+}
@@ -0,0 +1,810 @@
+// plx_posix.h : the plex catalog components that the plx_*.h files build on,
+// for builds without plex and windows (the unit tests in tests/). They are
+// copies of the catalog versions that the generated stdafx.h carries, changed
+// only where the catalog code is msvc or win32 specific.
+
+#pragma once
+
+#include <errno.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Exception
+// line_ : The line of code, usually __LINE__.
+// message_ : Whatever useful text.
+//
+namespace plx {
+class Exception {
+  int line_;
+  const char* message_;
+
+protected:
+  void PostCtor() {
+  }
+
+public:
+  Exception(int line, const char* message) : line_(line), message_(message) {}
+  virtual ~Exception() {}
+  const char* Message() const { return message_; }
+  int Line() const { return line_; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::RangeException (thrown by ItRange and others)
+//
+class RangeException : public plx::Exception {
+  void* ptr_;
+public:
+  RangeException(int line, void* ptr)
+      : Exception(line, "Invalid Range"), ptr_(ptr) {
+    PostCtor();
+  }
+
+  void* pointer() const {
+    return ptr_;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::ItRange
+// s_ : first element
+// e_ : one past the last element
+//
+template <typename It>
+class ItRange {
+  It s_;
+  It e_;
+
+public:
+  typedef typename std::iterator_traits<
+      typename std::remove_reference<It>::type
+  >::reference RefT;
+
+  typedef typename std::iterator_traits<
+      typename std::remove_reference<It>::type
+  >::value_type ValueT;
+
+  typedef typename std::remove_const<It>::type NoConstIt;
+
+  ItRange() : s_(), e_() {
+  }
+
+  template <typename U>
+  ItRange(const ItRange<U>& other) : s_(other.start()), e_(other.end()) {
+  }
+
+  ItRange(It start, It end) : s_(start), e_(end) {
+  }
+
+  ItRange(It start, size_t size) : s_(start), e_(start + size) {
+  }
+
+  bool empty() const {
+    return (s_ == e_);
+  }
+
+  size_t size() const {
+    return (e_ - s_);
+  }
+
+  It start() const {
+    return s_;
+  }
+
+  It begin() const {
+    return s_;
+  }
+
+  It end() const {
+    return e_;
+  }
+
+  bool valid() const {
+    return (e_ >= s_);
+  }
+
+  RefT front() const {
+    if (s_ >= e_)
+      throw plx::RangeException(__LINE__, nullptr);
+    return s_[0];
+  }
+
+  RefT back() const {
+    return e_[-1];
+  }
+
+  RefT operator[](size_t i) const {
+    return s_[i];
+  }
+
+  bool equals(const ItRange<It>& o) const {
+    if (o.size() != size())
+      return false;
+    return (memcmp(s_, o.s_, size()) == 0);
+  }
+
+  size_t starts_with(const ItRange<It>& o) const {
+    if (o.size() > size())
+      return 0;
+    return (memcmp(s_, o.s_, o.size()) == 0) ? o.size() : 0;
+  }
+
+  bool contains(const uint8_t* ptr) const {
+    return ((ptr >= reinterpret_cast<uint8_t*>(s_)) &&
+            (ptr < reinterpret_cast<uint8_t*>(e_)));
+  }
+
+  bool contains(ValueT x, size_t* pos) const {
+    auto c = s_;
+    while (c != e_) {
+      if (*c == x) {
+        *pos = c - s_;
+        return true;
+      }
+      ++c;
+    }
+    return false;
+  }
+
+  template <size_t count>
+  size_t CopyToArray(ValueT (&arr)[count]) const {
+    auto copied = std::min(size(), count);
+    auto last = copied + s_;
+    std::copy(s_, last, arr);
+    return copied;
+  }
+
+  template <size_t count>
+  size_t CopyToArray(std::array<ValueT, count>& arr) const {
+    auto copied = std::min(size(), count);
+    auto last = copied + s_;
+    std::copy(s_, last, arr.begin());
+    return copied;
+  }
+
+  intptr_t advance(size_t count) {
+    auto ns = s_ + count;
+    if (ns > e_)
+      return (e_ - ns);
+    s_ = ns;
+    return size();
+  }
+
+  void clear() {
+    s_ = It();
+    e_ = It();
+  }
+
+  void reset_start(It new_start) {
+    auto sz = size();
+    s_ = new_start;
+    e_ = s_ + sz;
+  }
+
+  void extend(size_t count) {
+    e_ += count;
+  }
+
+  ItRange<const uint8_t*> const_bytes() const {
+    auto s = reinterpret_cast<const uint8_t*>(s_);
+    auto e = reinterpret_cast<const uint8_t*>(e_);
+    return ItRange<const uint8_t*>(s, e);
+  }
+
+  ItRange<uint8_t*> bytes() const {
+    auto s = reinterpret_cast<uint8_t*>(s_);
+    auto e = reinterpret_cast<uint8_t*>(e_);
+    return ItRange<uint8_t*>(s, e);
+  }
+
+  ItRange<It> slice(size_t start, size_t count = 0) const {
+    return ItRange<It>(s_ + start,
+                       count ? (s_ + start + count) : e_ );
+  }
+
+};
+
+template <typename U, size_t count>
+ItRange<U*> RangeFromLitStr(U (&str)[count]) {
+  return ItRange<U*>(str, str + count - 1);
+}
+
+template <typename U, size_t count>
+ItRange<U*> RangeFromArray(U (&str)[count]) {
+  return ItRange<U*>(str, str + count);
+}
+
+template <typename U>
+ItRange<U*> RangeUntilValue(U* start, U value) {
+  auto stop = start;
+  while (*stop != value) {
+    ++stop;
+  }
+  return ItRange<U*>(start, stop);
+}
+
+template <typename U>
+ItRange<U*> RangeFromVector(std::vector<U>& vec, size_t len = 0) {
+  auto s = &vec[0];
+  return ItRange<U*>(s, len ? s + len : s + vec.size());
+}
+
+template <typename U>
+ItRange<const U*> RangeFromVector(const std::vector<U>& vec, size_t len = 0) {
+  auto s = &vec[0];
+  return ItRange<const U*>(s, len ? s + len : s + vec.size());
+}
+
+ItRange<uint8_t*> RangeFromBytes(void* start, size_t count) ;
+
+ItRange<const uint8_t*> RangeFromBytes(const void* start, size_t count) ;
+
+ItRange<const uint8_t*> RangeFromString(const std::string& str) ;
+
+ItRange<uint8_t*> RangeFromString(std::string& str) ;
+
+ItRange<const uint16_t*> RangeFromString(const std::wstring& str) ;
+
+ItRange<uint16_t*> RangeFromString(std::wstring& str) ;
+
+template <typename U>
+std::string StringFromRange(const ItRange<U>& r) {
+  return std::string(r.start(), r.end());
+}
+
+template <typename U>
+std::wstring WideStringFromRange(const ItRange<U>& r) {
+  return std::wstring(r.start(), r.end());
+}
+
+template <typename U>
+std::unique_ptr<U[]> HeapRange(ItRange<U*>&r) {
+  std::unique_ptr<U[]> ptr(new U[r.size()]);
+  r.reset_start(ptr.get());
+  return ptr;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Range  (alias for ItRange<T*>)
+//
+template <typename T>
+using Range = plx::ItRange<T*>;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::IOException
+// error_code_ : errno of the last operation.
+// name_ : The file or pipe in question.
+//
+class IOException : public plx::Exception {
+  int error_code_;
+  const std::wstring name_;
+
+public:
+  IOException(int line, const wchar_t* name)
+      : Exception(line, "IO problem"),
+        error_code_(errno),
+        name_(name ? name : L"") {
+    PostCtor();
+  }
+  int ErrorCode() const { return error_code_; }
+  const wchar_t* Name() const { return name_.c_str(); }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::InvalidParamException
+// parameter_ : the position of the offending parameter, zero if unknown.
+//
+class InvalidParamException : public plx::Exception {
+  int parameter_;
+
+public:
+  InvalidParamException(int line, int parameter)
+      : Exception(line, "Invalid parameter"), parameter_(parameter) {
+    PostCtor();
+  }
+  int Parameter() const { return parameter_; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// HexASCII (converts a byte into a two-char readable representation.
+//
+static const char HexASCIITable[] =
+    { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+char* HexASCII(uint8_t byte, char* out) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+std::string HexASCIIStr(const plx::Range<const uint8_t>& r, char separator) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::CodecException (thrown by some decoders)
+// bytes_ : The 16 bytes or less that caused the issue.
+//
+class CodecException : public plx::Exception {
+  uint8_t bytes_[16];
+  size_t count_;
+
+public:
+  CodecException(int line, const plx::Range<const unsigned char>* br)
+      : Exception(line, "Codec exception"), count_(0) {
+    if (br)
+      count_ = br->CopyToArray(bytes_);
+    PostCtor();
+  }
+
+  std::string bytes() const {
+    return plx::HexASCIIStr(plx::Range<const uint8_t>(bytes_, count_), ',');
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonException
+//
+class JsonException : public plx::Exception {
+
+public:
+  JsonException(int line)
+      : Exception(line, "Json exception") {
+    PostCtor();
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonType
+//
+enum class JsonType {
+  NULLT,
+  BOOL,
+  INT64,
+  DOUBLE,
+  ARRAY,
+  OBJECT,
+  STRING,
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::JsonValue
+// type_ : the actual type from the Data union.
+// u_ : the storage for all the possible values.
+template <typename T> using AligedStore =
+    std::aligned_storage<sizeof(T), __alignof(T)>;
+
+class JsonValue {
+  //typedef std::unordered_map<std::string, JsonValue> ObjectImpl;
+  typedef std::map<std::string, JsonValue> ObjectImpl;
+  typedef std::vector<JsonValue> ArrayImpl;
+  typedef std::string StringImpl;
+
+  plx::JsonType type_;
+  union Data {
+    bool bolv;
+    double dblv;
+    int64_t intv;
+    AligedStore<StringImpl>::type str;
+    AligedStore<ArrayImpl>::type arr;
+    AligedStore<ObjectImpl>::type obj;
+  } u_;
+
+ public:
+  typedef ObjectImpl::const_iterator KeyValueIterator;
+
+  JsonValue() : type_(JsonType::NULLT) {
+  }
+
+  JsonValue(const plx::JsonType& type) : type_(type) {
+    if (type_ == JsonType::ARRAY)
+      new (&u_.arr) ArrayImpl;
+    else if (type_ == JsonType::OBJECT)
+      new (&u_.obj) ObjectImpl();
+    else
+      throw plx::InvalidParamException(__LINE__, 1);
+  }
+
+  JsonValue(const JsonValue& other) : type_(JsonType::NULLT) {
+    *this = other;
+  }
+
+  JsonValue(JsonValue&& other) : type_(JsonType::NULLT) {
+    *this = std::move(other);
+  }
+
+  ~JsonValue() {
+    Destroy();
+  }
+
+  JsonValue(std::nullptr_t) : type_(JsonType::NULLT) {
+  }
+
+  JsonValue(bool b) : type_(JsonType::BOOL) {
+    u_.bolv = b;
+  }
+
+  JsonValue(int v) : type_(JsonType::INT64) {
+    u_.intv = v;
+  }
+
+  JsonValue(int64_t v) : type_(JsonType::INT64) {
+    u_.intv = v;
+  }
+
+  JsonValue(double v) : type_(JsonType::DOUBLE) {
+    u_.dblv = v;
+  }
+
+  JsonValue(const std::string& s) : type_(JsonType::STRING) {
+    new (&u_.str) std::string(s);
+  }
+
+  JsonValue(const char* s) : type_(JsonType::STRING) {
+    new (&u_.str) StringImpl(s);
+  }
+
+  JsonValue(std::initializer_list<JsonValue> il) : type_(JsonType::ARRAY) {
+    new (&u_.arr) ArrayImpl(il.begin(), il.end());
+  }
+
+  template<class It>
+  JsonValue(It first, It last) : type_(JsonType::ARRAY) {
+    new (&u_.arr) ArrayImpl(first, last);
+  }
+
+  JsonValue& operator=(const JsonValue& other) {
+    if (this != &other) {
+      Destroy();
+
+      if (other.type_ == JsonType::BOOL)
+        u_.bolv = other.u_.bolv;
+      else if (other.type_ == JsonType::INT64)
+        u_.intv = other.u_.intv;
+      else if (other.type_ == JsonType::DOUBLE)
+        u_.dblv = other.u_.dblv;
+      else if (other.type_ == JsonType::ARRAY)
+        new (&u_.arr) ArrayImpl(*other.GetArray());
+      else if (other.type_ == JsonType::OBJECT)
+        new (&u_.obj) ObjectImpl(*other.GetObject());
+      else if (other.type_ == JsonType::STRING)
+        new (&u_.str) StringImpl(*other.GetString());
+
+      type_ = other.type_;
+    }
+    return *this;
+  }
+
+  JsonValue& operator=(JsonValue&& other) {
+    if (this != &other) {
+      Destroy();
+
+      if (other.type_ == JsonType::BOOL)
+        u_.bolv = other.u_.bolv;
+      else if (other.type_ == JsonType::INT64)
+        u_.intv = other.u_.intv;
+      else if (other.type_ == JsonType::DOUBLE)
+        u_.dblv = other.u_.dblv;
+      else if (other.type_ == JsonType::ARRAY)
+        new (&u_.arr) ArrayImpl(std::move(*other.GetArray()));
+      else if (other.type_ == JsonType::OBJECT)
+        new (&u_.obj) ObjectImpl(std::move(*other.GetObject()));
+      else if (other.type_ == JsonType::STRING)
+        new (&u_.str) StringImpl(std::move(*other.GetString()));
+
+      type_ = other.type_;
+    }
+    return *this;
+  }
+
+  JsonValue& operator[](const std::string& s) {
+    return (*GetObject())[s];
+  }
+
+  JsonValue& operator[](size_t ix) {
+    return (*GetArray())[ix];
+  }
+
+  plx::JsonType type() const {
+    return type_;
+  }
+
+  bool get_bool() const {
+    return u_.bolv;
+  }
+
+  int64_t get_int64() const {
+    return u_.intv;
+  }
+
+  double get_double() const {
+    return u_.dblv;
+  }
+
+  std::string get_string() const {
+    return *GetString();
+  }
+
+  bool has_key(const std::string& k) const {
+    return (GetObject()->find(k) != end(*GetObject()));
+  }
+
+  std::pair<KeyValueIterator, KeyValueIterator>  get_iterator() const {
+    return std::make_pair(GetObject()->begin(), GetObject()->end());
+  }
+
+  void push_back(JsonValue&& value) {
+    GetArray()->push_back(value);
+  }
+
+  size_t size() const {
+   if (type_ == JsonType::ARRAY)
+      return GetArray()->size();
+    else if (type_ == JsonType::OBJECT)
+      return GetObject()->size();
+    else return 0;
+  }
+
+ private:
+
+  ObjectImpl* GetObject() {
+    if (type_ != JsonType::OBJECT)
+      throw plx::JsonException(__LINE__);
+    void* addr = &u_.obj;
+    return reinterpret_cast<ObjectImpl*>(addr);
+  }
+
+  const ObjectImpl* GetObject() const {
+    if (type_ != JsonType::OBJECT)
+      throw plx::JsonException(__LINE__);
+    const void* addr = &u_.obj;
+    return reinterpret_cast<const ObjectImpl*>(addr);
+  }
+
+  ArrayImpl* GetArray() {
+    if (type_ != JsonType::ARRAY)
+      throw plx::JsonException(__LINE__);
+    void* addr = &u_.arr;
+    return reinterpret_cast<ArrayImpl*>(addr);
+  }
+
+  const ArrayImpl* GetArray() const {
+    if (type_ != JsonType::ARRAY)
+      throw plx::JsonException(__LINE__);
+    const void* addr = &u_.arr;
+    return reinterpret_cast<const ArrayImpl*>(addr);
+  }
+
+  std::string* GetString() {
+    if (type_ != JsonType::STRING)
+      throw plx::JsonException(__LINE__);
+    void* addr = &u_.str;
+    return reinterpret_cast<StringImpl*>(addr);
+  }
+
+  const std::string* GetString() const {
+    if (type_ != JsonType::STRING)
+      throw plx::JsonException(__LINE__);
+    const void* addr = &u_.str;
+    return reinterpret_cast<const StringImpl*>(addr);
+  }
+
+  void Destroy() {
+    if (type_ == JsonType::ARRAY)
+      GetArray()->~ArrayImpl();
+    else if (type_ == JsonType::OBJECT)
+      GetObject()->~ObjectImpl();
+    else if (type_ == JsonType::STRING)
+      GetString()->~StringImpl();
+  }
+
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::OverflowKind
+//
+enum class OverflowKind {
+  None,
+  Positive,
+  Negative,
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::OverflowException (thrown by some numeric converters)
+// kind_ : Type of overflow, positive or negative.
+//
+class OverflowException : public plx::Exception {
+  plx::OverflowKind kind_;
+
+public:
+  OverflowException(int line, plx::OverflowKind kind)
+      : Exception(line, "Overflow"), kind_(kind) {
+    PostCtor();
+  }
+  plx::OverflowKind kind() const { return kind_; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::NextInt  integer promotion.
+
+short NextInt(char value) ;
+
+int NextInt(short value) ;
+
+long long NextInt(int value) ;
+
+long long NextInt(long value) ;
+
+long long NextInt(long long value) ;
+
+short NextInt(unsigned char value) ;
+
+int NextInt(unsigned short value) ;
+
+long long NextInt(unsigned int value) ;
+
+long long NextInt(unsigned long value) ;
+
+long long NextInt(unsigned long long value) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::To  (integer to integer type safe cast)
+//
+
+template <bool src_signed, bool tgt_signed>
+struct ToCastHelper;
+
+template <>
+struct ToCastHelper<false, false> {
+  template <typename Tgt, typename Src>
+  static inline Tgt cast(Src value) {
+    if (sizeof(Tgt) >= sizeof(Src)) {
+      return static_cast<Tgt>(value);
+    } else {
+      if (value > std::numeric_limits<Tgt>::max())
+        throw plx::OverflowException(__LINE__, OverflowKind::Positive);
+      if (value < std::numeric_limits<Tgt>::min())
+        throw plx::OverflowException(__LINE__, OverflowKind::Negative);
+      return static_cast<Tgt>(value);
+    }
+  }
+};
+
+template <>
+struct ToCastHelper<true, true> {
+  template <typename Tgt, typename Src>
+  static inline Tgt cast(Src value) {
+    if (sizeof(Tgt) >= sizeof(Src)) {
+      return static_cast<Tgt>(value);
+    } else {
+      if (value > std::numeric_limits<Tgt>::max())
+        throw plx::OverflowException(__LINE__, OverflowKind::Positive);
+      if (value < std::numeric_limits<Tgt>::min())
+        throw plx::OverflowException(__LINE__, OverflowKind::Negative);
+      return static_cast<Tgt>(value);
+    }
+  }
+};
+
+template <>
+struct ToCastHelper<false, true> {
+  template <typename Tgt, typename Src>
+  static inline Tgt cast(Src value) {
+    if (plx::NextInt(value) > std::numeric_limits<Tgt>::max())
+      throw plx::OverflowException(__LINE__, OverflowKind::Positive);
+    if (plx::NextInt(value) < std::numeric_limits<Tgt>::min())
+      throw plx::OverflowException(__LINE__, OverflowKind::Negative);
+    return static_cast<Tgt>(value);
+  }
+};
+
+template <>
+struct ToCastHelper<true, false> {
+  template <typename Tgt, typename Src>
+  static inline Tgt cast(Src value) {
+    if (value < Src(0))
+      throw plx::OverflowException(__LINE__, OverflowKind::Negative);
+    if (unsigned(value) > std::numeric_limits<Tgt>::max())
+      throw plx::OverflowException(__LINE__, OverflowKind::Positive);
+    return static_cast<Tgt>(value);
+  }
+};
+
+template <typename Tgt, typename Src>
+typename std::enable_if<
+    std::numeric_limits<Tgt>::is_integer &&
+    std::numeric_limits<Src>::is_integer,
+    Tgt>::type
+To(const Src & value) {
+  return ToCastHelper<std::numeric_limits<Src>::is_signed,
+                      std::numeric_limits<Tgt>::is_signed>::template cast<Tgt>(value);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SkipWhitespace (advances a range as long isspace() is false.
+//
+template <typename T>
+typename std::enable_if<
+    sizeof(T) == 1,
+    plx::Range<T>>::type
+SkipWhitespace(const plx::Range<T>& r) {
+  auto wr = r;
+  while (!wr.empty()) {
+    if (!std::isspace(wr.front()))
+      break;
+    wr.advance(1);
+  }
+  return wr;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::DecodeString (decodes a json-style encoded string)
+//
+std::string DecodeString(plx::Range<const char>& range) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::ParseJsonValue (converts a JSON string into a JsonValue)
+//
+plx::JsonValue ParseJsonValue(plx::Range<const char>& range);
+
+plx::JsonValue ParseJsonValue(plx::Range<const char>& range) ;
+
+}
+
+// the bounded sprintf of msvc that the plx_*.cpp files use.
+#define _TRUNCATE (static_cast<size_t>(-1))
+
+template <size_t count, typename... Args>
+int _snprintf_s(char (&buf)[count], size_t, const char* fmt, Args... args) {
+  auto len = snprintf(buf, count, fmt, args...);
+  return (len < 0 || static_cast<size_t>(len) >= count) ? -1 : len;
+}
+
+// and its conversions with an explicit locale, only for LC_NUMERIC.
+typedef locale_t _locale_t;
+
+inline _locale_t _create_locale(int, const char* name) {
+  return newlocale(LC_NUMERIC_MASK, name, static_cast<locale_t>(0));
+}
+
+inline double _strtod_l(const char* str, char** end, _locale_t locale) {
+  return strtod_l(str, end, locale);
+}
+
+template <typename... Args>
+int _snprintf_s_l(char* buf, size_t size, size_t, const char* fmt,
+                  _locale_t locale, Args... args) {
+  auto previous = uselocale(locale);
+  auto len = snprintf(buf, size, fmt, args...);
+  uselocale(previous);
+  return (len < 0 || static_cast<size_t>(len) >= size) ? -1 : len;
+}
@@ -0,0 +1,459 @@
+// plx_segments.cpp : see plx_segments.h.
+
+#include "plx_segments.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+#include <sys/statvfs.h>
+#endif
+
+namespace plx {
+namespace SegmentsImp {
+const wchar_t kJournal[] = L"segments.journal";
+
+// Record: op, creation, size, name length, name in wchar_t units, which
+// is utf16 on windows.
+void SerializeRecord(uint8_t op, const SegmentIndex::Segment& seg, std::vector<uint8_t>& out) {
+  auto name_len = plx::To<uint16_t>(seg.name.size());
+  out.push_back(op);
+  auto pos = out.size();
+  out.resize(pos + sizeof(seg.creation_ns1600) + sizeof(seg.size) +
+             sizeof(name_len) + (name_len * sizeof(wchar_t)));
+  auto p = &out[pos];
+  memcpy(p, &seg.creation_ns1600, sizeof(seg.creation_ns1600));
+  p += sizeof(seg.creation_ns1600);
+  memcpy(p, &seg.size, sizeof(seg.size));
+  p += sizeof(seg.size);
+  memcpy(p, &name_len, sizeof(name_len));
+  p += sizeof(name_len);
+  if (name_len)
+    memcpy(p, seg.name.c_str(), name_len * sizeof(wchar_t));
+}
+
+bool IsSegment(const std::wstring& name) {
+  return !name.empty() && (name.back() == L'4');
+}
+}
+
+#if defined(_WIN32)
+
+LocalFolder::LocalFolder(const std::wstring& dir) : dir_(dir) {
+}
+
+bool LocalFolder::list(std::vector<Entry>& entries) {
+  entries.clear();
+  try {
+    files_.read(dir_);
+  } catch (plx::IOException&) {
+    // the folder is gone or not there yet.
+    return false;
+  }
+  for (files_.first(); !files_.done(); files_.next()) {
+    if (files_.is_directory())
+      continue;
+    Entry entry = {
+      plx::WideStringFromRange(files_.file_name()),
+      files_.creation_ns1600(),
+      files_.size_in_bytes()
+    };
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+bool LocalFolder::stat(const std::wstring& name, Entry& entry) {
+  WIN32_FILE_ATTRIBUTE_DATA fad;
+  if (!::GetFileAttributesExW(path(name).raw(), GetFileExInfoStandard, &fad))
+    return false;
+  entry.name = name;
+  entry.creation_ns1600 = (static_cast<long long>(fad.ftCreationTime.dwHighDateTime) << 32) |
+                          fad.ftCreationTime.dwLowDateTime;
+  entry.size = (static_cast<long long>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+  return true;
+}
+
+bool LocalFolder::rename(const std::wstring& from, const std::wstring& to) {
+  return ::MoveFileW(path(from).raw(), path(to).raw()) ? true : false;
+}
+
+SegmentFolder::Removed LocalFolder::remove(const std::wstring& name) {
+  if (::DeleteFileW(path(name).raw()))
+    return Removed::yes;
+  return (::GetLastError() == ERROR_FILE_NOT_FOUND) ? Removed::missing : Removed::busy;
+}
+
+bool LocalFolder::read(const std::wstring& name, std::vector<uint8_t>& data) {
+  auto file = plx::File::Create(
+      path(name), plx::FileParams::Read_SharedRead(), plx::FileSecurity());
+  if (!file.is_valid())
+    return false;
+  data.resize(plx::To<size_t>(file.size_in_bytes()));
+  return data.empty() || (file.read(&data[0], data.size(), 0) == data.size());
+}
+
+bool LocalFolder::append(const std::wstring& name, const std::vector<uint8_t>& data) {
+  auto file = plx::File::Create(
+      path(name), plx::FileParams::Append_SharedRead(), plx::FileSecurity());
+  if (!file.is_valid())
+    return false;
+  return file.write(plx::RangeFromVector(data)) == data.size();
+}
+
+// The new contents are written and flushed next to the old ones and then
+// moved over them.
+bool LocalFolder::replace(const std::wstring& name, const std::vector<uint8_t>& data) {
+  auto tmp_path = path(name + L".tmp");
+  HANDLE tmp = ::CreateFileW(tmp_path.raw(), GENERIC_WRITE, 0, nullptr,
+                             CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (tmp == INVALID_HANDLE_VALUE)
+    return false;
+  DWORD written = 0;
+  auto ok = data.empty() ||
+      (::WriteFile(tmp, &data[0], plx::To<DWORD>(data.size()), &written, nullptr) &&
+       (written == data.size()));
+  ok = ok && ::FlushFileBuffers(tmp);
+  ::CloseHandle(tmp);
+  if (!ok || !::MoveFileExW(tmp_path.raw(), path(name).raw(),
+                            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    ::DeleteFileW(tmp_path.raw());
+    return false;
+  }
+  return true;
+}
+
+long long LocalFolder::free_bytes() {
+  ULARGE_INTEGER avail = {0};
+  if (!::GetDiskFreeSpaceExW(dir_.raw(), &avail, nullptr, nullptr))
+    return -1LL;
+  return static_cast<long long>(avail.QuadPart);
+}
+
+#else
+
+LocalFolder::LocalFolder(const std::wstring& dir)
+    : dir_(plx::UTF8FromWide(plx::Range<const wchar_t>(dir.data(), dir.data() + dir.size()))) {
+}
+
+std::string LocalFolder::path(const std::wstring& name) const {
+  return dir_ + "/" +
+      plx::UTF8FromWide(plx::Range<const wchar_t>(name.data(), name.data() + name.size()));
+}
+
+bool LocalFolder::list(std::vector<Entry>& entries) {
+  entries.clear();
+  auto dir_fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    return false;
+  try {
+    files_.read(dir_fd);
+  } catch (plx::IOException&) {
+    ::close(dir_fd);
+    return false;
+  }
+  for (files_.first(); !files_.done(); files_.next()) {
+    if (files_.is_directory())
+      continue;
+    auto name = files_.file_name();
+    Entry entry = {
+      plx::WideFromUTF8(plx::Range<const uint8_t>(
+          reinterpret_cast<const uint8_t*>(name.start()),
+          reinterpret_cast<const uint8_t*>(name.end())), false),
+      files_.creation_ns1600(),
+      files_.size_in_bytes()
+    };
+    entries.push_back(entry);
+  }
+  ::close(dir_fd);
+  return true;
+}
+
+bool LocalFolder::stat(const std::wstring& name, Entry& entry) {
+  struct statx stx;
+  if (::statx(AT_FDCWD, path(name).c_str(), AT_SYMLINK_NOFOLLOW,
+              STATX_SIZE | STATX_MTIME | STATX_BTIME, &stx) != 0)
+    return false;
+  auto& t = (stx.stx_mask & STATX_BTIME) ? stx.stx_btime : stx.stx_mtime;
+  entry.name = name;
+  entry.creation_ns1600 = ((t.tv_sec + 11644473600LL) * 10000000LL) + (t.tv_nsec / 100);
+  entry.size = static_cast<long long>(stx.stx_size);
+  return true;
+}
+
+bool LocalFolder::rename(const std::wstring& from, const std::wstring& to) {
+  return ::renameat2(AT_FDCWD, path(from).c_str(),
+                     AT_FDCWD, path(to).c_str(), RENAME_NOREPLACE) == 0;
+}
+
+SegmentFolder::Removed LocalFolder::remove(const std::wstring& name) {
+  if (::unlink(path(name).c_str()) == 0)
+    return Removed::yes;
+  return (errno == ENOENT) ? Removed::missing : Removed::busy;
+}
+
+bool LocalFolder::read(const std::wstring& name, std::vector<uint8_t>& data) {
+  auto fd = ::open(path(name).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  auto ok = ::fstat(fd, &st) == 0;
+  data.resize(ok ? static_cast<size_t>(st.st_size) : 0);
+  size_t done = 0;
+  while (ok && (done != data.size())) {
+    auto count = ::read(fd, &data[done], data.size() - done);
+    ok = count > 0;
+    done += ok ? count : 0;
+  }
+  ::close(fd);
+  return ok;
+}
+
+bool LocalFolder::append(const std::wstring& name, const std::vector<uint8_t>& data) {
+  auto fd = ::open(path(name).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  auto ok = data.empty() ||
+      (::write(fd, &data[0], data.size()) == static_cast<ssize_t>(data.size()));
+  ::close(fd);
+  return ok;
+}
+
+// The new contents are written and synced next to the old ones and then
+// renamed over them, the folder is synced so the rename sticks.
+bool LocalFolder::replace(const std::wstring& name, const std::vector<uint8_t>& data) {
+  auto tmp_path = path(name + L".tmp");
+  auto fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  auto ok = data.empty() ||
+      (::write(fd, &data[0], data.size()) == static_cast<ssize_t>(data.size()));
+  ok = ok && (::fsync(fd) == 0);
+  ::close(fd);
+  if (!ok || (::rename(tmp_path.c_str(), path(name).c_str()) != 0)) {
+    ::unlink(tmp_path.c_str());
+    return false;
+  }
+  auto dir_fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+long long LocalFolder::free_bytes() {
+  struct statvfs vfs;
+  if (::statvfs(dir_.c_str(), &vfs) != 0)
+    return -1LL;
+  return static_cast<long long>(vfs.f_bavail) * static_cast<long long>(vfs.f_frsize);
+}
+
+#endif
+
+bool SegmentIndex::load() {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto replayed = replay_journal();
+  if (!replayed)
+    rescan_impl();
+  compact_journal();
+  return replayed;
+}
+
+void SegmentIndex::rescan() {
+  std::lock_guard<std::mutex> lock(lock_);
+  rescan_impl();
+  compact_journal();
+}
+
+void SegmentIndex::open_segment(const std::wstring& name) {
+  std::lock_guard<std::mutex> lock(lock_);
+  active_.push_back(name);
+}
+
+std::wstring SegmentIndex::close_segment(const std::wstring& name,
+                                         const std::wstring& final_name) {
+  if (name.empty())
+    return name;
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = std::find(begin(active_), end(active_), name);
+  if (it != end(active_))
+    active_.erase(it);
+
+  auto closed = name;
+  if (!final_name.empty() && (final_name != name)) {
+    if (folder_->rename(name, final_name))
+      closed = final_name;
+  }
+  Segment seg;
+  if (!folder_->stat(closed, seg))
+    return closed;
+  segments_.push_back(seg);
+  total_bytes_ += seg.size;
+  bytes_added_ += seg.size;
+  append_record(kOpAdd, seg);
+  return closed;
+}
+
+long long SegmentIndex::bytes_added() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return bytes_added_;
+}
+
+size_t SegmentIndex::count() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return segments_.size();
+}
+
+long long SegmentIndex::total_bytes() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return total_bytes_;
+}
+
+std::vector<SegmentIndex::Segment> SegmentIndex::segments() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return std::vector<Segment>(begin(segments_), end(segments_));
+}
+
+bool SegmentIndex::evict_oldest(long long* reclaimed) {
+  auto& seg = segments_.front();
+  auto removed = folder_->remove(seg.name);
+  // Somebody else has it open, try again next pass.
+  if (removed == SegmentFolder::Removed::busy)
+    return false;
+  if (removed == SegmentFolder::Removed::yes)
+    *reclaimed += seg.size;
+  folder_->remove(seg.name + L".json");
+  append_record(kOpRemove, seg);
+  total_bytes_ -= seg.size;
+  segments_.pop_front();
+  return true;
+}
+
+void SegmentIndex::append_record(uint8_t op, const Segment& seg) {
+  std::vector<uint8_t> rec;
+  SegmentsImp::SerializeRecord(op, seg, rec);
+  if (folder_->append(SegmentsImp::kJournal, rec))
+    ++journal_records_;
+}
+
+// Rewrites the journal with only the live segments. A crash leaves the old
+// journal or the new one but never a truncated one.
+void SegmentIndex::compact_journal() {
+  std::vector<uint8_t> data;
+  for (auto& seg : segments_)
+    SegmentsImp::SerializeRecord(kOpAdd, seg, data);
+  // the old journal is still good, compact again next time.
+  if (folder_->replace(SegmentsImp::kJournal, data))
+    journal_records_ = segments_.size();
+}
+
+// Returns false if there is no journal or it is damaged.
+bool SegmentIndex::replay_journal() {
+  std::vector<uint8_t> data;
+  if (!folder_->read(SegmentsImp::kJournal, data))
+    return false;
+
+  segments_.clear();
+  total_bytes_ = 0;
+  const auto size = data.size();
+  size_t pos = 0;
+  const size_t header = 1 + 8 + 8 + 2;
+  while (pos != size) {
+    if (size - pos < header)
+      return false;
+    Segment seg;
+    auto op = data[pos];
+    memcpy(&seg.creation_ns1600, &data[pos + 1], 8);
+    memcpy(&seg.size, &data[pos + 9], 8);
+    uint16_t name_len;
+    memcpy(&name_len, &data[pos + 17], 2);
+    pos += header;
+    if (size - pos < name_len * sizeof(wchar_t))
+      return false;
+    seg.name.resize(name_len);
+    if (name_len)
+      memcpy(&seg.name[0], &data[pos], name_len * sizeof(wchar_t));
+    pos += name_len * sizeof(wchar_t);
+
+    if (op == kOpAdd) {
+      segments_.push_back(seg);
+      total_bytes_ += seg.size;
+    } else if (op == kOpRemove) {
+      // Removals are almost always of the oldest segment.
+      auto it = std::find_if(begin(segments_), end(segments_),
+          [&seg](const Segment& s) { return s.name == seg.name; });
+      if (it != end(segments_)) {
+        total_bytes_ -= it->size;
+        segments_.erase(it);
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SegmentIndex::rescan_impl() {
+  if (!folder_->list(listing_))
+    return;
+  std::vector<Segment> found;
+  for (auto& entry : listing_) {
+    if (!SegmentsImp::IsSegment(entry.name))
+      continue;
+    if (std::find(begin(active_), end(active_), entry.name) != end(active_))
+      continue;
+    found.push_back(entry);
+  }
+  std::sort(begin(found), end(found), [](const Segment& a, const Segment& b) {
+    return a.creation_ns1600 < b.creation_ns1600;
+  });
+  segments_.assign(begin(found), end(found));
+  total_bytes_ = 0;
+  for (auto& seg : segments_)
+    total_bytes_ += seg.size;
+}
+
+RetentionEngine::Result RetentionEngine::run(SegmentIndex* index, int64_t lookahead_secs,
+                                             const Limits& limits,
+                                             long long now_ns1600, uint64_t now_ms) {
+  update_write_rate(index, now_ms);
+
+  Result result = { 0LL, folder_->free_bytes(), write_rate_, -1.0 };
+  // What we expect to write before the next pass must fit as well.
+  const long long reserve = limits.min_free_bytes ?
+      limits.min_free_bytes + static_cast<long long>(write_rate_ * lookahead_secs) : 0LL;
+  const long long max_age = limits.max_age_hours * 3600LL * 10000000LL;
+  const long long free_bytes = result.free_bytes;
+
+  result.reclaimed = index->evict_while(
+      [&](const SegmentIndex::Segment& oldest, size_t count,
+          long long total_bytes, long long reclaimed) -> bool {
+    if (limits.keep_file_count && (plx::To<int64_t>(count) > limits.keep_file_count))
+      return true;
+    if (limits.max_bytes && (total_bytes > limits.max_bytes))
+      return true;
+    if (reserve && (free_bytes >= 0) && ((free_bytes + reclaimed) < reserve))
+      return true;
+    if (max_age && ((now_ns1600 - oldest.creation_ns1600) > max_age))
+      return true;
+    return false;
+  });
+
+  if (result.free_bytes >= 0)
+    result.free_bytes += result.reclaimed;
+  if ((write_rate_ > 0.0) && (result.free_bytes > limits.min_free_bytes))
+    result.secs_to_full = (result.free_bytes - limits.min_free_bytes) / write_rate_;
+  return result;
+}
+
+void RetentionEngine::update_write_rate(SegmentIndex* index, uint64_t now_ms) {
+  auto added = index->bytes_added();
+  if ((last_added_ >= 0) && (now_ms > last_pass_ms_)) {
+    double rate = (added - last_added_) * 1000.0 / (now_ms - last_pass_ms_);
+    // smooth it a bit, segments close in bursts.
+    write_rate_ = (write_rate_ == 0.0) ? rate : (0.7 * write_rate_) + (0.3 * rate);
+  }
+  last_added_ = added;
+  last_pass_ms_ = now_ms;
+}
+
+}
@@ -0,0 +1,226 @@
+// plx_segments.h : the index of the recorded segments of a folder and the
+// retention limits applied to it. The file system comes in through
+// plx::SegmentFolder, plx::LocalFolder is the real one and the unit tests
+// in tests/ bring one that lives in memory.
+
+#pragma once
+
+#include "plx_io.h"
+
+#include <deque>
+
+namespace plx {
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::SegmentFolder : the file operations on one folder that the segment
+// index needs. Names are relative to the folder.
+// list() : every file in it, false if it cannot be listed.
+// stat() : false if |name| is not there.
+// rename() : fails if |to| is taken.
+// remove() : busy if |name| is there but cannot go, for example because
+//   somebody has it open.
+// read() : the whole file, false if it is not there.
+// append() : makes the file if needed.
+// replace() : |name| ends up holding |data| or stays as it was, also if
+//   the process or the machine dies halfway.
+// free_bytes() : what the volume has left for us, -1 if it is unknown.
+//
+class SegmentFolder {
+public:
+  struct Entry {
+    std::wstring name;
+    long long creation_ns1600;
+    long long size;
+  };
+
+  enum class Removed {
+    yes,
+    missing,
+    busy
+  };
+
+  virtual ~SegmentFolder() {}
+  virtual bool list(std::vector<Entry>& entries) = 0;
+  virtual bool stat(const std::wstring& name, Entry& entry) = 0;
+  virtual bool rename(const std::wstring& from, const std::wstring& to) = 0;
+  virtual Removed remove(const std::wstring& name) = 0;
+  virtual bool read(const std::wstring& name, std::vector<uint8_t>& data) = 0;
+  virtual bool append(const std::wstring& name, const std::vector<uint8_t>& data) = 0;
+  virtual bool replace(const std::wstring& name, const std::vector<uint8_t>& data) = 0;
+  virtual long long free_bytes() = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::LocalFolder : plx::SegmentFolder on the folder at |dir|. On linux
+// the names are utf8 on disk and the creation time is the birth time if
+// the file system keeps it, else the last write, like plx::DirEntries.
+//
+class LocalFolder : public SegmentFolder {
+#if defined(_WIN32)
+  const plx::FilePath dir_;
+#else
+  const std::string dir_;
+#endif
+  // kept so listings reuse their memory.
+  plx::DirEntries files_;
+
+  LocalFolder(const LocalFolder&) = delete;
+  LocalFolder& operator=(const LocalFolder&) = delete;
+
+public:
+  explicit LocalFolder(const std::wstring& dir) ;
+
+  bool list(std::vector<Entry>& entries) override ;
+  bool stat(const std::wstring& name, Entry& entry) override ;
+  bool rename(const std::wstring& from, const std::wstring& to) override ;
+  Removed remove(const std::wstring& name) override ;
+  bool read(const std::wstring& name, std::vector<uint8_t>& data) override ;
+  bool append(const std::wstring& name, const std::vector<uint8_t>& data) override ;
+  bool replace(const std::wstring& name, const std::vector<uint8_t>& data) override ;
+  long long free_bytes() override ;
+
+private:
+#if defined(_WIN32)
+  plx::FilePath path(const std::wstring& name) const {
+    return dir_.append(name);
+  }
+#else
+  std::string path(const std::wstring& name) const ;
+#endif
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::SegmentIndex : the closed segments of a folder, oldest first, so the
+// cleaner does not need to list the folder. Segments are the files whose
+// name ends in '4', each one can have a |name|.json sidecar. Every change
+// is appended to segments.journal in the same folder, load() replays it.
+// A full listing only happens when the journal is missing or damaged and
+// from time to time to fix drift, like files deleted by hand. |folder|
+// has to outlive the index. All the methods can be called from any thread.
+//
+class SegmentIndex {
+public:
+  typedef SegmentFolder::Entry Segment;
+
+private:
+  static const uint8_t kOpAdd = 1;
+  static const uint8_t kOpRemove = 2;
+
+  SegmentFolder* const folder_;
+  std::mutex lock_;
+  std::deque<Segment> segments_;
+  // segments being written, never evicted or picked up by a listing.
+  std::vector<std::wstring> active_;
+  long long total_bytes_;
+  // all the bytes ever added, used to compute the write rate.
+  long long bytes_added_;
+  size_t journal_records_;
+  std::vector<SegmentFolder::Entry> listing_;
+
+  SegmentIndex(const SegmentIndex&) = delete;
+  SegmentIndex& operator=(const SegmentIndex&) = delete;
+
+public:
+  explicit SegmentIndex(SegmentFolder* folder)
+      : folder_(folder), total_bytes_(0LL), bytes_added_(0LL), journal_records_(0) {
+  }
+
+  // Returns false if the journal was missing or damaged and the folder
+  // had to be listed instead.
+  bool load() ;
+
+  // Reconciles the index with the folder contents.
+  void rescan() ;
+
+  void open_segment(const std::wstring& name) ;
+
+  // The segment is complete. If the file does not exist, for example the
+  // writer was discarded, it is just forgotten. It is renamed to
+  // |final_name| unless that is empty or taken. Returns the name it ends
+  // up with.
+  std::wstring close_segment(const std::wstring& name,
+                             const std::wstring& final_name = std::wstring()) ;
+
+  // Deletes the oldest segment and its sidecar while
+  // |should_evict(oldest, count, total_bytes, reclaimed)| returns true.
+  // Each eviction is O(1). Stops at a segment that cannot be deleted.
+  // Returns the bytes reclaimed.
+  template <typename Pred>
+  long long evict_while(Pred should_evict) {
+    std::lock_guard<std::mutex> lock(lock_);
+    long long reclaimed = 0;
+    while (!segments_.empty()) {
+      if (!should_evict(segments_.front(), segments_.size(), total_bytes_, reclaimed))
+        break;
+      if (!evict_oldest(&reclaimed))
+        break;
+    }
+    if (journal_records_ > (2 * segments_.size()) + 64)
+      compact_journal();
+    return reclaimed;
+  }
+
+  long long bytes_added() ;
+  size_t count() ;
+  long long total_bytes() ;
+  // A copy of the segments, oldest first.
+  std::vector<Segment> segments() ;
+
+private:
+  bool evict_oldest(long long* reclaimed) ;
+  void append_record(uint8_t op, const Segment& seg) ;
+  void compact_journal() ;
+  bool replay_journal() ;
+  void rescan_impl() ;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::RetentionEngine : applies all the retention limits in one pass over
+// the index: file count, total bytes, minimum free space and maximum age, a
+// zero limit is off. The write rate is measured between passes so the free
+// space limit can evict ahead of the disk filling up before the next pass.
+// The free space comes from the index folder and the time from the caller,
+// |now_ns1600| is the wall clock and |now_ms| a monotonic one.
+//
+class RetentionEngine {
+public:
+  struct Limits {
+    int64_t keep_file_count;
+    int64_t max_bytes;
+    int64_t min_free_bytes;
+    int64_t max_age_hours;
+  };
+
+  struct Result {
+    long long reclaimed;
+    long long free_bytes;   // -1 if unknown.
+    double write_rate;      // bytes per second.
+    double secs_to_full;    // negative if unknown.
+  };
+
+private:
+  SegmentFolder* const folder_;
+  long long last_added_;
+  uint64_t last_pass_ms_;
+  double write_rate_;
+
+public:
+  explicit RetentionEngine(SegmentFolder* folder)
+      : folder_(folder),
+        last_added_(-1LL),
+        last_pass_ms_(0ULL),
+        write_rate_(0.0) {
+  }
+
+  // |lookahead_secs| is how long until the next pass.
+  Result run(SegmentIndex* index, int64_t lookahead_secs, const Limits& limits,
+             long long now_ns1600, uint64_t now_ms) ;
+
+private:
+  void update_write_rate(SegmentIndex* index, uint64_t now_ms) ;
+};
+
+}
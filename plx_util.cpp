@@ -0,0 +1,436 @@
+// plx_util.cpp : see plx_util.h.
+
+#include "plx_util.h"
+
+namespace plx {
+namespace FormatImp {
+struct Spec {
+  bool left;
+  bool zero;
+  size_t width;
+  int precision;
+  char conversion;
+};
+
+// parses what follows a '%' up to and including the conversion.
+const char* ParseSpec(const char* f, Spec& spec) {
+  spec.left = false;
+  spec.zero = false;
+  spec.width = 0;
+  spec.precision = -1;
+  for (;; ++f) {
+    if (*f == '-')
+      spec.left = true;
+    else if (*f == '0')
+      spec.zero = true;
+    else
+      break;
+  }
+  while ((*f >= '0') && (*f <= '9'))
+    spec.width = (spec.width * 10) + (*f++ - '0');
+  if (*f == '.') {
+    spec.precision = 0;
+    ++f;
+    while ((*f >= '0') && (*f <= '9'))
+      spec.precision = (spec.precision * 10) + (*f++ - '0');
+  }
+  while ((*f == 'l') || (*f == 'h') || (*f == 'z') || (*f == 'I') ||
+         (*f == '6') || (*f == '4'))
+    ++f;
+  spec.conversion = *f;
+  return *f ? f + 1 : f;
+}
+
+// appends |s| padded to the width, zeros go after a leading sign.
+void Pad(plx::FormatOut& out, const Spec& spec, const char* s, size_t len, bool zeros) {
+  if (len >= spec.width) {
+    out.append(s, len);
+  } else if (spec.left) {
+    out.append(s, len);
+    out.append(spec.width - len, ' ');
+  } else if (zeros && spec.zero) {
+    size_t sign = ((len != 0) && (*s == '-')) ? 1 : 0;
+    out.append(s, sign);
+    out.append(spec.width - len, '0');
+    out.append(s + sign, len - sign);
+  } else {
+    out.append(spec.width - len, ' ');
+    out.append(s, len);
+  }
+}
+
+void Integer(plx::FormatOut& out, const Spec& spec, const plx::FormatArg& arg) {
+  char digits[24];
+  auto end = digits + sizeof(digits);
+  auto p = end;
+  bool negative = (arg.kind != plx::FormatArg::uint) && (arg.i < 0);
+  uint64_t mag = negative ? (0ULL - arg.u) : arg.u;
+  if ((spec.conversion == 'x') || (spec.conversion == 'X')) {
+    const char* hex = (spec.conversion == 'x') ? "0123456789abcdef" : "0123456789ABCDEF";
+    mag = arg.u;
+    negative = false;
+    do {
+      *--p = hex[mag & 0xF];
+      mag >>= 4;
+    } while (mag);
+  } else {
+    do {
+      *--p = static_cast<char>('0' + (mag % 10));
+      mag /= 10;
+    } while (mag);
+  }
+  if (negative)
+    *--p = '-';
+  Pad(out, spec, p, end - p, true);
+}
+
+void Double(plx::FormatOut& out, const Spec& spec, double v) {
+  char fmt[] = { '%', '.', '*', spec.conversion, 0 };
+  int precision = (spec.precision < 0) ? 6 : std::min(spec.precision, 40);
+  // %f of the largest double is a bit over 300 digits.
+  char buf[400];
+#if defined(_MSC_VER)
+  auto len = _snprintf_s(buf, _TRUNCATE, fmt, precision, v);
+#else
+  auto len = snprintf(buf, sizeof(buf), fmt, precision, v);
+#endif
+  if (len < 0)
+    len = 0;
+  Pad(out, spec, buf, std::min(static_cast<size_t>(len), sizeof(buf) - 1), std::isfinite(v));
+}
+}
+void FormatArgs(plx::FormatOut& out, const char* fmt,
+                const plx::FormatArg* args, size_t count) {
+  size_t next = 0;
+  while (*fmt) {
+    auto pct = strchr(fmt, '%');
+    if (!pct) {
+      out.append(fmt, strlen(fmt));
+      break;
+    }
+    out.append(fmt, pct - fmt);
+    if (pct[1] == '%') {
+      out.append(1, '%');
+      fmt = pct + 2;
+      continue;
+    }
+    FormatImp::Spec spec;
+    fmt = FormatImp::ParseSpec(pct + 1, spec);
+    if (next == count)
+      throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+    auto& arg = args[next];
+    bool integer = (arg.kind == plx::FormatArg::sint) || (arg.kind == plx::FormatArg::uint) ||
+                   (arg.kind == plx::FormatArg::chr);
+    switch (spec.conversion) {
+      case 'd': case 'i': case 'u': case 'x': case 'X':
+        if (!integer)
+          throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+        FormatImp::Integer(out, spec, arg);
+        break;
+      case 'c': {
+        if (!integer)
+          throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+        char c = static_cast<char>(arg.i);
+        FormatImp::Pad(out, spec, &c, 1, false);
+        break;
+      }
+      case 'f': case 'e': case 'g': case 'E': case 'G':
+        if (arg.kind == plx::FormatArg::str)
+          throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+        FormatImp::Double(out, spec,
+            (arg.kind == plx::FormatArg::dbl) ? arg.d :
+            (arg.kind == plx::FormatArg::uint) ? static_cast<double>(arg.u) :
+                                                 static_cast<double>(arg.i));
+        break;
+      case 's':
+        if (arg.kind == plx::FormatArg::str) {
+          auto len = arg.len;
+          if ((spec.precision >= 0) && (static_cast<size_t>(spec.precision) < len))
+            len = spec.precision;
+          FormatImp::Pad(out, spec, arg.s, len, false);
+        } else if (arg.kind == plx::FormatArg::chr) {
+          char c = static_cast<char>(arg.i);
+          FormatImp::Pad(out, spec, &c, 1, false);
+        } else if (arg.kind == plx::FormatArg::dbl) {
+          spec.conversion = 'g';
+          FormatImp::Double(out, spec, arg.d);
+        } else {
+          spec.conversion = 'd';
+          FormatImp::Integer(out, spec, arg);
+        }
+        break;
+      default:
+        throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+    }
+    ++next;
+  }
+  if (next != count)
+    throw plx::InvalidParamException(__LINE__, static_cast<int>(next));
+}
+std::string PrintfToString(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  // measure on a copy, |args| is still needed to print.
+  va_list measure;
+  va_copy(measure, args);
+#if defined(_MSC_VER)
+  auto size = _vscprintf(fmt, measure);
+#else
+  auto size = vsnprintf(nullptr, 0, fmt, measure);
+#endif
+  va_end(measure);
+  if (size < 0) {
+    va_end(args);
+    throw plx::InvalidParamException(__LINE__, 1);
+  }
+  std::string out(size + 1, 0);
+  vsnprintf(&out[0], out.size(), fmt, args);
+  va_end(args);
+  out.resize(size);
+  return out;
+}
+size_t LowestBit(unsigned int mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+namespace ClockImp {
+#if defined(_WIN32)
+int64_t QpcFrequency() {
+  LARGE_INTEGER li;
+  ::QueryPerformanceFrequency(&li);
+  return li.QuadPart;
+}
+#else
+int64_t QpcFrequency() {
+  return 1000000000LL;
+}
+#endif
+
+const int64_t qpc_frequency = QpcFrequency();
+}
+int64_t QpcNow() {
+#if defined(_WIN32)
+  LARGE_INTEGER li;
+  ::QueryPerformanceCounter(&li);
+  return li.QuadPart;
+#else
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (static_cast<int64_t>(ts.tv_sec) * 1000000000LL) + ts.tv_nsec;
+#endif
+}
+int64_t QpcToNanos(int64_t ticks) {
+  // split so ticks * 1e9 does not overflow after a few days of uptime.
+  const int64_t freq = ClockImp::qpc_frequency;
+  return ((ticks / freq) * 1000000000LL) + (((ticks % freq) * 1000000000LL) / freq);
+}
+namespace Utf8Imp {
+const unsigned int kInvalid = 0xFFFFFFFF;
+const unsigned int kReplacement = 0xFFFD;
+#if WCHAR_MAX == 0xFFFF
+// a surrogate pair is two units and four bytes, anything else at most three.
+const size_t kMaxUTF8PerUnit = 3;
+#else
+const size_t kMaxUTF8PerUnit = 4;
+#endif
+
+// |s| points to a byte that is not ascii. Returns the code point and moves
+// |s| past it, or returns kInvalid with |s| past the bytes that could have
+// started a valid sequence.
+unsigned int DecodeSequence(const uint8_t*& s, const uint8_t* e) {
+  unsigned int c = *s++;
+  unsigned int cp;
+  int more;
+  // the second byte is narrower to rule out overlongs, surrogates and
+  // values past U+10FFFF.
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  if ((c >= 0xC2) && (c <= 0xDF)) {
+    cp = c & 0x1F;
+    more = 1;
+  } else if ((c >= 0xE0) && (c <= 0xEF)) {
+    cp = c & 0x0F;
+    more = 2;
+    if (c == 0xE0)
+      lo = 0xA0;
+    else if (c == 0xED)
+      hi = 0x9F;
+  } else if ((c >= 0xF0) && (c <= 0xF4)) {
+    cp = c & 0x07;
+    more = 3;
+    if (c == 0xF0)
+      lo = 0x90;
+    else if (c == 0xF4)
+      hi = 0x8F;
+  } else {
+    return kInvalid;
+  }
+  for (; more; --more) {
+    if ((s == e) || (*s < lo) || (*s > hi))
+      return kInvalid;
+    cp = (cp << 6) | (*s++ & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
+  }
+  return cp;
+}
+
+// Returns the next code point and moves |s| past it. Unpaired surrogates
+// and values that are not unicode come back as U+FFFD. Only a surrogate
+// pair needs to look at |e|, utf32 has none.
+#if WCHAR_MAX == 0xFFFF
+unsigned int ReadUnit(const wchar_t*& s, const wchar_t* e) {
+  auto c = static_cast<unsigned int>(*s++);
+  if ((c >= 0xD800) && (c <= 0xDBFF) && (s != e) && (*s >= 0xDC00) && (*s <= 0xDFFF))
+    return 0x10000 + ((c - 0xD800) << 10) + (*s++ - 0xDC00);
+#else
+unsigned int ReadUnit(const wchar_t*& s, const wchar_t*) {
+  auto c = static_cast<unsigned int>(*s++);
+#endif
+  if (((c >= 0xD800) && (c <= 0xDFFF)) || (c > 0x10FFFF))
+    return kReplacement;
+  return c;
+}
+
+wchar_t* PutUTF16(unsigned int cp, wchar_t* out) {
+#if WCHAR_MAX == 0xFFFF
+  if (cp >= 0x10000) {
+    cp -= 0x10000;
+    *out++ = static_cast<wchar_t>(0xD800 | (cp >> 10));
+    *out++ = static_cast<wchar_t>(0xDC00 | (cp & 0x3FF));
+    return out;
+  }
+#endif
+  *out++ = static_cast<wchar_t>(cp);
+  return out;
+}
+
+char* PutUTF8(unsigned int cp, char* out) {
+  if (cp < 0x80) {
+    *out++ = static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    *out++ = static_cast<char>(0xC0 | (cp >> 6));
+    *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    *out++ = static_cast<char>(0xE0 | (cp >> 12));
+    *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    *out++ = static_cast<char>(0xF0 | (cp >> 18));
+    *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  return out;
+}
+
+// Stores the 16 bytes of |v| as 16 wchar_t.
+void WidenASCII(__m128i v, wchar_t* out) {
+  const __m128i zero = _mm_setzero_si128();
+  auto lo = _mm_unpacklo_epi8(v, zero);
+  auto hi = _mm_unpackhi_epi8(v, zero);
+#if WCHAR_MAX == 0xFFFF
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), lo);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), hi);
+#else
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(lo, zero));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(lo, zero));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(hi, zero));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(hi, zero));
+#endif
+}
+
+// Narrows 16 wchar_t at |s| to bytes in |v|. Returns a mask with a bit set
+// for each unit that is not ascii, only the units before the first such bit
+// are right in |v|.
+unsigned int NarrowASCII(const wchar_t* s, __m128i& v) {
+  auto in = reinterpret_cast<const __m128i*>(s);
+#if WCHAR_MAX == 0xFFFF
+  const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+  auto a = _mm_loadu_si128(in);
+  auto b = _mm_loadu_si128(in + 1);
+  // signed saturation keeps every non zero unit non zero.
+  auto non_ascii = _mm_packs_epi16(_mm_and_si128(a, high), _mm_and_si128(b, high));
+  v = _mm_packus_epi16(a, b);
+#else
+  const __m128i high = _mm_set1_epi32(~0x7F);
+  auto a = _mm_loadu_si128(in);
+  auto b = _mm_loadu_si128(in + 1);
+  auto c = _mm_loadu_si128(in + 2);
+  auto d = _mm_loadu_si128(in + 3);
+  auto non_ascii = _mm_packs_epi16(
+      _mm_packs_epi32(_mm_and_si128(a, high), _mm_and_si128(b, high)),
+      _mm_packs_epi32(_mm_and_si128(c, high), _mm_and_si128(d, high)));
+  v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+#endif
+  auto ascii = _mm_cmpeq_epi8(non_ascii, _mm_setzero_si128());
+  return static_cast<unsigned int>(~_mm_movemask_epi8(ascii)) & 0xFFFF;
+}
+}
+std::wstring WideFromUTF8(const plx::Range<const uint8_t>& utf8, bool strict) {
+  if (utf8.empty())
+      return std::wstring();
+  // never more units than bytes, so convert into the worst case and trim.
+  std::wstring wide(utf8.size(), L'\0');
+  auto s = utf8.start();
+  auto e = utf8.end();
+  auto out = &wide[0];
+  while (s != e) {
+    if ((e - s) >= 16) {
+      // runs of ascii are widened 16 bytes at a time. The store can go past
+      // what is kept but not past the buffer since |out| trails |s|.
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+      auto mask = static_cast<unsigned int>(_mm_movemask_epi8(v));
+      auto ascii = mask ? plx::LowestBit(mask) : 16;
+      Utf8Imp::WidenASCII(v, out);
+      s += ascii;
+      out += ascii;
+      if (!mask)
+        continue;
+    } else if (*s < 0x80) {
+      *out++ = *s++;
+      continue;
+    }
+    auto cp = Utf8Imp::DecodeSequence(s, e);
+    if (cp == Utf8Imp::kInvalid) {
+      if (strict)
+        throw plx::CodecException(__LINE__, nullptr);
+      cp = Utf8Imp::kReplacement;
+    }
+    out = Utf8Imp::PutUTF16(cp, out);
+  }
+  wide.resize(out - &wide[0]);
+  return wide;
+}
+std::string UTF8FromWide(const plx::Range<const wchar_t>& wide) {
+  if (wide.empty())
+      return std::string();
+  std::string utf8(wide.size() * Utf8Imp::kMaxUTF8PerUnit, '\0');
+  auto s = wide.start();
+  auto e = wide.end();
+  auto out = &utf8[0];
+  while (s != e) {
+    if ((e - s) >= 16) {
+      __m128i v;
+      auto mask = Utf8Imp::NarrowASCII(s, v);
+      auto ascii = mask ? plx::LowestBit(mask) : 16;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+      s += ascii;
+      out += ascii;
+      if (!mask)
+        continue;
+    } else if (static_cast<unsigned int>(*s) < 0x80) {
+      *out++ = static_cast<char>(*s++);
+      continue;
+    }
+    out = Utf8Imp::PutUTF8(Utf8Imp::ReadUnit(s, e), out);
+  }
+  utf8.resize(out - &utf8[0]);
+  return utf8;
+}
+}
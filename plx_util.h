@@ -0,0 +1,836 @@
+// plx_util.h : allocators, queues, clocks and text helpers that are not in
+// the plex catalog. Portable, the unit tests in tests/ build them on linux.
+
+#pragma once
+
+#include "plx_base.h"
+
+namespace plx {
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Arena : bump allocator over a list of chunks that double in size.
+// allocate() : uninitialized memory, freed all at once by reset() or the dtor.
+//   nothing allocated here has its destructor called.
+// reset() : forgets every allocation but keeps the largest chunk around so
+//   the next round of allocations usually needs no new chunk. Once a round
+//   fits in one chunk it is constant time.
+// Moving an arena moves the chunks, pointers into them stay valid.
+//
+class Arena {
+  struct Chunk {
+    std::unique_ptr<uint8_t[]> mem;
+    size_t size;
+
+    explicit Chunk(size_t size) : mem(new uint8_t[size]), size(size) {
+    }
+
+    Chunk(Chunk&& other) : mem(std::move(other.mem)), size(other.size) {
+    }
+
+    Chunk& operator=(Chunk&& other) {
+      mem = std::move(other.mem);
+      size = other.size;
+      return *this;
+    }
+  };
+
+  std::vector<Chunk> chunks_;
+  uint8_t* cur_;
+  uint8_t* end_;
+  size_t next_size_;
+  size_t used_;
+
+  static const size_t kMaxChunk = 64 * 1024 * 1024;
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+public:
+  explicit Arena(size_t first_chunk = 4096)
+      : cur_(nullptr),
+        end_(nullptr),
+        next_size_(first_chunk ? first_chunk : 4096),
+        used_(0) {
+  }
+
+  Arena(Arena&& other)
+      : chunks_(std::move(other.chunks_)),
+        cur_(other.cur_),
+        end_(other.end_),
+        next_size_(other.next_size_),
+        used_(other.used_) {
+    other.chunks_.clear();
+    other.cur_ = nullptr;
+    other.end_ = nullptr;
+    other.used_ = 0;
+  }
+
+  Arena& operator=(Arena&& other) {
+    std::swap(chunks_, other.chunks_);
+    std::swap(cur_, other.cur_);
+    std::swap(end_, other.end_);
+    std::swap(next_size_, other.next_size_);
+    std::swap(used_, other.used_);
+    return *this;
+  }
+
+  void* allocate(size_t bytes, size_t align = 8) {
+    auto p = align_up(cur_, align);
+    // aligning can step past the end of the chunk.
+    if (!cur_ || (p > end_) || (bytes > size_t(end_ - p))) {
+      new_chunk(bytes + align);
+      p = align_up(cur_, align);
+    }
+    cur_ = p + bytes;
+    used_ += bytes;
+    return p;
+  }
+
+  template <typename T>
+  T* allocate_array(size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena memory is never destroyed");
+    return reinterpret_cast<T*>(allocate(count * sizeof(T), __alignof(T)));
+  }
+
+  void reset() {
+    if (chunks_.empty())
+      return;
+    auto largest = std::max_element(chunks_.begin(), chunks_.end(),
+        [](const Chunk& a, const Chunk& b) { return a.size < b.size; });
+    if (largest != chunks_.begin())
+      std::swap(*largest, chunks_.front());
+    chunks_.erase(chunks_.begin() + 1, chunks_.end());
+    cur_ = chunks_[0].mem.get();
+    end_ = cur_ + chunks_[0].size;
+    used_ = 0;
+  }
+
+  size_t bytes_used() const {
+    return used_;
+  }
+
+  size_t bytes_reserved() const {
+    size_t total = 0;
+    for (auto& chunk : chunks_)
+      total += chunk.size;
+    return total;
+  }
+
+  size_t chunk_count() const {
+    return chunks_.size();
+  }
+
+private:
+  static uint8_t* align_up(uint8_t* p, size_t align) {
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<uint8_t*>((addr + align - 1) & ~(uintptr_t(align) - 1));
+  }
+
+  void new_chunk(size_t min_size) {
+    auto size = std::max(next_size_, min_size);
+    chunks_.push_back(Chunk(size));
+    cur_ = chunks_.back().mem.get();
+    end_ = cur_ + size;
+    next_size_ = (size < kMaxChunk / 2) ? size * 2 : std::max(size, size_t(kMaxChunk));
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::SpscQueue : bounded, lock-free single producer single consumer ring.
+// slots_ : storage, the size is always a power of two.
+// head_ : count of popped items, only written by the consumer.
+// tail_ : count of pushed items, only written by the producer.
+//
+template <typename T>
+class SpscQueue {
+  std::vector<T> slots_;
+  const size_t mask_;
+  char cache_line_pad0_[64];
+  std::atomic<size_t> head_;
+  char cache_line_pad1_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_;
+  char cache_line_pad2_[64 - sizeof(std::atomic<size_t>)];
+
+  static size_t RoundUpPow2(size_t v) {
+    size_t p = 1;
+    while (p < v)
+      p <<= 1;
+    return p;
+  }
+
+public:
+  explicit SpscQueue(size_t capacity)
+      : slots_(RoundUpPow2(capacity)),
+        mask_(slots_.size() - 1),
+        head_(0),
+        tail_(0) {
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Producer side. Returns false if the queue is full.
+  bool push(T&& value) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+      return false;
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if the queue is empty.
+  bool pop(T& value) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+    value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only a snapshot when called while the other side is active.
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const {
+    return slots_.size();
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::ArenaRing : keeps the most recent frames of a stream in one fixed
+// size arena. The oldest frame is always a keyframe; room is made by
+// dropping whole groups of pictures. Frames are copied once on push and
+// visit() hands out pointers into the arena, so nothing is copied out.
+// arena_ : the frame bytes, each frame is contiguous.
+// records_ : ring of frame descriptors, oldest at |first_|.
+// window_ : how much time to keep, in the units of the timestamps.
+//
+class ArenaRing {
+public:
+  struct Record {
+    size_t offset;
+    size_t size;
+    int64_t time;
+    bool keyframe;
+  };
+
+private:
+  std::vector<uint8_t> arena_;
+  std::vector<Record> records_;
+  size_t first_;
+  size_t count_;
+  size_t head_;   // offset of the oldest frame.
+  size_t tail_;   // one past the newest frame.
+  const int64_t window_;
+  uint64_t dropped_;
+
+  ArenaRing(const ArenaRing&) = delete;
+  ArenaRing& operator=(const ArenaRing&) = delete;
+
+public:
+  ArenaRing(size_t arena_bytes, size_t max_frames, int64_t window)
+      : arena_(arena_bytes),
+        records_(max_frames),
+        first_(0), count_(0), head_(0), tail_(0),
+        window_(window),
+        dropped_(0) {
+    if (!arena_bytes || !max_frames)
+      throw plx::InvalidParamException(__LINE__, 1);
+  }
+
+  // Returns false if the frame was not stored, because it is bigger than
+  // the arena or because the ring is empty and it is not a keyframe.
+  bool push(const plx::Range<const uint8_t>& frame, int64_t time, bool keyframe) {
+    if ((frame.size() > arena_.size()) || (!count_ && !keyframe)) {
+      ++dropped_;
+      return false;
+    }
+    if (count_ == records_.size())
+      drop_gop();
+
+    size_t pos;
+    while (!find_space(frame.size(), &pos))
+      drop_gop();
+    if (!count_ && !keyframe) {
+      // dropping made room by removing everything this frame depends on.
+      ++dropped_;
+      return false;
+    }
+
+    if (frame.size())
+      memcpy(&arena_[pos], frame.start(), frame.size());
+    Record rec = { pos, frame.size(), time, keyframe };
+    records_[(first_ + count_) % records_.size()] = rec;
+    if (!count_)
+      head_ = pos;
+    ++count_;
+    tail_ = pos + frame.size();
+
+    // Trim to the time window, but only if what is left still covers it.
+    size_t next_key;
+    while (find_second_key(&next_key) && ((time - at(next_key).time) >= window_))
+      drop_gop();
+    return true;
+  }
+
+  // Calls |fn(range, time, keyframe)| for each frame, oldest first.
+  template <typename Fn>
+  void visit(Fn fn) const {
+    for (size_t ix = 0; ix != count_; ++ix) {
+      auto& rec = at(ix);
+      auto start = rec.size ? &arena_[rec.offset] : nullptr;
+      fn(plx::Range<const uint8_t>(start, rec.size), rec.time, rec.keyframe);
+    }
+  }
+
+  void clear() {
+    first_ = count_ = head_ = tail_ = 0;
+  }
+
+  size_t frames() const {
+    return count_;
+  }
+
+  int64_t duration() const {
+    return count_ ? at(count_ - 1).time - at(0).time : 0;
+  }
+
+  uint64_t dropped() const {
+    return dropped_;
+  }
+
+  size_t capacity_bytes() const {
+    return arena_.size();
+  }
+
+private:
+  const Record& at(size_t ix) const {
+    return records_[(first_ + ix) % records_.size()];
+  }
+
+  bool find_space(size_t size, size_t* pos) {
+    if (!count_) {
+      head_ = tail_ = 0;
+      *pos = 0;
+      return true;
+    }
+    if (tail_ > head_) {
+      // used space is [head_, tail_), try the end then the start.
+      if (arena_.size() - tail_ >= size) {
+        *pos = tail_;
+        return true;
+      }
+      if (head_ >= size) {
+        *pos = 0;
+        return true;
+      }
+      return false;
+    }
+    // wrapped, free space is [tail_, head_).
+    if (head_ - tail_ >= size) {
+      *pos = tail_;
+      return true;
+    }
+    return false;
+  }
+
+  bool find_second_key(size_t* ix) const {
+    for (size_t i = 1; i < count_; ++i) {
+      if (at(i).keyframe) {
+        *ix = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Drops the oldest frame and the ones that depend on it.
+  void drop_gop() {
+    do {
+      first_ = (first_ + 1) % records_.size();
+      --count_;
+      ++dropped_;
+    } while (count_ && !at(0).keyframe);
+    if (count_)
+      head_ = at(0).offset;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::CoalescingEvent : wakes a single waiter. Signals that arrive before
+// the waiter runs are merged into one wakeup.
+// pending_ : the reasons (a bit mask) given to signal() since the last wait.
+// pending_since_ : when the oldest of those signals arrived.
+//
+class CoalescingEvent {
+  typedef std::chrono::steady_clock Clock;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  unsigned int pending_;
+  Clock::time_point pending_since_;
+  bool closed_;
+
+  CoalescingEvent(const CoalescingEvent&) = delete;
+  CoalescingEvent& operator=(const CoalescingEvent&) = delete;
+
+public:
+  CoalescingEvent() : pending_(0), closed_(false) {
+  }
+
+  void signal(unsigned int reasons) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!pending_)
+        pending_since_ = Clock::now();
+      pending_ |= reasons;
+    }
+    cv_.notify_one();
+  }
+
+  // Wakes the waiter for good.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cv_.notify_one();
+  }
+
+  // Returns the reasons, zero on timeout or when closed. |waited_ms| gets
+  // how long the oldest signal was pending.
+  unsigned int wait(uint32_t timeout_ms, uint64_t* waited_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                 [this]() { return closed_ || (pending_ != 0); });
+    *waited_ms = 0;
+    if (closed_)
+      return 0;
+    auto reasons = pending_;
+    if (reasons) {
+      *waited_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - pending_since_).count();
+    }
+    pending_ = 0;
+    return reasons;
+  }
+
+  bool is_closed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Snapshot : an immutable T that can be replaced while others read it.
+// publish() swaps in a new value, readers that hold the old one keep it
+// alive until they let go.
+// Reader : per thread cache of the snapshot. refresh() only touches the
+// shared pointer when the version moved, so checking for a new value is one
+// atomic load. get() is valid until the next refresh() of the same reader.
+//
+template <typename T>
+class Snapshot {
+  std::shared_ptr<const T> current_;
+  std::atomic<uint32_t> version_;
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+public:
+  explicit Snapshot(std::shared_ptr<const T> initial)
+      : current_(std::move(initial)), version_(0) {
+  }
+
+  std::shared_ptr<const T> get() const {
+    return std::atomic_load(&current_);
+  }
+
+  uint32_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  void publish(std::shared_ptr<const T> next) {
+    std::atomic_store(&current_, std::move(next));
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+  class Reader {
+    const Snapshot& snapshot_;
+    std::shared_ptr<const T> cached_;
+    uint32_t seen_;
+
+  public:
+    explicit Reader(const Snapshot& snapshot)
+        : snapshot_(snapshot),
+          seen_(snapshot.version()) {
+      cached_ = snapshot.get();
+    }
+
+    // returns true if there is a new value.
+    bool refresh() {
+      auto version = snapshot_.version();
+      if (version == seen_)
+        return false;
+      cached_ = snapshot_.get();
+      seen_ = version;
+      return true;
+    }
+
+    const T& get() const {
+      return *cached_;
+    }
+  };
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::LowestBit : index of the lowest set bit of a non-zero |mask|.
+//
+size_t LowestBit(unsigned int mask) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::QpcNow : monotonic high resolution ticks from QueryPerformanceCounter,
+// or nanoseconds of CLOCK_MONOTONIC off windows.
+// plx::QpcToNanos : converts a tick count to nanoseconds.
+//
+int64_t QpcNow() ;
+
+int64_t QpcToNanos(int64_t ticks) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::LatencyHistogram : lock-free log-linear histogram of nanoseconds.
+// Each power of two range is split in 8 linear buckets so a percentile is
+// off by at most 12.5%. Any thread can record(), readers see a snapshot
+// that can be a few samples behind.
+// buckets_ : values below 8 get their own bucket, then 8 per power of two.
+//
+class LatencyHistogram {
+public:
+  static const int kSubBits = 3;
+  static const size_t kSubBuckets = 1 << kSubBits;
+  static const size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  struct Summary {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+  };
+
+private:
+  std::atomic<uint64_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+public:
+  LatencyHistogram() {
+    reset();
+  }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void record(uint64_t nanos) {
+    buckets_[BucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(nanos, std::memory_order_relaxed);
+    auto max = max_.load(std::memory_order_relaxed);
+    while ((nanos > max) &&
+           !max_.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Not atomic with respect to record(), samples recorded meanwhile can
+  // be half counted.
+  void reset() {
+    for (auto& bucket : buckets_)
+      bucket.store(0, std::memory_order_relaxed);
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket holding the |p| fraction of the samples.
+  uint64_t percentile(double p) const {
+    uint64_t total = 0;
+    for (auto& bucket : buckets_)
+      total += bucket.load(std::memory_order_relaxed);
+    if (!total)
+      return 0;
+    auto rank = static_cast<uint64_t>(p * static_cast<double>(total));
+    if (rank >= total)
+      rank = total - 1;
+    uint64_t seen = 0;
+    for (size_t ix = 0; ix != kBuckets; ++ix) {
+      seen += buckets_[ix].load(std::memory_order_relaxed);
+      if (seen > rank)
+        return std::min(BucketUpperBound(ix), max_.load(std::memory_order_relaxed));
+    }
+    return max_;
+  }
+
+  Summary summary() const {
+    auto count = count_.load(std::memory_order_relaxed);
+    Summary sm = {
+      count,
+      count ? sum_.load(std::memory_order_relaxed) / count : 0,
+      percentile(0.5),
+      percentile(0.99),
+      percentile(0.999),
+      max_.load(std::memory_order_relaxed)
+    };
+    return sm;
+  }
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBuckets)
+      return static_cast<size_t>(value);
+    auto shift = HighestBit(value) - kSubBits;
+    auto sub = static_cast<size_t>(value >> shift) & (kSubBuckets - 1);
+    return ((shift + 1) * kSubBuckets) + sub;
+  }
+
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < kSubBuckets)
+      return index;
+    auto shift = (index / kSubBuckets) - 1;
+    auto sub = index % kSubBuckets;
+    return ((static_cast<uint64_t>(kSubBuckets + sub + 1) << shift) - 1);
+  }
+
+private:
+  static size_t HighestBit(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FormatOut : text made by plx::FormatTo(). Starts in a buffer owned
+// by the derived class and moves to the heap only if that fills up.
+// text() : the text so far, always followed by a zero.
+//
+class FormatOut {
+  char* start_;
+  size_t size_;
+  size_t capacity_;
+  std::unique_ptr<char[]> heap_;
+
+protected:
+  FormatOut(char* buf, size_t capacity)
+      : start_(buf), size_(0), capacity_(capacity) {
+    start_[0] = 0;
+  }
+
+public:
+  FormatOut(const FormatOut&) = delete;
+  FormatOut& operator=(const FormatOut&) = delete;
+
+  void append(const char* s, size_t count) {
+    if ((size_ + count) >= capacity_)
+      grow(size_ + count + 1);
+    memcpy(start_ + size_, s, count);
+    size_ += count;
+    start_[size_] = 0;
+  }
+
+  void append(size_t count, char c) {
+    if ((size_ + count) >= capacity_)
+      grow(size_ + count + 1);
+    memset(start_ + size_, c, count);
+    size_ += count;
+    start_[size_] = 0;
+  }
+
+  void clear() {
+    size_ = 0;
+    start_[0] = 0;
+  }
+
+  const char* c_str() const { return start_; }
+  size_t size() const { return size_; }
+  bool on_heap() const { return heap_ != nullptr; }
+
+  plx::Range<const char> text() const {
+    return plx::Range<const char>(start_, start_ + size_);
+  }
+
+  std::string str() const {
+    return std::string(start_, size_);
+  }
+
+private:
+  void grow(size_t needed) {
+    auto capacity = std::max(capacity_ * 2, needed);
+    std::unique_ptr<char[]> heap(new char[capacity]);
+    memcpy(heap.get(), start_, size_ + 1);
+    heap_ = std::move(heap);
+    start_ = heap_.get();
+    capacity_ = capacity;
+  }
+};
+
+template <size_t N>
+class FormatBuffer : public FormatOut {
+  char buf_[N];
+
+public:
+  FormatBuffer() : FormatOut(buf_, N) {
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FormatArg : one argument of plx::FormatTo() with its type. Only the
+// types below convert, anything else does not compile. A null char pointer
+// prints as "(null)".
+//
+struct FormatArg {
+  enum Kind {
+    none,
+    sint,
+    uint,
+    dbl,
+    chr,
+    str
+  };
+
+  Kind kind;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char* s;
+  };
+  size_t len;
+
+  FormatArg() : kind(none), u(0), len(0) {}
+  FormatArg(char c) : kind(chr), i(c), len(0) {}
+  FormatArg(short v) : kind(sint), i(v), len(0) {}
+  FormatArg(int v) : kind(sint), i(v), len(0) {}
+  FormatArg(long v) : kind(sint), i(v), len(0) {}
+  FormatArg(long long v) : kind(sint), i(v), len(0) {}
+  FormatArg(unsigned char v) : kind(uint), u(v), len(0) {}
+  FormatArg(unsigned short v) : kind(uint), u(v), len(0) {}
+  FormatArg(unsigned int v) : kind(uint), u(v), len(0) {}
+  FormatArg(unsigned long v) : kind(uint), u(v), len(0) {}
+  FormatArg(unsigned long long v) : kind(uint), u(v), len(0) {}
+  FormatArg(double v) : kind(dbl), d(v), len(0) {}
+  FormatArg(const char* v) : kind(str), s(v ? v : "(null)"), len(v ? strlen(v) : 6) {}
+  FormatArg(const std::string& v) : kind(str), s(v.c_str()), len(v.size()) {}
+  FormatArg(const plx::Range<const char>& v) : kind(str), s(v.start()), len(v.size()) {}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FormatTo : printf syntax where the argument decides the size, so
+// length modifiers like l or ll are accepted and ignored. %d, %u, %x, %X
+// and %c take integers, %f, %e, %g take numbers and %s takes anything.
+// Flags are '-' and '0', width and precision are numbers, not '*'. A bad
+// conversion or a wrong number of arguments throws plx::InvalidParamException
+// with the position of the argument.
+//
+void FormatArgs(plx::FormatOut& out, const char* fmt,
+                const plx::FormatArg* args, size_t count) ;
+
+template <typename... Args>
+void FormatTo(plx::FormatOut& out, const char* fmt, const Args&... values) {
+  // the extra element keeps the array non empty without arguments.
+  const plx::FormatArg args[] = { plx::FormatArg(values)..., plx::FormatArg() };
+  FormatArgs(out, fmt, args, sizeof...(Args));
+}
+
+// Short results are made on the stack, the string is the only allocation.
+template <typename... Args>
+std::string Format(const char* fmt, const Args&... values) {
+  plx::FormatBuffer<256> out;
+  FormatTo(out, fmt, values...);
+  return out.str();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PLX_FORMAT_TO : plx::FormatTo() with a literal format, whose conversions
+// are counted against the arguments at compile time where the compiler has
+// c++14 constexpr. VS2013 has none, there only the run time check is left.
+//
+namespace FormatImp {
+template <typename... Args>
+std::integral_constant<size_t, sizeof...(Args)> Arity(const Args&...);
+
+#if (defined(__cpp_constexpr) && (__cpp_constexpr >= 201304)) || \
+    (defined(_MSC_VER) && (_MSC_VER >= 1910))
+#define PLX_FORMAT_ARITY(fmt, count) \
+    static_assert(plx::FormatImp::Conversions(fmt) == (count), \
+                  "the format does not take that many arguments")
+
+// conversions in |f|, "%%" is not one.
+constexpr size_t Conversions(const char* f) {
+  size_t count = 0;
+  for (; *f; ++f) {
+    if (*f != '%')
+      continue;
+    if (f[1] == '%')
+      ++f;
+    else
+      ++count;
+  }
+  return count;
+}
+#else
+#define PLX_FORMAT_ARITY(fmt, count)
+#endif
+}
+
+#define PLX_FORMAT_TO(out, fmt, ...)                                              \
+  do {                                                                            \
+    PLX_FORMAT_ARITY(fmt, decltype(plx::FormatImp::Arity(__VA_ARGS__))::value);   \
+    plx::FormatTo(out, fmt, __VA_ARGS__);                                         \
+  } while (0)
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::PrintfToString : vsnprintf into a std::string. The catalog
+// plx::StringPrintf frees its new[] buffer with delete and reads its va_list
+// again after vsnprintf used it up, use this one or plx::Format instead.
+//
+std::string PrintfToString(const char* fmt, ...) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::WideFromUTF8 (validates and converts in one pass)
+// strict : throws plx::CodecException on bad utf8, otherwise each bad
+// sequence becomes U+FFFD. Where wchar_t is 32 bits the result is utf32.
+std::wstring WideFromUTF8(const plx::Range<const uint8_t>& utf8, bool strict) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::UTF8FromWide (unpaired surrogates become U+FFFD)
+std::string UTF8FromWide(const plx::Range<const wchar_t>& wide) ;
+
+}
@@ -0,0 +1,319 @@
+// plx_video.cpp : see plx_video.h.
+
+#include "plx_video.h"
+
+namespace plx {
+namespace SimdImp {
+#if defined(_MSC_VER)
+#define PLX_TARGET_AVX2
+#else
+#define PLX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+plx::SimdLevel DetectSimdLevel() {
+#if defined(_MSC_VER)
+  int regs[4] = {0};
+  __cpuid(regs, 0);
+  auto max_leaf = regs[0];
+  __cpuid(regs, 1);
+  bool sse2 = (regs[3] & (1 << 26)) != 0;
+  // avx needs the os to save the ymm registers.
+  bool os_avx = ((regs[2] & (1 << 27)) != 0) && ((regs[2] & (1 << 28)) != 0) &&
+                ((_xgetbv(0) & 6) == 6);
+  if (os_avx && (max_leaf >= 7)) {
+    __cpuidex(regs, 7, 0);
+    if (regs[1] & (1 << 5))
+      return plx::SimdLevel::avx2;
+  }
+  return sse2 ? plx::SimdLevel::sse2 : plx::SimdLevel::scalar;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return plx::SimdLevel::avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return plx::SimdLevel::sse2;
+  return plx::SimdLevel::scalar;
+#endif
+}
+
+const plx::SimdLevel best_simd_level = DetectSimdLevel();
+
+uint32_t Sad16x16Scalar(const uint8_t* a, const uint8_t* b, size_t stride) {
+  uint32_t sum = 0;
+  for (size_t y = 0; y != 16; ++y) {
+    for (size_t x = 0; x != 16; ++x)
+      sum += (a[x] > b[x]) ? (a[x] - b[x]) : (b[x] - a[x]);
+    a += stride;
+    b += stride;
+  }
+  return sum;
+}
+
+uint32_t Sad16x16SSE2(const uint8_t* a, const uint8_t* b, size_t stride) {
+  __m128i acc = _mm_setzero_si128();
+  for (size_t y = 0; y != 16; ++y) {
+    auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    a += stride;
+    b += stride;
+  }
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(acc) +
+                               _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+}
+
+// Two horizontally adjacent tiles at once.
+PLX_TARGET_AVX2
+void Sad16x16PairAVX2(const uint8_t* a, const uint8_t* b, size_t stride, uint32_t* out) {
+  __m256i acc = _mm256_setzero_si256();
+  for (size_t y = 0; y != 16; ++y) {
+    auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+    auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    a += stride;
+    b += stride;
+  }
+  auto lo = _mm256_castsi256_si128(acc);
+  auto hi = _mm256_extracti128_si256(acc, 1);
+  out[0] = static_cast<uint32_t>(_mm_cvtsi128_si32(lo) +
+                                 _mm_cvtsi128_si32(_mm_srli_si128(lo, 8)));
+  out[1] = static_cast<uint32_t>(_mm_cvtsi128_si32(hi) +
+                                 _mm_cvtsi128_si32(_mm_srli_si128(hi, 8)));
+}
+
+PLX_TARGET_AVX2
+void BlockSadRowAVX2(const uint8_t* a, const uint8_t* b, size_t stride,
+                     size_t blocks, uint32_t* out) {
+  size_t bx = 0;
+  for (; bx + 2 <= blocks; bx += 2)
+    Sad16x16PairAVX2(a + (bx * 16), b + (bx * 16), stride, out + bx);
+  if (bx != blocks)
+    out[bx] = Sad16x16SSE2(a + (bx * 16), b + (bx * 16), stride);
+}
+
+// The kernels below take one row of output and return how many pixels they
+// did, the callers finish the row with the scalar kernel.
+
+// One row of luma shrunk by 4, each output the average of 4 samples
+// |pixel_step| bytes apart.
+size_t Shrink4RowScalar(const uint8_t* src, size_t pixel_step, size_t count,
+                        uint8_t* dst, size_t start) {
+  for (size_t x = start; x != count; ++x) {
+    auto s = src + (x * 4 * pixel_step);
+    dst[x] = static_cast<uint8_t>(
+        (s[0] + s[pixel_step] + s[2 * pixel_step] + s[3 * pixel_step]) / 4);
+  }
+  return count;
+}
+
+// Sums of each 4 consecutive 16 bit values of |lo| then |hi|.
+inline __m128i SumQuadsSSE2(__m128i lo, __m128i hi) {
+  const __m128i ones = _mm_set1_epi16(1);
+  auto pairs = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+  return _mm_madd_epi16(pairs, ones);
+}
+
+// 4 outputs from 4 pixels (step 1) or 4 yuy2 pixel pairs (step 2).
+inline __m128i Shrink4QuadSSE2(const uint8_t* src, size_t pixel_step) {
+  if (pixel_step == 1) {
+    const __m128i zero = _mm_setzero_si128();
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return SumQuadsSSE2(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero));
+  }
+  const __m128i luma_mask = _mm_set1_epi16(0x00ff);
+  auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+  return SumQuadsSSE2(_mm_and_si128(a, luma_mask), _mm_and_si128(b, luma_mask));
+}
+
+size_t Shrink4RowSSE2(const uint8_t* src, size_t pixel_step, size_t count, uint8_t* dst) {
+  // bytes of source per 4 outputs.
+  const size_t quad = 16 * pixel_step;
+  size_t x = 0;
+  for (; x + 16 <= count; x += 16) {
+    auto s = src + (x * 4 * pixel_step);
+    auto q0 = _mm_srli_epi32(Shrink4QuadSSE2(s, pixel_step), 2);
+    auto q1 = _mm_srli_epi32(Shrink4QuadSSE2(s + quad, pixel_step), 2);
+    auto q2 = _mm_srli_epi32(Shrink4QuadSSE2(s + (2 * quad), pixel_step), 2);
+    auto q3 = _mm_srli_epi32(Shrink4QuadSSE2(s + (3 * quad), pixel_step), 2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+        _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_packs_epi32(q2, q3)));
+  }
+  return x;
+}
+
+// 8 outputs in order, see Shrink4QuadSSE2.
+PLX_TARGET_AVX2
+inline __m256i Shrink4OctAVX2(const uint8_t* src, size_t pixel_step) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i lo, hi;
+  if (pixel_step == 1) {
+    const __m256i zero = _mm256_setzero_si256();
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    lo = _mm256_unpacklo_epi8(v, zero);
+    hi = _mm256_unpackhi_epi8(v, zero);
+  } else {
+    const __m256i luma_mask = _mm256_set1_epi16(0x00ff);
+    lo = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), luma_mask);
+    hi = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32)), luma_mask);
+  }
+  auto pairs = _mm256_packs_epi32(_mm256_madd_epi16(lo, ones), _mm256_madd_epi16(hi, ones));
+  auto sums = _mm256_madd_epi16(pairs, ones);
+  // the unpacks keep step 1 in order, step 2 comes out as quadwords 0 2 1 3.
+  return (pixel_step == 1) ? sums : _mm256_permute4x64_epi64(sums, 0xd8);
+}
+
+PLX_TARGET_AVX2
+size_t Shrink4RowAVX2(const uint8_t* src, size_t pixel_step, size_t count, uint8_t* dst) {
+  // bytes of source per 8 outputs.
+  const size_t oct = 32 * pixel_step;
+  // the packs below leave dwords 0 4 1 5 2 6 3 7.
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t x = 0;
+  for (; x + 32 <= count; x += 32) {
+    auto s = src + (x * 4 * pixel_step);
+    auto o0 = _mm256_srli_epi32(Shrink4OctAVX2(s, pixel_step), 2);
+    auto o1 = _mm256_srli_epi32(Shrink4OctAVX2(s + oct, pixel_step), 2);
+    auto o2 = _mm256_srli_epi32(Shrink4OctAVX2(s + (2 * oct), pixel_step), 2);
+    auto o3 = _mm256_srli_epi32(Shrink4OctAVX2(s + (3 * oct), pixel_step), 2);
+    auto bytes = _mm256_packus_epi16(_mm256_packs_epi32(o0, o1), _mm256_packs_epi32(o2, o3));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),
+                        _mm256_permutevar8x32_epi32(bytes, order));
+  }
+  return x;
+}
+
+// Luma of one yuy2 row and the averaged chroma of two.
+size_t Yuy2RowsScalar(const uint8_t* r0, const uint8_t* r1, size_t width,
+                      uint8_t* y0, uint8_t* y1, uint8_t* uv, size_t start) {
+  size_t x = start;
+  for (; x + 1 < width; x += 2) {
+    y0[x] = r0[x * 2];
+    y0[x + 1] = r0[(x * 2) + 2];
+    y1[x] = r1[x * 2];
+    y1[x + 1] = r1[(x * 2) + 2];
+    uv[x] = static_cast<uint8_t>((r0[(x * 2) + 1] + r1[(x * 2) + 1] + 1) >> 1);
+    uv[x + 1] = static_cast<uint8_t>((r0[(x * 2) + 3] + r1[(x * 2) + 3] + 1) >> 1);
+  }
+  if (x < width) {
+    y0[x] = r0[x * 2];
+    y1[x] = r1[x * 2];
+  }
+  return width;
+}
+
+size_t Yuy2RowsSSE2(const uint8_t* r0, const uint8_t* r1, size_t width,
+                    uint8_t* y0, uint8_t* y1, uint8_t* uv) {
+  const __m128i luma_mask = _mm_set1_epi16(0x00ff);
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + (x * 2)));
+    auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + (x * 2) + 16));
+    auto a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + (x * 2)));
+    auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + (x * 2) + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x),
+        _mm_packus_epi16(_mm_and_si128(a0, luma_mask), _mm_and_si128(b0, luma_mask)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x),
+        _mm_packus_epi16(_mm_and_si128(a1, luma_mask), _mm_and_si128(b1, luma_mask)));
+    auto c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+    auto c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x), _mm_avg_epu8(c0, c1));
+  }
+  return x;
+}
+
+PLX_TARGET_AVX2
+size_t Yuy2RowsAVX2(const uint8_t* r0, const uint8_t* r1, size_t width,
+                    uint8_t* y0, uint8_t* y1, uint8_t* uv) {
+  const __m256i luma_mask = _mm256_set1_epi16(0x00ff);
+  size_t x = 0;
+  // packus works per 128 bit lane, the permute puts the quadwords back in order.
+  for (; x + 32 <= width; x += 32) {
+    auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r0 + (x * 2)));
+    auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r0 + (x * 2) + 32));
+    auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r1 + (x * 2)));
+    auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r1 + (x * 2) + 32));
+    auto l0 = _mm256_packus_epi16(_mm256_and_si256(a0, luma_mask), _mm256_and_si256(b0, luma_mask));
+    auto l1 = _mm256_packus_epi16(_mm256_and_si256(a1, luma_mask), _mm256_and_si256(b1, luma_mask));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y0 + x), _mm256_permute4x64_epi64(l0, 0xd8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y1 + x), _mm256_permute4x64_epi64(l1, 0xd8));
+    auto c0 = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(b0, 8));
+    auto c1 = _mm256_packus_epi16(_mm256_srli_epi16(a1, 8), _mm256_srli_epi16(b1, 8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + x),
+                        _mm256_permute4x64_epi64(_mm256_avg_epu8(c0, c1), 0xd8));
+  }
+  return x;
+}
+
+}
+plx::SimdLevel BestSimdLevel() {
+  return SimdImp::best_simd_level;
+}
+void BlockSad16(const uint8_t* a, const uint8_t* b, size_t stride,
+                size_t width, size_t height, uint32_t* out, plx::SimdLevel level) {
+  const size_t blocks_x = width / 16;
+  const size_t blocks_y = height / 16;
+  for (size_t by = 0; by != blocks_y; ++by) {
+    auto row_a = a + (by * 16 * stride);
+    auto row_b = b + (by * 16 * stride);
+    auto row_out = out + (by * blocks_x);
+    if (level == plx::SimdLevel::avx2) {
+      SimdImp::BlockSadRowAVX2(row_a, row_b, stride, blocks_x, row_out);
+    } else if (level == plx::SimdLevel::sse2) {
+      for (size_t bx = 0; bx != blocks_x; ++bx)
+        row_out[bx] = SimdImp::Sad16x16SSE2(row_a + (bx * 16), row_b + (bx * 16), stride);
+    } else {
+      for (size_t bx = 0; bx != blocks_x; ++bx)
+        row_out[bx] = SimdImp::Sad16x16Scalar(row_a + (bx * 16), row_b + (bx * 16), stride);
+    }
+  }
+}
+void DownsampleLuma(const uint8_t* src, size_t src_stride,
+                    size_t width, size_t height,
+                    size_t pixel_step, size_t factor,
+                    uint8_t* dst, size_t dst_stride, plx::SimdLevel level) {
+  const size_t out_w = width / factor;
+  const size_t out_h = height / factor;
+  const size_t step = pixel_step * factor;
+  for (size_t y = 0; y != out_h; ++y) {
+    auto s = src + (y * factor * src_stride);
+    auto d = dst + (y * dst_stride);
+    if ((factor == 4) && ((pixel_step == 1) || (pixel_step == 2))) {
+      size_t done = 0;
+      if (level == plx::SimdLevel::avx2)
+        done = SimdImp::Shrink4RowAVX2(s, pixel_step, out_w, d);
+      else if (level == plx::SimdLevel::sse2)
+        done = SimdImp::Shrink4RowSSE2(s, pixel_step, out_w, d);
+      SimdImp::Shrink4RowScalar(s, pixel_step, out_w, d, done);
+      continue;
+    }
+    for (size_t x = 0; x != out_w; ++x) {
+      unsigned int sum = 0;
+      for (size_t k = 0; k != factor; ++k)
+        sum += s[k * pixel_step];
+      d[x] = static_cast<uint8_t>(sum / factor);
+      s += step;
+    }
+  }
+}
+void Yuy2ToNv12(const uint8_t* src, size_t src_stride,
+                size_t width, size_t row_begin, size_t row_end,
+                uint8_t* dst_y, size_t y_stride,
+                uint8_t* dst_uv, size_t uv_stride, plx::SimdLevel level) {
+  for (size_t row = row_begin; row < row_end; row += 2) {
+    auto r0 = src + (row * src_stride);
+    // an odd last row pairs with itself.
+    auto last = (row + 1) == row_end;
+    auto r1 = last ? r0 : r0 + src_stride;
+    auto y0 = dst_y + (row * y_stride);
+    auto y1 = last ? y0 : y0 + y_stride;
+    auto uv = dst_uv + ((row / 2) * uv_stride);
+    size_t done = 0;
+    if (level == plx::SimdLevel::avx2)
+      done = SimdImp::Yuy2RowsAVX2(r0, r1, width, y0, y1, uv);
+    else if (level == plx::SimdLevel::sse2)
+      done = SimdImp::Yuy2RowsSSE2(r0, r1, width, y0, y1, uv);
+    SimdImp::Yuy2RowsScalar(r0, r1, width, y0, y1, uv, done);
+  }
+}
+}
@@ -0,0 +1,825 @@
+// plx_video.h : the mp4 muxer, frame buffers and pixel kernels that are
+// not in the plex catalog. The kernels pick sse2 or avx2 at runtime, see
+// plx::BestSimdLevel.
+
+#pragma once
+
+#include "plx_util.h"
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+namespace plx {
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Fmp4Muxer : fragmented mp4 (ISO BMFF / CMAF) writer for H.264.
+// Input is annex-b access units in decode order, without b-frames. The
+// header goes out with the first keyframe and then a moof+mdat pair every
+// |frames_per_fragment| frames, so a file cut at any point plays up to its
+// last complete fragment. Memory use is bounded by one fragment.
+// A frame lasts until the next one starts, so dropped frames leave a gap
+// in the timeline instead of shifting what comes after.
+//
+class Fmp4Muxer {
+public:
+  typedef std::function<void(const plx::Range<const uint8_t>&)> Sink;
+
+  struct Params {
+    uint32_t width;
+    uint32_t height;
+    uint32_t timescale;   // units of the frame times.
+    uint32_t frames_per_fragment;
+    // of the last frame, which has no next one to go by.
+    uint32_t frame_duration;
+  };
+
+private:
+  struct SampleInfo {
+    int64_t time;
+    uint32_t size;
+    uint32_t flags;
+  };
+
+  static const uint32_t kKeyFrameFlags = 0x02000000;
+  static const uint32_t kDeltaFrameFlags = 0x01010000;
+
+  const Params params_;
+  Sink sink_;
+  std::vector<uint8_t> sps_;
+  std::vector<uint8_t> pps_;
+  std::vector<uint8_t> box_;
+  std::vector<uint8_t> mdat_;
+  std::vector<SampleInfo> samples_;
+  uint32_t sequence_;
+  // the file timeline starts at the time of the first frame.
+  int64_t first_time_;
+  int64_t last_time_;
+  uint32_t last_duration_;
+  uint64_t bytes_out_;
+  bool header_done_;
+
+  Fmp4Muxer(const Fmp4Muxer&) = delete;
+  Fmp4Muxer& operator=(const Fmp4Muxer&) = delete;
+
+public:
+  Fmp4Muxer(const Params& params, Sink sink)
+      : params_(params),
+        sink_(sink),
+        sequence_(0),
+        first_time_(0),
+        last_time_(0),
+        last_duration_(0),
+        bytes_out_(0),
+        header_done_(false) {
+    if (!params_.timescale || !params_.frames_per_fragment || !params_.frame_duration)
+      throw plx::InvalidParamException(__LINE__, 1);
+    samples_.reserve(params_.frames_per_fragment);
+  }
+
+  // Takes the SPS and PPS out of |annexb|, for encoders that hand them
+  // over apart from the frames.
+  void add_parameter_sets(const plx::Range<const uint8_t>& annexb) {
+    auto nals = annexb;
+    plx::Range<const uint8_t> nal;
+    while (NextNal(nals, nal)) {
+      auto type = nal[0] & 0x1f;
+      if (type == 7)
+        sps_.assign(nal.start(), nal.end());
+      else if (type == 8)
+        pps_.assign(nal.start(), nal.end());
+    }
+  }
+
+  // Returns false if the unit was dropped, because the stream has not
+  // produced a keyframe with its SPS and PPS yet or because |time| is not
+  // past the time of the unit before.
+  bool add_access_unit(const plx::Range<const uint8_t>& annexb,
+                       int64_t time, bool keyframe) {
+    if (header_done_ && (time <= last_time_))
+      return false;
+    // the last frame of the fragment ends where this one starts.
+    if (samples_.size() >= params_.frames_per_fragment)
+      write_fragment(time);
+    auto mdat_start = mdat_.size();
+    auto nals = annexb;
+    plx::Range<const uint8_t> nal;
+    while (NextNal(nals, nal)) {
+      auto type = nal[0] & 0x1f;
+      if (type == 7) {
+        sps_.assign(nal.start(), nal.end());
+      } else if (type == 8) {
+        pps_.assign(nal.start(), nal.end());
+      } else if (type == 9) {
+        // access unit delimiters are not carried in mp4.
+        continue;
+      }
+      PutU32(mdat_, static_cast<uint32_t>(nal.size()));
+      mdat_.insert(mdat_.end(), nal.start(), nal.end());
+    }
+
+    if (!header_done_) {
+      if (!keyframe || sps_.size() < 4 || pps_.empty()) {
+        mdat_.resize(mdat_start);
+        return false;
+      }
+      first_time_ = time;
+      write_header();
+    }
+
+    SampleInfo si = {
+      time,
+      static_cast<uint32_t>(mdat_.size() - mdat_start),
+      keyframe ? kKeyFrameFlags : kDeltaFrameFlags
+    };
+    samples_.push_back(si);
+    last_time_ = time;
+    return true;
+  }
+
+  // Writes the pending frames as a fragment, the end of the stream.
+  void flush() {
+    if (samples_.empty())
+      return;
+    write_fragment(last_time_ + (last_duration_ ? last_duration_ : params_.frame_duration));
+  }
+
+  uint64_t bytes_out() const {
+    return bytes_out_;
+  }
+
+  // Finds the next annex-b NAL unit and advances |r| past it.
+  static bool NextNal(plx::Range<const uint8_t>& r, plx::Range<const uint8_t>& nal) {
+    auto start = FindStartCode(r.start(), r.end());
+    if (start == r.end())
+      return false;
+    auto next = FindStartCode(start, r.end());
+    if (next != r.end())
+      next -= 3;
+    // trailing zeros belong to the next start code.
+    auto end = next;
+    while ((end > start) && (end[-1] == 0))
+      --end;
+    r = plx::Range<const uint8_t>(next, r.end());
+    if (end == start)
+      return NextNal(r, nal);
+    nal = plx::Range<const uint8_t>(start, end);
+    return true;
+  }
+
+private:
+  // The pending frames as a moof+mdat pair, the last one ends at |end_time|.
+  void write_fragment(int64_t end_time) {
+    box_.clear();
+    const uint32_t trun_size = 20 + 12 * static_cast<uint32_t>(samples_.size());
+    const uint32_t traf_size = 8 + 16 + 20 + trun_size;
+    const uint32_t moof_size = 8 + 16 + traf_size;
+
+    auto moof = BeginBox(box_, "moof");
+    auto mfhd = BeginFullBox(box_, "mfhd", 0, 0);
+    PutU32(box_, ++sequence_);
+    EndBox(box_, mfhd);
+    auto traf = BeginBox(box_, "traf");
+    // default-base-is-moof.
+    auto tfhd = BeginFullBox(box_, "tfhd", 0, 0x020000);
+    PutU32(box_, 1);
+    EndBox(box_, tfhd);
+    auto tfdt = BeginFullBox(box_, "tfdt", 1, 0);
+    PutU64(box_, static_cast<uint64_t>(samples_[0].time - first_time_));
+    EndBox(box_, tfdt);
+    // data offset, sample duration, size and flags present.
+    auto trun = BeginFullBox(box_, "trun", 0, 0x000701);
+    PutU32(box_, static_cast<uint32_t>(samples_.size()));
+    PutU32(box_, moof_size + 8);
+    for (size_t ix = 0; ix != samples_.size(); ++ix) {
+      auto next = (ix + 1 == samples_.size()) ? end_time : samples_[ix + 1].time;
+      last_duration_ = static_cast<uint32_t>(next - samples_[ix].time);
+      PutU32(box_, last_duration_);
+      PutU32(box_, samples_[ix].size);
+      PutU32(box_, samples_[ix].flags);
+    }
+    EndBox(box_, trun);
+    EndBox(box_, traf);
+    EndBox(box_, moof);
+    if (box_.size() != moof_size)
+      throw plx::RangeException(__LINE__, nullptr);
+
+    PutU32(box_, static_cast<uint32_t>(mdat_.size() + 8));
+    PutFourCC(box_, "mdat");
+    emit(box_);
+    emit(mdat_);
+
+    mdat_.clear();
+    samples_.clear();
+  }
+
+  // Returns the first byte after a 00 00 01 sequence.
+  static const uint8_t* FindStartCode(const uint8_t* p, const uint8_t* end) {
+    while (end - p >= 3) {
+      if (p[2] > 1) {
+        p += 3;
+      } else if (!p[0] && !p[1] && (p[2] == 1)) {
+        return p + 3;
+      } else {
+        ++p;
+      }
+    }
+    return end;
+  }
+
+  static void PutU16(std::vector<uint8_t>& v, uint32_t x) {
+    v.push_back(uint8_t(x >> 8));
+    v.push_back(uint8_t(x));
+  }
+
+  static void PutU32(std::vector<uint8_t>& v, uint32_t x) {
+    v.push_back(uint8_t(x >> 24));
+    v.push_back(uint8_t(x >> 16));
+    v.push_back(uint8_t(x >> 8));
+    v.push_back(uint8_t(x));
+  }
+
+  static void PutU64(std::vector<uint8_t>& v, uint64_t x) {
+    PutU32(v, uint32_t(x >> 32));
+    PutU32(v, uint32_t(x));
+  }
+
+  static void PutFourCC(std::vector<uint8_t>& v, const char* cc) {
+    v.insert(v.end(), cc, cc + 4);
+  }
+
+  static void PutZeros(std::vector<uint8_t>& v, size_t count) {
+    v.insert(v.end(), count, 0);
+  }
+
+  static void PutMatrix(std::vector<uint8_t>& v) {
+    static const uint32_t unity[] =
+        { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (auto m : unity)
+      PutU32(v, m);
+  }
+
+  static size_t BeginBox(std::vector<uint8_t>& v, const char* type) {
+    auto pos = v.size();
+    PutU32(v, 0);
+    PutFourCC(v, type);
+    return pos;
+  }
+
+  static size_t BeginFullBox(std::vector<uint8_t>& v, const char* type,
+                             uint8_t version, uint32_t flags) {
+    auto pos = BeginBox(v, type);
+    PutU32(v, (uint32_t(version) << 24) | (flags & 0xffffff));
+    return pos;
+  }
+
+  static void EndBox(std::vector<uint8_t>& v, size_t pos) {
+    auto size = static_cast<uint32_t>(v.size() - pos);
+    v[pos + 0] = uint8_t(size >> 24);
+    v[pos + 1] = uint8_t(size >> 16);
+    v[pos + 2] = uint8_t(size >> 8);
+    v[pos + 3] = uint8_t(size);
+  }
+
+  void emit(const std::vector<uint8_t>& v) {
+    if (v.empty())
+      return;
+    sink_(plx::Range<const uint8_t>(&v[0], v.size()));
+    bytes_out_ += v.size();
+  }
+
+  void write_header() {
+    box_.clear();
+    auto ftyp = BeginBox(box_, "ftyp");
+    PutFourCC(box_, "iso6");
+    PutU32(box_, 0);
+    PutFourCC(box_, "iso6");
+    PutFourCC(box_, "cmfc");
+    PutFourCC(box_, "avc1");
+    PutFourCC(box_, "mp41");
+    EndBox(box_, ftyp);
+
+    auto moov = BeginBox(box_, "moov");
+    auto mvhd = BeginFullBox(box_, "mvhd", 0, 0);
+    PutU32(box_, 0);                  // creation time.
+    PutU32(box_, 0);                  // modification time.
+    PutU32(box_, params_.timescale);
+    PutU32(box_, 0);                  // duration, unknown.
+    PutU32(box_, 0x00010000);         // rate 1.0
+    PutU16(box_, 0x0100);             // volume 1.0
+    PutZeros(box_, 10);
+    PutMatrix(box_);
+    PutZeros(box_, 24);
+    PutU32(box_, 2);                  // next track id.
+    EndBox(box_, mvhd);
+
+    auto trak = BeginBox(box_, "trak");
+    // track enabled and in movie.
+    auto tkhd = BeginFullBox(box_, "tkhd", 0, 3);
+    PutU32(box_, 0);
+    PutU32(box_, 0);
+    PutU32(box_, 1);                  // track id.
+    PutU32(box_, 0);
+    PutU32(box_, 0);                  // duration.
+    PutZeros(box_, 8);
+    PutU16(box_, 0);                  // layer.
+    PutU16(box_, 0);                  // alternate group.
+    PutU16(box_, 0);                  // volume.
+    PutU16(box_, 0);
+    PutMatrix(box_);
+    PutU32(box_, params_.width << 16);
+    PutU32(box_, params_.height << 16);
+    EndBox(box_, tkhd);
+
+    auto mdia = BeginBox(box_, "mdia");
+    auto mdhd = BeginFullBox(box_, "mdhd", 0, 0);
+    PutU32(box_, 0);
+    PutU32(box_, 0);
+    PutU32(box_, params_.timescale);
+    PutU32(box_, 0);
+    PutU16(box_, 0x55c4);             // 'und' language.
+    PutU16(box_, 0);
+    EndBox(box_, mdhd);
+
+    auto hdlr = BeginFullBox(box_, "hdlr", 0, 0);
+    PutU32(box_, 0);
+    PutFourCC(box_, "vide");
+    PutZeros(box_, 12);
+    const char name[] = "VideoHandler";
+    box_.insert(box_.end(), name, name + sizeof(name));
+    EndBox(box_, hdlr);
+
+    auto minf = BeginBox(box_, "minf");
+    auto vmhd = BeginFullBox(box_, "vmhd", 0, 1);
+    PutZeros(box_, 8);
+    EndBox(box_, vmhd);
+    auto dinf = BeginBox(box_, "dinf");
+    auto dref = BeginFullBox(box_, "dref", 0, 0);
+    PutU32(box_, 1);
+    // media data is in this file.
+    auto url = BeginFullBox(box_, "url ", 0, 1);
+    EndBox(box_, url);
+    EndBox(box_, dref);
+    EndBox(box_, dinf);
+
+    auto stbl = BeginBox(box_, "stbl");
+    auto stsd = BeginFullBox(box_, "stsd", 0, 0);
+    PutU32(box_, 1);
+    auto avc1 = BeginBox(box_, "avc1");
+    PutZeros(box_, 6);
+    PutU16(box_, 1);                  // data reference index.
+    PutZeros(box_, 16);
+    PutU16(box_, params_.width);
+    PutU16(box_, params_.height);
+    PutU32(box_, 0x00480000);         // 72 dpi.
+    PutU32(box_, 0x00480000);
+    PutU32(box_, 0);
+    PutU16(box_, 1);                  // frame count.
+    PutZeros(box_, 32);               // compressor name.
+    PutU16(box_, 0x0018);             // depth.
+    PutU16(box_, 0xffff);
+    auto avcc = BeginBox(box_, "avcC");
+    box_.push_back(1);
+    box_.push_back(sps_[1]);          // profile.
+    box_.push_back(sps_[2]);          // compatibility.
+    box_.push_back(sps_[3]);          // level.
+    box_.push_back(0xff);             // 4 byte NAL lengths.
+    box_.push_back(0xe1);             // one SPS.
+    PutU16(box_, static_cast<uint32_t>(sps_.size()));
+    box_.insert(box_.end(), sps_.begin(), sps_.end());
+    box_.push_back(1);                // one PPS.
+    PutU16(box_, static_cast<uint32_t>(pps_.size()));
+    box_.insert(box_.end(), pps_.begin(), pps_.end());
+    EndBox(box_, avcc);
+    EndBox(box_, avc1);
+    EndBox(box_, stsd);
+    // The sample tables are empty, the samples live in the fragments.
+    auto stts = BeginFullBox(box_, "stts", 0, 0);
+    PutU32(box_, 0);
+    EndBox(box_, stts);
+    auto stsc = BeginFullBox(box_, "stsc", 0, 0);
+    PutU32(box_, 0);
+    EndBox(box_, stsc);
+    auto stsz = BeginFullBox(box_, "stsz", 0, 0);
+    PutU32(box_, 0);
+    PutU32(box_, 0);
+    EndBox(box_, stsz);
+    auto stco = BeginFullBox(box_, "stco", 0, 0);
+    PutU32(box_, 0);
+    EndBox(box_, stco);
+    EndBox(box_, stbl);
+    EndBox(box_, minf);
+    EndBox(box_, mdia);
+    EndBox(box_, trak);
+
+    auto mvex = BeginBox(box_, "mvex");
+    auto trex = BeginFullBox(box_, "trex", 0, 0);
+    PutU32(box_, 1);                  // track id.
+    PutU32(box_, 1);                  // sample description index.
+    PutU32(box_, 0);
+    PutU32(box_, 0);
+    PutU32(box_, 0);
+    EndBox(box_, trex);
+    EndBox(box_, mvex);
+    EndBox(box_, moov);
+
+    emit(box_);
+    header_done_ = true;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::SimdLevel : which kernel flavor to use.
+// plx::BestSimdLevel : the best one this cpu and os support.
+//
+enum class SimdLevel {
+  scalar,
+  sse2,
+  avx2,
+};
+
+plx::SimdLevel BestSimdLevel() ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::BlockSad16 : sum of absolute differences of two 8 bit planes in
+// 16x16 tiles. |out| gets (width / 16) * (height / 16) values, row major,
+// partial tiles at the right and bottom edges are ignored. All the levels
+// produce exactly the same output.
+//
+void BlockSad16(const uint8_t* a, const uint8_t* b, size_t stride,
+                size_t width, size_t height, uint32_t* out, plx::SimdLevel level) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::DownsampleLuma : shrinks the luma of a frame by |factor| in both
+// directions. |pixel_step| is the distance between luma samples, 1 for
+// planar formats like NV12 and 2 for packed ones like YUY2. Each output
+// pixel is the average of |factor| horizontal samples of one source row.
+// A factor of 4 has sse2 and avx2 kernels, all the levels produce exactly
+// the same output.
+//
+void DownsampleLuma(const uint8_t* src, size_t src_stride,
+                    size_t width, size_t height,
+                    size_t pixel_step, size_t factor,
+                    uint8_t* dst, size_t dst_stride, plx::SimdLevel level) ;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FramePool : recycles page aligned buffers of one size so steady state
+// frames do not touch the heap. Buffers are created on demand up to
+// |max_frames|, after that acquire() returns an empty FrameRef. Each buffer
+// has an intrusive reference count, plx::FrameRef is the handle to it.
+// The buffers outlive the pool object if frames are still out.
+// shared_ : state shared with the frames, freed by whoever lets go last.
+//
+class FrameRef;
+
+class FramePool {
+public:
+  struct Stats {
+    size_t frame_bytes;
+    size_t allocated;
+    size_t in_use;
+    size_t high_water;
+    uint64_t exhausted;
+    bool large_pages;
+  };
+
+  class Frame {
+    friend class FramePool;
+    friend class FrameRef;
+    std::atomic<int> refs_;
+    void* shared_;
+    uint8_t* data_;
+
+    Frame(void* shared, uint8_t* data) : refs_(0), shared_(shared), data_(data) {}
+  };
+
+private:
+  struct Shared {
+    std::mutex lock;
+    // one for the pool object plus one per frame in use.
+    std::atomic<size_t> refs;
+    size_t frame_bytes;
+    size_t alloc_bytes;
+    size_t max_frames;
+    bool large_pages;
+    std::vector<Frame*> all;
+    std::vector<Frame*> free;
+    size_t in_use;
+    size_t high_water;
+    uint64_t exhausted;
+
+    ~Shared() {
+      for (auto frame : all) {
+#if defined(_WIN32)
+        ::VirtualFree(frame->data_, 0, MEM_RELEASE);
+#else
+        ::munmap(frame->data_, alloc_bytes);
+#endif
+        delete frame;
+      }
+    }
+  };
+
+  Shared* shared_;
+
+public:
+  FramePool(size_t frame_bytes, size_t max_frames, bool large_pages)
+      : shared_(new Shared) {
+    shared_->refs = 1;
+    shared_->frame_bytes = frame_bytes;
+    shared_->max_frames = max_frames;
+    shared_->in_use = 0;
+    shared_->high_water = 0;
+    shared_->exhausted = 0;
+#if defined(_WIN32)
+    auto large_page = large_pages ? ::GetLargePageMinimum() : 0;
+#else
+    // huge pages are 2 MB on x64, MAP_HUGETLB needs them reserved.
+    size_t large_page = large_pages ? (2 * 1024 * 1024) : 0;
+#endif
+    shared_->large_pages = large_page != 0;
+    auto granule = shared_->large_pages ? large_page : 4096;
+    shared_->alloc_bytes = ((frame_bytes + granule - 1) / granule) * granule;
+    shared_->all.reserve(max_frames);
+    shared_->free.reserve(max_frames);
+  }
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  ~FramePool() {
+    Release(shared_);
+  }
+
+  inline FrameRef acquire();
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(shared_->lock);
+    Stats st = {
+      shared_->frame_bytes,
+      shared_->all.size(),
+      shared_->in_use,
+      shared_->high_water,
+      shared_->exhausted,
+      shared_->large_pages
+    };
+    return st;
+  }
+
+  size_t frame_bytes() const {
+    return shared_->frame_bytes;
+  }
+
+  // Called by FrameRef when the last reference to |frame| goes away.
+  static void Recycle(Frame* frame) {
+    auto shared = reinterpret_cast<Shared*>(frame->shared_);
+    {
+      std::lock_guard<std::mutex> lock(shared->lock);
+      shared->free.push_back(frame);
+      --shared->in_use;
+    }
+    Release(shared);
+  }
+
+private:
+  static void Release(Shared* shared) {
+    if (--shared->refs == 0)
+      delete shared;
+  }
+
+  Frame* take_frame() {
+    std::lock_guard<std::mutex> lock(shared_->lock);
+    Frame* frame = nullptr;
+    if (!shared_->free.empty()) {
+      frame = shared_->free.back();
+      shared_->free.pop_back();
+    } else if (shared_->all.size() < shared_->max_frames) {
+      frame = new_frame();
+    }
+    if (!frame) {
+      ++shared_->exhausted;
+      return nullptr;
+    }
+    ++shared_->in_use;
+    if (shared_->in_use > shared_->high_water)
+      shared_->high_water = shared_->in_use;
+    ++shared_->refs;
+    return frame;
+  }
+
+  Frame* new_frame() {
+    void* mem = nullptr;
+#if defined(_WIN32)
+    if (shared_->large_pages) {
+      // needs the lock pages privilege, without it we stay on small pages.
+      mem = ::VirtualAlloc(nullptr, shared_->alloc_bytes,
+                           MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (!mem)
+        shared_->large_pages = false;
+    }
+    if (!mem) {
+      mem = ::VirtualAlloc(nullptr, shared_->alloc_bytes,
+                           MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+      if (!mem)
+        return nullptr;
+    }
+#else
+    if (shared_->large_pages) {
+      // without reserved huge pages this fails and we stay on small pages.
+      mem = ::mmap(nullptr, shared_->alloc_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (mem == MAP_FAILED) {
+        mem = nullptr;
+        shared_->large_pages = false;
+      }
+    }
+    if (!mem) {
+      mem = ::mmap(nullptr, shared_->alloc_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED)
+        return nullptr;
+    }
+#endif
+    auto frame = new Frame(shared_, reinterpret_cast<uint8_t*>(mem));
+    shared_->all.push_back(frame);
+    return frame;
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::FrameRef : counted reference to a plx::FramePool buffer. Copies share
+// the buffer, the last one to go away gives it back to the pool.
+// frame_ : null for an empty reference.
+//
+class FrameRef {
+  FramePool::Frame* frame_;
+
+public:
+  FrameRef() : frame_(nullptr) {}
+
+  explicit FrameRef(FramePool::Frame* frame) : frame_(frame) {
+    if (frame_)
+      ++frame_->refs_;
+  }
+
+  FrameRef(const FrameRef& other) : frame_(other.frame_) {
+    if (frame_)
+      ++frame_->refs_;
+  }
+
+  FrameRef(FrameRef&& other) : frame_(other.frame_) {
+    other.frame_ = nullptr;
+  }
+
+  ~FrameRef() {
+    reset();
+  }
+
+  FrameRef& operator=(FrameRef other) {
+    std::swap(frame_, other.frame_);
+    return *this;
+  }
+
+  void reset() {
+    if (frame_ && (--frame_->refs_ == 0))
+      FramePool::Recycle(frame_);
+    frame_ = nullptr;
+  }
+
+  uint8_t* data() const {
+    return frame_->data_;
+  }
+
+  int ref_count() const {
+    return frame_ ? frame_->refs_.load() : 0;
+  }
+
+  explicit operator bool() const {
+    return frame_ != nullptr;
+  }
+};
+
+inline FrameRef FramePool::acquire() {
+  return FrameRef(take_frame());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::RowWorkers : runs a function over bands of rows using a fixed set of
+// threads plus the calling thread. run() returns when every band is done.
+// Only one thread at a time can call run().
+// fn_ : the band function of the current run().
+// next_ : first row not handed out yet.
+// pending_ : bands handed out or not, that have not finished.
+//
+class RowWorkers {
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t, size_t)>* fn_;
+  size_t rows_;
+  size_t band_;
+  size_t next_;
+  size_t pending_;
+  bool exit_;
+
+public:
+  explicit RowWorkers(size_t threads)
+      : fn_(nullptr), rows_(0), band_(0), next_(0), pending_(0), exit_(false) {
+    for (size_t ix = 0; ix != threads; ++ix)
+      threads_.emplace_back(&RowWorkers::threadproc, this);
+  }
+
+  RowWorkers(const RowWorkers&) = delete;
+  RowWorkers& operator=(const RowWorkers&) = delete;
+
+  ~RowWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      exit_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_)
+      thread.join();
+  }
+
+  size_t thread_count() const {
+    return threads_.size();
+  }
+
+  // Calls |fn(begin, end)| for bands covering [0, rows). Band sizes are a
+  // multiple of |granule| so subsampled planes split cleanly.
+  void run(size_t rows, size_t granule, const std::function<void(size_t, size_t)>& fn) {
+    if (!rows)
+      return;
+    auto parts = threads_.size() + 1;
+    auto band = (rows + parts - 1) / parts;
+    band = ((band + granule - 1) / granule) * granule;
+    if (band >= rows) {
+      fn(0, rows);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      fn_ = &fn;
+      rows_ = rows;
+      band_ = band;
+      next_ = 0;
+      pending_ = (rows + band - 1) / band;
+    }
+    work_cv_.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(lock_);
+    done_cv_.wait(lock, [this]() { return pending_ == 0; });
+    fn_ = nullptr;
+  }
+
+private:
+  void work() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (next_ < rows_) {
+      auto begin = next_;
+      auto end = std::min(begin + band_, rows_);
+      next_ = end;
+      auto fn = fn_;
+      lock.unlock();
+      (*fn)(begin, end);
+      lock.lock();
+      if (--pending_ == 0)
+        done_cv_.notify_all();
+    }
+  }
+
+  void threadproc() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+      work_cv_.wait(lock, [this]() { return exit_ || (next_ < rows_); });
+      if (exit_)
+        return;
+      lock.unlock();
+      work();
+      lock.lock();
+    }
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// plx::Yuy2ToNv12 : converts rows [row_begin, row_end) of a packed 4:2:2
+// frame to 4:2:0 with separate luma and interleaved chroma planes. Chroma
+// is the rounded average of each pair of rows. |row_begin| must be even.
+// The last column of an odd |width| has no chroma pair of its own, only its
+// luma is written. All the levels produce the same output.
+//
+void Yuy2ToNv12(const uint8_t* src, size_t src_stride,
+                size_t width, size_t row_begin, size_t row_end,
+                uint8_t* dst_y, size_t y_stride,
+                uint8_t* dst_uv, size_t uv_stride, plx::SimdLevel level) ;
+
+}
@@ -0,0 +1,101 @@
+// settings_core.h : the shape of config.json and of the settings.json each
+// camera folder gets, without anything from windows. main.cpp loads and
+// saves them, the unit tests in tests/ check the schema.
+
+#pragma once
+
+#include "plx_json.h"
+
+// One entry of the optional "cameras" array. It picks a device by a piece
+// of its name and overrides the top level values for that camera, -1 or
+// empty means not overridden.
+struct CameraSettings {
+  std::string device;
+  std::string folder;
+  int64_t average_bitrate;
+  int64_t keep_file_count;
+  int64_t max_bytes;
+  int64_t max_age_hours;
+
+  CameraSettings()
+      : average_bitrate(-1), keep_file_count(-1), max_bytes(-1), max_age_hours(-1) {
+  }
+};
+
+struct Settings {
+  std::string folder;
+  int64_t seconds_per_file;
+  int64_t average_bitrate;
+  int64_t keep_file_count;
+  int64_t clean_interval_minutes;
+  // retention policies, zero means no limit.
+  int64_t max_bytes;
+  int64_t min_free_bytes;
+  int64_t max_age_hours;
+  // seconds kept in memory before an event, zero disables it.
+  int64_t pre_event_seconds;
+  int64_t pre_event_megabytes;
+  // per-mille of the picture that must change to be motion, zero disables it.
+  int64_t motion_threshold;
+  // back the frame pool with large pages, needs the lock pages privilege.
+  int64_t large_pages;
+  // empty means every camera found.
+  std::vector<CameraSettings> cameras;
+};
+
+// The shape of config.json. Each field carries its own range so a bad value
+// is reported by name, ValidateSettings() checks what involves several.
+const int64_t kNoLimit = INT64_MAX;
+// a week, the cleaner wait is a 32 bit count of milliseconds.
+const int64_t kMaxCleanIntervalMinutes = 7 * 24 * 60;
+// a day, past that a lost file loses too much.
+const int64_t kMaxSecondsPerFile = 24 * 60 * 60;
+// 64 GB, the pre-event ring is allocated up front.
+const int64_t kMaxPreEventMegabytes = 64 * 1024;
+
+const plx::JsonField<CameraSettings> camera_fields[] = {
+  plx::JsonStringField("device", &CameraSettings::device, false),
+  plx::JsonStringField("folder", &CameraSettings::folder, false),
+  plx::JsonOptionalInt64Field("average_bitrate", &CameraSettings::average_bitrate, 50000, kNoLimit, -1),
+  plx::JsonOptionalInt64Field("keep_file_count", &CameraSettings::keep_file_count, 0, kNoLimit, -1),
+  plx::JsonOptionalInt64Field("max_bytes", &CameraSettings::max_bytes, 0, kNoLimit, -1),
+  plx::JsonOptionalInt64Field("max_age_hours", &CameraSettings::max_age_hours, 0, kNoLimit, -1),
+};
+
+const plx::JsonSchema<CameraSettings> camera_schema(camera_fields);
+const plx::JsonArrayOf<Settings, CameraSettings> cameras_codec(&Settings::cameras, camera_schema);
+
+const plx::JsonField<Settings> settings_fields[] = {
+  plx::JsonStringField("folder", &Settings::folder, true),
+  plx::JsonInt64Field("seconds_per_file", &Settings::seconds_per_file, 10, kMaxSecondsPerFile),
+  plx::JsonInt64Field("average_bitrate", &Settings::average_bitrate, 50000, kNoLimit),
+  plx::JsonInt64Field("keep_file_count", &Settings::keep_file_count, 0, kNoLimit),
+  plx::JsonInt64Field("clean_interval_minutes", &Settings::clean_interval_minutes, 1, kMaxCleanIntervalMinutes),
+  plx::JsonOptionalInt64Field("max_bytes", &Settings::max_bytes, 0, kNoLimit, 0),
+  plx::JsonOptionalInt64Field("min_free_bytes", &Settings::min_free_bytes, 0, kNoLimit, 0),
+  plx::JsonOptionalInt64Field("max_age_hours", &Settings::max_age_hours, 0, kNoLimit, 0),
+  plx::JsonOptionalInt64Field("pre_event_seconds", &Settings::pre_event_seconds, 0, kNoLimit, 0),
+  plx::JsonOptionalInt64Field("pre_event_megabytes", &Settings::pre_event_megabytes, 0, kMaxPreEventMegabytes, 256),
+  plx::JsonOptionalInt64Field("motion_threshold", &Settings::motion_threshold, 0, 1000, 0),
+  plx::JsonOptionalInt64Field("large_pages", &Settings::large_pages, 0, 1, 0),
+  plx::JsonArrayField("cameras", cameras_codec),
+};
+
+const plx::JsonSchema<Settings> settings_schema(settings_fields);
+
+// The settings of one camera, |folder| is used unless the camera has its own.
+inline Settings SettingsForCamera(const Settings& base, const CameraSettings& camera,
+                                  const std::string& folder) {
+  Settings settings(base);
+  settings.cameras.clear();
+  settings.folder = camera.folder.empty() ? folder : camera.folder;
+  if (camera.average_bitrate >= 0)
+    settings.average_bitrate = camera.average_bitrate;
+  if (camera.keep_file_count >= 0)
+    settings.keep_file_count = camera.keep_file_count;
+  if (camera.max_bytes >= 0)
+    settings.max_bytes = camera.max_bytes;
+  if (camera.max_age_hours >= 0)
+    settings.max_age_hours = camera.max_age_hours;
+  return settings;
+}
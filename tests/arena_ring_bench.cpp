@@ -0,0 +1,90 @@
+// plx::ArenaRing as the pre-event ring of a 4 Mbit/s 1080p30 camera: 10
+// seconds in an 8 MB arena, a 60 KB keyframe every second and 14 KB frames
+// in between. Push throughput and latency, and the latency of a flush: the
+// whole ring through plx::Fmp4Muxer into a sink that only adds up, then
+// clear(), as the saver thread does it.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+std::mt19937 rng(19);
+
+std::vector<uint8_t> MakeUnit(bool keyframe, size_t size) {
+  std::vector<uint8_t> au = { 0, 0, 0, 1, 0x09, 0xf0 };
+  if (keyframe) {
+    const uint8_t sets[] = { 0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9,
+                             0, 0, 0, 1, 0x68, 0xeb, 0xe3, 0xcb };
+    au.insert(au.end(), sets, sets + sizeof(sets));
+  }
+  au.insert(au.end(), { 0, 0, 1, static_cast<uint8_t>(keyframe ? 0x65 : 0x41) });
+  for (size_t ix = 0; ix != size; ++ix)
+    au.push_back(static_cast<uint8_t>(1 + (rng() % 255)));
+  return au;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const int fps = 30;
+  const int64_t frame_time = 10000000LL / fps;
+  const int64_t window = 10 * 10000000LL;
+  // a flush every 20 seconds of stream, the ring is full by then.
+  const int flushes = quick ? 5 : 100;
+  const int frames = flushes * 20 * fps;
+
+  std::vector<std::vector<uint8_t>> units;
+  units.push_back(MakeUnit(true, 60 * 1024));
+  for (int ix = 1; ix != fps; ++ix)
+    units.push_back(MakeUnit(false, 14 * 1024));
+
+  plx::ArenaRing ring(8 << 20, 11 * fps, window);
+  plx::LatencyHistogram push, flush;
+  uint64_t bytes_in = 0;
+  uint64_t sunk = 0;
+  size_t flushed_frames = 0;
+  auto start = plx::QpcNow();
+  uint64_t push_ns = 0;
+
+  for (int ix = 0; ix != frames; ++ix) {
+    auto& au = units[ix % fps];
+    auto t0 = plx::QpcNow();
+    CHECK(ring.push(plx::Range<const uint8_t>(&au[0], au.size()),
+                    ix * frame_time, !(ix % fps)));
+    auto ns = plx::QpcToNanos(plx::QpcNow() - t0);
+    push.record(ns);
+    push_ns += ns;
+    bytes_in += au.size();
+
+    if (((ix + 1) % (20 * fps)) == 0) {
+      t0 = plx::QpcNow();
+      plx::Fmp4Muxer::Params params = { 1920, 1080, 10000000, fps, frame_time };
+      plx::Fmp4Muxer muxer(params, [&sunk](const plx::Range<const uint8_t>& r) {
+        sunk += r.size();
+      });
+      ring.visit([&](const plx::Range<const uint8_t>& frame, int64_t time, bool keyframe) {
+        CHECK(muxer.add_access_unit(frame, time, keyframe));
+        ++flushed_frames;
+      });
+      muxer.flush();
+      ring.clear();
+      flush.record(plx::QpcToNanos(plx::QpcNow() - t0));
+    }
+  }
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  CHECK(flushed_frames >= static_cast<size_t>(flushes) * 10 * fps);
+  CHECK(ring.dropped() > 0);
+
+  auto mb = static_cast<double>(bytes_in) / (1024.0 * 1024.0);
+  printf("%d frames, %.1f MB, %zu frames flushed, %.1f MB out, %.2f s\n",
+         frames, mb, flushed_frames, sunk / (1024.0 * 1024.0), secs);
+  printf("push  %.0f MB/s, %.0f frames/s\n",
+         mb / (push_ns / 1.0e9), frames / (push_ns / 1.0e9));
+  PrintLatency("push", push);
+  PrintLatency("flush", flush);
+  return 0;
+}
@@ -0,0 +1,261 @@
+// plx::ArenaRing against a model of what it should keep. Through random
+// frame sizes, group lengths and arena wrap-arounds the ring always holds
+// the newest frames back to a keyframe, each one with its own bytes, and
+// only drops whole groups starting from the oldest. The pointers visit()
+// hands out stay on the same bytes until their frame is dropped.
+
+#include <deque>
+#include <random>
+
+#include "test_util.h"
+
+namespace {
+
+struct Frame {
+  std::vector<uint8_t> data;
+  int64_t time;
+  bool keyframe;
+};
+
+struct Seen {
+  const uint8_t* p;
+  size_t size;
+  int64_t time;
+  bool keyframe;
+};
+
+std::vector<Seen> Visit(const plx::ArenaRing& ring) {
+  std::vector<Seen> seen;
+  ring.visit([&seen](const plx::Range<const uint8_t>& r, int64_t time, bool keyframe) {
+    Seen s = { r.start(), r.size(), time, keyframe };
+    seen.push_back(s);
+  });
+  return seen;
+}
+
+// Frame |number| is filled with bytes that only it has at that size.
+Frame MakeFrame(int number, size_t size, bool keyframe) {
+  Frame frame = { std::vector<uint8_t>(size), number, keyframe };
+  for (size_t ix = 0; ix != size; ++ix)
+    frame.data[ix] = static_cast<uint8_t>((number * 31) + ix);
+  return frame;
+}
+
+bool Push(plx::ArenaRing& ring, const Frame& frame) {
+  auto start = frame.data.empty() ? nullptr : &frame.data[0];
+  return ring.push(plx::Range<const uint8_t>(start, frame.data.size()),
+                   frame.time, frame.keyframe);
+}
+
+void CheckSame(const plx::ArenaRing& ring, const std::deque<Frame>& model) {
+  auto seen = Visit(ring);
+  CHECK(seen.size() == model.size());
+  CHECK(ring.frames() == model.size());
+  for (size_t ix = 0; ix != seen.size(); ++ix) {
+    CHECK(seen[ix].time == model[ix].time);
+    CHECK(seen[ix].keyframe == model[ix].keyframe);
+    CHECK(seen[ix].size == model[ix].data.size());
+    if (seen[ix].size)
+      CHECK(!memcmp(seen[ix].p, &model[ix].data[0], seen[ix].size));
+  }
+  CHECK(model.empty() || model.front().keyframe);
+  CHECK(ring.duration() == (model.empty() ? 0 : model.back().time - model.front().time));
+}
+
+// The frames are in one buffer of |arena| bytes and never overlap.
+void CheckLayout(const plx::ArenaRing& ring, size_t arena) {
+  auto seen = Visit(ring);
+  for (size_t ix = 0; ix != seen.size(); ++ix) {
+    for (size_t jx = ix + 1; jx != seen.size(); ++jx) {
+      if (!seen[ix].size || !seen[jx].size)
+        continue;
+      CHECK((seen[ix].p + seen[ix].size <= seen[jx].p) ||
+            (seen[jx].p + seen[jx].size <= seen[ix].p));
+      auto lo = std::min(seen[ix].p, seen[jx].p);
+      auto hi = std::max(seen[ix].p + seen[ix].size, seen[jx].p + seen[jx].size);
+      CHECK(static_cast<size_t>(hi - lo) <= arena);
+    }
+  }
+}
+
+// Drops the oldest group from the model.
+void DropGop(std::deque<Frame>& model) {
+  do {
+    model.pop_front();
+  } while (!model.empty() && !model.front().keyframe);
+}
+
+void TestRefused() {
+  plx::ArenaRing ring(100, 8, 1000);
+  // nothing to decode it against.
+  CHECK(!Push(ring, MakeFrame(0, 10, false)));
+  // bigger than the arena.
+  CHECK(!Push(ring, MakeFrame(1, 101, true)));
+  CHECK(ring.frames() == 0);
+  CHECK(ring.dropped() == 2);
+  CHECK(Push(ring, MakeFrame(2, 100, true)));
+  // the only way to fit it is dropping the keyframe it needs.
+  CHECK(!Push(ring, MakeFrame(3, 1, false)));
+  CHECK(ring.frames() == 0);
+  CHECK(ring.dropped() == 4);
+
+  bool thrown = false;
+  try {
+    plx::ArenaRing empty(0, 8, 1000);
+  } catch (plx::InvalidParamException&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+// Frames of 30 bytes in 100: the fourth does not fit behind the third and
+// goes to the start once the first one is dropped.
+void TestWrapAround() {
+  plx::ArenaRing ring(100, 16, 1000);
+  std::deque<Frame> model;
+  for (int number = 0; number != 3; ++number) {
+    model.push_back(MakeFrame(number, 30, true));
+    CHECK(Push(ring, model.back()));
+  }
+  auto seen = Visit(ring);
+  auto base = seen[0].p;
+  CHECK((seen[1].p == base + 30) && (seen[2].p == base + 60));
+
+  model.push_back(MakeFrame(3, 30, true));
+  CHECK(Push(ring, model.back()));
+  model.pop_front();
+  CheckSame(ring, model);
+  seen = Visit(ring);
+  CHECK(seen.back().p == base);
+  // the survivors did not move.
+  CHECK((seen[0].p == base + 30) && (seen[1].p == base + 60));
+
+  // wrapped, only [30, 30) is free: each push drops one more.
+  for (int number = 4; number != 7; ++number) {
+    model.push_back(MakeFrame(number, 30, true));
+    CHECK(Push(ring, model.back()));
+    model.pop_front();
+    CheckSame(ring, model);
+  }
+  CHECK(ring.dropped() == 4);
+}
+
+// A group goes as a whole, its delta frames cannot stay without it.
+void TestGopEviction() {
+  plx::ArenaRing ring(1000, 64, 1000000);
+  std::deque<Frame> model;
+  int number = 0;
+  for (int gop = 0; gop != 3; ++gop) {
+    for (int ix = 0; ix != 5; ++ix) {
+      model.push_back(MakeFrame(number++, 60, ix == 0));
+      CHECK(Push(ring, model.back()));
+    }
+  }
+  CheckSame(ring, model);
+  // 900 bytes in, the next 200 need the whole first group gone.
+  model.push_back(MakeFrame(number++, 200, true));
+  CHECK(Push(ring, model.back()));
+  DropGop(model);
+  CheckSame(ring, model);
+  CHECK(ring.dropped() == 5);
+  CHECK(model.front().time == 5);
+}
+
+// Only whole groups older than the window go, and only while the rest
+// still covers it.
+void TestWindow() {
+  plx::ArenaRing ring(1 << 20, 1024, 100);
+  std::deque<Frame> model;
+  for (int number = 0; number != 1000; ++number) {
+    // a keyframe every 30, times in steps of 10.
+    auto frame = MakeFrame(number, 16, !(number % 30));
+    frame.time = number * 10;
+    model.push_back(frame);
+    CHECK(Push(ring, model.back()));
+    while (true) {
+      size_t next = 1;
+      while ((next < model.size()) && !model[next].keyframe)
+        ++next;
+      if ((next == model.size()) || ((frame.time - model[next].time) < 100))
+        break;
+      DropGop(model);
+    }
+    CheckSame(ring, model);
+    CHECK(ring.duration() < 100 + 300);
+  }
+}
+
+// At most |max_frames| descriptors, the oldest group makes room.
+void TestMaxFrames() {
+  plx::ArenaRing ring(1 << 16, 10, 1000000);
+  std::deque<Frame> model;
+  for (int number = 0; number != 100; ++number) {
+    if (model.size() == 10)
+      DropGop(model);
+    model.push_back(MakeFrame(number, 8, !(number % 4)));
+    CHECK(Push(ring, model.back()));
+    CheckSame(ring, model);
+  }
+}
+
+// Random sizes and group lengths, some frames nearly the whole arena. After
+// each push the old frames left are the newest ones, where they were.
+void TestRandom() {
+  std::mt19937 rng(11);
+  for (int round = 0; round != 50; ++round) {
+    const size_t arena = 256 + (rng() % 4096);
+    const size_t max_frames = 4 + (rng() % 60);
+    plx::ArenaRing ring(arena, max_frames, 1LL << 40);
+    std::deque<Frame> model;
+    int gop_left = 0;
+    for (int number = 0; number != 2000; ++number) {
+      bool keyframe = !gop_left;
+      if (keyframe)
+        gop_left = 1 + (rng() % 12);
+      --gop_left;
+      auto size = (rng() % 8) ? rng() % (arena / 6) : rng() % (arena + 1);
+      auto frame = MakeFrame(number, size, keyframe);
+
+      auto before = Visit(ring);
+      auto stored = Push(ring, frame);
+      CHECK(stored || !keyframe || (size > arena));
+      if (stored) {
+        model.push_back(frame);
+        // what is left of the old frames is their newest part, unmoved.
+        auto after = Visit(ring);
+        auto kept = after.size() - 1;
+        CHECK(kept <= before.size());
+        for (size_t ix = 0; ix != kept; ++ix) {
+          auto& old = before[before.size() - kept + ix];
+          CHECK((after[ix].p == old.p) && (after[ix].time == old.time));
+        }
+        while (model.size() > after.size())
+          model.pop_front();
+      } else if (size <= arena) {
+        // a delta frame is only refused once its group is gone, and with
+        // it everything older.
+        CHECK(!ring.frames());
+        model.clear();
+        gop_left = 0;
+      }
+      CheckSame(ring, model);
+      CheckLayout(ring, arena);
+      CHECK(ring.frames() <= max_frames);
+    }
+    ring.clear();
+    CHECK(ring.frames() == 0);
+    CHECK(Push(ring, MakeFrame(0, arena, true)));
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestRefused();
+  TestWrapAround();
+  TestGopEviction();
+  TestWindow();
+  TestMaxFrames();
+  TestRandom();
+  return 0;
+}
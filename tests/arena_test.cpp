@@ -0,0 +1,72 @@
+// plx::Arena hands out aligned blocks that stay inside their chunk and do
+// not overlap, across chunk growth and reset().
+
+#include <random>
+
+#include "test_util.h"
+
+namespace {
+
+bool Aligned(const void* p, size_t align) {
+  return (reinterpret_cast<uintptr_t>(p) % align) == 0;
+}
+
+// Alignment padding used to push the block past the end of a small chunk.
+void TestAlignPastChunkEnd() {
+  plx::Arena arena(16);
+  auto first = static_cast<uint8_t*>(arena.allocate(21, 1));
+  CHECK(arena.chunk_count() == 1);
+  auto chunk_end = first + arena.bytes_reserved();
+  auto second = static_cast<uint8_t*>(arena.allocate(8, 8));
+  CHECK(Aligned(second, 8));
+  // 21 bytes in, an aligned 8 cannot fit in the first chunk.
+  CHECK((second < first) || (second >= chunk_end));
+  CHECK(arena.chunk_count() == 2);
+  memset(second, 0xCD, 8);
+}
+
+struct Block {
+  uint8_t* p;
+  size_t bytes;
+  uint8_t fill;
+};
+
+// Random sizes and alignments, each block filled with its own byte. A block
+// overwritten by a later one, or placed past its chunk, shows up as a
+// wrong byte (or as a crash under a sanitizer).
+void TestRandomBlocks() {
+  std::mt19937 rng(7);
+  const size_t aligns[] = { 1, 2, 4, 8, 16, 32, 64 };
+  plx::Arena arena(16);
+  for (int round = 0; round != 3; ++round) {
+    std::vector<Block> blocks;
+    size_t used = 0;
+    for (int ix = 0; ix != 5000; ++ix) {
+      auto bytes = static_cast<size_t>(rng() % ((ix % 50) ? 40 : 5000));
+      auto align = aligns[rng() % (sizeof(aligns) / sizeof(aligns[0]))];
+      auto p = static_cast<uint8_t*>(arena.allocate(bytes, align));
+      CHECK(Aligned(p, align));
+      Block block = { p, bytes, static_cast<uint8_t>(ix) };
+      memset(p, block.fill, bytes);
+      blocks.push_back(block);
+      used += bytes;
+    }
+    for (auto& block : blocks) {
+      for (size_t jx = 0; jx != block.bytes; ++jx)
+        CHECK(block.p[jx] == block.fill);
+    }
+    CHECK(arena.bytes_used() == used);
+    CHECK(arena.bytes_reserved() >= used);
+    arena.reset();
+    CHECK(arena.chunk_count() == 1);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestAlignPastChunkEnd();
+  TestRandomBlocks();
+  printf("arena ok\n");
+  return 0;
+}
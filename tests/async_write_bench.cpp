@@ -0,0 +1,131 @@
+// Sequential write speed of plx::AsyncFileWriter over block size and queue
+// depth, on plx::IoUringIo and on the plx::ThreadPoolIo pwrite fallback,
+// against plain write() calls as they come. The writes are the sizes the
+// fmp4 muxer hands out, a few KB to a few hundred. Each run ends with
+// fdatasync so the disk is in the number, not only the page cache. The file
+// is in the current directory, 256 MB a run or 4 MB with --quick.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_io.h"
+
+namespace {
+
+const char kPath[] = "async_write_bench.tmp";
+
+// the sizes of the writes, the same for every run.
+std::vector<size_t> WriteSizes(uint64_t total) {
+  std::mt19937 rng(25);
+  std::vector<size_t> sizes;
+  uint64_t sum = 0;
+  while (sum < total) {
+    // mostly inter frames, now and then a keyframe.
+    size_t size = (rng() % 30) ? (2000 + rng() % 30000) : (100000 + rng() % 300000);
+    size = static_cast<size_t>(std::min<uint64_t>(size, total - sum));
+    sizes.push_back(size);
+    sum += size;
+  }
+  return sizes;
+}
+
+std::unique_ptr<plx::AsyncIo> MakeThreadPool(int fd, unsigned int depth) {
+  return std::unique_ptr<plx::AsyncIo>(new plx::ThreadPoolIo(
+      [fd](const plx::AsyncIo::Op& op) -> int64_t {
+        return ::pwrite(fd, op.data, op.size, static_cast<off_t>(op.offset));
+      }, depth));
+}
+
+std::unique_ptr<plx::AsyncIo> MakeIoUring(int fd, unsigned int depth) {
+  return std::unique_ptr<plx::AsyncIo>(new plx::IoUringIo(fd, depth));
+}
+
+typedef std::unique_ptr<plx::AsyncIo> (*MakeIo)(int fd, unsigned int depth);
+
+// MB/s of one run, with |make| null for plain write().
+double Run(MakeIo make, size_t block_size, unsigned int depth,
+           const std::vector<size_t>& sizes, const std::vector<uint8_t>& data) {
+  auto file = plx::LargeFile::Create(kPath, O_WRONLY | O_CREAT | O_TRUNC);
+  CHECK(file.is_valid());
+  uint64_t total = 0;
+  size_t pos = 0;
+  auto start = plx::QpcNow();
+  if (make) {
+    plx::AsyncFileWriter writer(make(file.native(), depth), block_size, depth);
+    for (auto size : sizes) {
+      writer.write(&data[pos], size);
+      pos = (pos + size) % (data.size() / 2);
+      total += size;
+    }
+    writer.flush();
+    CHECK(writer.failures() == 0);
+  } else {
+    for (auto size : sizes) {
+      CHECK(file.write(&data[pos], size, -1) == size);
+      pos = (pos + size) % (data.size() / 2);
+      total += size;
+    }
+  }
+  CHECK(::fdatasync(file.native()) == 0);
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  CHECK(file.size_in_bytes() == static_cast<long long>(total));
+  return total / (1024.0 * 1024.0) / secs;
+}
+
+bool HasIoUring() {
+  try {
+    plx::IoUringIo io(STDOUT_FILENO, 1);
+    return true;
+  } catch (plx::IOException&) {
+    return false;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const uint64_t total = quick ? (4ULL << 20) : (256ULL << 20);
+  auto sizes = WriteSizes(total);
+  // twice the largest write, any offset in the first half has one after it.
+  std::vector<uint8_t> data(800 * 1024);
+  for (size_t ix = 0; ix != data.size(); ++ix)
+    data[ix] = static_cast<uint8_t>(ix * 13);
+
+  printf("%zu writes, %.0f MB a run\n", sizes.size(), total / (1024.0 * 1024.0));
+  printf("plain write()                %8.1f MB/s\n", Run(nullptr, 0, 0, sizes, data));
+
+  struct Backend {
+    const char* name;
+    MakeIo make;
+  };
+  std::vector<Backend> backends;
+  if (HasIoUring()) {
+    Backend uring = { "io_uring", MakeIoUring };
+    backends.push_back(uring);
+  } else {
+    printf("no io_uring, only the pwrite thread pool runs\n");
+  }
+  Backend pool = { "pwrite pool", MakeThreadPool };
+  backends.push_back(pool);
+
+  const size_t blocks[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4096 * 1024 };
+  const unsigned int depths[] = { 1, 2, 4, 8, 16 };
+  for (auto& backend : backends) {
+    printf("\n%-12s block KB", backend.name);
+    for (auto depth : depths)
+      printf("   depth %-3u", depth);
+    printf("   (MB/s)\n");
+    for (auto block : blocks) {
+      printf("%21zu", block / 1024);
+      for (auto depth : depths)
+        printf("   %9.1f", Run(backend.make, block, depth, sizes, data));
+      printf("\n");
+    }
+  }
+  ::unlink(kPath);
+  return 0;
+}
@@ -0,0 +1,100 @@
+// plx::AsyncFileWriter on each plx::AsyncIo this machine has: random sized
+// writes, some of them out of order with write_at(), have to read back
+// as the same file. On kernels without io_uring only the thread pool runs.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_io.h"
+
+namespace {
+
+std::mt19937 rng(25);
+
+std::vector<uint8_t> ReadAll(int fd) {
+  std::vector<uint8_t> data(static_cast<size_t>(::lseek(fd, 0, SEEK_END)));
+  if (!data.empty())
+    CHECK(::pread(fd, &data[0], data.size(), 0) == static_cast<ssize_t>(data.size()));
+  return data;
+}
+
+void Check(const char* name, std::unique_ptr<plx::AsyncIo> (*make)(int)) {
+  char path[] = "/tmp/async_writer_test_XXXXXX";
+  auto fd = ::mkstemp(path);
+  CHECK(fd >= 0);
+  ::unlink(path);
+
+  std::vector<uint8_t> expected;
+  uint64_t blocks = 0;
+  {
+    plx::AsyncFileWriter writer(make(fd), 64 * 1024, 4,
+        [&blocks](uint64_t, size_t, int64_t) { ++blocks; });
+    for (int ix = 0; ix != 2000; ++ix) {
+      std::vector<uint8_t> chunk(rng() % ((ix % 100) ? 3000 : 200000));
+      for (auto& c : chunk)
+        c = static_cast<uint8_t>(rng());
+      if (!chunk.empty() && !(ix % 7)) {
+        // over what is already there, like a header rewritten at the end.
+        // blocks in flight can land in any order, so they go out first.
+        writer.flush();
+        auto offset = rng() % (expected.size() + 1);
+        writer.write_at(offset, &chunk[0], chunk.size());
+        if (expected.size() < offset + chunk.size())
+          expected.resize(offset + chunk.size());
+        memcpy(&expected[offset], &chunk[0], chunk.size());
+        // back to the end for the next write().
+        writer.write_at(expected.size(), nullptr, 0);
+        continue;
+      }
+      writer.write(chunk.empty() ? nullptr : &chunk[0], chunk.size());
+      expected.insert(expected.end(), chunk.begin(), chunk.end());
+    }
+    writer.flush();
+    CHECK(writer.failures() == 0);
+    CHECK(writer.end() == expected.size());
+  }
+  auto written = ReadAll(fd);
+  CHECK(written == expected);
+  ::close(fd);
+  printf("%-12s %zu bytes in %llu blocks\n", name, expected.size(),
+         static_cast<unsigned long long>(blocks));
+}
+
+std::unique_ptr<plx::AsyncIo> MakeThreadPool(int fd) {
+  return std::unique_ptr<plx::AsyncIo>(new plx::ThreadPoolIo(
+      [fd](const plx::AsyncIo::Op& op) -> int64_t {
+        return ::pwrite(fd, op.data, op.size, static_cast<off_t>(op.offset));
+      }, 4));
+}
+
+std::unique_ptr<plx::AsyncIo> MakeIoUring(int fd) {
+  return std::unique_ptr<plx::AsyncIo>(new plx::IoUringIo(fd, 4));
+}
+
+std::unique_ptr<plx::AsyncIo> MakeBest(int fd) {
+  return plx::MakeAsyncIo(fd, 4);
+}
+
+bool HasIoUring() {
+  try {
+    plx::IoUringIo io(STDOUT_FILENO, 1);
+    return true;
+  } catch (plx::IOException&) {
+    return false;
+  }
+}
+
+}  // namespace
+
+int main() {
+  Check("thread pool", MakeThreadPool);
+  if (HasIoUring())
+    Check("io_uring", MakeIoUring);
+  else
+    printf("no io_uring, MakeAsyncIo falls back to the thread pool\n");
+  Check("MakeAsyncIo", MakeBest);
+  return 0;
+}
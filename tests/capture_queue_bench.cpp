@@ -0,0 +1,154 @@
+// Capture callback latency with a sink that stalls now and then, writing
+// inline from the callback versus queueing to a SegmentedWriter. A camera
+// drops frames when its callback runs past the next frame, which is what
+// "late" counts; the queue drops when the writer falls a whole queue behind.
+
+#include "test_util.h"
+#include "capture_core.h"
+
+namespace {
+
+struct BenchParams {
+  int frames;
+  int interval_us;
+  // cost of each write, like an encoder running synchronously.
+  int write_us;
+  // every |stall_every| frames one write takes |stall_ms| more, like a
+  // disk flush.
+  int stall_every;
+  int stall_ms;
+};
+
+// busy waits, sleeping would hand the core to the other thread.
+void BusyWait(int us) {
+  auto start = plx::QpcNow();
+  while (plx::QpcToNanos(plx::QpcNow() - start) < (us * 1000LL)) {
+  }
+}
+
+class BenchSink {
+  const BenchParams& params_;
+  int written_;
+
+public:
+  explicit BenchSink(const BenchParams& params) : params_(params), written_(0) {}
+
+  void write() {
+    BusyWait(params_.write_us);
+    if ((++written_ % params_.stall_every) == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(params_.stall_ms));
+  }
+};
+
+typedef std::shared_ptr<BenchSink> SinkPtr;
+
+class QueuedDelegate : public SegmentedWriter<SinkPtr, int64_t>::Delegate {
+public:
+  bool prepare_frame(int64_t&) override {
+    return true;
+  }
+
+  bool write_frame(SinkPtr& sink, int64_t&, int64_t) override {
+    sink->write();
+    return true;
+  }
+
+  void frame_written(int64_t&, int64_t) override {}
+  void finalize_writer(SinkPtr&) override {}
+  void discard_writer(SinkPtr&, const std::wstring&) override {}
+};
+
+struct Result {
+  plx::LatencyHistogram callback;
+  int late;
+  uint64_t dropped;
+};
+
+// Calls |callback| once per frame interval like a camera would.
+template <typename Fn>
+void Produce(const BenchParams& params, Result& result, Fn callback) {
+  auto start = std::chrono::steady_clock::now();
+  auto interval = std::chrono::microseconds(params.interval_us);
+  for (int ix = 0; ix != params.frames; ++ix) {
+    auto slot = start + (interval * ix);
+    std::this_thread::sleep_until(slot);
+    auto arrival = plx::QpcNow();
+    callback(ix, arrival);
+    auto done = plx::QpcNow();
+    result.callback.record(plx::QpcToNanos(done - arrival));
+    if (std::chrono::steady_clock::now() > (slot + interval))
+      ++result.late;
+  }
+}
+
+void RunInline(const BenchParams& params, Result& result) {
+  BenchSink sink(params);
+  Produce(params, result, [&](int, int64_t) {
+    sink.write();
+  });
+}
+
+void RunQueued(const BenchParams& params, Result& result) {
+  QueuedDelegate delegate;
+  SegmentedWriter<SinkPtr, int64_t> segments(&delegate, 64);
+  // segments of a third of the run, rotated from another thread like the
+  // UI timer does in the app.
+  const int64_t segment_length = (params.frames / 3) * params.interval_us;
+  segments.start(std::make_shared<BenchSink>(params), segment_length);
+  std::atomic<bool> done(false);
+  std::thread rotator([&]() {
+    auto seen = segments.segment_count();
+    while (!done) {
+      if (segments.segment_count() != seen) {
+        segments.finalize_retired();
+        seen = segments.segment_count();
+      }
+      if (!segments.has_next())
+        segments.prepare_next(std::make_shared<BenchSink>(params), L"", segment_length);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+  Produce(params, result, [&](int ix, int64_t arrival) {
+    segments.push(ix, static_cast<int64_t>(ix) * params.interval_us, arrival, 0);
+  });
+  done = true;
+  rotator.join();
+  segments.stop();
+  auto st = segments.stats();
+  result.dropped = st.queue_full_drops;
+  CHECK((st.frames_written + st.queue_full_drops) == static_cast<uint64_t>(params.frames));
+  PrintLatency("  queue wait", segments.latency().queue);
+  PrintLatency("  frame total", segments.latency().total);
+}
+
+void Report(const char* name, const Result& result) {
+  PrintLatency(name, result.callback);
+  printf("  late callbacks %d, queue drops %llu\n",
+         result.late, static_cast<unsigned long long>(result.dropped));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchParams params;
+  if (HasArg(argc, argv, "--quick")) {
+    BenchParams quick = { 240, 4000, 500, 60, 40 };
+    params = quick;
+  } else {
+    // 30 seconds of 60 fps with a 200 ms stall every 5 seconds.
+    BenchParams full = { 1800, 16667, 2000, 300, 200 };
+    params = full;
+  }
+  printf("%d frames every %d us, writes of %d us, %d ms stall every %d frames\n",
+         params.frames, params.interval_us, params.write_us,
+         params.stall_ms, params.stall_every);
+
+  Result inline_result = {};
+  RunInline(params, inline_result);
+  Report("inline callback", inline_result);
+
+  Result queued_result = {};
+  RunQueued(params, queued_result);
+  Report("queued callback", queued_result);
+  return 0;
+}
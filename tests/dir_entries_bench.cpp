@@ -0,0 +1,131 @@
+// plx::DirEntries on a folder of many small files, as the cleaner sees a
+// camera folder, against readdir and readdir + fstatat. Listing again with
+// read() reuses the buffer. The totals of every method have to agree.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test_util.h"
+#include "plx_io.h"
+
+namespace {
+
+struct Totals {
+  size_t files;
+  long long bytes;
+  long long newest;
+};
+
+std::string MakeFolder(size_t count) {
+  char tmpl[] = "/tmp/dir_entries_bench_XXXXXX";
+  CHECK(mkdtemp(tmpl));
+  std::string dir(tmpl);
+  std::string data(96, 'x');
+  for (size_t ix = 0; ix != count; ++ix) {
+    auto name = dir + plx::Format("/2026-10-17-%06d.mp4", static_cast<int>(ix));
+    auto fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    auto bytes = ix % 97;
+    CHECK(::write(fd, data.data(), bytes) == static_cast<ssize_t>(bytes));
+    ::close(fd);
+  }
+  return dir;
+}
+
+void RemoveFolder(const std::string& dir) {
+  auto d = ::opendir(dir.c_str());
+  CHECK(d);
+  while (auto e = ::readdir(d)) {
+    if (e->d_name[0] != '.')
+      ::unlinkat(::dirfd(d), e->d_name, 0);
+  }
+  ::closedir(d);
+  ::rmdir(dir.c_str());
+}
+
+bool IsDot(const char* name) {
+  return (name[0] == '.') && (!name[1] || ((name[1] == '.') && !name[2]));
+}
+
+Totals ListEntries(plx::DirEntries& entries, int dir_fd, bool stat) {
+  Totals totals = { 0, 0, 0 };
+  entries.read(dir_fd);
+  for (entries.first(); !entries.done(); entries.next()) {
+    if (IsDot(entries.file_name().start()))
+      continue;
+    ++totals.files;
+    if (stat) {
+      totals.bytes += entries.size_in_bytes();
+      totals.newest = std::max(totals.newest, entries.creation_ns1600());
+    }
+  }
+  return totals;
+}
+
+Totals ListReaddir(const std::string& dir, bool stat) {
+  Totals totals = { 0, 0, 0 };
+  auto d = ::opendir(dir.c_str());
+  CHECK(d);
+  while (auto e = ::readdir(d)) {
+    if (IsDot(e->d_name))
+      continue;
+    ++totals.files;
+    if (stat) {
+      struct stat st;
+      CHECK(::fstatat(::dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0);
+      // struct stat has no birth time, only counts and sizes are compared.
+      totals.bytes += st.st_size;
+    }
+  }
+  ::closedir(d);
+  return totals;
+}
+
+// Best of |runs|, in ms.
+template <typename Fn>
+double BestMs(int runs, Fn list, Totals* totals) {
+  double best = 1.0e30;
+  for (int ix = 0; ix != runs; ++ix) {
+    auto start = plx::QpcNow();
+    *totals = list();
+    best = std::min(best, plx::QpcToNanos(plx::QpcNow() - start) / 1.0e6);
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const size_t count = quick ? 5000 : 100000;
+  const int runs = quick ? 3 : 10;
+  auto dir = MakeFolder(count);
+  auto dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  CHECK(dir_fd >= 0);
+
+  long long expected_bytes = 0;
+  for (size_t ix = 0; ix != count; ++ix)
+    expected_bytes += ix % 97;
+
+  plx::DirEntries entries;
+  Totals totals;
+  printf("%zu files, best of %d\n", count, runs);
+  auto ms = BestMs(runs, [&] { return ListEntries(entries, dir_fd, false); }, &totals);
+  CHECK(totals.files == count);
+  printf("DirEntries names          %8.2f ms\n", ms);
+  ms = BestMs(runs, [&] { return ListEntries(entries, dir_fd, true); }, &totals);
+  CHECK((totals.files == count) && (totals.bytes == expected_bytes) && (totals.newest > 0));
+  printf("DirEntries size and time  %8.2f ms\n", ms);
+  ms = BestMs(runs, [&] { return ListReaddir(dir, false); }, &totals);
+  CHECK(totals.files == count);
+  printf("readdir names             %8.2f ms\n", ms);
+  ms = BestMs(runs, [&] { return ListReaddir(dir, true); }, &totals);
+  CHECK((totals.files == count) && (totals.bytes == expected_bytes));
+  printf("readdir + fstatat         %8.2f ms\n", ms);
+
+  ::close(dir_fd);
+  RemoveFolder(dir);
+  return 0;
+}
@@ -0,0 +1,364 @@
+// plx::Fmp4Muxer on a made up annex-b stream: the boxes come out as
+// ftyp, moov and then moof+mdat pairs, every trun points at its mdat and
+// its samples are the input NALs with length prefixes, frame times survive
+// dropped frames, and a copy of the file cut anywhere plays every fragment
+// that made it whole. Also bad params and frames that go back in time.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint32_t kTimescale = 90000;
+const uint32_t kFrameDuration = 3000;
+const uint32_t kFramesPerFragment = 10;
+
+std::mt19937 rng(3);
+
+struct Unit {
+  Bytes annexb;
+  // what the mp4 sample has to hold, the NALs without the delimiter.
+  std::vector<Bytes> nals;
+  int64_t time;
+  bool keyframe;
+};
+
+struct Sample {
+  Bytes data;
+  int64_t time;
+  uint32_t duration;
+  bool keyframe;
+};
+
+uint32_t GetU32(const Bytes& v, size_t pos) {
+  return (uint32_t(v[pos]) << 24) | (uint32_t(v[pos + 1]) << 16) |
+         (uint32_t(v[pos + 2]) << 8) | uint32_t(v[pos + 3]);
+}
+
+uint64_t GetU64(const Bytes& v, size_t pos) {
+  return (uint64_t(GetU32(v, pos)) << 32) | GetU32(v, pos + 4);
+}
+
+bool IsBox(const Bytes& v, size_t pos, const char* type) {
+  return !memcmp(&v[pos + 4], type, 4);
+}
+
+// No zero bytes, so no start code can show up inside.
+Bytes MakeNal(uint8_t type, size_t size) {
+  Bytes nal(size);
+  nal[0] = 0x60 | type;
+  for (size_t ix = 1; ix != size; ++ix)
+    nal[ix] = static_cast<uint8_t>(1 + (rng() % 255));
+  return nal;
+}
+
+void AddNal(Unit& unit, const Bytes& nal, bool in_sample) {
+  // both start code lengths, sometimes with trailing zeros.
+  if (rng() % 2)
+    unit.annexb.push_back(0);
+  unit.annexb.insert(unit.annexb.end(), { 0, 0, 1 });
+  unit.annexb.insert(unit.annexb.end(), nal.begin(), nal.end());
+  if (!(rng() % 5))
+    unit.annexb.insert(unit.annexb.end(), { 0, 0 });
+  if (in_sample)
+    unit.nals.push_back(nal);
+}
+
+// Two frames before the first keyframe, a keyframe every 30 frames and a
+// few dropped frames. With |in_band| the SPS and PPS come with each
+// keyframe.
+std::vector<Unit> MakeStream(size_t count, const Bytes& sps, const Bytes& pps, bool in_band) {
+  std::vector<Unit> units;
+  int64_t time = 1000000;
+  for (size_t ix = 0; ix != count; ++ix) {
+    Unit unit;
+    unit.time = time;
+    unit.keyframe = (ix >= 2) && !((ix - 2) % 30);
+    AddNal(unit, MakeNal(9, 2), false);
+    if (unit.keyframe && in_band) {
+      AddNal(unit, sps, true);
+      AddNal(unit, pps, true);
+    }
+    if (unit.keyframe)
+      AddNal(unit, MakeNal(5, 500 + rng() % 3000), true);
+    else
+      AddNal(unit, MakeNal(1, 20 + rng() % 800), true);
+    units.push_back(unit);
+    time += kFrameDuration * (((ix % 17) == 16) ? 3 : 1);
+  }
+  return units;
+}
+
+Bytes Mux(const std::vector<Unit>& units, const Bytes* parameter_sets,
+          std::vector<size_t>* accepted) {
+  Bytes file;
+  plx::Fmp4Muxer::Params params = { 640, 480, kTimescale, kFramesPerFragment, kFrameDuration };
+  plx::Fmp4Muxer muxer(params, [&file](const plx::Range<const uint8_t>& r) {
+    file.insert(file.end(), r.start(), r.end());
+  });
+  if (parameter_sets)
+    muxer.add_parameter_sets(plx::Range<const uint8_t>(&(*parameter_sets)[0], parameter_sets->size()));
+  for (size_t ix = 0; ix != units.size(); ++ix) {
+    auto& au = units[ix].annexb;
+    if (muxer.add_access_unit(plx::Range<const uint8_t>(&au[0], au.size()),
+                              units[ix].time, units[ix].keyframe))
+      accepted->push_back(ix);
+  }
+  muxer.flush();
+  CHECK(muxer.bytes_out() == file.size());
+  return file;
+}
+
+// The byte range of the |type| box inside [pos, end), or 0 if missing.
+size_t FindBox(const Bytes& v, size_t pos, size_t end, const char* type) {
+  while (pos + 8 <= end) {
+    auto size = GetU32(v, pos);
+    CHECK((size >= 8) && (pos + size <= end));
+    if (IsBox(v, pos, type))
+      return pos;
+    pos += size;
+  }
+  return 0;
+}
+
+// What a player gets out of |file|: the samples of every whole fragment.
+// Checks the layout of what it reads.
+std::vector<Sample> Play(const Bytes& file, Bytes* avcc) {
+  std::vector<Sample> samples;
+  size_t pos = 0;
+  uint32_t sequence = 0;
+  while (pos + 8 <= file.size()) {
+    auto size = GetU32(file, pos);
+    CHECK(size >= 8);
+    if (pos + size > file.size())
+      break;
+    if (pos == 0) {
+      CHECK(IsBox(file, pos, "ftyp"));
+    } else if (IsBox(file, pos, "moov")) {
+      auto trak = FindBox(file, pos + 8, pos + size, "trak");
+      auto mvex = FindBox(file, pos + 8, pos + size, "mvex");
+      CHECK(trak && mvex && FindBox(file, mvex + 8, mvex + GetU32(file, mvex), "trex"));
+      // moov/trak/mdia/minf/stbl/stsd/avc1/avcC
+      auto mdia = FindBox(file, trak + 8, trak + GetU32(file, trak), "mdia");
+      auto minf = FindBox(file, mdia + 8, mdia + GetU32(file, mdia), "minf");
+      auto stbl = FindBox(file, minf + 8, minf + GetU32(file, minf), "stbl");
+      auto stsd = FindBox(file, stbl + 8, stbl + GetU32(file, stbl), "stsd");
+      CHECK(mdia && minf && stbl && stsd);
+      auto avc1 = stsd + 16;
+      CHECK(IsBox(file, avc1, "avc1"));
+      auto avc_box = FindBox(file, avc1 + 86, avc1 + GetU32(file, avc1), "avcC");
+      CHECK(avc_box);
+      avcc->assign(file.begin() + avc_box + 8, file.begin() + avc_box + GetU32(file, avc_box));
+    } else {
+      CHECK(IsBox(file, pos, "moof"));
+      auto moof = pos;
+      auto mdat = moof + size;
+      // a fragment without its whole mdat does not play.
+      if ((mdat + 8 > file.size()) || (mdat + GetU32(file, mdat) > file.size()))
+        break;
+      CHECK(IsBox(file, mdat, "mdat"));
+      auto mdat_end = mdat + GetU32(file, mdat);
+
+      auto mfhd = FindBox(file, moof + 8, mdat, "mfhd");
+      CHECK(mfhd && (GetU32(file, mfhd + 12) == ++sequence));
+      auto traf = FindBox(file, moof + 8, mdat, "traf");
+      auto traf_end = traf + GetU32(file, traf);
+      auto tfhd = FindBox(file, traf + 8, traf_end, "tfhd");
+      CHECK(tfhd && (GetU32(file, tfhd + 8) == 0x020000));
+      auto tfdt = FindBox(file, traf + 8, traf_end, "tfdt");
+      CHECK(tfdt && (file[tfdt + 8] == 1));
+      auto time = static_cast<int64_t>(GetU64(file, tfdt + 12));
+      auto trun = FindBox(file, traf + 8, traf_end, "trun");
+      CHECK(trun && (GetU32(file, trun + 8) == 0x000701));
+      auto count = GetU32(file, trun + 12);
+      // default-base-is-moof: the data starts right after the mdat header.
+      CHECK(moof + GetU32(file, trun + 16) == mdat + 8);
+      auto data = mdat + 8;
+      for (uint32_t ix = 0; ix != count; ++ix) {
+        auto entry = trun + 20 + 12 * ix;
+        Sample sample;
+        sample.time = time;
+        sample.duration = GetU32(file, entry);
+        auto sample_size = GetU32(file, entry + 4);
+        auto flags = GetU32(file, entry + 8);
+        CHECK((flags == 0x02000000) || (flags == 0x01010000));
+        sample.keyframe = (flags == 0x02000000);
+        CHECK(data + sample_size <= mdat_end);
+        sample.data.assign(file.begin() + data, file.begin() + data + sample_size);
+        samples.push_back(sample);
+        data += sample_size;
+        time += sample.duration;
+      }
+      CHECK(data == mdat_end);
+      size = static_cast<uint32_t>(mdat_end - moof);
+    }
+    pos += size;
+  }
+  return samples;
+}
+
+Bytes LengthPrefixed(const std::vector<Bytes>& nals) {
+  Bytes out;
+  for (auto& nal : nals) {
+    auto size = static_cast<uint32_t>(nal.size());
+    out.insert(out.end(), { uint8_t(size >> 24), uint8_t(size >> 16),
+                            uint8_t(size >> 8), uint8_t(size) });
+    out.insert(out.end(), nal.begin(), nal.end());
+  }
+  return out;
+}
+
+void CheckSamples(const std::vector<Sample>& samples, const std::vector<Unit>& units,
+                  const std::vector<size_t>& accepted) {
+  CHECK(samples.size() == accepted.size());
+  auto first_time = units[accepted[0]].time;
+  for (size_t ix = 0; ix != samples.size(); ++ix) {
+    auto& unit = units[accepted[ix]];
+    CHECK(samples[ix].data == LengthPrefixed(unit.nals));
+    CHECK(samples[ix].keyframe == unit.keyframe);
+    CHECK(samples[ix].time == unit.time - first_time);
+    if (ix + 1 != samples.size())
+      CHECK(samples[ix].duration == units[accepted[ix + 1]].time - unit.time);
+    else
+      CHECK(samples[ix].duration == samples[ix - 1].duration);
+  }
+}
+
+void TestLayout() {
+  auto sps = MakeNal(7, 12);
+  auto pps = MakeNal(8, 4);
+  auto units = MakeStream(95, sps, pps, true);
+  std::vector<size_t> accepted;
+  auto file = Mux(units, nullptr, &accepted);
+  // the two frames before the first keyframe are dropped.
+  CHECK((accepted.size() == 93) && (accepted[0] == 2));
+
+  Bytes avcc;
+  auto samples = Play(file, &avcc);
+  CheckSamples(samples, units, accepted);
+  // version, profile, compatibility, level, length size, one SPS.
+  CHECK((avcc[0] == 1) && (avcc[1] == sps[1]) && (avcc[3] == sps[3]));
+  CHECK((avcc[4] == 0xff) && (avcc[5] == 0xe1));
+  CHECK(Bytes(avcc.begin() + 8, avcc.begin() + 8 + sps.size()) == sps);
+  CHECK(Bytes(avcc.end() - pps.size(), avcc.end()) == pps);
+
+  // every fragment but the last is full.
+  size_t fragments = 0;
+  for (size_t pos = 0; pos < file.size(); pos += GetU32(file, pos))
+    fragments += IsBox(file, pos, "moof") ? 1 : 0;
+  CHECK(fragments == (accepted.size() + kFramesPerFragment - 1) / kFramesPerFragment);
+  printf("%zu frames in %zu fragments, %zu bytes\n", samples.size(), fragments, file.size());
+}
+
+void TestTruncated() {
+  auto sps = MakeNal(7, 12);
+  auto pps = MakeNal(8, 4);
+  auto units = MakeStream(64, sps, pps, true);
+  std::vector<size_t> accepted;
+  auto file = Mux(units, nullptr, &accepted);
+  Bytes avcc;
+  auto all = Play(file, &avcc);
+
+  // where each fragment ends and how many frames are whole up to there.
+  std::vector<std::pair<size_t, size_t>> ends;
+  size_t frames = 0;
+  for (size_t pos = 0; pos < file.size(); pos += GetU32(file, pos)) {
+    if (IsBox(file, pos, "mdat")) {
+      frames = std::min(frames + kFramesPerFragment, all.size());
+      ends.push_back(std::make_pair(pos + GetU32(file, pos), frames));
+    }
+  }
+  CHECK(frames == all.size());
+
+  std::vector<size_t> cuts;
+  for (auto& end : ends) {
+    cuts.push_back(end.first - 1);
+    cuts.push_back(end.first);
+    cuts.push_back(end.first + 1);
+  }
+  for (int ix = 0; ix != 300; ++ix)
+    cuts.push_back(rng() % file.size());
+  for (auto cut : cuts) {
+    if (cut > file.size())
+      continue;
+    Bytes part(file.begin(), file.begin() + cut);
+    size_t whole = 0;
+    for (auto& end : ends) {
+      if (end.first <= cut)
+        whole = end.second;
+    }
+    auto samples = Play(part, &avcc);
+    CHECK(samples.size() == whole);
+    for (size_t ix = 0; ix != whole; ++ix) {
+      CHECK(samples[ix].data == all[ix].data);
+      CHECK(samples[ix].time == all[ix].time);
+    }
+  }
+  printf("%zu cuts of a %zu byte file\n", cuts.size(), file.size());
+}
+
+// The encoder gives the SPS and PPS apart, the keyframes carry neither.
+void TestParameterSets() {
+  auto sps = MakeNal(7, 9);
+  auto pps = MakeNal(8, 5);
+  auto units = MakeStream(40, sps, pps, false);
+  std::vector<size_t> accepted;
+  CHECK(Mux(units, nullptr, &accepted).empty() && accepted.empty());
+
+  Unit sets;
+  AddNal(sets, sps, false);
+  AddNal(sets, pps, false);
+  auto file = Mux(units, &sets.annexb, &accepted);
+  Bytes avcc;
+  CheckSamples(Play(file, &avcc), units, accepted);
+  CHECK(Bytes(avcc.begin() + 8, avcc.begin() + 8 + sps.size()) == sps);
+}
+
+void TestErrors() {
+  auto sink = [](const plx::Range<const uint8_t>&) {};
+  plx::Fmp4Muxer::Params bad[] = {
+    { 640, 480, 0, 10, 3000 },
+    { 640, 480, 90000, 0, 3000 },
+    { 640, 480, 90000, 10, 0 },
+  };
+  for (auto& params : bad) {
+    bool thrown = false;
+    try {
+      plx::Fmp4Muxer muxer(params, sink);
+    } catch (plx::InvalidParamException&) {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+
+  auto units = MakeStream(4, MakeNal(7, 8), MakeNal(8, 4), true);
+  plx::Fmp4Muxer::Params params = { 640, 480, kTimescale, kFramesPerFragment, kFrameDuration };
+  plx::Fmp4Muxer muxer(params, sink);
+  for (auto& unit : units)
+    muxer.add_access_unit(plx::Range<const uint8_t>(&unit.annexb[0], unit.annexb.size()),
+                          unit.time, unit.keyframe);
+  // a frame that does not move the time forward is dropped.
+  auto& last = units.back();
+  CHECK(!muxer.add_access_unit(plx::Range<const uint8_t>(&last.annexb[0], last.annexb.size()),
+                               last.time, false));
+  auto bytes = muxer.bytes_out();
+  muxer.flush();
+  // the two frames after the keyframe in one fragment.
+  CHECK(muxer.bytes_out() == bytes + 8 + 16 + 8 + 16 + 20 + 20 + 2 * 12 + 8 +
+                             4 + units[2].nals[0].size() + 4 + units[2].nals[1].size() +
+                             4 + units[2].nals[2].size() + 4 + units[3].nals[0].size());
+}
+
+}  // namespace
+
+int main() {
+  TestLayout();
+  TestTruncated();
+  TestParameterSets();
+  TestErrors();
+  return 0;
+}
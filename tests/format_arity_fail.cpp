@@ -0,0 +1,10 @@
+// Must not compile: PLX_FORMAT_TO with one argument more than the format
+// takes. CMakeLists.txt checks that the compiler says why.
+
+#include "plx_util.h"
+
+int main() {
+  plx::FormatBuffer<16> out;
+  PLX_FORMAT_TO(out, "%d%% of %s", 1, "all", 2);
+  return 0;
+}
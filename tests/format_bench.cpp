@@ -0,0 +1,66 @@
+// ns per call of plx::Format and plx::FormatTo against plx::PrintfToString,
+// the plx-owned replacement for the catalog StringPrintf, and snprintf into
+// a stack buffer, on the kind of lines the app formats: a line of the
+// status text, a segment file name and a short log line. FormatTo reuses
+// one buffer the way the status text does.
+
+#include "test_util.h"
+
+namespace {
+
+template <typename Fn>
+double NanosPerCall(int calls, Fn fn) {
+  size_t check = 0;
+  auto start = plx::QpcNow();
+  for (int ix = 0; ix != calls; ++ix)
+    check += fn();
+  auto ns = static_cast<double>(plx::QpcToNanos(plx::QpcNow() - start)) / calls;
+  CHECK(check != 0);
+  return ns;
+}
+
+template <typename... Args>
+void Compare(const char* name, int calls, const char* fmt, const Args&... values) {
+  // all four make the same text.
+  char buf[512];
+  snprintf(buf, sizeof(buf), fmt, values...);
+  CHECK(plx::Format(fmt, values...) == buf);
+  CHECK(plx::PrintfToString(fmt, values...) == buf);
+
+  auto format = NanosPerCall(calls, [&]() {
+    return plx::Format(fmt, values...).size();
+  });
+  plx::FormatBuffer<512> out;
+  auto format_to = NanosPerCall(calls, [&]() {
+    out.clear();
+    plx::FormatTo(out, fmt, values...);
+    return out.size();
+  });
+  auto printf_to_string = NanosPerCall(calls, [&]() {
+    return plx::PrintfToString(fmt, values...).size();
+  });
+  auto stack = NanosPerCall(calls, [&]() {
+    return static_cast<size_t>(snprintf(buf, sizeof(buf), fmt, values...));
+  });
+  printf("%-10s %9.0f  %11.0f  %17.0f  %11.0f\n", name, format, format_to,
+         printf_to_string, stack);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const int calls = quick ? 20000 : 2000000;
+
+  printf("line       Format ns  FormatTo ns  PrintfToString ns  snprintf ns\n");
+  Compare("status", calls,
+          "camera %d: %s  %dx%d @ %.2f fps  dropped %llu  queue %d/%d  disk %5.1f MB/s\n",
+          2, "USB Camera 2", 1280, 720, 29.97, 123456ULL, 3, 8, 41.25);
+  Compare("file name", calls, "%s\\%04d-%02d-%02d-%02d%02d%02d.mp4",
+          "C:\\cams\\front", 2026, 10, 17, 12, 34, 56);
+  Compare("log", calls, "segment %s closed, %lld bytes", "front", 12345678LL);
+  // long enough that Format leaves the stack buffer.
+  std::string note(300, 'n');
+  Compare("long", calls, "%s [%-20s] %x", note.c_str(), "padded", 0xbeefu);
+  return 0;
+}
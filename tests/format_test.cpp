@@ -0,0 +1,179 @@
+// plx::FormatTo and plx::Format print what printf prints for every
+// conversion, flag, width and precision they take, whatever the size of
+// the argument, also past the stack buffer where the text moves to the
+// heap. Bad conversions, wrong argument counts and conversions that do not
+// fit the argument throw plx::InvalidParamException naming the argument,
+// and PLX_FORMAT_TO counts the arguments when it compiles. A null string
+// prints as "(null)". plx::PrintfToString is vsnprintf into a string, of
+// any length.
+
+#include <limits.h>
+
+#include "test_util.h"
+
+namespace {
+
+// |got| must be what snprintf makes of the same call.
+template <typename... Args>
+void Same(const char* fmt, const Args&... values) {
+  char want[512];
+  snprintf(want, sizeof(want), fmt, values...);
+  auto got = plx::Format(fmt, values...);
+  if (got != want) {
+    fprintf(stderr, "\"%s\": got \"%s\" want \"%s\"\n", fmt, got.c_str(), want);
+    CHECK(false);
+  }
+}
+
+void TestConversions() {
+  Same("%d %i %u", -12, 34, 56u);
+  Same("%d %d", INT_MIN, INT_MAX);
+  Same("%lld %lld %llu", LLONG_MIN, LLONG_MAX, ULLONG_MAX);
+  Same("%x %X %x", 0xbeefu, 0xBEEFu, 0u);
+  Same("%llx", 0xfedcba9876543210ULL);
+  Same("%c%c%c", 'a', 'b', 'c');
+  Same("%s and %s", "this", "that");
+  Same("%f %e %g", 3.25, 1234.5, 0.0001);
+  Same("%.3f %.0f %.10e %.2g", 2.0 / 3.0, 2.5, 1.0 / 7.0, 123456.0);
+  Same("%E %G", 1e-300, 1e300);
+  Same("%f %f", std::numeric_limits<double>::infinity(), -0.0);
+  Same("100%% of %d%%", 50);
+  Same("no conversions at all");
+  Same("");
+
+  // the argument decides the size, not the length modifier.
+  CHECK(plx::Format("%d", 5000000000LL) == "5000000000");
+  CHECK(plx::Format("%lld %llu", -1, 7) == "-1 7");
+  CHECK(plx::Format("%x", -1) == "ffffffffffffffff");
+  CHECK(plx::Format("%hhd %zu %I64d", 300, size_t(9), 1) == "300 9 1");
+  // %s takes anything, %f takes integers.
+  CHECK(plx::Format("%s %s %s %s", 12, -3, 'x', 0.5) == "12 -3 x 0.5");
+  CHECK(plx::Format("%.1f %.1f", 3, 4u) == "3.0 4.0");
+  CHECK(plx::Format("%s", std::string("std")) == "std");
+  const char text[] = "ranged";
+  CHECK(plx::Format("[%s]", plx::Range<const char>(text, text + 3)) == "[ran]");
+  CHECK(plx::Format("%s", std::string("a\0b", 3)) == std::string("a\0b", 3));
+}
+
+void TestWidths() {
+  Same("[%5d] [%-5d] [%05d] [%-05d]", 42, 42, 42, 42);
+  Same("[%5d] [%05d] [%5d]", -42, -42, 123456);
+  Same("[%8x] [%08X]", 0xabcu, 0xabcu);
+  Same("[%10s] [%-10s] [%2s]", "right", "left", "longer");
+  Same("[%.3s] [%8.2s] [%-8.2s]", "truncate", "ab", "abc");
+  Same("[%10.3f] [%-10.3f] [%010.3f] [%010.3f]", 3.14159, 3.14159, 3.14159, -3.14159);
+  Same("[%12e] [%-12g] [%012g]", 1.5, 2.5, -2.5);
+  Same("[%3c] [%-3c]", 'x', 'y');
+  // zero padding does not apply to inf and nan.
+  Same("[%08f]", std::numeric_limits<double>::infinity());
+  Same("[%0s]", "z");
+}
+
+void TestHeap() {
+  plx::FormatBuffer<16> out;
+  plx::FormatTo(out, "%s", "short");
+  CHECK(!out.on_heap() && (out.str() == "short"));
+  // exactly full needs the zero too.
+  out.clear();
+  plx::FormatTo(out, "%s", "fifteen chars..");
+  CHECK(!out.on_heap() && (out.size() == 15));
+  out.clear();
+  plx::FormatTo(out, "%s!", "fifteen chars..");
+  CHECK(out.on_heap() && (out.str() == "fifteen chars..!"));
+  CHECK(out.c_str()[out.size()] == 0);
+
+  // appending keeps what was there, across several moves.
+  std::string want;
+  for (int ix = 0; ix != 500; ++ix) {
+    plx::FormatTo(out, "[%05d:%-6s]", ix, "ab");
+    want += plx::Format("[%05d:%-6s]", ix, "ab");
+  }
+  CHECK(out.str().substr(16) == want);
+  CHECK(strlen(out.c_str()) == out.size());
+
+  // wide fields and long strings.
+  std::string big(5000, 'q');
+  CHECK(plx::Format("%s|", big) == big + "|");
+  CHECK(plx::Format("%3000d", 7).size() == 3000);
+  CHECK(plx::Format("%-3000s|", "x").size() == 3001);
+  CHECK(plx::Format("%.40f", 1.0).size() == 42);
+  CHECK(plx::Format("%f", -std::numeric_limits<double>::max()).size() ==
+        static_cast<size_t>(snprintf(nullptr, 0, "%f", -std::numeric_limits<double>::max())));
+}
+
+// The argument InvalidParamException names, -1 if nothing was thrown.
+template <typename... Args>
+int BadArgument(const char* fmt, const Args&... values) {
+  try {
+    plx::Format(fmt, values...);
+  } catch (plx::InvalidParamException& ex) {
+    return ex.Parameter();
+  }
+  return -1;
+}
+
+void TestErrors() {
+  // too few and too many.
+  CHECK(BadArgument("%d %d", 1) == 1);
+  CHECK(BadArgument("%d") == 0);
+  CHECK(BadArgument("%d", 1, 2) == 1);
+  CHECK(BadArgument("none", 1) == 0);
+  // conversions that do not fit the argument.
+  CHECK(BadArgument("%d", "text") == 0);
+  CHECK(BadArgument("%s %d", "a", 0.5) == 1);
+  CHECK(BadArgument("%c", 1.5) == 0);
+  CHECK(BadArgument("%f", "1.5") == 0);
+  // unknown or cut short.
+  CHECK(BadArgument("%q", 1) == 0);
+  CHECK(BadArgument("%n", 1) == 0);
+  CHECK(BadArgument("%*d", 1, 2) == 0);
+  CHECK(BadArgument("abc %", 1) == 0);
+  CHECK(BadArgument("%5", 1) == 0);
+  CHECK(BadArgument("%d %p", 1, 2) == 1);
+  // nothing is thrown for good ones.
+  CHECK(BadArgument("%d %s", 1, "x") == -1);
+
+  // a null string is not a crash.
+  const char* none = nullptr;
+  CHECK(plx::Format("[%s]", none) == "[(null)]");
+  CHECK(plx::Format("[%8s]", none) == "[  (null)]");
+  CHECK(plx::Format("[%.2s]", none) == "[(n]");
+}
+
+void TestCompileTimeArity() {
+  plx::FormatBuffer<64> out;
+  PLX_FORMAT_TO(out, "%d%% of %s, %.1f", 50, "all", 2.5);
+  CHECK(out.str() == "50% of all, 2.5");
+  PLX_FORMAT_TO(out, "|%-4s|", "x");
+  CHECK(out.str() == "50% of all, 2.5|x   |");
+#if (defined(__cpp_constexpr) && (__cpp_constexpr >= 201304))
+  static_assert(plx::FormatImp::Conversions("") == 0, "");
+  static_assert(plx::FormatImp::Conversions("%%%d%%") == 1, "");
+  static_assert(plx::FormatImp::Conversions("%5.2f %-3s %llu") == 3, "");
+  printf("argument counts checked at compile time\n");
+#endif
+}
+
+void TestPrintfToString() {
+  CHECK(plx::PrintfToString("%d-%s-%.2f", 7, "x", 0.5) == "7-x-0.50");
+  CHECK(plx::PrintfToString("").empty());
+  // past any first guess of the size, twice so the va_list is reused.
+  for (int size : { 127, 128, 129, 1000, 100000 }) {
+    auto s = plx::PrintfToString("%*d|%s", size, 1, "end");
+    CHECK(s.size() == static_cast<size_t>(size) + 4);
+    CHECK(s.substr(s.size() - 5) == "1|end");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestConversions();
+  TestWidths();
+  TestHeap();
+  TestErrors();
+  TestCompileTimeArity();
+  TestPrintfToString();
+  printf("format ok\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+// Frame gaps: what FrameGapDetector makes of camera timestamps, and the gap
+// events a SegmentedWriter keeps per segment, including frames it dropped
+// itself because the queue was full and the segment that stop() closes.
+
+#include "test_util.h"
+#include "capture_core.h"
+
+namespace {
+
+const int64_t kInterval = 333333;
+
+void TestDetector() {
+  FrameGapDetector detector(kInterval);
+  CHECK(detector.add(0) == 0);
+  CHECK(detector.add(kInterval) == 0);
+  // jitter under half an interval is no gap.
+  CHECK(detector.add(kInterval * 2 + (kInterval * 4) / 10) == 0);
+  // three intervals after the last frame, two are missing.
+  CHECK(detector.add(kInterval * 5 + (kInterval * 4) / 10) == 2);
+  CHECK(detector.add(kInterval * 5 + (kInterval * 4) / 10 + 1000) == 0);
+  auto st = detector.stats();
+  CHECK(st.frames == 5);
+  CHECK(st.dropped == 2);
+  CHECK(st.duplicated == 1);
+  CHECK(st.gaps == 1);
+  // a restarted camera starts from scratch.
+  detector.reset();
+  CHECK(detector.add(kInterval * 100) == 0);
+  CHECK(detector.stats().gaps == 1);
+}
+
+typedef std::shared_ptr<int> WriterPtr;
+
+// Blocks write_frame() while |hold| is set, so the queue fills up.
+class BlockingDelegate : public SegmentedWriter<WriterPtr, int64_t>::Delegate {
+public:
+  std::atomic<bool> hold;
+  std::atomic<int> entered;
+
+  BlockingDelegate() : hold(false), entered(0) {}
+
+  bool prepare_frame(int64_t&) override {
+    return true;
+  }
+
+  bool write_frame(WriterPtr&, int64_t&, int64_t) override {
+    ++entered;
+    while (hold)
+      std::this_thread::yield();
+    return true;
+  }
+
+  void frame_written(int64_t&, int64_t) override {}
+  void finalize_writer(WriterPtr&) override {}
+  void discard_writer(WriterPtr&, const std::wstring&) override {}
+};
+
+void WaitWritten(const SegmentedWriter<WriterPtr, int64_t>& writer, uint64_t count) {
+  while (writer.stats().frames_written < count)
+    std::this_thread::yield();
+}
+
+// Gaps the camera reports and frames the full queue drops end up in the
+// same list, the last segment's comes back from stop().
+void TestQueueDropsAreGaps() {
+  const size_t kDepth = 4;
+  BlockingDelegate delegate;
+  SegmentedWriter<WriterPtr, int64_t> writer(&delegate, kDepth);
+  CHECK(writer.start(std::make_shared<int>(0), kInterval * 1000));
+
+  delegate.hold = true;
+  auto first_arrival = plx::QpcNow();
+  CHECK(writer.push(0, 0, first_arrival, 0));
+  while (!delegate.entered)
+    std::this_thread::yield();
+  // frame 0 is stuck in the writer, 1 to 4 fill the queue.
+  int64_t frame = 1;
+  for (; frame != 1 + kDepth; ++frame)
+    CHECK(writer.push(frame, frame * kInterval, plx::QpcNow(), 0));
+  // 5 and 6 do not fit, the camera had dropped one before 6.
+  CHECK(!writer.push(frame, frame * kInterval, plx::QpcNow(), 0));
+  ++frame;
+  CHECK(!writer.push(frame, frame * kInterval, plx::QpcNow(), 1));
+  ++frame;
+  delegate.hold = false;
+  WaitWritten(writer, 1 + kDepth);
+  CHECK(writer.push(frame, frame * kInterval, plx::QpcNow(), 0));
+  // a camera gap on its own.
+  frame += 3;
+  CHECK(writer.push(frame, frame * kInterval, plx::QpcNow(), 2));
+
+  auto info = writer.stop();
+  CHECK(info.first_arrival == first_arrival);
+  CHECK(info.gaps.size() == 2);
+  CHECK(info.gaps[0].time == 7 * kInterval);
+  CHECK(info.gaps[0].dropped == 3);
+  CHECK(info.gaps[1].time == 10 * kInterval);
+  CHECK(info.gaps[1].dropped == 2);
+  auto st = writer.stats();
+  CHECK(st.queue_full_drops == 2);
+  CHECK(st.frames_written == 3 + kDepth);
+  // nothing left for a second stop().
+  CHECK(writer.stop().first_arrival == -1);
+}
+
+// Each segment keeps its own gaps, times relative to its start.
+void TestGapsPerSegment() {
+  BlockingDelegate delegate;
+  SegmentedWriter<WriterPtr, int64_t> writer(&delegate, 16);
+  const int64_t length = kInterval * 10;
+  CHECK(writer.start(std::make_shared<int>(0), length));
+  CHECK(writer.prepare_next(std::make_shared<int>(1), L"next", length));
+  CHECK(writer.push(0, 0, plx::QpcNow(), 0));
+  CHECK(writer.push(4, 4 * kInterval, plx::QpcNow(), 3));
+  CHECK(writer.push(10, 10 * kInterval, plx::QpcNow(), 5));
+  CHECK(writer.push(13, 13 * kInterval, plx::QpcNow(), 2));
+  WaitWritten(writer, 4);
+  CHECK(writer.segment_count() == 1);
+  writer.finalize_retired();
+  auto first = writer.take_retired_info();
+  CHECK(first.gaps.size() == 1);
+  CHECK(first.gaps[0].time == 4 * kInterval);
+  CHECK(first.gaps[0].dropped == 3);
+  auto last = writer.stop();
+  CHECK(last.gaps.size() == 2);
+  CHECK(last.gaps[0].time == 0);
+  CHECK(last.gaps[0].dropped == 5);
+  CHECK(last.gaps[1].time == 3 * kInterval);
+  CHECK(last.gaps[1].dropped == 2);
+}
+
+}  // namespace
+
+int main() {
+  TestDetector();
+  TestQueueDropsAreGaps();
+  TestGapsPerSegment();
+  printf("frame gaps ok\n");
+  return 0;
+}
@@ -0,0 +1,142 @@
+// Soak of the YUY2 camera path outside media foundation: frames from a
+// plx::FramePool converted over plx::RowWorkers with one band function made
+// up front, then held by a consumer that looks ahead a few frames like the
+// encoder and stalls now and then like the disk. Once the pool has grown to
+// what the stalls need, a frame must not touch the heap: every operator new
+// after the warm up has to be a new pool frame, and the pool must not grow
+// past its limit or leak frames.
+
+#include <new>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+std::atomic<uint64_t> g_allocations(0);
+
+struct SoakParams {
+  size_t width;
+  size_t height;
+  int frames;
+  // frames the consumer holds on to, like encoder lookahead.
+  int hold;
+  // every |stall_every| frames the consumer sleeps |stall_ms|.
+  int stall_every;
+  int stall_ms;
+};
+
+const size_t kPoolFrames = 32;
+
+void Consume(const SoakParams& params, plx::SpscQueue<plx::FrameRef>& queue,
+             std::atomic<bool>& done) {
+  std::vector<plx::FrameRef> held(params.hold);
+  int count = 0;
+  plx::FrameRef frame;
+  while (true) {
+    if (!queue.pop(frame)) {
+      if (done && !queue.size())
+        break;
+      std::this_thread::yield();
+      continue;
+    }
+    // the oldest held frame goes back to the pool.
+    held[count % params.hold] = std::move(frame);
+    if ((++count % params.stall_every) == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(params.stall_ms));
+  }
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  auto mem = malloc(size ? size : 1);
+  if (!mem)
+    throw std::bad_alloc();
+  return mem;
+}
+
+void operator delete(void* mem) noexcept {
+  free(mem);
+}
+
+void operator delete(void* mem, size_t) noexcept {
+  free(mem);
+}
+
+int main(int argc, char** argv) {
+  SoakParams params;
+  if (HasArg(argc, argv, "--quick")) {
+    SoakParams quick = { 640, 480, 3000, 8, 250, 10 };
+    params = quick;
+  } else {
+    // about ten minutes of 1080p at 60 fps, stalling 100 ms every 10 s.
+    SoakParams full = { 1920, 1080, 36000, 8, 600, 100 };
+    params = full;
+  }
+  printf("%d frames of %zux%zu, %d held, %d ms stall every %d frames\n",
+         params.frames, params.width, params.height, params.hold,
+         params.stall_ms, params.stall_every);
+
+  const size_t nv12_size = params.width * params.height * 3 / 2;
+  std::vector<uint8_t> src(params.width * params.height * 2);
+  for (size_t ix = 0; ix != src.size(); ++ix)
+    src[ix] = static_cast<uint8_t>(ix * 7);
+
+  plx::FramePool pool(nv12_size, kPoolFrames, false);
+  auto cores = std::max(std::thread::hardware_concurrency(), 1U);
+  plx::RowWorkers workers(std::min(cores - 1, 3U));
+  plx::SpscQueue<plx::FrameRef> queue(kPoolFrames);
+  auto level = plx::BestSimdLevel();
+  uint8_t* dst = nullptr;
+  const std::function<void(size_t, size_t)> convert_rows = [&](size_t begin, size_t end) {
+    plx::Yuy2ToNv12(&src[0], params.width * 2, params.width, begin, end,
+                    dst, params.width, dst + (params.width * params.height),
+                    params.width, level);
+  };
+  plx::LatencyHistogram latency;
+
+  std::atomic<bool> done(false);
+  std::thread consumer(Consume, std::cref(params), std::ref(queue), std::ref(done));
+
+  // the first stalls set how far the pool grows.
+  const int warmup = params.stall_every * 2;
+  uint64_t allocations = 0;
+  size_t pool_frames = 0;
+  uint64_t misses = 0;
+  for (int ix = 0; ix != params.frames; ++ix) {
+    if (ix == warmup) {
+      allocations = g_allocations;
+      pool_frames = pool.stats().allocated;
+    }
+    auto start = plx::QpcNow();
+    auto frame = pool.acquire();
+    if (!frame) {
+      // the app goes to the heap here, the soak just counts it.
+      ++misses;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    dst = frame.data();
+    workers.run(params.height, 2, convert_rows);
+    latency.record(plx::QpcToNanos(plx::QpcNow() - start));
+    while (!queue.push(std::move(frame)))
+      std::this_thread::yield();
+  }
+  auto steady_allocations = g_allocations - allocations;
+  done = true;
+  consumer.join();
+
+  auto st = pool.stats();
+  PrintLatency("convert", latency);
+  printf("pool frames %zu, %zu after warm up, high water %zu, misses %llu\n",
+         st.allocated, pool_frames, st.high_water,
+         static_cast<unsigned long long>(misses));
+  printf("heap allocations after warm up %llu\n",
+         static_cast<unsigned long long>(steady_allocations));
+  CHECK(st.allocated <= kPoolFrames);
+  CHECK(st.in_use == 0);
+  CHECK(steady_allocations == (st.allocated - pool_frames));
+  return 0;
+}
@@ -0,0 +1,205 @@
+// plx::JsonParseNumber takes exactly the json number grammar and reads and
+// writes numbers the same way whatever the locale of the process is.
+// plx::JsonParseValue builds the same plx::JsonValue as the catalog
+// plx::ParseJsonValue, with the strict numbers, also for a long array of
+// them.
+
+#include <locale.h>
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+bool Rejected(const char* text) {
+  plx::Range<const char> range(text, text + strlen(text));
+  int64_t iv = 0;
+  double dv = 0.0;
+  try {
+    plx::JsonParseNumber(range, &iv, &dv);
+  } catch (plx::CodecException&) {
+    return true;
+  }
+  return false;
+}
+
+// Parses all of |text|, which must be a double.
+double Double(const char* text) {
+  plx::Range<const char> range(text, text + strlen(text));
+  int64_t iv = 0;
+  double dv = 0.0;
+  CHECK(!plx::JsonParseNumber(range, &iv, &dv));
+  CHECK(range.empty());
+  return dv;
+}
+
+int64_t Integer(const char* text) {
+  plx::Range<const char> range(text, text + strlen(text));
+  int64_t iv = 0;
+  double dv = 0.0;
+  CHECK(plx::JsonParseNumber(range, &iv, &dv));
+  CHECK(range.empty());
+  return iv;
+}
+
+void TestGrammar() {
+  const char* bad[] = {
+    "", "-", "+1", "01", "-01", "00", ".5", "-.5", "1.", "1.e5", "1e", "1e+", "--1", "x"
+  };
+  for (auto text : bad) {
+    if (!Rejected(text)) {
+      fprintf(stderr, "accepted \"%s\"\n", text);
+      CHECK(false);
+    }
+  }
+  CHECK(Integer("0") == 0);
+  CHECK(Integer("-0") == 0);
+  CHECK(Integer("10") == 10);
+  CHECK(Integer("-9223372036854775808") == INT64_MIN);
+  CHECK(Double("0.5") == 0.5);
+  CHECK(Double("-0.0") == 0.0);
+  CHECK(Double("1e3") == 1000.0);
+  CHECK(Double("1E-2") == 0.01);
+  CHECK(Double("0e0") == 0.0);
+  CHECK(Double("9223372036854775808") == 9223372036854775808.0);
+  // past the fast path, the crt rounds it.
+  CHECK(Double("1.7976931348623157e308") == 1.7976931348623157e308);
+  CHECK(Double("123456789012345678901234567890") == 123456789012345678901234567890.0);
+
+  // the number stops where the grammar does, the reader checks what follows.
+  const char text[] = "12,";
+  plx::Range<const char> range(text, text + 3);
+  int64_t iv = 0;
+  double dv = 0.0;
+  CHECK(plx::JsonParseNumber(range, &iv, &dv));
+  CHECK(iv == 12);
+  CHECK(range.size() == 1);
+}
+
+// Formatting goes through the same locale independent conversions.
+void CheckRoundTrips() {
+  const double values[] = { 0.1, 2.5, -1234.5678, 1.0 / 3.0, 6.02214076e23, 5e-324 };
+  for (auto v : values) {
+    char buf[32];
+    auto len = plx::JsonFormatDouble(v, buf);
+    CHECK(len > 0);
+    CHECK(!strchr(buf, ','));
+    CHECK(Double(buf) == v);
+  }
+  CHECK(Double("1.5e300") == 1.5e300);
+}
+
+// A decimal comma locale must not change anything.
+void TestLocale() {
+  const char* names[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "German" };
+  const char* found = nullptr;
+  for (auto name : names) {
+    if (setlocale(LC_ALL, name)) {
+      found = name;
+      break;
+    }
+  }
+  if (!found) {
+    printf("no decimal comma locale installed, checked with \"C\" only\n");
+    CheckRoundTrips();
+    return;
+  }
+  printf("checked with %s\n", found);
+  CheckRoundTrips();
+  setlocale(LC_ALL, "C");
+}
+
+bool Same(const plx::JsonValue& a, const plx::JsonValue& b) {
+  if (a.type() != b.type())
+    return false;
+  switch (a.type()) {
+    case plx::JsonType::BOOL: return a.get_bool() == b.get_bool();
+    case plx::JsonType::INT64: return a.get_int64() == b.get_int64();
+    case plx::JsonType::DOUBLE: return a.get_double() == b.get_double();
+    case plx::JsonType::STRING: return a.get_string() == b.get_string();
+    case plx::JsonType::ARRAY: {
+      if (a.size() != b.size())
+        return false;
+      for (size_t ix = 0; ix != a.size(); ++ix) {
+        if (!Same(const_cast<plx::JsonValue&>(a)[ix], const_cast<plx::JsonValue&>(b)[ix]))
+          return false;
+      }
+      return true;
+    }
+    case plx::JsonType::OBJECT: {
+      if (a.size() != b.size())
+        return false;
+      auto ita = a.get_iterator();
+      auto itb = b.get_iterator();
+      for (; ita.first != ita.second; ++ita.first, ++itb.first) {
+        if ((ita.first->first != itb.first->first) || !Same(ita.first->second, itb.first->second))
+          return false;
+      }
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+plx::JsonValue Parse(const std::string& text, size_t* left) {
+  plx::Range<const char> range(text.data(), text.data() + text.size());
+  auto value = plx::JsonParseValue(range);
+  *left = range.size();
+  return value;
+}
+
+bool ParseRejected(const std::string& text) {
+  size_t left = 0;
+  try {
+    Parse(text, &left);
+  } catch (plx::CodecException&) {
+    return true;
+  }
+  return false;
+}
+
+void TestParseValue() {
+  const std::string text =
+      "{\"file\": \"a\\tb.mp4\", \"size\": 12345678, \"fps\": 29.97,"
+      " \"gaps\": [{\"time\": 1.5e1, \"dropped\": -2}, [], {}],"
+      " \"ok\": true, \"bad\": false, \"note\": null, \"size\": 7} ,[1]";
+  size_t left = 0;
+  auto value = Parse(text, &left);
+  plx::Range<const char> range(text.data(), text.data() + text.size());
+  auto catalog = plx::ParseJsonValue(range);
+  CHECK(Same(value, catalog));
+  // the last of a repeated key wins, what follows the value is left.
+  CHECK(value["size"].get_int64() == 7);
+  CHECK(value["file"].get_string() == "a\tb.mp4");
+  CHECK(value["gaps"][0]["time"].get_double() == 15.0);
+  CHECK(left == 5);
+
+  CHECK(Parse("-7", &left).get_int64() == -7);
+  CHECK(Parse(" \"x\\u00e9\"", &left).get_string() == "x\xc3\xa9");
+  // the catalog takes all of these.
+  CHECK(ParseRejected("[+1]"));
+  CHECK(ParseRejected("[01]"));
+  CHECK(ParseRejected("{\"a\": .5}"));
+  CHECK(ParseRejected("[1,]"));
+  CHECK(ParseRejected(""));
+
+  // every number used to copy the rest of the text.
+  std::string numbers("[");
+  for (int ix = 0; ix != 200000; ++ix)
+    numbers += plx::Format(ix ? ",%d.5" : "%d.5", ix);
+  numbers += "]";
+  auto array = Parse(numbers, &left);
+  CHECK((array.size() == 200000) && !left);
+  CHECK(array[199999].get_double() == 199999.5);
+}
+
+}  // namespace
+
+int main() {
+  TestGrammar();
+  TestLocale();
+  TestParseValue();
+  printf("json numbers ok\n");
+  return 0;
+}
@@ -0,0 +1,184 @@
+// Parse throughput of plx::JsonReader, the plx::JsonDoc DOM and
+// plx::JsonParseValue against the catalog's plx::ParseJsonValue on 1 KB,
+// 1 MB and 100 MB documents shaped like the segment sidecars: objects with
+// strings, integers and arrays of doubles. Then what one parse of each DOM
+// costs in heap: operator new is counted, and for JsonDoc also the bytes it
+// put in its arena. From 1 MB on, the arena of a JsonDoc must hold ten
+// times fewer bytes than ParseJsonValue allocates, with a thousand times
+// fewer allocations.
+
+#include <new>
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+std::atomic<uint64_t> g_allocations(0);
+std::atomic<uint64_t> g_bytes(0);
+
+std::string MakeDocument(size_t bytes) {
+  std::string json("[");
+  for (int ix = 0; json.size() < bytes; ++ix) {
+    if (ix)
+      json += ",";
+    json += plx::Format(
+        "{\"file\":\"2026-10-17-%06d.mp4\",\"camera\":\"USB Camera %d\","
+        "\"size\":%d,\"dropped\":%d,\"gaps\":[{\"time\":%d.25,\"dropped\":1},"
+        "{\"time\":%d.5e1,\"dropped\":-2}]}",
+        ix, ix % 4, 12345678 + ix, ix % 7, ix % 600, ix % 60);
+  }
+  json += "]";
+  return json;
+}
+
+// Touches every value so both parsers do all the work.
+uint64_t WalkReader(const std::string& json) {
+  plx::JsonReader reader(plx::Range<const char>(json.data(), json.data() + json.size()));
+  uint64_t sum = 0;
+  while (true) {
+    switch (reader.next()) {
+      case plx::JsonReader::Token::end:
+        return sum;
+      case plx::JsonReader::Token::int64:
+        sum += static_cast<uint64_t>(reader.int64());
+        break;
+      case plx::JsonReader::Token::dbl:
+        sum += static_cast<uint64_t>(reader.dbl());
+        break;
+      case plx::JsonReader::Token::string:
+      case plx::JsonReader::Token::key:
+        sum += reader.str().size();
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// One document reused across runs, like a reader of many files would.
+plx::JsonDoc doc;
+
+uint64_t ParseDoc(const std::string& json) {
+  return doc.parse(plx::Range<const char>(json.data(), json.data() + json.size())).size();
+}
+
+uint64_t ParseValue(const std::string& json) {
+  plx::Range<const char> range(json.data(), json.data() + json.size());
+  auto value = plx::ParseJsonValue(range);
+  return value.size();
+}
+
+uint64_t PlxParseValue(const std::string& json) {
+  plx::Range<const char> range(json.data(), json.data() + json.size());
+  auto value = plx::JsonParseValue(range);
+  return value.size();
+}
+
+template <typename Fn>
+double MegabytesPerSec(const std::string& json, int runs, Fn parse, uint64_t* result) {
+  auto start = plx::QpcNow();
+  for (int ix = 0; ix != runs; ++ix)
+    *result += parse(json);
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  return (static_cast<double>(json.size()) * runs) / (1024.0 * 1024.0) / secs;
+}
+
+struct HeapUse {
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+// What one |parse| allocates while the result is alive.
+template <typename Fn>
+HeapUse Measure(Fn parse) {
+  auto allocations = g_allocations.load();
+  auto bytes = g_bytes.load();
+  parse();
+  HeapUse use = { g_allocations - allocations, g_bytes - bytes };
+  return use;
+}
+
+void HeapTable(const std::string& json) {
+  plx::Range<const char> text(json.data(), json.data() + json.size());
+  size_t arena_bytes = 0;
+  // a new document each time, so its arena grows from nothing.
+  auto doc_use = Measure([&]() {
+    plx::JsonDoc fresh;
+    fresh.parse(text);
+    arena_bytes = fresh.arena().bytes_used();
+  });
+  auto value_use = Measure([&]() {
+    auto range = text;
+    plx::ParseJsonValue(range);
+  });
+  auto plx_use = Measure([&]() {
+    auto range = text;
+    plx::JsonParseValue(range);
+  });
+  printf("%-11zu JsonDoc %6llu allocs %9llu bytes (arena %9zu)  "
+         "ParseJsonValue %8llu allocs %10llu bytes  JsonParseValue %8llu allocs %10llu bytes\n",
+         json.size(),
+         static_cast<unsigned long long>(doc_use.allocations),
+         static_cast<unsigned long long>(doc_use.bytes), arena_bytes,
+         static_cast<unsigned long long>(value_use.allocations),
+         static_cast<unsigned long long>(value_use.bytes),
+         static_cast<unsigned long long>(plx_use.allocations),
+         static_cast<unsigned long long>(plx_use.bytes));
+  CHECK(arena_bytes <= doc_use.bytes);
+  // a small document is mostly the first arena chunk and the key table.
+  if (json.size() < 1024 * 1024)
+    return;
+  CHECK(arena_bytes * 10 <= value_use.bytes);
+  CHECK(doc_use.allocations * 1000 <= value_use.allocations);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  g_bytes += size;
+  auto mem = malloc(size ? size : 1);
+  if (!mem)
+    throw std::bad_alloc();
+  return mem;
+}
+
+void operator delete(void* mem) noexcept {
+  free(mem);
+}
+
+void operator delete(void* mem, size_t) noexcept {
+  free(mem);
+}
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const size_t sizes[] = { 1024, 1024 * 1024, 100 * 1024 * 1024 };
+  // the catalog DOM needs several times the document in memory, the quick
+  // run stops at 1 MB.
+  const size_t count = quick ? 2 : 3;
+  const size_t work = quick ? (4 * 1024 * 1024) : (256 * 1024 * 1024);
+
+  printf("size        runs     reader MB/s  JsonDoc MB/s  ParseJsonValue MB/s  JsonParseValue MB/s\n");
+  for (size_t ix = 0; ix != count; ++ix) {
+    auto json = MakeDocument(sizes[ix]);
+    auto runs = static_cast<int>(std::max<size_t>(work / json.size(), 1));
+    uint64_t reader_result = 0;
+    uint64_t doc_result = 0;
+    uint64_t value_result = 0;
+    uint64_t plx_result = 0;
+    auto reader_mbs = MegabytesPerSec(json, runs, WalkReader, &reader_result);
+    auto doc_mbs = MegabytesPerSec(json, runs, ParseDoc, &doc_result);
+    auto value_mbs = MegabytesPerSec(json, runs, ParseValue, &value_result);
+    auto plx_mbs = MegabytesPerSec(json, runs, PlxParseValue, &plx_result);
+    CHECK(reader_result && (doc_result == value_result) && (plx_result == value_result));
+    printf("%-11zu %-8d %-12.1f %-13.1f %-20.1f %.1f\n",
+           json.size(), runs, reader_mbs, doc_mbs, value_mbs, plx_mbs);
+  }
+
+  printf("\nheap use of one parse\n");
+  for (size_t ix = 0; ix != 2; ++ix)
+    HeapTable(MakeDocument(sizes[ix]));
+  return 0;
+}
@@ -0,0 +1,145 @@
+// plx::JsonSaxReader over a stream far bigger than its buffer: a catalog
+// of segment sidecars made on the fly, 1 GB or 64 MB with --quick, never
+// held in memory as a whole. Throughput when every value is handled and
+// when the handler skips all but one key of each record, and what the
+// process holds: the buffer has to stay at its 64 KB and the peak resident
+// memory must not move by more than a few MB whatever the stream size.
+
+#include <sys/resource.h>
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+// Makes "[{...},{...},...]" up to |total| bytes, one record at a time.
+class Catalog {
+  const uint64_t total_;
+  uint64_t made_;
+  int records_;
+  std::string pending_;
+  size_t pos_;
+
+public:
+  explicit Catalog(uint64_t total) : total_(total), made_(0), records_(0), pos_(0) {
+    pending_ = "[";
+  }
+
+  uint64_t made() const {
+    return made_;
+  }
+
+  size_t read(char* buf, size_t len) {
+    if (pos_ == pending_.size())
+      refill();
+    auto count = std::min(len, pending_.size() - pos_);
+    memcpy(buf, pending_.data() + pos_, count);
+    pos_ += count;
+    made_ += count;
+    return count;
+  }
+
+private:
+  void refill() {
+    pending_.clear();
+    pos_ = 0;
+    if (records_ < 0)
+      return;
+    if (made_ >= total_) {
+      pending_ = "]";
+      records_ = -1;
+      return;
+    }
+    // a few records at a time, like a disk read would bring.
+    for (int ix = 0; ix != 16; ++ix, ++records_) {
+      pending_ += plx::Format(
+          "%s{\"file\":\"2026-10-17-%06d.mp4\",\"camera\":\"USB Camera %d\","
+          "\"size\":%d,\"dropped\":%d,\"note\":\"a \\\"quoted\\\" \\u00e9 note\","
+          "\"gaps\":[{\"time\":%d.25,\"dropped\":1},{\"time\":%d.5e1,\"dropped\":-2}]}",
+          records_ ? "," : "", records_, records_ % 4, 12345678 + records_,
+          records_ % 7, records_ % 600, records_ % 60);
+    }
+  }
+};
+
+class CountAll : public plx::JsonHandler {
+public:
+  uint64_t values;
+  uint64_t sum;
+
+  CountAll() : values(0), sum(0) {
+  }
+
+  void string(const plx::Range<const char>& value) override {
+    ++values;
+    sum += value.size();
+  }
+
+  void int64(int64_t value) override {
+    ++values;
+    sum += value;
+  }
+
+  void dbl(double value) override {
+    ++values;
+    sum += static_cast<uint64_t>(value);
+  }
+};
+
+// Only the size of each segment, the rest of a record is skipped.
+class SizesOnly : public plx::JsonHandler {
+public:
+  uint64_t values;
+  uint64_t sum;
+
+  SizesOnly() : values(0), sum(0) {
+  }
+
+  bool key(const plx::Range<const char>& name) override {
+    return (name.size() == 4) && !memcmp(name.start(), "size", 4);
+  }
+
+  void int64(int64_t value) override {
+    ++values;
+    sum += value;
+  }
+};
+
+long PeakResidentKB() {
+  rusage usage;
+  ::getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+template <typename Handler>
+void Run(const char* name, uint64_t total, Handler& handler) {
+  Catalog catalog(total);
+  plx::JsonSaxReader sax;
+  auto rss = PeakResidentKB();
+  auto start = plx::QpcNow();
+  sax.parse([&catalog](char* buf, size_t len) { return catalog.read(buf, len); }, handler);
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  auto grown = PeakResidentKB() - rss;
+  printf("%-12s %6.0f MB  %7.1f MB/s  %10llu values  buffer %zu KB  peak rss +%ld KB\n",
+         name, catalog.made() / (1024.0 * 1024.0),
+         catalog.made() / (1024.0 * 1024.0) / secs,
+         static_cast<unsigned long long>(handler.values), sax.buffer_size() / 1024, grown);
+  CHECK(sax.offset() == static_cast<long long>(catalog.made()));
+  CHECK(sax.buffer_size() == 64 * 1024);
+  CHECK(grown < 4 * 1024);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const uint64_t total = quick ? (64ULL << 20) : (1ULL << 30);
+
+  CountAll all;
+  Run("every value", total, all);
+  SizesOnly sizes;
+  Run("sizes only", total, sizes);
+  // every record has one size and eight more values.
+  CHECK(all.values == sizes.values * 9);
+  return 0;
+}
@@ -0,0 +1,244 @@
+// plx::JsonSaxReader sees the same events as plx::JsonReader whatever the
+// chunks are: every chunk size from 1 byte to the whole document, with the
+// buffer as small as the chunk. Tokens cut anywhere, strings longer than
+// the buffer, escapes split in the middle. Skipped subtrees and values are
+// left out of the events and nothing in them is decoded, and the buffer
+// does not grow for them. Broken documents are rejected at every chunk
+// size.
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+const char kDocument[] =
+    "{\"file\": \"2026-10-17-000001.mp4\", \"size\": 12345678, \"fps\": 29.97,\n"
+    "  \"note\": \"tab\\there \\\"quoted\\\" \\u00e9 \\ud83d\\ude00 and a slash \\/\",\n"
+    "  \"big\": 123456789012345678901234567890, \"small\": -0.5e-3, \"zero\": 0,\n"
+    "  \"long\": \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+    "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\",\n"
+    "  \"gaps\": [{\"time\": 12.25, \"dropped\": 1}, {\"time\": 1e2, \"dropped\": -2}],\n"
+    "  \"skip\": {\"a\": [1, 2, {\"b\": \"]}\\\"[{\"}], \"c\": \"\\\\\"},\n"
+    "  \"flags\": [true, false, null, [], {}, [[\"x\"]]],\n"
+    "  \"empty\": \"\", \"last\": -9223372036854775808}  \n";
+
+// One line per event, the same for both readers.
+class Recorder : public plx::JsonHandler {
+public:
+  std::string events;
+  // keys whose values are skipped, and arrays deeper than this are.
+  std::string skip_key;
+  size_t max_array_depth;
+  size_t array_depth;
+
+  Recorder() : max_array_depth(~size_t(0)), array_depth(0) {
+  }
+
+  bool key(const plx::Range<const char>& name) override {
+    auto k = std::string(name.start(), name.end());
+    events += "key " + k + "\n";
+    return k != skip_key;
+  }
+
+  bool begin_object() override {
+    events += "{\n";
+    return true;
+  }
+
+  void end_object() override {
+    events += "}\n";
+  }
+
+  bool begin_array() override {
+    events += "[\n";
+    if (array_depth == max_array_depth)
+      return false;
+    ++array_depth;
+    return true;
+  }
+
+  void end_array() override {
+    --array_depth;
+    events += "]\n";
+  }
+
+  void string(const plx::Range<const char>& value) override {
+    events += "string " + std::string(value.start(), value.end()) + "\n";
+  }
+
+  void int64(int64_t value) override {
+    events += plx::Format("int64 %lld\n", static_cast<long long>(value));
+  }
+
+  void dbl(double value) override {
+    events += plx::Format("dbl %.17g\n", value);
+  }
+
+  void boolean(bool value) override {
+    events += value ? "true\n" : "false\n";
+  }
+
+  void null() override {
+    events += "null\n";
+  }
+};
+
+// The events of plx::JsonReader, with the same skipping as |rules|.
+std::string PullEvents(const std::string& json, const Recorder& rules) {
+  Recorder out;
+  plx::JsonReader reader(plx::Range<const char>(json.data(), json.data() + json.size()));
+  bool skip = false;
+  size_t array_depth = 0;
+  for (;;) {
+    auto token = reader.next();
+    if (token == plx::JsonReader::Token::end)
+      return out.events;
+    if (skip) {
+      skip = false;
+      if ((token == plx::JsonReader::Token::object_begin) ||
+          (token == plx::JsonReader::Token::array_begin))
+        reader.skip_children();
+      continue;
+    }
+    switch (token) {
+      case plx::JsonReader::Token::key:
+        out.key(reader.str());
+        skip = std::string(reader.str().start(), reader.str().end()) == rules.skip_key;
+        break;
+      case plx::JsonReader::Token::object_begin: out.begin_object(); break;
+      case plx::JsonReader::Token::object_end: out.end_object(); break;
+      case plx::JsonReader::Token::array_begin:
+        out.events += "[\n";
+        if (array_depth == rules.max_array_depth)
+          reader.skip_children();
+        else
+          ++array_depth;
+        break;
+      case plx::JsonReader::Token::array_end:
+        --array_depth;
+        out.events += "]\n";
+        break;
+      case plx::JsonReader::Token::string: out.string(reader.str()); break;
+      case plx::JsonReader::Token::int64: out.int64(reader.int64()); break;
+      case plx::JsonReader::Token::dbl: out.dbl(reader.dbl()); break;
+      case plx::JsonReader::Token::boolean: out.boolean(reader.boolean()); break;
+      case plx::JsonReader::Token::null: out.null(); break;
+      default: CHECK(false);
+    }
+  }
+}
+
+// Hands |json| out |chunk| bytes at a time to a reader whose buffer is
+// |chunk| bytes too.
+std::string SaxEvents(const std::string& json, size_t chunk, Recorder& handler,
+                      size_t* buffer_size) {
+  handler.events.clear();
+  handler.array_depth = 0;
+  plx::JsonSaxReader sax(chunk);
+  size_t pos = 0;
+  sax.parse([&](char* buf, size_t len) {
+    auto count = std::min(std::min(len, chunk), json.size() - pos);
+    memcpy(buf, json.data() + pos, count);
+    pos += count;
+    return count;
+  }, handler);
+  CHECK(sax.offset() == static_cast<long long>(json.size()));
+  *buffer_size = sax.buffer_size();
+  return handler.events;
+}
+
+bool SaxRejected(const std::string& json, size_t chunk) {
+  Recorder handler;
+  size_t buffer_size = 0;
+  try {
+    SaxEvents(json, chunk, handler, &buffer_size);
+  } catch (plx::CodecException&) {
+    return true;
+  }
+  return false;
+}
+
+void TestEveryChunk() {
+  const std::string json(kDocument);
+  Recorder handler;
+  auto want = PullEvents(json, handler);
+  CHECK(want.find("string tab\there \"quoted\" \xc3\xa9 \xf0\x9f\x98\x80 and a slash /\n") !=
+        std::string::npos);
+  CHECK(want.find("int64 -9223372036854775808\n") != std::string::npos);
+  for (size_t chunk = 1; chunk <= json.size(); ++chunk) {
+    size_t buffer_size = 0;
+    auto got = SaxEvents(json, chunk, handler, &buffer_size);
+    if (got != want) {
+      fprintf(stderr, "chunk %zu:\n%s\nwant:\n%s\n", chunk, got.c_str(), want.c_str());
+      CHECK(false);
+    }
+    // the longest token is the long string, 131 bytes.
+    if (chunk >= 131)
+      CHECK(buffer_size == chunk);
+    else
+      CHECK(buffer_size < 2 * 131);
+  }
+}
+
+void TestSkipping() {
+  const std::string json(kDocument);
+  Recorder handler;
+  handler.skip_key = "skip";
+  handler.max_array_depth = 1;
+  auto want = PullEvents(json, handler);
+  CHECK(want.find("key skip\n") != std::string::npos);
+  CHECK(want.find("key a\n") == std::string::npos);
+  CHECK(want.find("string x\n") == std::string::npos);
+  for (size_t chunk = 1; chunk <= json.size(); ++chunk) {
+    size_t buffer_size = 0;
+    CHECK(SaxEvents(json, chunk, handler, &buffer_size) == want);
+  }
+
+  // a skipped string longer than the buffer leaves it alone, it only grows
+  // for the key in front of it.
+  std::string long_skipped = "{\"skip\": [\"" + std::string(5000, 'x') + "\\\"]\"], \"n\": 1}";
+  handler.max_array_depth = ~size_t(0);
+  for (size_t chunk = 1; chunk <= 64; ++chunk) {
+    size_t buffer_size = 0;
+    CHECK(SaxEvents(long_skipped, chunk, handler, &buffer_size) ==
+          "{\nkey skip\nkey n\nint64 1\n}\n");
+    CHECK((chunk >= 16) ? (buffer_size == chunk) : (buffer_size < 32));
+  }
+
+  // skipping the whole document is fine too.
+  Recorder none;
+  none.max_array_depth = 0;
+  size_t buffer_size = 0;
+  CHECK(SaxEvents("[1, [2], \"]\"]", 3, none, &buffer_size) == "[\n");
+}
+
+void TestErrors() {
+  const char* bad[] = {
+    "", "{", "[1, 2", "{\"a\" 1}", "{\"a\": }", "[1,]", "[01]", "[+1]", "[tru]",
+    "[\"abc", "[\"a\\x\"]", "{\"a\": 1} x", "[1] [2]", "]", "[\"a\x01\"]",
+    "{\"skip\": [1, 2}"
+  };
+  for (auto text : bad) {
+    std::string json(text);
+    for (size_t chunk = 1; chunk <= json.size() + 1; ++chunk) {
+      if (!SaxRejected(json, chunk)) {
+        fprintf(stderr, "accepted \"%s\" in chunks of %zu\n", text, chunk);
+        CHECK(false);
+      }
+    }
+  }
+  // cut anywhere, the document is incomplete.
+  const std::string json(kDocument);
+  for (size_t len = 0; len < json.size() - 4; len += 7)
+    CHECK(SaxRejected(json.substr(0, len), 16));
+}
+
+}  // namespace
+
+int main() {
+  TestEveryChunk();
+  TestSkipping();
+  TestErrors();
+  printf("json sax ok\n");
+  return 0;
+}
@@ -0,0 +1,228 @@
+// plx::JsonSchema with the schema of config.json. Every decode error names
+// the field the way the status line shows it, like
+// "cameras[1].max_bytes: json integer out of range": values out of range or
+// of the wrong type, keys repeated or missing, also inside the cameras.
+// Unknown keys are skipped whatever they hold and missing optional ones
+// take their defaults. What a camera folder gets as settings.json decodes
+// back to the same settings, for random settings too.
+
+#include <random>
+
+#include "test_util.h"
+#include "settings_core.h"
+
+namespace {
+
+const char kConfig[] =
+    "{\"folder\": \"D:\\\\cams\", \"seconds_per_file\": 600, \"average_bitrate\": 4000000,"
+    " \"keep_file_count\": 100, \"clean_interval_minutes\": 5, \"max_bytes\": 1000000000,"
+    " \"cameras\": [{\"device\": \"front\", \"average_bitrate\": 2000000},"
+    "               {\"device\": \"back\", \"folder\": \"E:\\\\back\", \"max_bytes\": 5}]}";
+
+Settings Decode(const std::string& json) {
+  Settings settings;
+  settings_schema.decode(plx::Range<const char>(json.data(), json.data() + json.size()),
+                         settings);
+  return settings;
+}
+
+// What the status line shows for a rejected config, empty if it decodes.
+std::string Error(const std::string& json) {
+  try {
+    Decode(json);
+  } catch (plx::JsonSchemaException& ex) {
+    return ex.field() + ": " + ex.Message();
+  } catch (plx::Exception& ex) {
+    return ex.Message();
+  }
+  return std::string();
+}
+
+// kConfig with |from| replaced by |to|.
+std::string Edit(const char* from, const char* to) {
+  std::string json(kConfig);
+  auto pos = json.find(from);
+  CHECK(pos != std::string::npos);
+  return json.replace(pos, strlen(from), to);
+}
+
+bool Same(const CameraSettings& a, const CameraSettings& b) {
+  return (a.device == b.device) && (a.folder == b.folder) &&
+         (a.average_bitrate == b.average_bitrate) &&
+         (a.keep_file_count == b.keep_file_count) &&
+         (a.max_bytes == b.max_bytes) && (a.max_age_hours == b.max_age_hours);
+}
+
+bool Same(const Settings& a, const Settings& b) {
+  if (a.cameras.size() != b.cameras.size())
+    return false;
+  for (size_t ix = 0; ix != a.cameras.size(); ++ix) {
+    if (!Same(a.cameras[ix], b.cameras[ix]))
+      return false;
+  }
+  return (a.folder == b.folder) && (a.seconds_per_file == b.seconds_per_file) &&
+         (a.average_bitrate == b.average_bitrate) &&
+         (a.keep_file_count == b.keep_file_count) &&
+         (a.clean_interval_minutes == b.clean_interval_minutes) &&
+         (a.max_bytes == b.max_bytes) && (a.min_free_bytes == b.min_free_bytes) &&
+         (a.max_age_hours == b.max_age_hours) &&
+         (a.pre_event_seconds == b.pre_event_seconds) &&
+         (a.pre_event_megabytes == b.pre_event_megabytes) &&
+         (a.motion_threshold == b.motion_threshold) && (a.large_pages == b.large_pages);
+}
+
+void TestDecode() {
+  auto settings = Decode(kConfig);
+  CHECK(settings.folder == "D:\\cams");
+  CHECK(settings.seconds_per_file == 600);
+  CHECK(settings.max_bytes == 1000000000);
+  // optional keys that are not there.
+  CHECK((settings.min_free_bytes == 0) && (settings.max_age_hours == 0));
+  CHECK((settings.pre_event_seconds == 0) && (settings.pre_event_megabytes == 256));
+  CHECK((settings.motion_threshold == 0) && (settings.large_pages == 0));
+  CHECK(settings.cameras.size() == 2);
+  CHECK(settings.cameras[0].device == "front");
+  CHECK(settings.cameras[0].folder.empty());
+  CHECK(settings.cameras[0].average_bitrate == 2000000);
+  CHECK(settings.cameras[0].max_bytes == -1);
+  CHECK(settings.cameras[1].folder == "E:\\back");
+  CHECK(settings.cameras[1].max_bytes == 5);
+
+  // what each camera records with.
+  auto front = SettingsForCamera(settings, settings.cameras[0], "D:\\cams\\cam0");
+  CHECK(front.folder == "D:\\cams\\cam0" && front.cameras.empty());
+  CHECK((front.average_bitrate == 2000000) && (front.max_bytes == 1000000000));
+  auto back = SettingsForCamera(settings, settings.cameras[1], "D:\\cams\\cam1");
+  CHECK((back.folder == "E:\\back") && (back.average_bitrate == 4000000));
+  CHECK((back.max_bytes == 5) && (back.keep_file_count == 100));
+}
+
+void TestErrors() {
+  CHECK(Error(kConfig).empty());
+  CHECK(Error(Edit("\"max_bytes\": 5", "\"max_bytes\": -1")) ==
+        "cameras[1].max_bytes: json integer out of range");
+  CHECK(Error(Edit("\"average_bitrate\": 2000000", "\"average_bitrate\": 49999")) ==
+        "cameras[0].average_bitrate: json integer out of range");
+  CHECK(Error(Edit("\"seconds_per_file\": 600", "\"seconds_per_file\": 9")) ==
+        "seconds_per_file: json integer out of range");
+  CHECK(Error(Edit("\"seconds_per_file\": 600", "\"seconds_per_file\": 86401")) ==
+        "seconds_per_file: json integer out of range");
+  CHECK(Error(Edit("\"seconds_per_file\": 600", "\"seconds_per_file\": 600.5")) ==
+        "seconds_per_file: json integer expected");
+  CHECK(Error(Edit("\"seconds_per_file\": 600", "\"seconds_per_file\": \"600\"")) ==
+        "seconds_per_file: json integer expected");
+  // past 64 bits it is not an integer anymore.
+  CHECK(Error(Edit("\"max_bytes\": 1000000000", "\"max_bytes\": 99999999999999999999")) ==
+        "max_bytes: json integer expected");
+  CHECK(Error(Edit("\"max_bytes\": 1000000000", "\"large_pages\": 2")) ==
+        "large_pages: json integer out of range");
+  CHECK(Error(Edit("\"folder\": \"D:\\\\cams\"", "\"folder\": 7")) ==
+        "folder: json string expected");
+  CHECK(Error(Edit("\"device\": \"back\"", "\"device\": null")) ==
+        "cameras[1].device: json string expected");
+  CHECK(Error(Edit("\"cameras\": [", "\"cameras\": {\"x\": [")) ==
+        "cameras: json array expected");
+  CHECK(Error(Edit("{\"device\": \"back\"", "[{\"device\": \"back\"")) ==
+        "cameras[1].: json object expected");
+  CHECK(Error("[]") == ": json object expected");
+}
+
+void TestKeys() {
+  // repeated, also inside a camera.
+  CHECK(Error(Edit("\"keep_file_count\": 100", "\"keep_file_count\": 100, \"keep_file_count\": 7")) ==
+        "keep_file_count: json field repeated");
+  CHECK(Error(Edit("\"max_bytes\": 5", "\"max_bytes\": 5, \"max_bytes\": 6")) ==
+        "cameras[1].max_bytes: json field repeated");
+  // missing required ones, the optional ones are never missing.
+  CHECK(Error(Edit("\"folder\": \"D:\\\\cams\", ", "")) == "folder: json field missing");
+  CHECK(Error(Edit("\"clean_interval_minutes\": 5, ", "")) ==
+        "clean_interval_minutes: json field missing");
+  CHECK(Error(Edit("\"max_bytes\": 1000000000,", "")).empty());
+  CHECK(Error(Edit("{\"device\": \"front\", ", "{")).empty());
+  CHECK(Error(Edit("\"cameras\": [{\"device\": \"front\", \"average_bitrate\": 2000000},"
+                   "               {\"device\": \"back\", \"folder\": \"E:\\\\back\", \"max_bytes\": 5}]",
+                   "\"cameras\": []")).empty());
+  // unknown keys are skipped whatever they hold, the next key still counts.
+  auto json = Edit("\"keep_file_count\": 100",
+                   "\"comment\": {\"keep_file_count\": [1, {\"x\": [\"]\"]}]}, \"keep_file_count\": 100,"
+                   " \"old\": [[], {}], \"n\": 1.5e300, \"t\": true, \"z\": null");
+  CHECK(Error(json).empty());
+  CHECK(Decode(json).keep_file_count == 100);
+  CHECK(Error(Edit("\"max_bytes\": 5", "\"max_bytes\": 5, \"note\": {\"max_bytes\": -1}")).empty());
+  // one object and nothing after it.
+  CHECK(!Error(std::string(kConfig) + " {}").empty());
+  CHECK(!Error(std::string(kConfig, sizeof(kConfig) - 2)).empty());
+}
+
+std::string Encode(const Settings& settings) {
+  plx::JsonWriter writer;
+  settings_schema.encode(writer, settings);
+  return writer.str();
+}
+
+std::string RandomString(std::mt19937& rng) {
+  std::string s;
+  auto size = rng() % 12;
+  for (size_t ix = 0; ix != size; ++ix) {
+    // quotes, backslashes, control chars and utf8 all need care.
+    const char* pieces[] = { "a", "\"", "\\", "\n", "\x01", "\xc3\xa9", "/", " " };
+    s += pieces[rng() % 8];
+  }
+  return s;
+}
+
+int64_t RandomInt(std::mt19937& rng, int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+// settings.json is what SaveSettings() writes, it has to decode back.
+void TestRoundTrip() {
+  auto settings = Decode(kConfig);
+  auto json = Encode(settings);
+  CHECK(Same(Decode(json), settings));
+  CHECK(Encode(Decode(json)) == json);
+  // optional values at their default are not written.
+  CHECK(json.find("min_free_bytes") == std::string::npos);
+  CHECK(json.find("\"cameras\":[") != std::string::npos);
+
+  std::mt19937 rng(20);
+  for (int round = 0; round != 2000; ++round) {
+    Settings st;
+    st.folder = RandomString(rng);
+    st.seconds_per_file = RandomInt(rng, 10, kMaxSecondsPerFile);
+    st.average_bitrate = RandomInt(rng, 50000, kNoLimit);
+    st.keep_file_count = RandomInt(rng, 0, kNoLimit);
+    st.clean_interval_minutes = RandomInt(rng, 1, kMaxCleanIntervalMinutes);
+    st.max_bytes = (rng() % 2) ? 0 : RandomInt(rng, 0, kNoLimit);
+    st.min_free_bytes = (rng() % 2) ? 0 : RandomInt(rng, 0, kNoLimit);
+    st.max_age_hours = RandomInt(rng, 0, 1000);
+    st.pre_event_seconds = RandomInt(rng, 0, 60);
+    st.pre_event_megabytes = (rng() % 2) ? 256 : RandomInt(rng, 0, kMaxPreEventMegabytes);
+    st.motion_threshold = RandomInt(rng, 0, 1000);
+    st.large_pages = rng() % 2;
+    auto cameras = rng() % 4;
+    for (size_t ix = 0; ix != cameras; ++ix) {
+      CameraSettings camera;
+      camera.device = RandomString(rng);
+      camera.folder = RandomString(rng);
+      camera.average_bitrate = (rng() % 2) ? -1 : RandomInt(rng, 50000, kNoLimit);
+      camera.keep_file_count = (rng() % 2) ? -1 : RandomInt(rng, 0, kNoLimit);
+      camera.max_bytes = (rng() % 2) ? -1 : RandomInt(rng, 0, kNoLimit);
+      camera.max_age_hours = (rng() % 2) ? -1 : RandomInt(rng, 0, kNoLimit);
+      st.cameras.push_back(camera);
+    }
+    auto text = Encode(st);
+    CHECK(Same(Decode(text), st));
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestDecode();
+  TestErrors();
+  TestKeys();
+  TestRoundTrip();
+  return 0;
+}
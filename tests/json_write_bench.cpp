@@ -0,0 +1,101 @@
+// plx::JsonWriter throughput in MB/s of json out, with one writer reused
+// and flushed to a sink after every record the way the sidecars are
+// written. Three kinds of records: sidecars (short strings, integers and a
+// few short decimals), arbitrary doubles that need the %g path of
+// plx::JsonFormatDouble, and strings full of bytes that must be escaped.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+void Sidecar(plx::JsonWriter& writer, int ix) {
+  writer.begin_object();
+  writer.key("file").string("2026-10-17-123456.mp4");
+  writer.key("camera").string("USB Camera 2");
+  writer.key("gaps").begin_array();
+  for (int gap = 0; gap != 4; ++gap) {
+    writer.begin_object()
+          .key("time").dbl(ix + gap * 0.25)
+          .key("dropped").int64(gap + 1)
+          .end_object();
+  }
+  writer.end_array();
+  writer.key("dropped").int64(ix);
+  writer.end_object();
+}
+
+const std::vector<double>* g_doubles;
+
+void Doubles(plx::JsonWriter& writer, int ix) {
+  writer.begin_array();
+  for (size_t d = 0; d != 16; ++d)
+    writer.dbl((*g_doubles)[(ix * 16 + d) % g_doubles->size()]);
+  writer.end_array();
+}
+
+const std::string* g_escapy;
+
+void Escapy(plx::JsonWriter& writer, int) {
+  writer.begin_object();
+  writer.key("note").string(*g_escapy);
+  writer.key("path").string("C:\\cams\\front\\2026-10-17-123456.mp4");
+  writer.end_object();
+}
+
+template <typename Fn>
+void Run(const char* name, int records, Fn record) {
+  plx::JsonWriter writer;
+  uint64_t bytes = 0;
+  auto sink = [&bytes](const char*, size_t len) {
+    bytes += len;
+    return len;
+  };
+  // warm up, the buffer keeps its capacity from here on.
+  record(writer, 0);
+  writer.flush(sink);
+  bytes = 0;
+
+  auto start = plx::QpcNow();
+  for (int ix = 0; ix != records; ++ix) {
+    record(writer, ix);
+    CHECK(writer.flush(sink));
+  }
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  printf("%-10s %8d records %9.1f MB  %8.1f MB/s  %6.0f ns/record\n", name, records,
+         bytes / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0) / secs,
+         secs * 1.0e9 / records);
+
+  // what was written reads back.
+  record(writer, records / 2);
+  plx::Range<const char> range = writer.text();
+  plx::JsonParseValue(range);
+  CHECK(range.empty());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const int records = quick ? 20000 : 2000000;
+
+  std::mt19937_64 rng(18);
+  std::vector<double> doubles(4096);
+  for (auto& v : doubles) {
+    std::uniform_real_distribution<double> dist(-1.0e6, 1.0e6);
+    v = dist(rng) * std::pow(10.0, static_cast<int>(rng() % 40) - 20);
+  }
+  g_doubles = &doubles;
+  std::string escapy;
+  for (int ix = 0; ix != 200; ++ix)
+    escapy.push_back(static_cast<char>((ix % 3) ? ('a' + ix % 26) : (ix % 32)));
+  escapy += "\"quoted\" and \\back\\slashes\\";
+  g_escapy = &escapy;
+
+  Run("sidecars", records, Sidecar);
+  Run("doubles", records / 4, Doubles);
+  Run("escapes", records, Escapy);
+  return 0;
+}
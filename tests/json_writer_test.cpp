@@ -0,0 +1,286 @@
+// plx::JsonWriter writes what the readers read back unchanged: random
+// plx::JsonValue trees through plx::JsonParseValue, and doubles bit for
+// bit through plx::JsonFormatDouble, subnormals and extremes included.
+// Every byte plx::JsonFindStringEnd stops at is escaped, wherever it sits
+// in the 16 byte blocks of the scan, and nothing else is. flush() hands
+// the text to a sink that may take it in pieces.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_json.h"
+
+namespace {
+
+bool SameBits(double a, double b) {
+  return !memcmp(&a, &b, sizeof(a));
+}
+
+bool Same(plx::JsonValue& a, plx::JsonValue& b) {
+  if (a.type() != b.type())
+    return false;
+  switch (a.type()) {
+    case plx::JsonType::BOOL: return a.get_bool() == b.get_bool();
+    case plx::JsonType::INT64: return a.get_int64() == b.get_int64();
+    case plx::JsonType::DOUBLE: return SameBits(a.get_double(), b.get_double());
+    case plx::JsonType::STRING: return a.get_string() == b.get_string();
+    case plx::JsonType::ARRAY: {
+      if (a.size() != b.size())
+        return false;
+      for (size_t ix = 0; ix != a.size(); ++ix) {
+        if (!Same(a[ix], b[ix]))
+          return false;
+      }
+      return true;
+    }
+    case plx::JsonType::OBJECT: {
+      if (a.size() != b.size())
+        return false;
+      auto ita = a.get_iterator();
+      for (; ita.first != ita.second; ++ita.first) {
+        auto& key = ita.first->first;
+        if (!b.has_key(key) || !Same(a[key], b[key]))
+          return false;
+      }
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+void Write(plx::JsonValue& value, plx::JsonWriter& writer) {
+  switch (value.type()) {
+    case plx::JsonType::BOOL: writer.boolean(value.get_bool()); break;
+    case plx::JsonType::INT64: writer.int64(value.get_int64()); break;
+    case plx::JsonType::DOUBLE: writer.dbl(value.get_double()); break;
+    case plx::JsonType::STRING: writer.string(value.get_string()); break;
+    case plx::JsonType::ARRAY:
+      writer.begin_array();
+      for (size_t ix = 0; ix != value.size(); ++ix)
+        Write(value[ix], writer);
+      writer.end_array();
+      break;
+    case plx::JsonType::OBJECT: {
+      writer.begin_object();
+      auto it = value.get_iterator();
+      for (; it.first != it.second; ++it.first) {
+        auto& key = it.first->first;
+        writer.key(plx::Range<const char>(key.data(), key.data() + key.size()));
+        Write(value[it.first->first], writer);
+      }
+      writer.end_object();
+      break;
+    }
+    default:
+      writer.null();
+  }
+}
+
+// Any finite double, from every binade.
+double RandomDouble(std::mt19937_64& rng) {
+  for (;;) {
+    auto bits = rng();
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    if (std::isfinite(v))
+      return v;
+  }
+}
+
+std::string RandomString(std::mt19937_64& rng) {
+  std::string s;
+  auto size = rng() % 24;
+  for (size_t ix = 0; ix != size; ++ix) {
+    // every ascii byte, some utf8.
+    if (rng() % 4)
+      s.push_back(static_cast<char>(rng() % 128));
+    else
+      s += "\xc3\xa9";
+  }
+  return s;
+}
+
+plx::JsonValue RandomValue(std::mt19937_64& rng, int depth) {
+  auto kind = rng() % (depth ? 8 : 6);
+  switch (kind) {
+    case 0: return nullptr;
+    case 1: return (rng() % 2) == 0;
+    case 2: return static_cast<int64_t>(rng());
+    case 3: return RandomDouble(rng);
+    case 4: return static_cast<double>(static_cast<int64_t>(rng() % 2000) - 1000) / 8.0;
+    case 5: return RandomString(rng);
+    case 6: {
+      plx::JsonValue arr(plx::JsonType::ARRAY);
+      auto count = rng() % 6;
+      for (size_t ix = 0; ix != count; ++ix)
+        plx::JsonAppend(arr, RandomValue(rng, depth - 1));
+      return arr;
+    }
+    default: {
+      plx::JsonValue obj(plx::JsonType::OBJECT);
+      auto count = rng() % 6;
+      for (size_t ix = 0; ix != count; ++ix)
+        obj[RandomString(rng)] = RandomValue(rng, depth - 1);
+      return obj;
+    }
+  }
+}
+
+void TestTrees() {
+  std::mt19937_64 rng(18);
+  plx::JsonWriter writer;
+  for (int round = 0; round != 3000; ++round) {
+    auto value = RandomValue(rng, 4);
+    writer.clear();
+    Write(value, writer);
+    plx::Range<const char> range = writer.text();
+    auto back = plx::JsonParseValue(range);
+    CHECK(range.empty());
+    if (!Same(value, back)) {
+      fprintf(stderr, "round %d: %s\n", round, writer.str().c_str());
+      CHECK(false);
+    }
+  }
+}
+
+// |v| through JsonFormatDouble and back, by itself and as the writer puts it.
+void CheckDouble(double v) {
+  char buf[32];
+  auto len = plx::JsonFormatDouble(v, buf);
+  CHECK((len > 0) && (len < sizeof(buf)) && (strlen(buf) == len));
+  CHECK(SameBits(strtod(buf, nullptr), v));
+
+  plx::JsonWriter writer;
+  writer.dbl(v);
+  plx::JsonReader reader(writer.text());
+  CHECK(reader.next() == plx::JsonReader::Token::dbl);
+  CHECK(SameBits(reader.dbl(), v));
+}
+
+void TestDoubles() {
+  const double values[] = {
+    0.0, -0.0, 1.0, -1.0, 0.1, 1.0 / 3.0, 5e-324, -5e-324, 2.2250738585072009e-308,
+    2.2250738585072014e-308, 1.7976931348623157e308, -1.7976931348623157e308,
+    9007199254740992.0, 9007199254740993.0, 1e22, 1e23, 123456.789, 4.35, 0.3
+  };
+  for (auto v : values)
+    CheckDouble(v);
+  std::mt19937_64 rng(1018);
+  for (int ix = 0; ix != 200000; ++ix)
+    CheckDouble(RandomDouble(rng));
+  // short decimals take the fast path of the formatter.
+  for (int ix = 0; ix != 100000; ++ix) {
+    auto m = static_cast<int64_t>(rng() % 2000000000) - 1000000000;
+    CheckDouble(static_cast<double>(m) / static_cast<double>(1 + (rng() % 4)) / 1000.0);
+  }
+  // no json form.
+  char buf[32];
+  CHECK(!plx::JsonFormatDouble(std::numeric_limits<double>::infinity(), buf));
+  CHECK(!plx::JsonFormatDouble(std::nan(""), buf));
+  plx::JsonWriter writer;
+  writer.begin_array().dbl(std::nan("")).dbl(2.0).end_array();
+  CHECK(writer.str() == "[null,2.0]");
+}
+
+std::string Escaped(const std::string& s) {
+  plx::JsonWriter writer;
+  writer.string(s);
+  return writer.str();
+}
+
+void TestEscapes() {
+  // each byte alone.
+  for (int c = 1; c != 256; ++c) {
+    std::string s(1, static_cast<char>(c));
+    auto text = Escaped(s);
+    std::string want;
+    switch (c) {
+      case '"': want = "\\\""; break;
+      case '\\': want = "\\\\"; break;
+      case '\b': want = "\\b"; break;
+      case '\f': want = "\\f"; break;
+      case '\n': want = "\\n"; break;
+      case '\r': want = "\\r"; break;
+      case '\t': want = "\\t"; break;
+      default:
+        want = (c < 0x20) ? plx::Format("\\u%04x", c) : s;
+    }
+    CHECK(text == "\"" + want + "\"");
+  }
+  CHECK(Escaped(std::string("a\0b", 3)) == "\"a\\u0000b\"");
+
+  // every byte the scan stops at, at every offset of the 16 byte blocks.
+  const char stops[] = { '"', '\\', '\x00', '\x01', '\x1f', '\n' };
+  for (size_t size = 1; size != 48; ++size) {
+    for (size_t at = 0; at != size; ++at) {
+      for (auto c : stops) {
+        std::string s(size, 'x');
+        s[at] = c;
+        // the bytes just past the controls are not escaped.
+        if (at + 1 != size)
+          s[at + 1] = ' ';
+        auto text = Escaped(s);
+        // in the body the scan only stops at the backslash of an escape.
+        auto p = text.data() + 1;
+        auto e = text.data() + text.size() - 1;
+        while ((p = plx::JsonFindStringEnd(p, e)) != e) {
+          CHECK(*p == '\\');
+          p += 2;
+        }
+        CHECK(text.size() == size + 2 + ((c == '"' || c == '\\' || c == '\n') ? 1 : 5));
+        plx::JsonReader reader(plx::Range<const char>(text.data(), text.data() + text.size()));
+        CHECK(reader.next() == plx::JsonReader::Token::string);
+        CHECK(std::string(reader.str().start(), reader.str().end()) == s);
+      }
+    }
+  }
+
+  // keys go through the same escaping.
+  plx::JsonWriter writer;
+  writer.begin_object().key("a\"\x02").int64(1).end_object();
+  CHECK(writer.str() == "{\"a\\\"\\u0002\":1}");
+}
+
+void TestFlush() {
+  plx::JsonWriter writer;
+  writer.begin_array();
+  for (int ix = 0; ix != 1000; ++ix)
+    writer.int64(ix);
+  writer.end_array();
+  auto want = writer.str();
+
+  // a sink that takes at most 7 bytes a call.
+  std::string out;
+  CHECK(writer.flush([&out](const char* data, size_t len) {
+    auto count = std::min<size_t>(len, 7);
+    out.append(data, count);
+    return count;
+  }));
+  CHECK(out == want);
+  CHECK(writer.str().empty());
+
+  // one that gives up halfway, the buffer is emptied anyway.
+  writer.string("abcdef");
+  size_t calls = 0;
+  CHECK(!writer.flush([&calls](const char*, size_t len) {
+    return (calls++ == 0) ? len / 2 : 0;
+  }));
+  CHECK(writer.str().empty());
+  // nothing to write never calls the sink.
+  CHECK(writer.flush([](const char*, size_t) -> size_t {
+    CHECK(false);
+    return 0;
+  }));
+}
+
+}  // namespace
+
+int main() {
+  TestTrees();
+  TestDoubles();
+  TestEscapes();
+  TestFlush();
+  printf("json writer ok\n");
+  return 0;
+}
@@ -0,0 +1,87 @@
+// plx::LargeFile reads and writes past 4 GB, where a 32-bit offset would
+// wrap around to the start of the file, and plx::AsyncFileWriter on its
+// handle does the same when it starts there. The positional calls leave
+// the current position alone. The file is sparse, only the pages written
+// take disk space.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test_util.h"
+#include "plx_io.h"
+
+namespace {
+
+const long long kFar = (5LL << 30) + 12345;
+
+std::vector<uint8_t> Pattern(size_t size, uint8_t seed) {
+  std::vector<uint8_t> data(size);
+  for (size_t ix = 0; ix != size; ++ix)
+    data[ix] = static_cast<uint8_t>(seed + ix * 7);
+  return data;
+}
+
+void TestFar(const char* path) {
+  auto file = plx::LargeFile::Create(path, O_RDWR | O_CREAT | O_TRUNC);
+  CHECK(file.is_valid());
+  auto head = Pattern(100, 1);
+  CHECK(file.write(plx::RangeFromVector(head)) == head.size());
+  auto far = Pattern(5000, 2);
+  CHECK(file.write(&far[0], far.size(), kFar) == far.size());
+  CHECK(file.size_in_bytes() == kFar + 5000);
+  CHECK(::lseek(file.native(), 0, SEEK_CUR) == 100);
+
+  // the start is still what was written there first.
+  std::vector<uint8_t> back(100);
+  CHECK(file.read(&back[0], back.size(), 0) == back.size());
+  CHECK(back == head);
+  back.resize(far.size());
+  CHECK(file.read(&back[0], back.size(), kFar) == back.size());
+  CHECK(back == far);
+  // in between is a hole, read from the current position.
+  back.assign(16, 0xff);
+  plx::Range<uint8_t> range(&back[0], back.size());
+  CHECK(file.read(range) == back.size());
+  CHECK(back == std::vector<uint8_t>(16, 0));
+  CHECK(::lseek(file.native(), 0, SEEK_CUR) == 116);
+  // nothing past the end.
+  CHECK(file.read(&back[0], back.size(), kFar + 5000) == 0);
+
+  // moving hands the file over.
+  auto moved = std::move(file);
+  CHECK(moved.is_valid() && !file.is_valid());
+}
+
+void TestAsyncFar(const char* path) {
+  auto file = plx::LargeFile::Create(path, O_RDWR | O_CREAT | O_TRUNC);
+  CHECK(file.is_valid());
+  auto data = Pattern(3 * 1024 * 1024 + 17, 3);
+  {
+    plx::AsyncFileWriter writer(plx::MakeAsyncIo(file.native(), 4), 256 * 1024, 4,
+                                plx::AsyncFileWriter::Done(), kFar);
+    for (size_t pos = 0; pos < data.size(); pos += 1000)
+      writer.write(&data[pos], std::min<size_t>(1000, data.size() - pos));
+    writer.flush();
+    CHECK(writer.failures() == 0);
+    CHECK(writer.end() == static_cast<uint64_t>(kFar) + data.size());
+  }
+  CHECK(file.size_in_bytes() == kFar + static_cast<long long>(data.size()));
+  std::vector<uint8_t> back(data.size());
+  CHECK(file.read(&back[0], back.size(), kFar) == back.size());
+  CHECK(back == data);
+}
+
+}  // namespace
+
+int main() {
+  char path[] = "/tmp/large_file_test_XXXXXX";
+  auto fd = ::mkstemp(path);
+  CHECK(fd >= 0);
+  ::close(fd);
+  CHECK(!plx::LargeFile::Create("/nonexistent/dir/file", O_RDONLY).is_valid());
+  TestFar(path);
+  TestAsyncFar(path);
+  ::unlink(path);
+  printf("large file ok\n");
+  return 0;
+}
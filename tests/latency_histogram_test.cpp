@@ -0,0 +1,170 @@
+// plx::LatencyHistogram. Every value lands in a bucket that holds it and
+// is at most 12.5% wide, up to 2^64 - 1. Percentiles of known
+// distributions are within a bucket of the exact answer, the mean and max
+// are exact, also with several threads recording at once.
+
+#include <algorithm>
+#include <random>
+#include <thread>
+
+#include "test_util.h"
+
+namespace {
+
+typedef plx::LatencyHistogram Histogram;
+
+// The smallest value of bucket |index|.
+uint64_t LowerBound(size_t index) {
+  return index ? Histogram::BucketUpperBound(index - 1) + 1 : 0;
+}
+
+void CheckBucket(uint64_t value) {
+  auto index = Histogram::BucketIndex(value);
+  CHECK(index < Histogram::kBuckets);
+  CHECK(LowerBound(index) <= value);
+  CHECK(value <= Histogram::BucketUpperBound(index));
+  auto width = Histogram::BucketUpperBound(index) - LowerBound(index);
+  CHECK(width <= (LowerBound(index) / 8));
+}
+
+void TestBuckets() {
+  for (uint64_t value = 0; value != 100000; ++value)
+    CheckBucket(value);
+  for (int bit = 0; bit != 64; ++bit) {
+    auto power = 1ULL << bit;
+    CheckBucket(power);
+    CheckBucket(power - 1);
+    CheckBucket(power + 1);
+  }
+  CheckBucket(~0ULL);
+  CHECK(Histogram::BucketIndex(~0ULL) == Histogram::kBuckets - 1);
+  // below 8 every value has its own bucket.
+  for (uint64_t value = 0; value != 8; ++value) {
+    CHECK(Histogram::BucketIndex(value) == value);
+    CHECK(Histogram::BucketUpperBound(value) == value);
+  }
+  // no bucket is skipped and none goes backwards.
+  for (size_t index = 1; index != Histogram::kBuckets; ++index)
+    CHECK(Histogram::BucketIndex(LowerBound(index)) == index);
+  std::mt19937_64 rng(5);
+  for (int ix = 0; ix != 1000000; ++ix)
+    CheckBucket(rng() >> (rng() % 64));
+}
+
+// |got| is |want| rounded up to the end of its bucket.
+bool Near(uint64_t got, uint64_t want) {
+  return (got >= want) && (got <= Histogram::BucketUpperBound(Histogram::BucketIndex(want)));
+}
+
+void TestEmpty() {
+  Histogram histogram;
+  auto sm = histogram.summary();
+  CHECK(!sm.count && !sm.mean && !sm.p50 && !sm.p99 && !sm.p999 && !sm.max);
+}
+
+void TestConstant() {
+  Histogram histogram;
+  for (int ix = 0; ix != 1000; ++ix)
+    histogram.record(33333333);
+  auto sm = histogram.summary();
+  CHECK(sm.count == 1000);
+  // the max caps the bucket bound.
+  CHECK((sm.mean == 33333333) && (sm.p50 == 33333333) && (sm.p999 == 33333333));
+  CHECK(sm.max == 33333333);
+}
+
+void TestUniform() {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000000; ++value)
+    histogram.record(value);
+  auto sm = histogram.summary();
+  CHECK(sm.count == 1000000);
+  CHECK(sm.mean == 500000);
+  CHECK(sm.max == 1000000);
+  // the sample at rank p * count is p * count + 1.
+  CHECK(Near(sm.p50, 500001));
+  CHECK(Near(sm.p99, 990001));
+  CHECK(Near(sm.p999, 999001) || (sm.p999 == sm.max));
+  CHECK(histogram.percentile(1.0) == 1000000);
+  CHECK(histogram.percentile(0.0) == 1);
+}
+
+// 99% fast, 1% a thousand times slower: the p99 is the first slow one.
+void TestBimodal() {
+  Histogram histogram;
+  for (int ix = 0; ix != 99000; ++ix)
+    histogram.record(100);
+  for (int ix = 0; ix != 1000; ++ix)
+    histogram.record(1000000);
+  auto sm = histogram.summary();
+  CHECK(Near(sm.p50, 100));
+  CHECK(sm.p99 == 1000000);
+  CHECK(sm.p999 == 1000000);
+  CHECK(sm.mean == (99000ULL * 100 + 1000ULL * 1000000) / 100000);
+  CHECK(histogram.percentile(0.9899) == Histogram::BucketUpperBound(Histogram::BucketIndex(100)));
+}
+
+// Against the exact percentiles of a sorted copy.
+void TestLogNormal() {
+  std::mt19937 rng(8);
+  std::lognormal_distribution<double> dist(13.0, 1.5);
+  Histogram histogram;
+  std::vector<uint64_t> values;
+  for (int ix = 0; ix != 200000; ++ix) {
+    auto value = static_cast<uint64_t>(dist(rng));
+    values.push_back(value);
+    histogram.record(value);
+  }
+  std::sort(values.begin(), values.end());
+  const double ps[] = { 0.5, 0.9, 0.99, 0.999 };
+  for (auto p : ps) {
+    auto exact = values[static_cast<size_t>(p * values.size())];
+    CHECK(Near(histogram.percentile(p), exact));
+  }
+  CHECK(histogram.summary().max == values.back());
+}
+
+void TestReset() {
+  Histogram histogram;
+  histogram.record(5);
+  histogram.record(5000);
+  histogram.reset();
+  CHECK(!histogram.count() && !histogram.summary().max && !histogram.percentile(0.5));
+  histogram.record(7);
+  CHECK(histogram.summary().p50 == 7);
+}
+
+void TestThreads() {
+  Histogram histogram;
+  const int kThreads = 4;
+  const uint64_t kPerThread = 200000;
+  std::vector<std::thread> threads;
+  for (int id = 0; id != kThreads; ++id) {
+    threads.emplace_back([&histogram, id, kPerThread]() {
+      for (uint64_t ix = 0; ix != kPerThread; ++ix)
+        histogram.record((ix * kThreads) + id);
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  const uint64_t total = kThreads * kPerThread;
+  auto sm = histogram.summary();
+  CHECK(sm.count == total);
+  CHECK(sm.max == total - 1);
+  CHECK(sm.mean == (total - 1) / 2);
+  CHECK(Near(sm.p50, total / 2));
+}
+
+}  // namespace
+
+int main() {
+  TestBuckets();
+  TestEmpty();
+  TestConstant();
+  TestUniform();
+  TestBimodal();
+  TestLogNormal();
+  TestReset();
+  TestThreads();
+  return 0;
+}
@@ -0,0 +1,119 @@
+// memory_folder.h : a plx::SegmentFolder that lives in memory, for the
+// tests of what runs on top of one.
+
+#pragma once
+
+#include <map>
+
+#include "plx_segments.h"
+
+class MemoryFolder : public plx::SegmentFolder {
+public:
+  struct File {
+    std::vector<uint8_t> data;
+    // segments only pretend to have their size.
+    long long size;
+    long long creation_ns1600;
+    bool busy;
+  };
+
+  std::map<std::wstring, File> files;
+  // the creation time of the next file, one second later each time.
+  long long clock;
+  // replace() fails as if the machine died before the rename.
+  bool fail_replace;
+  size_t replaces;
+  // the size of the volume, what the files do not take is free. Zero if
+  // the free space is unknown.
+  long long capacity;
+
+  MemoryFolder()
+      : clock(130000000000000000LL), fail_replace(false), replaces(0), capacity(0) {
+  }
+
+  void add_file(const std::wstring& name, long long size) {
+    File file = { std::vector<uint8_t>(), size, clock, false };
+    files[name] = file;
+    clock += 10000000LL;
+  }
+
+  bool has(const std::wstring& name) const {
+    return files.find(name) != files.end();
+  }
+
+  bool list(std::vector<Entry>& entries) override {
+    entries.clear();
+    for (auto& file : files) {
+      Entry entry = { file.first, file.second.creation_ns1600, file.second.size };
+      entries.push_back(entry);
+    }
+    return true;
+  }
+
+  bool stat(const std::wstring& name, Entry& entry) override {
+    auto it = files.find(name);
+    if (it == files.end())
+      return false;
+    entry.name = name;
+    entry.creation_ns1600 = it->second.creation_ns1600;
+    entry.size = it->second.size;
+    return true;
+  }
+
+  bool rename(const std::wstring& from, const std::wstring& to) override {
+    auto it = files.find(from);
+    if ((it == files.end()) || has(to))
+      return false;
+    files[to] = it->second;
+    files.erase(from);
+    return true;
+  }
+
+  Removed remove(const std::wstring& name) override {
+    auto it = files.find(name);
+    if (it == files.end())
+      return Removed::missing;
+    if (it->second.busy)
+      return Removed::busy;
+    files.erase(it);
+    return Removed::yes;
+  }
+
+  bool read(const std::wstring& name, std::vector<uint8_t>& data) override {
+    auto it = files.find(name);
+    if (it == files.end())
+      return false;
+    data = it->second.data;
+    return true;
+  }
+
+  bool append(const std::wstring& name, const std::vector<uint8_t>& data) override {
+    if (!has(name))
+      add_file(name, 0);
+    auto& file = files[name];
+    file.data.insert(file.data.end(), data.begin(), data.end());
+    file.size = static_cast<long long>(file.data.size());
+    return true;
+  }
+
+  bool replace(const std::wstring& name, const std::vector<uint8_t>& data) override {
+    if (fail_replace)
+      return false;
+    ++replaces;
+    if (!has(name))
+      add_file(name, 0);
+    auto& file = files[name];
+    file.data = data;
+    file.size = static_cast<long long>(data.size());
+    return true;
+  }
+
+  long long free_bytes() override {
+    if (!capacity)
+      return -1LL;
+    auto free = capacity;
+    for (auto& file : files)
+      free -= file.second.size;
+    return free;
+  }
+};
@@ -0,0 +1,82 @@
+// The motion detection kernels on 1080p frames at each simd level: shrink
+// the luma by 4 and compare 16x16 tiles with the previous frame, like
+// MotionDetector does for every frame. At 60 fps a frame has 16.7 ms.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+const size_t kWidth = 1920;
+const size_t kHeight = 1080;
+const size_t kShrink = 4;
+const double kFrameBudgetUs = 1000000.0 / 60.0;
+
+const char* LevelName(plx::SimdLevel level) {
+  switch (level) {
+    case plx::SimdLevel::avx2: return "avx2";
+    case plx::SimdLevel::sse2: return "sse2";
+    default: return "scalar";
+  }
+}
+
+void Run(const char* format, size_t pixel_step, plx::SimdLevel level, int frames,
+         const std::vector<std::vector<uint8_t>>& sources) {
+  const size_t small_w = kWidth / kShrink;
+  const size_t small_h = kHeight / kShrink;
+  std::vector<uint8_t> prev(small_w * small_h);
+  std::vector<uint8_t> cur(small_w * small_h);
+  std::vector<uint32_t> sads((small_w / 16) * (small_h / 16));
+  plx::LatencyHistogram shrink, sad;
+  uint64_t checksum = 0;
+  for (int ix = 0; ix != frames; ++ix) {
+    auto& src = sources[ix % sources.size()];
+    auto t0 = plx::QpcNow();
+    plx::DownsampleLuma(&src[0], kWidth * pixel_step, kWidth, kHeight, pixel_step, kShrink,
+                        &cur[0], small_w, level);
+    auto t1 = plx::QpcNow();
+    plx::BlockSad16(&prev[0], &cur[0], small_w, small_w, small_h, &sads[0], level);
+    auto t2 = plx::QpcNow();
+    shrink.record(plx::QpcToNanos(t1 - t0));
+    sad.record(plx::QpcToNanos(t2 - t1));
+    checksum += sads[ix % sads.size()];
+    prev.swap(cur);
+  }
+  auto total_us = (shrink.summary().mean + sad.summary().mean) / 1000.0;
+  printf("%-5s %-6s shrink p50 %5llu us, sad p50 %4llu us, %6.1f us/frame, %4.1f%% of 60 fps (%llu)\n",
+         format, LevelName(level),
+         static_cast<unsigned long long>(shrink.summary().p50 / 1000),
+         static_cast<unsigned long long>(sad.summary().p50 / 1000),
+         total_us, (100.0 * total_us) / kFrameBudgetUs,
+         static_cast<unsigned long long>(checksum));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int frames = HasArg(argc, argv, "--quick") ? 20 : 600;
+  std::mt19937 rng(60);
+  // a few frames that differ so the sads are not all zero.
+  std::vector<std::vector<uint8_t>> nv12(4), yuy2(4);
+  for (size_t ix = 0; ix != nv12.size(); ++ix) {
+    nv12[ix].resize(kWidth * kHeight);
+    yuy2[ix].resize(kWidth * kHeight * 2);
+    for (auto& px : nv12[ix])
+      px = static_cast<uint8_t>(rng());
+    for (auto& px : yuy2[ix])
+      px = static_cast<uint8_t>(rng());
+  }
+  std::vector<plx::SimdLevel> levels(1, plx::SimdLevel::scalar);
+  if (plx::BestSimdLevel() != plx::SimdLevel::scalar)
+    levels.push_back(plx::SimdLevel::sse2);
+  if (plx::BestSimdLevel() == plx::SimdLevel::avx2)
+    levels.push_back(plx::SimdLevel::avx2);
+  printf("%d frames of %dx%d\n", frames, static_cast<int>(kWidth), static_cast<int>(kHeight));
+  for (auto level : levels) {
+    Run("nv12", 1, level, frames, nv12);
+    Run("yuy2", 2, level, frames, yuy2);
+  }
+  return 0;
+}
@@ -0,0 +1,284 @@
+// 1 to 16 synthetic cameras, each with its own SegmentedWriter, writer
+// thread and sink like the pipelines of the app. A camera makes YUY2
+// frames, its writer thread converts them to NV12 and hands them to the
+// sink: null drops them, file writes them to one file per segment in a
+// folder of its own, syncs it when the segment is finalized and deletes
+// it so the disk does not fill up. A rotator
+// thread rotates the segments of every camera the way the UI timer does.
+// Frames come as fast as the writers take them, or at 30 fps with
+// --realtime. Per camera frames/s and MB/s, and for the whole run the CPU
+// time per frame and the end to end latency.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <random>
+
+#include "test_util.h"
+#include "capture_core.h"
+#include "plx_video.h"
+
+namespace {
+
+struct BenchParams {
+  size_t width;
+  size_t height;
+  int fps;
+  int frames;
+  bool realtime;
+  bool file;
+};
+
+// What the camera hands over: which of the source frames it is.
+typedef int Frame;
+
+class Sink {
+public:
+  virtual ~Sink() {}
+  virtual bool write(const std::vector<uint8_t>& nv12) = 0;
+  virtual void finalize() = 0;
+};
+
+typedef std::shared_ptr<Sink> SinkPtr;
+
+class NullSink : public Sink {
+public:
+  bool write(const std::vector<uint8_t>& nv12) override {
+    return !nv12.empty();
+  }
+
+  void finalize() override {}
+};
+
+// Deletes the segment once it is on disk, only a few per camera exist at
+// any time.
+class FileSink : public Sink {
+  const std::string path_;
+  int fd_;
+
+public:
+  explicit FileSink(const std::string& path)
+      : path_(path),
+        fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) {
+    CHECK(fd_ >= 0);
+  }
+
+  ~FileSink() {
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  bool write(const std::vector<uint8_t>& nv12) override {
+    return ::write(fd_, &nv12[0], nv12.size()) == static_cast<ssize_t>(nv12.size());
+  }
+
+  void finalize() override {
+    ::fdatasync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+    ::unlink(path_.c_str());
+  }
+};
+
+class Camera : public SegmentedWriter<SinkPtr, Frame>::Delegate {
+  const BenchParams& params_;
+  const std::vector<std::vector<uint8_t>>& source_;
+  const std::string dir_;
+  std::vector<uint8_t> nv12_;
+  int segments_made_;
+  std::atomic<uint64_t> bytes_out_;
+  // plx::QpcNow() after the newest frame was written.
+  std::atomic<int64_t> last_written_;
+
+public:
+  SegmentedWriter<SinkPtr, Frame> writer;
+
+  Camera(const BenchParams& params, const std::vector<std::vector<uint8_t>>& source,
+         const std::string& dir)
+      : params_(params), source_(source), dir_(dir),
+        nv12_(params.width * params.height * 3 / 2),
+        segments_made_(0), bytes_out_(0), last_written_(0),
+        writer(this, 64) {
+  }
+
+  ~Camera() {
+    writer.shutdown();
+  }
+
+  SinkPtr make_sink() {
+    if (!params_.file)
+      return std::make_shared<NullSink>();
+    auto path = dir_ + plx::Format("/segment-%d.nv12", segments_made_++);
+    return std::make_shared<FileSink>(path);
+  }
+
+  uint64_t bytes_out() const {
+    return bytes_out_;
+  }
+
+  int64_t last_written() const {
+    return last_written_;
+  }
+
+  bool prepare_frame(Frame& frame) override {
+    auto& yuy2 = source_[frame];
+    auto dst_y = &nv12_[0];
+    plx::Yuy2ToNv12(&yuy2[0], params_.width * 2, params_.width, 0, params_.height,
+                    dst_y, params_.width, dst_y + (params_.width * params_.height),
+                    params_.width, plx::BestSimdLevel());
+    return true;
+  }
+
+  bool write_frame(SinkPtr& sink, Frame&, int64_t) override {
+    if (!sink->write(nv12_))
+      return false;
+    bytes_out_ += nv12_.size();
+    return true;
+  }
+
+  void frame_written(Frame&, int64_t) override {
+    last_written_ = plx::QpcNow();
+  }
+
+  void finalize_writer(SinkPtr& sink) override {
+    sink->finalize();
+  }
+
+  void discard_writer(SinkPtr& sink, const std::wstring&) override {
+    sink->finalize();
+  }
+};
+
+double CpuSeconds() {
+  rusage usage;
+  ::getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         ((usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1.0e6);
+}
+
+// Produces the frames of one camera, paced or as fast as its writer goes.
+void Produce(const BenchParams& params, size_t sources, Camera& camera) {
+  const int64_t frame_time = 10000000LL / params.fps;
+  auto start = std::chrono::steady_clock::now();
+  auto interval = std::chrono::microseconds(1000000 / params.fps);
+  for (int ix = 0; ix != params.frames; ++ix) {
+    if (params.realtime) {
+      std::this_thread::sleep_until(start + (interval * ix));
+    } else {
+      // stay half a queue ahead of the writer, a full queue would drop.
+      while ((static_cast<uint64_t>(ix) - camera.writer.stats().frames_written) > 32)
+        std::this_thread::yield();
+    }
+    camera.writer.push(ix % static_cast<int>(sources), ix * frame_time, plx::QpcNow(), 0);
+  }
+}
+
+void Run(const BenchParams& params, int cameras,
+         const std::vector<std::vector<uint8_t>>& source) {
+  char tmpl[] = "/tmp/multi_camera_bench_XXXXXX";
+  CHECK(mkdtemp(tmpl));
+  const std::string root(tmpl);
+
+  // two second segments.
+  const int64_t segment_length = 2 * 10000000LL;
+  std::vector<std::unique_ptr<Camera>> all;
+  for (int ix = 0; ix != cameras; ++ix) {
+    auto dir = root + plx::Format("/camera-%d", ix);
+    CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    all.push_back(std::make_unique<Camera>(params, source, dir));
+    all.back()->writer.start(all.back()->make_sink(), segment_length);
+  }
+
+  std::atomic<bool> done(false);
+  std::thread rotator([&]() {
+    std::vector<uint32_t> seen(all.size());
+    while (!done) {
+      for (size_t ix = 0; ix != all.size(); ++ix) {
+        auto& camera = *all[ix];
+        if (camera.writer.segment_count() != seen[ix]) {
+          camera.writer.finalize_retired();
+          seen[ix] = camera.writer.segment_count();
+        }
+        if (!camera.writer.has_next())
+          camera.writer.prepare_next(camera.make_sink(), L"", segment_length);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+
+  auto cpu = CpuSeconds();
+  auto start = plx::QpcNow();
+  std::vector<std::thread> producers;
+  for (auto& camera : all)
+    producers.emplace_back(Produce, std::cref(params), source.size(), std::ref(*camera));
+  for (auto& producer : producers)
+    producer.join();
+  done = true;
+  rotator.join();
+  for (auto& camera : all)
+    camera->writer.stop();
+  auto secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+  cpu = CpuSeconds() - cpu;
+
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  double min_fps = 1.0e12;
+  double max_fps = 0.0;
+  uint64_t worst_p99 = 0;
+  for (auto& camera : all) {
+    auto st = camera->writer.stats();
+    CHECK(st.write_errors == 0);
+    if (!params.realtime)
+      CHECK(st.queue_full_drops == 0);
+    frames += st.frames_written;
+    bytes += camera->bytes_out();
+    auto fps = st.frames_written /
+        (plx::QpcToNanos(camera->last_written() - start) / 1.0e9);
+    min_fps = std::min(min_fps, fps);
+    max_fps = std::max(max_fps, fps);
+    auto sm = camera->writer.latency().total.summary();
+    worst_p99 = std::max(worst_p99, sm.p99);
+  }
+  printf("%2d cameras %-4s %7.0f fps (%5.0f to %5.0f each) %7.0f MB/s  "
+         "cpu %6.0f us/frame  worst p99 %6llu us\n",
+         cameras, params.file ? "file" : "null",
+         frames / secs, min_fps, max_fps, bytes / (1024.0 * 1024.0) / secs,
+         cpu * 1.0e6 / frames, static_cast<unsigned long long>(worst_p99 / 1000));
+  all.clear();
+
+  // the sinks deleted their segments, the folders are empty.
+  for (int ix = 0; ix != cameras; ++ix)
+    CHECK(::rmdir((root + plx::Format("/camera-%d", ix)).c_str()) == 0);
+  CHECK(::rmdir(root.c_str()) == 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  BenchParams params = {
+    quick ? 320u : 640u, quick ? 240u : 480u, 30, quick ? 90 : 900,
+    HasArg(argc, argv, "--realtime"), false
+  };
+  printf("%zux%zu yuy2 to nv12, %d frames per camera, %s\n", params.width, params.height,
+         params.frames, params.realtime ? "30 fps" : "as fast as possible");
+
+  // a few different frames so the caches see new data.
+  std::mt19937 rng(14);
+  std::vector<std::vector<uint8_t>> source(
+      8, std::vector<uint8_t>(params.width * params.height * 2));
+  for (auto& frame : source) {
+    for (auto& px : frame)
+      px = static_cast<uint8_t>(rng());
+  }
+
+  const int counts[] = { 1, 2, 4, 8, 16 };
+  for (auto file : { false, true }) {
+    params.file = file;
+    for (auto cameras : counts)
+      Run(params, cameras, source);
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+// plx::RetentionEngine on an in-memory folder. Each limit on its own evicts
+// the oldest segments, sidecars included, and no more than it needs to.
+// Together the strictest one wins, a segment that cannot be deleted stops
+// the pass instead of being jumped over. The free space floor grows with
+// the measured write rate and is off while the free space is unknown.
+
+#include "test_util.h"
+#include "memory_folder.h"
+
+namespace {
+
+typedef plx::RetentionEngine::Limits Limits;
+
+const long long kSecond = 10000000LL;
+const long long kHour = 3600LL * kSecond;
+
+std::wstring Name(int number) {
+  auto name = plx::Format("segment-%04d.mp4", number);
+  return std::wstring(name.begin(), name.end());
+}
+
+// |count| segments of |size| bytes, one every |every| 100ns units.
+void AddSegments(MemoryFolder& folder, plx::SegmentIndex& index,
+                 int first, int count, long long size, long long every) {
+  for (int number = first; number != first + count; ++number) {
+    // add_file() moves the clock a second for the segment and its sidecar.
+    folder.clock += every - 2 * kSecond;
+    index.open_segment(Name(number));
+    folder.add_file(Name(number), size);
+    index.close_segment(Name(number));
+    folder.add_file(Name(number) + L".json", 0);
+  }
+}
+
+// The segments left are exactly |first| to |last| and only their sidecars.
+void CheckLeft(MemoryFolder& folder, plx::SegmentIndex& index, int first, int last) {
+  auto segments = index.segments();
+  CHECK(segments.size() == static_cast<size_t>(last - first + 1));
+  for (int number = first; number <= last; ++number)
+    CHECK(segments[number - first].name == Name(number));
+  size_t files = 0;
+  for (auto& file : folder.files) {
+    if (file.first != L"segments.journal")
+      ++files;
+  }
+  CHECK(files == 2 * segments.size());
+  for (auto& seg : segments)
+    CHECK(folder.has(seg.name + L".json"));
+}
+
+Limits NoLimits() {
+  Limits limits = { 0, 0, 0, 0 };
+  return limits;
+}
+
+void TestNoLimits() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 20, 1000, kHour);
+  plx::RetentionEngine retention(&folder);
+  auto result = retention.run(&index, 60, NoLimits(), folder.clock + 1000 * kHour, 0);
+  CHECK(result.reclaimed == 0);
+  CHECK(result.free_bytes == -1);
+  CHECK(result.secs_to_full < 0.0);
+  CheckLeft(folder, index, 0, 19);
+}
+
+void TestFileCount() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kSecond);
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.keep_file_count = 6;
+  auto result = retention.run(&index, 60, limits, folder.clock, 0);
+  CHECK(result.reclaimed == 4000);
+  CheckLeft(folder, index, 4, 9);
+  // already within the limit.
+  CHECK(retention.run(&index, 60, limits, folder.clock, 1000).reclaimed == 0);
+  CheckLeft(folder, index, 4, 9);
+}
+
+void TestMaxBytes() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kSecond);
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  // 7 segments do not fit, 6 do.
+  limits.max_bytes = 6999;
+  CHECK(retention.run(&index, 60, limits, folder.clock, 0).reclaimed == 4000);
+  CheckLeft(folder, index, 4, 9);
+  CHECK(index.total_bytes() == 6000);
+  limits.max_bytes = 6000;
+  CHECK(retention.run(&index, 60, limits, folder.clock, 0).reclaimed == 0);
+}
+
+void TestMaxAge() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kHour);
+  auto newest = index.segments().back().creation_ns1600;
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.max_age_hours = 3;
+  // exactly 3 hours old is not too old yet.
+  auto result = retention.run(&index, 60, limits, newest + kHour, 0);
+  CHECK(result.reclaimed == 7000);
+  CheckLeft(folder, index, 7, 9);
+  CHECK(retention.run(&index, 60, limits, newest + 2 * kHour, 0).reclaimed == 1000);
+  CheckLeft(folder, index, 8, 9);
+}
+
+void TestMinFree() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kSecond);
+  // the journal takes some space too.
+  folder.capacity = 10000 + folder.files[L"segments.journal"].size + 2500;
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.min_free_bytes = 5000;
+  auto result = retention.run(&index, 60, limits, folder.clock, 0);
+  CHECK(result.reclaimed == 3000);
+  CHECK(result.free_bytes == 5500);
+  CheckLeft(folder, index, 3, 9);
+  // the free space is unknown, the floor is off.
+  folder.capacity = 0;
+  limits.min_free_bytes = 1LL << 40;
+  result = retention.run(&index, 60, limits, folder.clock, 0);
+  CHECK(result.reclaimed == 0);
+  CHECK(result.free_bytes == -1);
+}
+
+// The reserve is what is written until the next pass on top of the floor.
+void TestWriteRate() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kSecond);
+  folder.capacity = 1000000;
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.min_free_bytes = 1000;
+  auto result = retention.run(&index, 60, limits, folder.clock, 5000);
+  // the first pass has nothing to measure.
+  CHECK(result.write_rate == 0.0);
+  CHECK(result.reclaimed == 0);
+  CHECK(result.secs_to_full < 0.0);
+
+  // 10 segments, 10 KB in 10 seconds.
+  AddSegments(folder, index, 10, 10, 1000, kSecond);
+  auto free = folder.free_bytes();
+  result = retention.run(&index, 60, limits, folder.clock, 15000);
+  CHECK(result.write_rate == 1000.0);
+  CHECK(result.reclaimed == 0);
+  CHECK(result.free_bytes == free);
+  CHECK(static_cast<long long>(result.secs_to_full) == (free - 1000) / 1000);
+
+  // nothing was added since, the smoothed rate is 700 and the reserve
+  // 1000 + 700 * 60 = 43000. One segment makes it fit.
+  folder.capacity -= free - 42500;
+  result = retention.run(&index, 60, limits, folder.clock, 25000);
+  CHECK((result.write_rate > 699.9) && (result.write_rate < 700.1));
+  CHECK(result.reclaimed == 1000);
+  CHECK(result.free_bytes == 43500);
+  CheckLeft(folder, index, 1, 19);
+  // a longer wait until the next pass needs more room: at 490 bytes per
+  // second 120 seconds take the reserve to 59800, 17 more segments.
+  result = retention.run(&index, 120, limits, folder.clock, 35000);
+  CHECK(result.reclaimed == 17000);
+  CheckLeft(folder, index, 18, 19);
+}
+
+// The strictest limit decides how many go, and the oldest always go first.
+void TestCombined() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kHour);
+  auto newest = index.segments().back().creation_ns1600;
+  folder.capacity = 1LL << 30;
+  plx::RetentionEngine retention(&folder);
+  // the count wants 2 gone, the bytes 3 and the age 5.
+  Limits limits = { 8, 7000, 4096, 5 };
+  CHECK(retention.run(&index, 60, limits, newest + kHour, 0).reclaimed == 5000);
+  CheckLeft(folder, index, 5, 9);
+  limits.max_bytes = 2000;
+  CHECK(retention.run(&index, 60, limits, newest + kHour, 0).reclaimed == 3000);
+  CheckLeft(folder, index, 8, 9);
+  limits.keep_file_count = 1;
+  CHECK(retention.run(&index, 60, limits, newest + kHour, 0).reclaimed == 1000);
+  CheckLeft(folder, index, 9, 9);
+}
+
+// A segment somebody has open stops the pass, the newer ones stay even if
+// the limits want them gone.
+void TestBusy() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 10, 1000, kSecond);
+  folder.files[Name(2)].busy = true;
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.keep_file_count = 4;
+  CHECK(retention.run(&index, 60, limits, folder.clock, 0).reclaimed == 2000);
+  CheckLeft(folder, index, 2, 9);
+  folder.files[Name(2)].busy = false;
+  CHECK(retention.run(&index, 60, limits, folder.clock, 0).reclaimed == 4000);
+  CheckLeft(folder, index, 6, 9);
+}
+
+// A segment deleted behind our back is dropped from the index with its
+// sidecar but it reclaims nothing.
+void TestMissing() {
+  MemoryFolder folder;
+  plx::SegmentIndex index(&folder);
+  index.load();
+  AddSegments(folder, index, 0, 5, 1000, kSecond);
+  folder.files.erase(Name(0));
+  plx::RetentionEngine retention(&folder);
+  auto limits = NoLimits();
+  limits.keep_file_count = 3;
+  CHECK(retention.run(&index, 60, limits, folder.clock, 0).reclaimed == 1000);
+  CheckLeft(folder, index, 2, 4);
+}
+
+}  // namespace
+
+int main() {
+  TestNoLimits();
+  TestFileCount();
+  TestMaxBytes();
+  TestMaxAge();
+  TestMinFree();
+  TestWriteRate();
+  TestCombined();
+  TestBusy();
+  TestMissing();
+  return 0;
+}
@@ -0,0 +1,103 @@
+// plx::SegmentIndex on a real folder of 10^5 segments (5000 with --quick).
+// Starting up from the journal against listing the folder, and one pass of
+// the cleaner, a segment closed and the oldest one evicted, against the
+// listing and sort it needs without the index.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test_util.h"
+#include "plx_segments.h"
+
+namespace {
+
+typedef plx::SegmentIndex::Segment Segment;
+
+std::wstring Wide(const std::string& s) {
+  return std::wstring(s.begin(), s.end());
+}
+
+void Touch(const std::string& path) {
+  auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  CHECK(fd >= 0);
+  ::close(fd);
+}
+
+// What the cleaner did before the index: every segment, oldest first.
+size_t ListSegments(plx::SegmentFolder& folder, std::vector<Segment>& found) {
+  std::vector<plx::SegmentFolder::Entry> entries;
+  CHECK(folder.list(entries));
+  found.clear();
+  for (auto& entry : entries) {
+    if (!entry.name.empty() && (entry.name.back() == L'4'))
+      found.push_back(entry);
+  }
+  std::sort(begin(found), end(found), [](const Segment& a, const Segment& b) {
+    return a.creation_ns1600 < b.creation_ns1600;
+  });
+  return found.size();
+}
+
+double Micros(uint64_t qpc_start) {
+  return plx::QpcToNanos(plx::QpcNow() - qpc_start) / 1000.0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const int count = quick ? 5000 : 100000;
+  const int passes = quick ? 50 : 200;
+
+  char tmpl[] = "/tmp/segment_index_bench_XXXXXX";
+  CHECK(mkdtemp(tmpl));
+  const std::string dir(tmpl);
+  for (int ix = 0; ix != count; ++ix)
+    Touch(dir + plx::Format("/segment-%08d.mp4", ix));
+
+  plx::LocalFolder folder(Wide(dir));
+  {
+    plx::SegmentIndex index(&folder);
+    auto start = plx::QpcNow();
+    CHECK(!index.load());
+    printf("%d segments\n", count);
+    printf("load, listing   %10.0f us\n", Micros(start));
+    CHECK(index.count() == static_cast<size_t>(count));
+  }
+  plx::SegmentIndex index(&folder);
+  auto start = plx::QpcNow();
+  CHECK(index.load());
+  printf("load, journal   %10.0f us\n", Micros(start));
+  CHECK(index.count() == static_cast<size_t>(count));
+
+  // steady state: as many segments closed as evicted.
+  double index_us = 0.0;
+  double listing_us = 0.0;
+  std::vector<Segment> found;
+  for (int ix = 0; ix != passes; ++ix) {
+    auto name = plx::Format("recording-%d.mp4", ix);
+    index.open_segment(Wide(name));
+    Touch(dir + "/" + name);
+
+    start = plx::QpcNow();
+    index.close_segment(Wide(name), Wide(plx::Format("segment-%08d.mp4", count + ix)));
+    index.evict_while([count](const Segment&, size_t segments, long long, long long) {
+      return segments > static_cast<size_t>(count);
+    });
+    index_us += Micros(start);
+
+    start = plx::QpcNow();
+    CHECK(ListSegments(folder, found) == static_cast<size_t>(count));
+    listing_us += Micros(start);
+  }
+  printf("pass, index     %10.1f us\n", index_us / passes);
+  printf("pass, listing   %10.1f us\n", listing_us / passes);
+
+  std::vector<plx::SegmentFolder::Entry> entries;
+  CHECK(folder.list(entries));
+  for (auto& entry : entries)
+    folder.remove(entry.name);
+  ::rmdir(dir.c_str());
+  return 0;
+}
@@ -0,0 +1,195 @@
+// Frames pushed to a SegmentedWriter across segment rotations: every frame
+// is written once, in order, segments are back to back and each one starts
+// at time zero with the first frame at or past its boundary.
+
+#include "test_util.h"
+#include "capture_core.h"
+
+namespace {
+
+const int64_t kInterval = 333333;
+const int kFramesPerSegment = 30;
+
+struct Written {
+  int64_t frame;
+  int64_t time;
+};
+
+struct Segment {
+  int id;
+  std::vector<Written> frames;
+  bool finalized;
+  bool discarded;
+};
+
+typedef std::shared_ptr<Segment> SegmentPtr;
+
+class RecordingDelegate : public SegmentedWriter<SegmentPtr, int64_t>::Delegate {
+public:
+  std::atomic<int> errors;
+
+  RecordingDelegate() : errors(0) {}
+
+  bool prepare_frame(int64_t&) override {
+    return true;
+  }
+
+  bool write_frame(SegmentPtr& segment, int64_t& frame, int64_t time) override {
+    if (!segment || segment->finalized) {
+      ++errors;
+      return false;
+    }
+    Written written = { frame, time };
+    segment->frames.push_back(written);
+    return true;
+  }
+
+  void frame_written(int64_t&, int64_t) override {}
+
+  void finalize_writer(SegmentPtr& segment) override {
+    segment->finalized = true;
+  }
+
+  void discard_writer(SegmentPtr& segment, const std::wstring&) override {
+    segment->discarded = true;
+  }
+};
+
+class Harness {
+  RecordingDelegate delegate_;
+  SegmentedWriter<SegmentPtr, int64_t> writer_;
+  uint32_t seen_;
+
+public:
+  std::vector<SegmentPtr> segments;
+  std::vector<SegmentInfo> infos;
+  std::vector<int64_t> arrivals;
+
+  Harness() : writer_(&delegate_, 16), seen_(0) {
+    segments.push_back(make_segment());
+    CHECK(writer_.start(segments.back(), kFramesPerSegment * kInterval));
+  }
+
+  // Like the UI timer: closes the segment the writer thread left and gets
+  // the next one ready.
+  void rotate() {
+    if (writer_.segment_count() != seen_) {
+      seen_ = writer_.segment_count();
+      writer_.finalize_retired();
+      infos.push_back(writer_.take_retired_info());
+    }
+    if (!writer_.has_next()) {
+      segments.push_back(make_segment());
+      CHECK(writer_.prepare_next(segments.back(), L"next", kFramesPerSegment * kInterval));
+    }
+  }
+
+  void push(int64_t frame) {
+    auto arrival = plx::QpcNow();
+    arrivals.push_back(arrival);
+    while (!writer_.push(frame, frame * kInterval, arrival, 0))
+      std::this_thread::yield();
+  }
+
+  void wait_written(uint64_t count) {
+    while (writer_.stats().frames_written < count)
+      std::this_thread::yield();
+  }
+
+  void stop() {
+    writer_.stop();
+    CHECK(delegate_.errors == 0);
+  }
+
+private:
+  SegmentPtr make_segment() {
+    auto segment = std::make_shared<Segment>();
+    segment->id = static_cast<int>(segments.size());
+    segment->finalized = false;
+    segment->discarded = false;
+    return segment;
+  }
+};
+
+// Checks what every test expects, returns the frames that made it.
+int64_t CheckContinuity(const Harness& harness) {
+  int64_t next = 0;
+  for (auto& segment : harness.segments) {
+    if (segment->discarded) {
+      CHECK(segment->frames.empty());
+      continue;
+    }
+    if (segment->frames.empty())
+      continue;
+    CHECK(segment->finalized);
+    auto base = segment->frames.front().frame;
+    CHECK(base == next);
+    for (auto& written : segment->frames) {
+      CHECK(written.frame == next);
+      CHECK(written.time == (written.frame - base) * kInterval);
+      ++next;
+    }
+  }
+  return next;
+}
+
+// The next writer is always ready so every segment is exactly
+// kFramesPerSegment long.
+void TestExactBoundaries() {
+  const int64_t frames = kFramesPerSegment * 5 + 7;
+  Harness harness;
+  for (int64_t ix = 0; ix != frames; ++ix) {
+    harness.rotate();
+    harness.push(ix);
+    harness.wait_written(ix + 1);
+  }
+  harness.rotate();
+  harness.stop();
+  CHECK(CheckContinuity(harness) == frames);
+  CHECK(harness.infos.size() == 5);
+  for (size_t ix = 0; ix != harness.infos.size(); ++ix) {
+    auto& segment = harness.segments[ix];
+    CHECK(segment->frames.size() == kFramesPerSegment);
+    CHECK(segment->frames.front().frame == static_cast<int64_t>(ix * kFramesPerSegment));
+    // the first frame of the segment names it.
+    CHECK(harness.infos[ix].first_arrival == harness.arrivals[ix * kFramesPerSegment]);
+  }
+}
+
+// Rotation from another thread while frames pour in: boundaries move when
+// the next writer is late, but no frame is lost or written twice.
+void TestConcurrentRotation() {
+  const int64_t frames = kFramesPerSegment * 40;
+  Harness harness;
+  std::atomic<bool> done(false);
+  std::mutex lock;
+  std::thread rotator([&]() {
+    while (!done) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        harness.rotate();
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+  for (int64_t ix = 0; ix != frames; ++ix) {
+    harness.push(ix);
+    if ((ix % 7) == 0)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  harness.wait_written(frames);
+  done = true;
+  rotator.join();
+  harness.stop();
+  CHECK(CheckContinuity(harness) == frames);
+  CHECK(harness.infos.size() > 1);
+}
+
+}  // namespace
+
+int main() {
+  TestExactBoundaries();
+  TestConcurrentRotation();
+  printf("segment rotation ok\n");
+  return 0;
+}
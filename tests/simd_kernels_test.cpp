@@ -0,0 +1,149 @@
+// The sse2 and avx2 kernels of plx_video against the scalar ones, they
+// must match bit for bit on random planes of awkward sizes. Yuy2ToNv12 is
+// also checked against its definition.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+std::mt19937 rng(8);
+
+std::vector<uint8_t> RandomPlane(size_t size) {
+  std::vector<uint8_t> plane(size);
+  for (auto& px : plane)
+    px = static_cast<uint8_t>(rng());
+  return plane;
+}
+
+// The levels this machine can run besides scalar.
+std::vector<plx::SimdLevel> SimdLevels() {
+  std::vector<plx::SimdLevel> levels;
+  auto best = plx::BestSimdLevel();
+  if (best != plx::SimdLevel::scalar)
+    levels.push_back(plx::SimdLevel::sse2);
+  if (best == plx::SimdLevel::avx2)
+    levels.push_back(plx::SimdLevel::avx2);
+  return levels;
+}
+
+void TestBlockSad16() {
+  const size_t sizes[][2] = {
+    { 16, 16 }, { 32, 16 }, { 48, 32 }, { 50, 37 }, { 480, 270 }, { 1920, 1080 }
+  };
+  for (auto& size : sizes) {
+    for (size_t pad = 0; pad != 3; ++pad) {
+      auto width = size[0];
+      auto height = size[1];
+      auto stride = width + (pad * 7);
+      auto a = RandomPlane(stride * height);
+      auto b = RandomPlane(stride * height);
+      // a few identical tiles so zero sums are covered too.
+      std::copy(a.begin(), a.begin() + (stride * 16), b.begin());
+      const size_t tiles = (width / 16) * (height / 16);
+      std::vector<uint32_t> expected(tiles);
+      plx::BlockSad16(&a[0], &b[0], stride, width, height, &expected[0], plx::SimdLevel::scalar);
+      for (auto level : SimdLevels()) {
+        std::vector<uint32_t> got(tiles, 0xdeadbeef);
+        plx::BlockSad16(&a[0], &b[0], stride, width, height, &got[0], level);
+        CHECK(got == expected);
+      }
+    }
+  }
+}
+
+void TestDownsampleLuma() {
+  const size_t sizes[][2] = {
+    { 4, 4 }, { 64, 8 }, { 100, 9 }, { 130, 16 }, { 258, 12 }, { 1920, 1080 }
+  };
+  for (auto& size : sizes) {
+    for (size_t pixel_step = 1; pixel_step != 3; ++pixel_step) {
+      for (size_t factor = 2; factor != 6; factor += 2) {
+        auto width = size[0];
+        auto height = size[1];
+        auto src_stride = (width * pixel_step) + 5;
+        auto src = RandomPlane(src_stride * height);
+        auto out_w = width / factor;
+        auto out_h = height / factor;
+        auto dst_stride = out_w + 3;
+        std::vector<uint8_t> expected(dst_stride * out_h, 0);
+        plx::DownsampleLuma(&src[0], src_stride, width, height, pixel_step, factor,
+                            &expected[0], dst_stride, plx::SimdLevel::scalar);
+        for (auto level : SimdLevels()) {
+          std::vector<uint8_t> got(dst_stride * out_h, 0);
+          plx::DownsampleLuma(&src[0], src_stride, width, height, pixel_step, factor,
+                              &got[0], dst_stride, level);
+          CHECK(got == expected);
+        }
+      }
+    }
+  }
+  // all white must stay white, the sums do not overflow.
+  std::vector<uint8_t> white(256 * 2 * 4, 255);
+  std::vector<uint8_t> out(64 * 2, 0);
+  for (auto level : SimdLevels()) {
+    plx::DownsampleLuma(&white[0], 256 * 2, 256, 4, 2, 4, &out[0], 64, level);
+    for (size_t ix = 0; ix != 64; ++ix)
+      CHECK(out[ix] == 255);
+  }
+}
+
+// Straight from the definition: luma as is, chroma averaged over each row
+// pair and rounded up, an odd last row pairs with itself and an odd last
+// column gets no chroma.
+void ReferenceYuy2ToNv12(const std::vector<uint8_t>& src, size_t src_stride,
+                         size_t width, size_t height,
+                         std::vector<uint8_t>& y, std::vector<uint8_t>& uv, size_t stride) {
+  for (size_t row = 0; row != height; ++row) {
+    for (size_t x = 0; x != width; ++x)
+      y[(row * stride) + x] = src[(row * src_stride) + (x * 2)];
+  }
+  for (size_t row = 0; row < height; row += 2) {
+    auto r0 = &src[row * src_stride];
+    auto r1 = (row + 1 < height) ? r0 + src_stride : r0;
+    for (size_t x = 0; x != width - (width % 2); ++x)
+      uv[((row / 2) * stride) + x] = static_cast<uint8_t>((r0[(x * 2) + 1] + r1[(x * 2) + 1] + 1) / 2);
+  }
+}
+
+void TestYuy2ToNv12() {
+  // odd widths used to run the scalar loop past the end of the row.
+  const size_t sizes[][2] = {
+    { 1, 1 }, { 2, 2 }, { 3, 5 }, { 17, 4 }, { 33, 7 }, { 64, 6 }, { 95, 3 }, { 640, 480 }
+  };
+  std::vector<plx::SimdLevel> levels(1, plx::SimdLevel::scalar);
+  for (auto level : SimdLevels())
+    levels.push_back(level);
+  for (auto& size : sizes) {
+    auto width = size[0];
+    auto height = size[1];
+    auto src_stride = (width * 2) + 6;
+    auto src = RandomPlane(src_stride * height);
+    // a guard byte after each row catches writes past |width|.
+    auto stride = width + 1;
+    std::vector<uint8_t> expected_y(stride * height, 0xee), expected_uv(stride * ((height + 1) / 2), 0xee);
+    ReferenceYuy2ToNv12(src, src_stride, width, height, expected_y, expected_uv, stride);
+    for (auto level : levels) {
+      std::vector<uint8_t> y(stride * height, 0xee), uv(stride * ((height + 1) / 2), 0xee);
+      // in two bands like the converter threads do.
+      auto half = (height / 4) * 2;
+      plx::Yuy2ToNv12(&src[0], src_stride, width, 0, half, &y[0], stride, &uv[0], stride, level);
+      plx::Yuy2ToNv12(&src[0], src_stride, width, half, height, &y[0], stride, &uv[0], stride, level);
+      CHECK(y == expected_y);
+      CHECK(uv == expected_uv);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  printf("best simd level %d\n", static_cast<int>(plx::BestSimdLevel()));
+  TestBlockSad16();
+  TestDownsampleLuma();
+  TestYuy2ToNv12();
+  printf("simd kernels ok\n");
+  return 0;
+}
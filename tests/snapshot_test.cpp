@@ -0,0 +1,169 @@
+// plx::Snapshot the way the settings reload uses it. A Reader only moves
+// when the version does, to the newest value, and keeps the one it has
+// alive until then. With a writer publishing decoded config.json texts and
+// readers refreshing on other threads, readers only ever see whole
+// settings that decoded, never one a rejected text would have made, and
+// never go back to an older one.
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+#include "test_util.h"
+#include "settings_core.h"
+
+namespace {
+
+typedef plx::Snapshot<Settings> SettingsSnapshot;
+
+// Settings number |n|: every field says which one it is so a reader can
+// tell a torn or a made up value from a published one.
+std::string Config(int n, bool bad) {
+  return plx::Format(
+      "{\"folder\": \"cams-%d\", \"seconds_per_file\": %d, \"average_bitrate\": %d,"
+      " \"keep_file_count\": %d, \"clean_interval_minutes\": 1,"
+      " \"cameras\": [{\"device\": \"dev-%d\", \"max_bytes\": %d}]}",
+      n, 10 + n, 50000 + n, n, n, bad ? -n - 1 : n);
+}
+
+bool Consistent(const Settings& st, int* n) {
+  *n = static_cast<int>(st.keep_file_count);
+  return (st.folder == plx::Format("cams-%d", *n)) && (st.seconds_per_file == 10 + *n) &&
+         (st.average_bitrate == 50000 + *n) && (st.cameras.size() == 1) &&
+         (st.cameras[0].device == plx::Format("dev-%d", *n)) &&
+         (st.cameras[0].max_bytes == *n);
+}
+
+// The reload: decode, and publish only if it decoded.
+bool Reload(SettingsSnapshot& snapshot, const std::string& json) {
+  auto settings = std::make_shared<Settings>();
+  try {
+    settings_schema.decode(plx::Range<const char>(json.data(), json.data() + json.size()),
+                           *settings);
+  } catch (plx::JsonSchemaException&) {
+    return false;
+  }
+  snapshot.publish(settings);
+  return true;
+}
+
+std::shared_ptr<const Settings> Initial() {
+  auto json = Config(0, false);
+  auto settings = std::make_shared<Settings>();
+  settings_schema.decode(plx::Range<const char>(json.data(), json.data() + json.size()),
+                         *settings);
+  return settings;
+}
+
+void TestRefresh() {
+  SettingsSnapshot snapshot(Initial());
+  SettingsSnapshot::Reader reader(snapshot);
+  int n = -1;
+  CHECK(snapshot.version() == 0);
+  CHECK(!reader.refresh());
+  CHECK(Consistent(reader.get(), &n) && (n == 0));
+
+  // a rejected text leaves everything as it was.
+  CHECK(!Reload(snapshot, Config(1, true)));
+  CHECK(!Reload(snapshot, "{\"folder\": 1}"));
+  CHECK(snapshot.version() == 0);
+  CHECK(!reader.refresh());
+  CHECK(Consistent(reader.get(), &n) && (n == 0));
+
+  // several publishes between two refreshes: one refresh, to the newest.
+  CHECK(Reload(snapshot, Config(1, false)));
+  CHECK(Reload(snapshot, Config(2, false)));
+  CHECK(snapshot.version() == 2);
+  CHECK(Consistent(reader.get(), &n) && (n == 0));
+  CHECK(reader.refresh());
+  CHECK(Consistent(reader.get(), &n) && (n == 2));
+  CHECK(!reader.refresh());
+
+  // a reader made later starts at the current value and version.
+  SettingsSnapshot::Reader late(snapshot);
+  CHECK(!late.refresh());
+  CHECK(Consistent(late.get(), &n) && (n == 2));
+}
+
+// What a reader holds stays alive until it refreshes, even when the
+// snapshot itself has moved on twice.
+void TestLifetime() {
+  SettingsSnapshot snapshot(Initial());
+  std::weak_ptr<const Settings> first = snapshot.get();
+  SettingsSnapshot::Reader reader(snapshot);
+  auto& held = reader.get();
+  CHECK(Reload(snapshot, Config(1, false)));
+  CHECK(Reload(snapshot, Config(2, false)));
+  CHECK(!first.expired());
+  int n = -1;
+  CHECK(Consistent(held, &n) && (n == 0));
+  std::weak_ptr<const Settings> second = snapshot.get();
+  CHECK(reader.refresh());
+  CHECK(first.expired());
+  CHECK(!second.expired());
+}
+
+// One writer reloading good and bad texts, readers refreshing as fast as
+// they can like the cleaner thread and the UI do.
+void TestConcurrent() {
+  SettingsSnapshot snapshot(Initial());
+  const int kPublishes = 20000;
+  const int kReaders = 3;
+  std::atomic<bool> done(false);
+  std::atomic<int> published(0);
+  std::vector<std::thread> readers;
+  std::vector<uint64_t> refreshes(kReaders, 0);
+  for (int id = 0; id != kReaders; ++id) {
+    readers.emplace_back([&, id]() {
+      SettingsSnapshot::Reader reader(snapshot);
+      int last = 0;
+      while (!done) {
+        auto version = snapshot.version();
+        if (!reader.refresh())
+          continue;
+        ++refreshes[id];
+        int n = -1;
+        CHECK(Consistent(reader.get(), &n));
+        // never older than before nor than the version seen.
+        CHECK(n >= last);
+        CHECK(static_cast<uint32_t>(n) >= version);
+        last = n;
+      }
+      reader.refresh();
+      int n = -1;
+      CHECK(Consistent(reader.get(), &n) && (n == published));
+    });
+  }
+
+  std::mt19937 rng(19);
+  int rejected = 0;
+  for (int n = 1; n <= kPublishes; ++n) {
+    if (!(rng() % 4)) {
+      CHECK(!Reload(snapshot, Config(n, true)));
+      ++rejected;
+    }
+    CHECK(Reload(snapshot, Config(n, false)));
+    published = n;
+    // let the readers in between publishes, also on one core.
+    if (!(n % 16))
+      std::this_thread::yield();
+  }
+  done = true;
+  for (auto& reader : readers)
+    reader.join();
+  CHECK(snapshot.version() == static_cast<uint32_t>(kPublishes));
+  uint64_t total = 0;
+  for (auto count : refreshes)
+    total += count;
+  printf("%d published, %d rejected, %llu refreshes\n", kPublishes, rejected,
+         static_cast<unsigned long long>(total));
+}
+
+}  // namespace
+
+int main() {
+  TestRefresh();
+  TestLifetime();
+  TestConcurrent();
+  return 0;
+}
@@ -0,0 +1,37 @@
+// test_util.h : what the tests and benchmarks in this folder share.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plx_util.h"
+
+// Ends the test with the failed condition and its line.
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+inline bool HasArg(int argc, char** argv, const char* arg) {
+  for (int ix = 1; ix < argc; ++ix) {
+    if (!strcmp(argv[ix], arg))
+      return true;
+  }
+  return false;
+}
+
+// One line of latency percentiles in microseconds.
+inline void PrintLatency(const char* name, const plx::LatencyHistogram& histogram) {
+  auto sm = histogram.summary();
+  printf("%-24s %-9llu p50 %-8llu p99 %-8llu p999 %-8llu max %llu us\n", name,
+         static_cast<unsigned long long>(sm.count),
+         static_cast<unsigned long long>(sm.p50 / 1000),
+         static_cast<unsigned long long>(sm.p99 / 1000),
+         static_cast<unsigned long long>(sm.p999 / 1000),
+         static_cast<unsigned long long>(sm.max / 1000));
+}
@@ -0,0 +1,101 @@
+// What the per-frame latency tracing of SegmentedWriter costs. A frame
+// is a 1080p Yuy2ToNv12, the writer thread work of a YUY2 camera, run with
+// and without the probes drain() puts around it: three QpcNow() and four
+// LatencyHistogram::record(), plus the QpcNow() of the capture callback.
+// The two loops alternate so drift hits both. The probes alone are timed
+// too, against the budget of a 30 fps frame and against the frame work,
+// and have to stay under 1% of it.
+
+#include <random>
+
+#include "test_util.h"
+#include "capture_core.h"
+#include "plx_video.h"
+
+namespace {
+
+const size_t kWidth = 1920;
+const size_t kHeight = 1080;
+
+struct Frames {
+  std::vector<uint8_t> yuy2;
+  std::vector<uint8_t> nv12;
+
+  Frames() : yuy2(kWidth * kHeight * 2), nv12(kWidth * kHeight * 3 / 2) {
+    std::mt19937 rng(2);
+    for (auto& px : yuy2)
+      px = static_cast<uint8_t>(rng());
+  }
+
+  void convert() {
+    auto dst_y = &nv12[0];
+    plx::Yuy2ToNv12(&yuy2[0], kWidth * 2, kWidth, 0, kHeight,
+                    dst_y, kWidth, dst_y + (kWidth * kHeight), kWidth,
+                    plx::BestSimdLevel());
+  }
+};
+
+// Returns the nanoseconds |frames| took.
+int64_t Run(Frames& frames, int count, PipelineLatency* latency) {
+  auto begin = plx::QpcNow();
+  for (int ix = 0; ix != count; ++ix) {
+    if (!latency) {
+      frames.convert();
+      continue;
+    }
+    auto arrival = plx::QpcNow();
+    auto dequeued = plx::QpcNow();
+    latency->queue.record(plx::QpcToNanos(dequeued - arrival));
+    auto start = plx::QpcNow();
+    latency->convert.record(plx::QpcToNanos(start - dequeued));
+    frames.convert();
+    auto end = plx::QpcNow();
+    latency->write.record(plx::QpcToNanos(end - start));
+    latency->total.record(plx::QpcToNanos(end - arrival));
+  }
+  return plx::QpcToNanos(plx::QpcNow() - begin);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const int rounds = quick ? 4 : 40;
+  const int per_round = 25;
+  const int probes = quick ? 100000 : 10000000;
+
+  Frames frames;
+  PipelineLatency latency;
+  Run(frames, per_round, nullptr);
+  int64_t off_ns = 0;
+  int64_t on_ns = 0;
+  for (int round = 0; round != rounds; ++round) {
+    off_ns += Run(frames, per_round, nullptr);
+    on_ns += Run(frames, per_round, &latency);
+  }
+  const double count = static_cast<double>(rounds) * per_round;
+  auto off_us = off_ns / count / 1000.0;
+  auto on_us = on_ns / count / 1000.0;
+  printf("frame, tracing off %8.1f us\n", off_us);
+  printf("frame, tracing on  %8.1f us  %+.2f%%\n", on_us, 100.0 * (on_us - off_us) / off_us);
+
+  // the probes alone, as often as the frames of a busy camera.
+  PipelineLatency alone;
+  auto begin = plx::QpcNow();
+  for (int ix = 0; ix != probes; ++ix) {
+    auto arrival = plx::QpcNow();
+    auto dequeued = plx::QpcNow();
+    alone.queue.record(plx::QpcToNanos(dequeued - arrival));
+    auto start = plx::QpcNow();
+    alone.convert.record(plx::QpcToNanos(start - dequeued));
+    auto end = plx::QpcNow();
+    alone.write.record(plx::QpcToNanos(end - start));
+    alone.total.record(plx::QpcToNanos(end - arrival));
+  }
+  auto probe_ns = plx::QpcToNanos(plx::QpcNow() - begin) / static_cast<double>(probes);
+  printf("probes per frame   %8.1f ns  %.4f%% of the frame work, %.5f%% of 33 ms\n",
+         probe_ns, probe_ns / (off_us * 10.0), probe_ns / 333333.0);
+  CHECK(alone.total.count() == static_cast<uint64_t>(probes));
+  CHECK(probe_ns < off_us * 10.0);
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Throughput of plx::WideFromUTF8 and plx::UTF8FromWide on short path like
+// strings and on 1 MB of text: all ascii, mostly ascii with some accents,
+// and cjk where the 16 byte ascii path never applies.
+
+#include <random>
+
+#include "test_util.h"
+
+namespace {
+
+std::mt19937 rng(9);
+
+// |percent| of the code points come from [first, last], the rest are ascii.
+std::string MakeText(size_t bytes, int percent, unsigned int first, unsigned int last) {
+  std::wstring wide;
+  size_t size = 0;
+  while (size < bytes) {
+    unsigned int cp = 'a' + (rng() % 26);
+    if (static_cast<int>(rng() % 100) < percent)
+      cp = first + (rng() % (last - first + 1));
+    wide.push_back(static_cast<wchar_t>(cp));
+    size += (cp < 0x80) ? 1 : (cp < 0x800) ? 2 : 3;
+  }
+  return plx::UTF8FromWide(plx::Range<const wchar_t>(wide.data(), wide.data() + wide.size()));
+}
+
+struct Result {
+  double decode_mbs;
+  double encode_mbs;
+};
+
+// MB/s of utf8 in or out.
+Result Measure(const std::string& utf8, size_t total) {
+  auto s = reinterpret_cast<const uint8_t*>(utf8.data());
+  plx::Range<const uint8_t> in(s, s + utf8.size());
+  auto runs = std::max<size_t>(total / utf8.size(), 1);
+  size_t check = 0;
+
+  auto start = plx::QpcNow();
+  for (size_t ix = 0; ix != runs; ++ix)
+    check += plx::WideFromUTF8(in, true).size();
+  auto decode_secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+
+  auto wide = plx::WideFromUTF8(in, true);
+  plx::Range<const wchar_t> wide_in(wide.data(), wide.data() + wide.size());
+  start = plx::QpcNow();
+  for (size_t ix = 0; ix != runs; ++ix)
+    check += plx::UTF8FromWide(wide_in).size();
+  auto encode_secs = plx::QpcToNanos(plx::QpcNow() - start) / 1.0e9;
+
+  CHECK(check == runs * (wide.size() + utf8.size()));
+  auto mb = (static_cast<double>(utf8.size()) * runs) / (1024.0 * 1024.0);
+  Result result = { mb / decode_secs, mb / encode_secs };
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto quick = HasArg(argc, argv, "--quick");
+  const size_t total = quick ? (8 * 1024 * 1024) : (512 * 1024 * 1024);
+
+  struct Text {
+    const char* name;
+    int percent;
+    unsigned int first;
+    unsigned int last;
+  };
+  const Text texts[] = {
+    { "ascii", 0, 'a', 'a' },
+    { "latin 5%", 5, 0xC0, 0xFF },
+    { "cjk", 100, 0x4E00, 0x9FFF },
+  };
+  const size_t sizes[] = { 64, 1024 * 1024 };
+
+  printf("text        size      utf8->wide MB/s  wide->utf8 MB/s\n");
+  for (auto& text : texts) {
+    for (auto size : sizes) {
+      auto utf8 = MakeText(size, text.percent, text.first, text.last);
+      auto result = Measure(utf8, total);
+      printf("%-11s %-9zu %-16.0f %.0f\n",
+             text.name, utf8.size(), result.decode_mbs, result.encode_mbs);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,252 @@
+// plx::WideFromUTF8 and plx::UTF8FromWide against a plain table driven
+// reference on random text: valid text round trips, and bad utf8 gets one
+// U+FFFD per maximal bad subpart, or an exception when strict. Inputs mix
+// long ascii runs with other bytes so the 16 byte fast paths stop at every
+// offset. Where wchar_t is 32 bits, as on linux, the wide side is utf32.
+
+#include <random>
+
+#include "test_util.h"
+
+namespace {
+
+std::mt19937 rng(21);
+
+const unsigned int kReplacement = 0xFFFD;
+
+// Unicode table 3-7, the well-formed byte sequences. Leads not listed are
+// never valid.
+struct Lead {
+  uint8_t first;
+  uint8_t last;
+  int more;
+  // allowed range of the second byte, the others are 80..BF.
+  uint8_t lo;
+  uint8_t hi;
+};
+
+const Lead leads[] = {
+  { 0xC2, 0xDF, 1, 0x80, 0xBF },
+  { 0xE0, 0xE0, 2, 0xA0, 0xBF },
+  { 0xE1, 0xEC, 2, 0x80, 0xBF },
+  { 0xED, 0xED, 2, 0x80, 0x9F },
+  { 0xEE, 0xEF, 2, 0x80, 0xBF },
+  { 0xF0, 0xF0, 3, 0x90, 0xBF },
+  { 0xF1, 0xF3, 3, 0x80, 0xBF },
+  { 0xF4, 0xF4, 3, 0x80, 0x8F },
+};
+
+// Decodes byte by byte. Returns false if any sequence was bad.
+bool RefDecode(const std::string& utf8, std::wstring* wide) {
+  bool valid = true;
+  size_t ix = 0;
+  while (ix != utf8.size()) {
+    auto c = static_cast<uint8_t>(utf8[ix++]);
+    if (c < 0x80) {
+      wide->push_back(c);
+      continue;
+    }
+    const Lead* lead = nullptr;
+    for (auto& l : leads) {
+      if ((c >= l.first) && (c <= l.last))
+        lead = &l;
+    }
+    if (!lead) {
+      valid = false;
+      wide->push_back(kReplacement);
+      continue;
+    }
+    unsigned int cp = c & (0x3F >> lead->more);
+    int taken = 0;
+    for (; taken != lead->more; ++taken) {
+      if (ix == utf8.size())
+        break;
+      auto t = static_cast<uint8_t>(utf8[ix]);
+      auto lo = taken ? 0x80 : lead->lo;
+      auto hi = taken ? 0xBF : lead->hi;
+      if ((t < lo) || (t > hi))
+        break;
+      cp = (cp << 6) | (t & 0x3F);
+      ++ix;
+    }
+    if (taken != lead->more) {
+      // the lead and the bytes that fit are one bad subpart.
+      valid = false;
+      cp = kReplacement;
+    }
+    wide->push_back(static_cast<wchar_t>(cp));
+  }
+  return valid;
+}
+
+void RefEncode(unsigned int cp, std::string* utf8) {
+  if (((cp >= 0xD800) && (cp <= 0xDFFF)) || (cp > 0x10FFFF))
+    cp = kReplacement;
+  if (cp < 0x80) {
+    utf8->push_back(static_cast<char>(cp));
+    return;
+  }
+  int more = (cp < 0x800) ? 1 : (cp < 0x10000) ? 2 : 3;
+  static const uint8_t marks[] = { 0, 0xC0, 0xE0, 0xF0 };
+  utf8->push_back(static_cast<char>(marks[more] | (cp >> (6 * more))));
+  for (int shift = 6 * (more - 1); shift >= 0; shift -= 6)
+    utf8->push_back(static_cast<char>(0x80 | ((cp >> shift) & 0x3F)));
+}
+
+std::wstring Decode(const std::string& utf8, bool strict) {
+  auto s = reinterpret_cast<const uint8_t*>(utf8.data());
+  return plx::WideFromUTF8(plx::Range<const uint8_t>(s, s + utf8.size()), strict);
+}
+
+std::string Encode(const std::wstring& wide) {
+  return plx::UTF8FromWide(plx::Range<const wchar_t>(wide.data(), wide.data() + wide.size()));
+}
+
+bool StrictThrows(const std::string& utf8) {
+  try {
+    Decode(utf8, true);
+  } catch (plx::CodecException&) {
+    return true;
+  }
+  return false;
+}
+
+// Any scalar value, weighted towards ascii runs and each utf8 length.
+unsigned int RandomCodePoint() {
+  switch (rng() % 5) {
+    case 0:
+      return 0x80 + (rng() % (0x800 - 0x80));
+    case 1: {
+      auto cp = 0x800 + (rng() % (0x10000 - 0x800));
+      return ((cp >= 0xD800) && (cp <= 0xDFFF)) ? 0xE000 : cp;
+    }
+    case 2:
+      return 0x10000 + (rng() % (0x110000 - 0x10000));
+    default:
+      return 0x20 + (rng() % 0x5F);
+  }
+}
+
+// Runs of ascii letters, each followed by a few other code points.
+std::wstring RandomText(size_t units) {
+  std::wstring wide;
+  while (wide.size() < units) {
+    auto run = rng() % 40;
+    for (size_t ix = 0; ix != run; ++ix)
+      wide.push_back(static_cast<wchar_t>('a' + (rng() % 26)));
+    auto others = 1 + (rng() % 3);
+    for (size_t ix = 0; ix != others; ++ix)
+      wide.push_back(static_cast<wchar_t>(RandomCodePoint()));
+  }
+  wide.resize(units);
+  return wide;
+}
+
+void TestRoundTrip() {
+  for (int round = 0; round != 20000; ++round) {
+    auto wide = RandomText(rng() % 200);
+    std::string utf8;
+    for (auto cp : wide)
+      RefEncode(static_cast<unsigned int>(cp), &utf8);
+    CHECK(Encode(wide) == utf8);
+    CHECK(Decode(utf8, true) == wide);
+    CHECK(Decode(utf8, false) == wide);
+  }
+}
+
+// Valid text with bytes flipped, cut or inserted, and plain random bytes.
+std::string Mangle(std::string utf8) {
+  if (utf8.empty() || !(rng() % 8)) {
+    std::string random(rng() % 64, '\0');
+    for (auto& c : random)
+      c = static_cast<char>(rng());
+    return random;
+  }
+  auto edits = 1 + (rng() % 3);
+  for (size_t ix = 0; ix != edits; ++ix) {
+    auto pos = rng() % utf8.size();
+    switch (rng() % 3) {
+      case 0:
+        utf8[pos] = static_cast<char>(0x80 | rng());
+        break;
+      case 1:
+        utf8.resize(pos);
+        break;
+      default:
+        utf8.insert(utf8.begin() + pos, static_cast<char>(0x80 | rng()));
+        break;
+    }
+    if (utf8.empty())
+      break;
+  }
+  return utf8;
+}
+
+void TestBadUtf8() {
+  int invalid = 0;
+  for (int round = 0; round != 50000; ++round) {
+    std::string utf8;
+    for (auto cp : RandomText(rng() % 100))
+      RefEncode(static_cast<unsigned int>(cp), &utf8);
+    utf8 = Mangle(utf8);
+    std::wstring expected;
+    auto valid = RefDecode(utf8, &expected);
+    invalid += !valid;
+    CHECK(Decode(utf8, false) == expected);
+    CHECK(StrictThrows(utf8) == !valid);
+  }
+  // the mangling has to actually break most inputs.
+  CHECK(invalid > 25000);
+}
+
+// The sequences the decoder must refuse, at every offset of a 16 byte block.
+void TestEdgeCases() {
+  const char* bad[] = {
+    "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xED\xA0\x80",
+    "\xED\xBF\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80",
+    "\xF5\x80\x80\x80", "\xFF", "\x80", "\xE2\x82", "\xF0\x9F\x98"
+  };
+  for (auto seq : bad) {
+    for (size_t pad = 0; pad != 40; ++pad) {
+      auto utf8 = std::string(pad, 'x') + seq + std::string(40 - pad, 'y');
+      std::wstring expected;
+      CHECK(!RefDecode(utf8, &expected));
+      CHECK(Decode(utf8, false) == expected);
+      CHECK(StrictThrows(utf8));
+    }
+  }
+  // ends of the valid ranges.
+  const unsigned int good[] = { 0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFF, 0x10000, 0x10FFFF };
+  for (auto cp : good) {
+    std::string utf8;
+    RefEncode(cp, &utf8);
+    CHECK(Decode(utf8, true) == std::wstring(1, static_cast<wchar_t>(cp)));
+  }
+}
+
+// Surrogates and values past U+10FFFF are not unicode, in utf32 too.
+void TestBadWide() {
+  for (int round = 0; round != 20000; ++round) {
+    auto wide = RandomText(rng() % 100);
+    for (auto& unit : wide) {
+      if (!(rng() % 10))
+        unit = static_cast<wchar_t>(
+            (rng() % 2) ? (0xD800 + (rng() % 0x800)) : (0x110000 + (rng() % 0x1000)));
+    }
+    std::string expected;
+    for (auto cp : wide)
+      RefEncode(static_cast<unsigned int>(cp), &expected);
+    CHECK(Encode(wide) == expected);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+  TestBadUtf8();
+  TestEdgeCases();
+  TestBadWide();
+  printf("utf ok\n");
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Yuy2ToNv12 on 1080p frames at each simd level, on one thread and split
+// over plx::RowWorkers the way the YUY2 camera path does it.
+
+#include <random>
+
+#include "test_util.h"
+#include "plx_video.h"
+
+namespace {
+
+const size_t kWidth = 1920;
+const size_t kHeight = 1080;
+const double kFrameBudgetUs = 1000000.0 / 60.0;
+
+const char* LevelName(plx::SimdLevel level) {
+  switch (level) {
+    case plx::SimdLevel::avx2: return "avx2";
+    case plx::SimdLevel::sse2: return "sse2";
+    default: return "scalar";
+  }
+}
+
+void Run(plx::SimdLevel level, plx::RowWorkers* workers, int frames,
+         const std::vector<uint8_t>& src) {
+  std::vector<uint8_t> nv12(kWidth * kHeight * 3 / 2);
+  auto dst_y = &nv12[0];
+  auto dst_uv = dst_y + (kWidth * kHeight);
+  std::function<void(size_t, size_t)> convert = [&](size_t begin, size_t end) {
+    plx::Yuy2ToNv12(&src[0], kWidth * 2, kWidth, begin, end,
+                    dst_y, kWidth, dst_uv, kWidth, level);
+  };
+  plx::LatencyHistogram histogram;
+  for (int ix = 0; ix != frames; ++ix) {
+    auto start = plx::QpcNow();
+    if (workers)
+      workers->run(kHeight, 2, convert);
+    else
+      convert(0, kHeight);
+    histogram.record(plx::QpcToNanos(plx::QpcNow() - start));
+  }
+  auto sm = histogram.summary();
+  auto mean_us = sm.mean / 1000.0;
+  printf("%-6s %d threads p50 %5llu us p99 %5llu us, %6.0f MB/s in, %4.1f%% of 60 fps\n",
+         LevelName(level), workers ? static_cast<int>(workers->thread_count()) + 1 : 1,
+         static_cast<unsigned long long>(sm.p50 / 1000),
+         static_cast<unsigned long long>(sm.p99 / 1000),
+         (src.size() / mean_us), (100.0 * mean_us) / kFrameBudgetUs);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int frames = HasArg(argc, argv, "--quick") ? 20 : 600;
+  std::mt19937 rng(9);
+  std::vector<uint8_t> yuy2(kWidth * kHeight * 2);
+  for (auto& px : yuy2)
+    px = static_cast<uint8_t>(rng());
+  std::vector<plx::SimdLevel> levels(1, plx::SimdLevel::scalar);
+  if (plx::BestSimdLevel() != plx::SimdLevel::scalar)
+    levels.push_back(plx::SimdLevel::sse2);
+  if (plx::BestSimdLevel() == plx::SimdLevel::avx2)
+    levels.push_back(plx::SimdLevel::avx2);
+  // the same worker count as the converter: one less than the cores, up to 3.
+  auto cores = std::max(std::thread::hardware_concurrency(), 1U);
+  plx::RowWorkers workers(std::min(cores - 1, 3U));
+  printf("%d frames of %dx%d\n", frames, static_cast<int>(kWidth), static_cast<int>(kHeight));
+  for (auto level : levels) {
+    Run(level, nullptr, frames, yuy2);
+    if (workers.thread_count())
+      Run(level, &workers, frames, yuy2);
+  }
+  return 0;
+}